@@ -107,7 +107,7 @@ class BatchCommand:
 		os.remove(batchFileName)
 		return retCode
 
-def Build(hostPlatform, hostArch, buildSys, compiler, arch, configuration, tblgenMode, tblgenPath):
+def Build(hostPlatform, hostArch, buildSys, compiler, arch, configuration, tblgenMode, tblgenPath, cmakeOptions):
 	originalDir = os.path.abspath(os.curdir)
 
 	if not os.path.exists("Build"):
@@ -168,7 +168,7 @@ def Build(hostPlatform, hostArch, buildSys, compiler, arch, configuration, tblge
 		if (configuration == "clangformat"):
 			options = "-DSC_CLANGFORMAT=\"ON\""
 		else:
-			options = "-DCMAKE_BUILD_TYPE=\"%s\" -DSC_ARCH_NAME=\"%s\" %s" % (configuration, arch, tblgenOptions)
+			options = "-DCMAKE_BUILD_TYPE=\"%s\" -DSC_ARCH_NAME=\"%s\" %s %s" % (configuration, arch, tblgenOptions, cmakeOptions)
 		batCmd.AddCommand("cmake -G Ninja %s ../../" % options)
 		if tblgenMode:
 			batCmd.AddCommand("ninja clang-tblgen -j%d" % parallel)
@@ -186,7 +186,7 @@ def Build(hostPlatform, hostArch, buildSys, compiler, arch, configuration, tblge
 			cmake_options = "-DSC_CLANGFORMAT=\"ON\""
 			msbuild_options = ""
 		else:
-			cmake_options = "-T %shost=x64 -A %s %s" % (vcToolset, vcArch, tblgenOptions)
+			cmake_options = "-T %shost=x64 -A %s %s %s" % (vcToolset, vcArch, tblgenOptions, cmakeOptions)
 			msbuild_options = "/m:%d /v:m /p:Configuration=%s,Platform=%s" % (parallel, configuration, vcArch)
 		batCmd.AddCommand("cmake -G %s %s ../../" % (generator, cmake_options))
 		if tblgenMode:
@@ -256,11 +256,13 @@ if __name__ == "__main__":
 		configuration = sys.argv[4]
 	else:
 		configuration = "Release"
+	# The rest are passed to cmake as is, for example -DSC_LINK_DXCOMPILER=ON
+	cmakeOptions = " ".join(sys.argv[5:])
 
 	tblgenPath = None
 	if (configuration != "clangformat") and (hostArch != arch) and (not ((hostArch == "x64") and (arch == "x86"))):
 		# Cross compiling:
 		# Generate a project with host architecture, build clang-tblgen and llvm-tblgen, and keep the path of clang-tblgen and llvm-tblgen
-		tblgenPath = Build(hostPlatform, hostArch, buildSys, compiler, hostArch, configuration, True, None)
+		tblgenPath = Build(hostPlatform, hostArch, buildSys, compiler, hostArch, configuration, True, None, "")
 
-	Build(hostPlatform, hostArch, buildSys, compiler, arch, configuration, False, tblgenPath)
+	Build(hostPlatform, hostArch, buildSys, compiler, arch, configuration, False, tblgenPath, cmakeOptions)
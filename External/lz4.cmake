@@ -0,0 +1,15 @@
+# Copyright (c) Microsoft Corporation. All rights reserved.
+# Licensed under the MIT License.
+
+set(lz4_REV "5ff839680134437dbf4678f3d0c7b371d84f4964")
+
+UpdateExternalLib("lz4" "https://github.com/lz4/lz4.git" ${lz4_REV})
+
+set(LZ4_BUILD_CLI OFF CACHE BOOL "" FORCE)
+set(LZ4_BUILD_LEGACY_LZ4C OFF CACHE BOOL "" FORCE)
+set(BUILD_SHARED_LIBS OFF CACHE BOOL "" FORCE)
+set(BUILD_STATIC_LIBS ON CACHE BOOL "" FORCE)
+add_subdirectory(lz4/build/cmake EXCLUDE_FROM_ALL)
+set_target_properties(lz4_static PROPERTIES
+    FOLDER "External/lz4"
+    POSITION_INDEPENDENT_CODE ON)
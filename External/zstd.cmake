@@ -0,0 +1,17 @@
+# Copyright (c) Microsoft Corporation. All rights reserved.
+# Licensed under the MIT License.
+
+set(zstd_REV "794ea1b0afca0f020f4e57b6732332231fb23c70")
+
+UpdateExternalLib("zstd" "https://github.com/facebook/zstd.git" ${zstd_REV})
+
+set(ZSTD_BUILD_PROGRAMS OFF CACHE BOOL "" FORCE)
+set(ZSTD_BUILD_TESTS OFF CACHE BOOL "" FORCE)
+set(ZSTD_BUILD_SHARED OFF CACHE BOOL "" FORCE)
+set(ZSTD_BUILD_STATIC ON CACHE BOOL "" FORCE)
+set(ZSTD_LEGACY_SUPPORT OFF CACHE BOOL "" FORCE)
+set(ZSTD_MULTITHREAD_SUPPORT OFF CACHE BOOL "" FORCE)
+add_subdirectory(zstd/build/cmake EXCLUDE_FROM_ALL)
+set_target_properties(libzstd_static PROPERTIES
+    FOLDER "External/zstd"
+    POSITION_INDEPENDENT_CODE ON)
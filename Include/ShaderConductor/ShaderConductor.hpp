@@ -92,10 +92,57 @@ namespace ShaderConductor
         NumShaderResourceType,
     };
 
+    enum class ShaderDataType : uint32_t
+    {
+        Unknown = 0,
+        Bool,
+        Int16,
+        UInt16,
+        Int,
+        UInt,
+        Int64,
+        UInt64,
+        Half,
+        Float,
+        Double,
+        Struct,
+
+        NumShaderDataTypes,
+    };
+
+    enum class CompileStage : uint32_t
+    {
+        Dxc = 0,    // HLSL to DXIL or SPIR-V
+        SpirvCross, // SPIR-V to HLSL, GLSL, ESSL or MSL
+
+        NumCompileStages,
+    };
+
+    enum class FloatPrecision : uint32_t
+    {
+        Default = 0, // Whatever the target language defaults to
+        Low,
+        Medium,
+        High,
+    };
+
+    enum class CompressionCodec : uint32_t
+    {
+        None = 0,
+        Lz4,  // Fast to decompress, for hot loading
+        Zstd, // High compression ratio, for distribution
+
+        NumCompressionCodecs,
+    };
+
     struct MacroDefine
     {
         const char* name;
         const char* value;
+
+        // Declare a specialization constant defaulting to value instead of the macro, so one SPIR-V covers all its values. IDs
+        // follow the order of these defines. Only for values used in expressions, not in #if. DXIL targets get the macro.
+        bool specConstant = false;
     };
 
     class SC_API Blob
@@ -113,14 +160,24 @@ namespace ShaderConductor
         void Reset();
         void Reset(const void* data, uint32_t size);
 
-        const void* Data() const noexcept;
-        uint32_t Size() const noexcept;
+        // Throw std::runtime_error if a payload kept compressed by Deserialize's decompressOnAccess turns out to be corrupt
+        const void* Data() const;
+        uint32_t Size() const;
+
+        // Serialize into a self-describing frame. Level 0 picks the codec's default (LZ4 fast mode, zstd level 3). Distribution
+        // builds can ask for zstd 19 and up, which is several times slower to write.
+        Blob Serialize(CompressionCodec codec = CompressionCodec::None, int level = 0) const;
+        // Restore a frame produced by Serialize. With decompressOnAccess, the payload is kept compressed until the first
+        // Data() or Size() call, and corruption is only found then.
+        static Blob Deserialize(const void* data, uint32_t size, bool decompressOnAccess = false);
 
     private:
         class BlobImpl;
         BlobImpl* m_impl = nullptr;
     };
 
+    class CacheBackend;
+
     class SC_API Compiler
     {
     public:
@@ -167,6 +224,14 @@ namespace ShaderConductor
             std::function<Blob(const char* includeName)> loadIncludeCallback;
         };
 
+        // Receives dxcompiler's allocations of a compile, for example to serve them from an arena. Blocks must be 16-byte aligned.
+        struct MemoryAllocator
+        {
+            void* (*allocate)(void* userData, size_t size);
+            void (*free)(void* userData, void* ptr);
+            void* userData;
+        };
+
         struct Options
         {
             bool packMatricesInRowMajor = true;          // Experimental: Decide how a matrix get packed
@@ -174,6 +239,11 @@ namespace ShaderConductor
             bool enableDebugInfo = false;                // Embed debug info into the binary
             bool disableOptimizations = false;           // Force to turn off optimizations. Ignore optimizationLevel below.
             bool inheritCombinedSamplerBindings = false; // If textures and samplers are combined, inherit the binding of the texture
+            bool compactReflectionOnly = false;          // Only fill ReflectionResultDesc::compactDescs, leave descs empty
+            bool costReport = false;                     // Fill ResultDesc::cost for targets compiled through SPIR-V
+            bool mslArgumentBuffers = false;             // MSL 2.0+: one argument buffer per descriptor set, see CompactArgumentDesc
+            bool denseBindings = false;                  // Drop unused resources and renumber the rest from 0, see CompactBindingDesc
+            bool minifyOutput = false;                   // Text targets: short local names, no comments or whitespace that isn't needed
 
             int optimizationLevel = 3; // 0 to 3, no optimization to most optimization
             ShaderModel shaderModel = {6, 0};
@@ -182,6 +252,21 @@ namespace ShaderConductor
             int shiftAllSamplersBindings = 0;
             int shiftAllCBuffersBindings = 0;
             int shiftAllUABuffersBindings = 0;
+
+            // ESSL only. 16-bit floats, such as half with enable16bitTypes, become 32-bit mediump floats instead of float16_t, which
+            // GLES doesn't have. 16-bit floats in cbuffers and other buffers fail the compile, since widening them would change the
+            // buffer layout. MSL keeps 16-bit floats as half either way, but min16float stays float there.
+            bool float16AsMediump = false;
+            // ESSL default float precision of each ShaderStage. Default keeps the language's: mediump in pixel shaders, highp elsewhere.
+            FloatPrecision defaultFloatPrecision[static_cast<uint32_t>(ShaderStage::NumShaderStages)] = {};
+
+            const MemoryAllocator* allocator = nullptr; // Null for malloc/free. Must outlive the compile.
+
+            // 0 for no deadline. The compile runs in a worker process that is killed at the deadline, includes are still loaded by
+            // the calling thread, and the allocator isn't used. Workers are forked by a helper process, which has to be forked
+            // before other threads start compiling: call Initialize with forkDeadlineHelper first, or the first compile with a
+            // deadline forks it. Where there is no fork, the compile runs to its end, and is reported as timed out if it ends late.
+            uint32_t timeoutMs = 0;
         };
 
         struct TargetDesc
@@ -200,11 +285,278 @@ namespace ShaderConductor
             uint32_t bindCount;       // Number of contiguous bind points (for arrays)
         };
 
+        // The compact layout is one Blob: a CompactReflectionHeader, followed by descCount CompactReflectionDesc, memberCount
+        // CompactMemberDesc, inputCount and outputCount CompactParameterDesc, specConstantCount CompactSpecConstantDesc,
+        // argumentCount CompactArgumentDesc, bindingCount CompactBindingDesc records, and a string table of NUL-terminated names shared by
+        // all records.
+        struct CompactReflectionHeader
+        {
+            uint32_t descCount;
+            uint32_t memberCount;
+            uint32_t inputCount;
+            uint32_t outputCount;
+            uint32_t specConstantCount;
+            uint32_t argumentCount;
+            uint32_t bindingCount;
+            uint32_t workgroupSize[3]; // Compute shader only
+            uint32_t stringTableOffset; // From the beginning of the blob
+            uint32_t stringTableSize;
+        };
+
+        struct CompactReflectionDesc
+        {
+            uint32_t nameOffset; // Offset of the name in the string table
+            ShaderResourceType type;
+            uint32_t bufferBindPoint;
+            uint32_t bindPoint;
+            uint32_t bindCount;
+        };
+
+        // A top level member of a constant buffer, including $Globals
+        struct CompactMemberDesc
+        {
+            uint32_t nameOffset;
+            uint32_t bufferBindPoint; // Bind point of the constant buffer that owns this member
+            uint32_t offset;          // In bytes, from the beginning of the buffer
+            uint32_t size;            // In bytes
+            ShaderDataType dataType;
+            uint32_t rows;     // 1 for scalars and vectors
+            uint32_t columns;  // Number of components of a vector, or columns of a matrix
+            uint32_t elements; // 0 if not an array
+        };
+
+        // A stage input or output
+        struct CompactParameterDesc
+        {
+            uint32_t semanticOffset; // Semantic name without the index, such as TEXCOORD
+            uint32_t semanticIndex;
+            uint32_t location; // Register in DXIL, location in SPIR-V. ~0U for system values
+            ShaderDataType dataType;
+            uint32_t columns; // Number of components
+        };
+
+        // A specialization constant of a SPIR-V target, see MacroDefine::specConstant
+        struct CompactSpecConstantDesc
+        {
+            uint32_t nameOffset;
+            uint32_t id; // constant_id in SPIR-V, GLSL and ESSL, function_constant index in MSL
+            ShaderDataType dataType;
+            uint32_t defaultValue; // Bits of the 32-bit default value
+        };
+
+        // A resource in an MSL argument buffer. Each descriptor set, which is the HLSL register space, gets its own argument buffer.
+        struct CompactArgumentDesc
+        {
+            uint32_t nameOffset;
+            ShaderResourceType type;
+            uint32_t argumentBuffer; // [[buffer]] index of the argument buffer, same as the descriptor set
+            uint32_t id;             // [[id]] of the resource in the argument buffer
+            uint32_t count;          // Array size, taking that many IDs from id on. 0 for unbounded arrays.
+        };
+
+        // A resource renumbered by Options::denseBindings. The numbering restarts from 0 for every register type of the target: b, t, u
+        // and s in HLSL; uniform buffers, storage buffers, textures, images and samplers in GLSL and ESSL; buffers, textures and samplers
+        // in MSL. SPIR-V shares one numbering among all resources of a descriptor set. HLSL and SPIR-V number each descriptor set on its
+        // own, the others number all sets together.
+        struct CompactBindingDesc
+        {
+            uint32_t nameOffset;
+            ShaderResourceType type;
+            uint32_t descriptorSet;   // Register space in HLSL
+            uint32_t originalBinding; // Binding in the SPIR-V from dxcompiler
+            uint32_t binding;         // Binding in the target
+        };
+
+        // A blob whose counts or string table don't fit in its size reads as empty
+        class CompactReflectionView
+        {
+        public:
+            explicit CompactReflectionView(const Blob& compactDescs)
+                : m_data(reinterpret_cast<const uint8_t*>(compactDescs.Data())), m_size(compactDescs.Size())
+            {
+                m_valid = this->Validate();
+            }
+
+            uint32_t Count() const noexcept
+            {
+                return this->Valid() ? this->Header().descCount : 0;
+            }
+
+            const CompactReflectionDesc* begin() const noexcept
+            {
+                return reinterpret_cast<const CompactReflectionDesc*>(m_data + sizeof(CompactReflectionHeader));
+            }
+            const CompactReflectionDesc* end() const noexcept
+            {
+                return this->begin() + this->Count();
+            }
+            const CompactReflectionDesc& operator[](uint32_t index) const noexcept
+            {
+                return this->begin()[index];
+            }
+
+            uint32_t MemberCount() const noexcept
+            {
+                return this->Valid() ? this->Header().memberCount : 0;
+            }
+            const CompactMemberDesc* Members() const noexcept
+            {
+                return reinterpret_cast<const CompactMemberDesc*>(this->end());
+            }
+
+            uint32_t InputCount() const noexcept
+            {
+                return this->Valid() ? this->Header().inputCount : 0;
+            }
+            const CompactParameterDesc* Inputs() const noexcept
+            {
+                return reinterpret_cast<const CompactParameterDesc*>(this->Members() + this->MemberCount());
+            }
+
+            uint32_t OutputCount() const noexcept
+            {
+                return this->Valid() ? this->Header().outputCount : 0;
+            }
+            const CompactParameterDesc* Outputs() const noexcept
+            {
+                return this->Inputs() + this->InputCount();
+            }
+
+            uint32_t SpecConstantCount() const noexcept
+            {
+                return this->Valid() ? this->Header().specConstantCount : 0;
+            }
+            const CompactSpecConstantDesc* SpecConstants() const noexcept
+            {
+                return reinterpret_cast<const CompactSpecConstantDesc*>(this->Outputs() + this->OutputCount());
+            }
+
+            uint32_t ArgumentCount() const noexcept
+            {
+                return this->Valid() ? this->Header().argumentCount : 0;
+            }
+            const CompactArgumentDesc* Arguments() const noexcept
+            {
+                return reinterpret_cast<const CompactArgumentDesc*>(this->SpecConstants() + this->SpecConstantCount());
+            }
+
+            uint32_t BindingCount() const noexcept
+            {
+                return this->Valid() ? this->Header().bindingCount : 0;
+            }
+            const CompactBindingDesc* Bindings() const noexcept
+            {
+                return reinterpret_cast<const CompactBindingDesc*>(this->Arguments() + this->ArgumentCount());
+            }
+
+            // 0 for a dim outside [0, 3)
+            uint32_t WorkgroupSize(uint32_t dim) const noexcept
+            {
+                return (this->Valid() && (dim < 3)) ? this->Header().workgroupSize[dim] : 0;
+            }
+
+            // Empty for an offset outside the string table
+            const char* String(uint32_t offset) const noexcept
+            {
+                if (!this->Valid() || (offset >= this->Header().stringTableSize))
+                {
+                    return "";
+                }
+                return reinterpret_cast<const char*>(m_data + this->Header().stringTableOffset + offset);
+            }
+            const char* Name(const CompactReflectionDesc& desc) const noexcept
+            {
+                return this->String(desc.nameOffset);
+            }
+            const char* Name(const CompactMemberDesc& desc) const noexcept
+            {
+                return this->String(desc.nameOffset);
+            }
+            const char* Semantic(const CompactParameterDesc& desc) const noexcept
+            {
+                return this->String(desc.semanticOffset);
+            }
+            const char* Name(const CompactSpecConstantDesc& desc) const noexcept
+            {
+                return this->String(desc.nameOffset);
+            }
+            const char* Name(const CompactArgumentDesc& desc) const noexcept
+            {
+                return this->String(desc.nameOffset);
+            }
+            const char* Name(const CompactBindingDesc& desc) const noexcept
+            {
+                return this->String(desc.nameOffset);
+            }
+
+        private:
+            bool Valid() const noexcept
+            {
+                return m_valid;
+            }
+
+            const CompactReflectionHeader& Header() const noexcept
+            {
+                return *reinterpret_cast<const CompactReflectionHeader*>(m_data);
+            }
+
+            // The records have to end before the string table, which has to end within the blob with a NUL. Sums are in 64 bits, so
+            // huge counts can't wrap around.
+            bool Validate() const noexcept
+            {
+                if ((m_data == nullptr) || (m_size < sizeof(CompactReflectionHeader)))
+                {
+                    return false;
+                }
+
+                const CompactReflectionHeader& header = this->Header();
+                const uint64_t recordsEnd = sizeof(CompactReflectionHeader) +
+                                            uint64_t(header.descCount) * sizeof(CompactReflectionDesc) +
+                                            uint64_t(header.memberCount) * sizeof(CompactMemberDesc) +
+                                            (uint64_t(header.inputCount) + header.outputCount) * sizeof(CompactParameterDesc) +
+                                            uint64_t(header.specConstantCount) * sizeof(CompactSpecConstantDesc) +
+                                            uint64_t(header.argumentCount) * sizeof(CompactArgumentDesc) +
+                                            uint64_t(header.bindingCount) * sizeof(CompactBindingDesc);
+                const uint64_t stringTableEnd = uint64_t(header.stringTableOffset) + header.stringTableSize;
+                return (recordsEnd <= header.stringTableOffset) && (stringTableEnd <= m_size) &&
+                       ((header.stringTableSize == 0) || (m_data[stringTableEnd - 1] == '\0'));
+            }
+
+        private:
+            const uint8_t* m_data;
+            uint32_t m_size;
+            bool m_valid;
+        };
+
         struct ReflectionResultDesc
         {
-            Blob descs; // The underneath type is ReflectionDesc
-            uint32_t descCount = 0;
+            Blob descs; // The underneath type is ReflectionDesc. Empty if Options::compactReflectionOnly is set.
+            uint32_t descCount = 0; // Number of entries in descs, so 0 if Options::compactReflectionOnly is set
             uint32_t instructionCount = 0;
+
+            Blob compactDescs; // See CompactReflectionView. Also has constant buffer layouts, stage parameters and workgroup size.
+        };
+
+        // Counted statically from the SPIR-V module, so the numbers don't depend on a GPU or driver. An instruction counts once where
+        // it appears, not as often as it runs.
+        struct CostReport
+        {
+            uint32_t totalInstructions = 0; // In function bodies, without labels, debug lines and variable declarations
+            uint32_t aluInstructions = 0;   // Arithmetic, conversions, comparisons, bit ops, derivatives and extended instructions
+            uint32_t textureSamples = 0;    // Samples and gathers
+            uint32_t textureFetches = 0;    // Texel fetches and storage image reads
+            uint32_t loads = 0;
+            uint32_t stores = 0;
+            uint32_t atomics = 0;
+            uint32_t barriers = 0;
+            uint32_t branches = 0; // Conditional branches and switches
+            uint32_t loops = 0;
+
+            uint32_t temporaries = 0;   // Values defined in function bodies
+            uint32_t maxLiveValues = 0; // Most values live at once in a function, estimated over the instruction order
+
+            uint32_t inputComponents = 0; // Scalar components of the entry point's inputs, built-ins included
+            uint32_t outputComponents = 0;
         };
 
         struct ResultDesc
@@ -216,6 +568,16 @@ namespace ShaderConductor
             bool hasError;
 
             ReflectionResultDesc reflection;
+
+            uint64_t allocatedBytes = 0;     // Total bytes dxcompiler allocated while compiling this result's binary
+            uint64_t peakAllocatedBytes = 0; // Most bytes dxcompiler held at once during that compile
+
+            bool timedOut = false;                         // Options::timeoutMs passed and the compile was abandoned
+            CompileStage timeoutStage = CompileStage::Dxc; // Where the compile was when it was abandoned
+
+            Blob dependencies; // The source, if it has a file name, and every include asked for, see DependencyIndex
+
+            CostReport cost; // Zero unless Options::costReport is set and the target is compiled through SPIR-V
         };
 
         struct DisassembleDesc
@@ -240,16 +602,257 @@ namespace ShaderConductor
             uint32_t numModules;
         };
 
+        struct EntryPointDesc
+        {
+            const char* entryPoint;
+            ShaderStage stage;
+        };
+
+        struct SpirvDesc
+        {
+            const char* entryPoint;
+            ShaderStage stage;
+            const uint8_t* binary;
+            uint32_t binarySize;
+        };
+
+        // Identifies everything that decides a compile's output: the source after preprocessing, so includes and defines are folded
+        // in, the entry point, stage, options, target and dxcompiler version. Without debug info, #line markers only count by file
+        // name, so the same tree checked out in two places gets the same keys.
+        struct CacheKey
+        {
+            char str[33]; // 32 hex digits. Empty if the source doesn't preprocess.
+        };
+
     public:
+        // Load dxcompiler and create its instances now instead of on the first call that needs them. With warmUp, a tiny shader
+        // is also compiled to Dxil, SPIR-V and GLSL. Can run on a background thread; calls made meanwhile wait for the loading.
+        // With forkDeadlineHelper, also fork the helper process that the workers for Options::timeoutMs are forked from, see there.
+        static void Initialize(bool warmUp = false, bool forkDeadlineHelper = false);
+
         static ResultDesc Compile(const SourceDesc& source, const Options& options, const TargetDesc& target);
         static void Compile(const SourceDesc& source, const Options& options, const TargetDesc* targets, uint32_t numTargets,
                             ResultDesc* results);
+        // Compile several entry points of one source. The includes and macros are expanded once per stage and shared by the entry
+        // points of that stage; parsing and semantic analysis still run per entry point.
+        // results has numEntryPoints * numTargets elements, the targets of each entry point are adjacent.
+        static void CompileEntryPoints(const SourceDesc& source, const EntryPointDesc* entryPoints, uint32_t numEntryPoints,
+                                       const Options& options, const TargetDesc* targets, uint32_t numTargets, ResultDesc* results);
+        // Compile the stages of a graphics pipeline, given in pipeline order: VS, HS, DS, GS, PS, leaving out the ones it doesn't have.
+        // The inputs of each stage are matched with the outputs of the one before by semantic, and reading a semantic the stage before
+        // doesn't write is an error in both. Outputs nobody reads are removed, and the rest get consecutive locations, each varying
+        // starting at a new location: components of different varyings are never packed into one location. The stages are linked in
+        // SPIR-V, so the target can't be Dxil. results has numStages elements.
+        static void CompilePipeline(const SourceDesc* stages, uint32_t numStages, const Options& options, const TargetDesc& target,
+                                    ResultDesc* results);
         static ResultDesc Disassemble(const DisassembleDesc& source);
+        // Disassemble many binaries on numThreads worker threads. 0 means one thread per hardware thread.
+        static void Disassemble(const DisassembleDesc* sources, uint32_t numSources, ResultDesc* results, uint32_t numThreads = 0);
+
+        // Cross-compile an existing SPIR-V binary without running DXC. The target can't be Dxil.
+        static ResultDesc CrossCompile(const SpirvDesc& spirv, const Options& options, const TargetDesc& target);
+        // What Options::minifyOutput does to the text after it's generated, for text from elsewhere: comments and the whitespace
+        // that doesn't keep two tokens apart are dropped. Preprocessor directives, with their continuation lines, are kept as is.
+        static Blob MinifyText(const char* text, uint32_t size);
+
+        // Archive a result into one Blob. Each contained blob is compressed separately with the given codec.
+        static Blob SerializeResult(const ResultDesc& result, CompressionCodec codec = CompressionCodec::None, int level = 0);
+        static ResultDesc DeserializeResult(const void* data, uint32_t size, bool decompressOnAccess = false);
+
+        static CacheKey ComputeCacheKey(const SourceDesc& source, const Options& options, const TargetDesc& target);
+        // Looks all targets up in the cache with one batch get, compiles the misses and puts their results. Failed compiles aren't
+        // cached. Hits get the dependencies found on this machine.
+        static void Compile(const SourceDesc& source, const Options& options, const TargetDesc* targets, uint32_t numTargets,
+                            ResultDesc* results, CacheBackend& cache);
 
         // Currently only Dxil on Windows supports linking
         static bool LinkSupport();
         static ResultDesc Link(const LinkDesc& modules, const Options& options, const TargetDesc& target);
     };
+
+    // Registers modules once and links many entry points against them. Link can be called from several threads at the same time.
+    class SC_API LinkerSession
+    {
+    public:
+        LinkerSession();
+        ~LinkerSession() noexcept;
+
+        LinkerSession(const LinkerSession& other) = delete;
+        LinkerSession& operator=(const LinkerSession& other) = delete;
+
+        // The target is copied, the module doesn't need to outlive this call
+        void RegisterModule(const Compiler::ModuleDesc& module);
+
+        // moduleNames selects the registered modules to link
+        Compiler::ResultDesc Link(const char* entryPoint, ShaderStage stage, const char* const* moduleNames, uint32_t numModules,
+                                  const Compiler::Options& options, const Compiler::TargetDesc& target);
+
+    private:
+        class LinkerSessionImpl;
+        LinkerSessionImpl* m_impl = nullptr;
+    };
+
+    // Runs compile jobs on worker threads, and only admits as many as the memory budget fits. The memory of a job is estimated
+    // from the dxcompiler peak seen for the same source in earlier runs.
+    class SC_API CompileScheduler
+    {
+    public:
+        struct Job
+        {
+            Compiler::SourceDesc source;
+            Compiler::Options options;
+            const Compiler::TargetDesc* targets;
+            uint32_t numTargets;
+            Compiler::ResultDesc* results; // numTargets elements
+        };
+
+    public:
+        // 0 threads means one per hardware thread
+        explicit CompileScheduler(uint64_t memoryBudget, uint32_t numThreads = 0);
+        ~CompileScheduler() noexcept;
+
+        CompileScheduler(const CompileScheduler& other) = delete;
+        CompileScheduler& operator=(const CompileScheduler& other) = delete;
+
+        // Larger jobs start first. A job estimated above the whole budget runs alone.
+        void Run(const Job* jobs, uint32_t numJobs);
+
+        // Without history for the job, the largest peak seen so far is used, or budget / threads if nothing has been seen yet
+        uint64_t EstimatedPeakBytes(const Job& job) const;
+
+        // Keep the per-source peaks across processes
+        Blob SaveHistory() const;
+        void LoadHistory(const void* data, uint32_t size);
+
+    private:
+        class CompileSchedulerImpl;
+        CompileSchedulerImpl* m_impl = nullptr;
+    };
+
+    // Runs compile jobs in pre-forked worker processes, so a crash in DXC or SPIRV-Cross only takes down one worker, which is then
+    // restarted. Workers are forked by a helper process that the constructor forks from a warmed-up dxcompiler. A job and its
+    // results travel through memory shared with the worker, and includes are loaded by this process. Where there is no fork, jobs
+    // run on threads in this process.
+    class SC_API CompileWorkerPool
+    {
+    public:
+        // 0 workers means one per hardware thread. A job's inputs, an include, and a job's serialized results each have to fit in
+        // sharedMemorySize bytes. Create the pool before other threads start compiling, since the helper is forked from this process.
+        explicit CompileWorkerPool(uint32_t numWorkers = 0, uint32_t sharedMemorySize = 64 * 1024 * 1024);
+        ~CompileWorkerPool() noexcept;
+
+        CompileWorkerPool(const CompileWorkerPool& other) = delete;
+        CompileWorkerPool& operator=(const CompileWorkerPool& other) = delete;
+
+        // Options::timeoutMs kills the worker at the deadline. Options::allocator is not used by workers.
+        void Run(const CompileScheduler::Job* jobs, uint32_t numJobs);
+
+        uint32_t NumRestarts() const; // Workers replaced after a crash or a timeout
+
+    private:
+        class CompileWorkerPoolImpl;
+        CompileWorkerPoolImpl* m_impl = nullptr;
+    };
+
+    // Remembers which files each compile read, so an edit can be mapped to the sources to recompile. Keep it across runs with
+    // Save and Load. Record can be called from several threads at the same time.
+    class SC_API DependencyIndex
+    {
+    public:
+        DependencyIndex();
+        ~DependencyIndex() noexcept;
+
+        DependencyIndex(const DependencyIndex& other) = delete;
+        DependencyIndex& operator=(const DependencyIndex& other) = delete;
+
+        // Replaces what was recorded under sourceName, which is the caller's name for the compile, e.g. its file name
+        void Record(const char* sourceName, const Compiler::ResultDesc& result);
+        void Remove(const char* sourceName);
+
+        // Files are named as the include callback saw them. With compareContent, a file is read and only counts as changed if its
+        // content no longer matches what the compiles saw. It's read with loadCallback, which should be the include callback the
+        // compiles used, or from disk if there is none. Returns the affected source names, each one NUL-terminated.
+        Blob AffectedSources(const char* const* changedFiles, uint32_t numChangedFiles, bool compareContent = false,
+                             const std::function<Blob(const char* fileName)>& loadCallback = {}) const;
+
+        Blob Save() const;
+        void Load(const void* data, uint32_t size);
+
+    private:
+        class DependencyIndexImpl;
+        DependencyIndexImpl* m_impl = nullptr;
+    };
+
+    // Stores compile results, as Compiler::SerializeResult archives, under Compiler::CacheKey strings. Has to be thread safe.
+    class SC_API CacheBackend
+    {
+    public:
+        virtual ~CacheBackend() noexcept;
+
+        virtual bool Get(const char* key, Blob& value) = 0; // False on a miss
+        virtual void Put(const char* key, const Blob& value) = 0; // A put that fails is dropped instead of failing the compile
+
+        // found[i] tells whether values[i] is filled. The default calls Get for each key.
+        virtual void BatchGet(const char* const* keys, uint32_t numKeys, Blob* values, bool* found);
+    };
+
+    // One file per key under a directory, which can be a network share. Puts are written to a temporary file and renamed into place.
+    class SC_API FileSystemCache : public CacheBackend
+    {
+    public:
+        explicit FileSystemCache(const char* directory); // Created if it doesn't exist
+        ~FileSystemCache() noexcept override;
+
+        FileSystemCache(const FileSystemCache& other) = delete;
+        FileSystemCache& operator=(const FileSystemCache& other) = delete;
+
+        bool Get(const char* key, Blob& value) override;
+        void Put(const char* key, const Blob& value) override;
+
+    private:
+        class FileSystemCacheImpl;
+        FileSystemCacheImpl* m_impl = nullptr;
+    };
+
+    // A key-value store over HTTP: GET and PUT /cache/<key>, and POST /batch with one key per line. The batch response has, for
+    // each key, a uint32_t size, or 0xFFFFFFFF for a miss, followed by the value. An unreachable server counts as a miss, and puts
+    // to it are dropped, so a cook goes on without the cache. So is a server that doesn't connect, send or receive within timeoutMs.
+    class SC_API HttpCache : public CacheBackend
+    {
+    public:
+        HttpCache(const char* host, uint16_t port, uint32_t timeoutMs = 5000);
+        ~HttpCache() noexcept override;
+
+        HttpCache(const HttpCache& other) = delete;
+        HttpCache& operator=(const HttpCache& other) = delete;
+
+        bool Get(const char* key, Blob& value) override;
+        void Put(const char* key, const Blob& value) override;
+        void BatchGet(const char* const* keys, uint32_t numKeys, Blob* values, bool* found) override;
+
+    private:
+        class HttpCacheImpl;
+        HttpCacheImpl* m_impl = nullptr;
+    };
+
+    // A tiny server for HttpCache over any CacheBackend, to stand in for real cache infrastructure. Serves each connection on its own
+    // thread, and drops clients that go silent for 10 seconds.
+    class SC_API HttpCacheServer
+    {
+    public:
+        // Port 0 picks a free port
+        explicit HttpCacheServer(CacheBackend& storage, const char* address = "127.0.0.1", uint16_t port = 0);
+        ~HttpCacheServer() noexcept;
+
+        HttpCacheServer(const HttpCacheServer& other) = delete;
+        HttpCacheServer& operator=(const HttpCacheServer& other) = delete;
+
+        uint16_t Port() const;
+
+    private:
+        class HttpCacheServerImpl;
+        HttpCacheServerImpl* m_impl = nullptr;
+    };
 } // namespace ShaderConductor
 
 #endif // SHADER_CONDUCTOR_HPP
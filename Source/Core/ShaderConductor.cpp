@@ -33,12 +33,34 @@
 #include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
 #include <fstream>
+#include <functional>
+#include <iterator>
+#include <list>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 
 #include <dxc/DxilContainer/DxilContainer.h>
 #include <dxc/dxcapi.h>
+#include <llvm/ADT/SmallString.h>
 #include <llvm/Support/ErrorHandling.h>
+#include <llvm/Support/MD5.h>
 
 #include <spirv-tools/libspirv.h>
 #include <spirv.hpp>
@@ -48,10 +70,33 @@
 #include <spirv_msl.hpp>
 #include <spirv_cross_util.hpp>
 
+#include <lz4.h>
+#include <lz4hc.h>
+#include <zstd.h>
+
 #ifdef LLVM_ON_WIN32
 #include <d3d12shader.h>
 #endif
 
+#ifdef _WIN32
+#include <direct.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 #define SC_UNUSED(x) (void)(x);
 
 using namespace ShaderConductor;
@@ -96,6 +141,21 @@ namespace
             return linker;
         }
 
+        // A compiler whose allocations go to the given IMalloc. Falls back to the shared compiler if dxcompiler has no DxcCreateInstance2.
+        CComPtr<IDxcCompiler> CreateCompiler(IMalloc* malloc) const
+        {
+            CComPtr<IDxcCompiler> compiler;
+            if (m_createInstance2Func != nullptr)
+            {
+                IFT(m_createInstance2Func(malloc, CLSID_DxcCompiler, __uuidof(IDxcCompiler), reinterpret_cast<void**>(&compiler)));
+            }
+            else
+            {
+                compiler = m_compiler;
+            }
+            return compiler;
+        }
+
         bool LinkerSupport() const
         {
             return m_linkerSupport;
@@ -103,14 +163,18 @@ namespace
 
         void Destroy()
         {
-            if (m_dxcompilerDll)
+            if (m_createInstanceFunc)
             {
                 m_compiler = nullptr;
                 m_library = nullptr;
                 m_containerReflection = nullptr;
 
                 m_createInstanceFunc = nullptr;
+                m_createInstance2Func = nullptr;
+            }
 
+            if (m_dxcompilerDll)
+            {
 #ifdef _WIN32
                 ::FreeLibrary(m_dxcompilerDll);
 #else
@@ -123,16 +187,17 @@ namespace
 
         void Terminate()
         {
-            if (m_dxcompilerDll)
+            if (m_createInstanceFunc)
             {
                 m_compiler.Detach();
                 m_library.Detach();
                 m_containerReflection.Detach();
 
                 m_createInstanceFunc = nullptr;
-
-                m_dxcompilerDll = nullptr;
+                m_createInstance2Func = nullptr;
             }
+
+            m_dxcompilerDll = nullptr;
         }
 
     private:
@@ -143,6 +208,11 @@ namespace
                 return;
             }
 
+#ifdef SC_LINK_DXCOMPILER
+            // dxcompiler is bound at link time, nothing to load
+            m_createInstanceFunc = DxcCreateInstance;
+            m_createInstance2Func = DxcCreateInstance2;
+#else
 #ifdef _WIN32
             const char* dllName = "dxcompiler.dll";
 #elif __APPLE__
@@ -158,39 +228,44 @@ namespace
             m_dxcompilerDll = ::dlopen(dllName, RTLD_LAZY);
 #endif
 
-            if (m_dxcompilerDll != nullptr)
+            if (m_dxcompilerDll == nullptr)
             {
+                throw std::runtime_error("COULDN'T load dxcompiler.");
+            }
+
 #ifdef _WIN32
-                m_createInstanceFunc = (DxcCreateInstanceProc)::GetProcAddress(m_dxcompilerDll, functionName);
+            m_createInstanceFunc = (DxcCreateInstanceProc)::GetProcAddress(m_dxcompilerDll, functionName);
 #else
-                m_createInstanceFunc = (DxcCreateInstanceProc)::dlsym(m_dxcompilerDll, functionName);
+            m_createInstanceFunc = (DxcCreateInstanceProc)::dlsym(m_dxcompilerDll, functionName);
 #endif
 
-                if (m_createInstanceFunc != nullptr)
-                {
-                    IFT(m_createInstanceFunc(CLSID_DxcLibrary, __uuidof(IDxcLibrary), reinterpret_cast<void**>(&m_library)));
-                    IFT(m_createInstanceFunc(CLSID_DxcCompiler, __uuidof(IDxcCompiler), reinterpret_cast<void**>(&m_compiler)));
-                    IFT(m_createInstanceFunc(CLSID_DxcContainerReflection, __uuidof(IDxcContainerReflection),
-                                             reinterpret_cast<void**>(&m_containerReflection)));
-                }
-                else
-                {
-                    this->Destroy();
-
-                    throw std::runtime_error(std::string("COULDN'T get ") + functionName + " from dxcompiler.");
-                }
-            }
-            else
+            if (m_createInstanceFunc == nullptr)
             {
-                throw std::runtime_error("COULDN'T load dxcompiler.");
+                this->Destroy();
+
+                throw std::runtime_error(std::string("COULDN'T get ") + functionName + " from dxcompiler.");
             }
 
+            // Optional, older dxcompilers don't have it
+#ifdef _WIN32
+            m_createInstance2Func = (DxcCreateInstance2Proc)::GetProcAddress(m_dxcompilerDll, "DxcCreateInstance2");
+#else
+            m_createInstance2Func = (DxcCreateInstance2Proc)::dlsym(m_dxcompilerDll, "DxcCreateInstance2");
+#endif
+#endif
+
+            IFT(m_createInstanceFunc(CLSID_DxcLibrary, __uuidof(IDxcLibrary), reinterpret_cast<void**>(&m_library)));
+            IFT(m_createInstanceFunc(CLSID_DxcCompiler, __uuidof(IDxcCompiler), reinterpret_cast<void**>(&m_compiler)));
+            IFT(m_createInstanceFunc(CLSID_DxcContainerReflection, __uuidof(IDxcContainerReflection),
+                                     reinterpret_cast<void**>(&m_containerReflection)));
+
             m_linkerSupport = (CreateLinker() != nullptr);
         }
 
     private:
         HMODULE m_dxcompilerDll = nullptr;
         DxcCreateInstanceProc m_createInstanceFunc = nullptr;
+        DxcCreateInstance2Proc m_createInstance2Func = nullptr;
 
         CComPtr<IDxcLibrary> m_library;
         CComPtr<IDxcCompiler> m_compiler;
@@ -199,10 +274,55 @@ namespace
         bool m_linkerSupport;
     };
 
+    // FNV-1a. Pass the previous result as hash to continue a hash over more data.
+    uint64_t HashContent(const void* data, size_t size, uint64_t hash = 0xCBF29CE484222325ULL)
+    {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+        }
+        return hash;
+    }
+
+    // Slashes only, without ./ segments, so the same file gets the same name however it was reached
+    std::string NormalizeDependencyName(const char* name)
+    {
+        std::string ret = (name != nullptr) ? name : "";
+        std::replace(ret.begin(), ret.end(), '\\', '/');
+        for (size_t pos; (pos = ret.find("/./")) != std::string::npos;)
+        {
+            ret.erase(pos, 2);
+        }
+        while (ret.compare(0, 2, "./") == 0)
+        {
+            ret.erase(0, 2);
+        }
+        return ret;
+    }
+
+    // ResultDesc::dependencies is a list of uint64_t content hash and NUL-terminated name. A source without a file name has nothing
+    // to watch, it isn't listed.
+    void AppendDependency(std::vector<uint8_t>& dependencies, const char* name, uint64_t hash)
+    {
+        if (name == nullptr)
+        {
+            return;
+        }
+
+        const std::string normalized = NormalizeDependencyName(name);
+        const uint8_t* hashBytes = reinterpret_cast<const uint8_t*>(&hash);
+        dependencies.insert(dependencies.end(), hashBytes, hashBytes + sizeof(hash));
+        dependencies.insert(dependencies.end(), normalized.c_str(), normalized.c_str() + normalized.size() + 1);
+    }
+
     class ScIncludeHandler : public IDxcIncludeHandler
     {
     public:
-        explicit ScIncludeHandler(std::function<Blob(const char* includeName)> loadCallback) : m_loadCallback(std::move(loadCallback))
+        // Every include asked for goes into dependencies, if it's given. Missing ones get a hash of 0.
+        explicit ScIncludeHandler(std::function<Blob(const char* includeName)> loadCallback,
+                                  std::vector<uint8_t>* dependencies = nullptr)
+            : m_loadCallback(std::move(loadCallback)), m_dependencies(dependencies)
         {
         }
 
@@ -226,8 +346,16 @@ namespace
             }
             catch (...)
             {
+                if (m_dependencies != nullptr)
+                {
+                    AppendDependency(*m_dependencies, utf8FileName.c_str(), 0);
+                }
                 return E_FAIL;
             }
+            if (m_dependencies != nullptr)
+            {
+                AppendDependency(*m_dependencies, utf8FileName.c_str(), HashContent(source.Data(), source.Size()));
+            }
 
             *includeSource = nullptr;
             return Dxcompiler::Instance().Library()->CreateBlobWithEncodingOnHeapCopy(source.Data(), source.Size(), CP_UTF8,
@@ -273,10 +401,186 @@ namespace
 
     private:
         std::function<Blob(const char* includeName)> m_loadCallback;
+        std::vector<uint8_t>* m_dependencies;
 
         std::atomic<ULONG> m_ref = 0;
     };
 
+    // Forwards dxcompiler's allocations to Compiler::MemoryAllocator, or malloc/free, and counts the bytes
+    class ScMalloc : public IMalloc
+    {
+    public:
+        explicit ScMalloc(const Compiler::MemoryAllocator* allocator) : m_allocator(allocator)
+        {
+        }
+
+        void* STDMETHODCALLTYPE Alloc(SIZE_T size) override
+        {
+            void* block;
+            if (m_allocator != nullptr)
+            {
+                block = m_allocator->allocate(m_allocator->userData, size + BlockHeaderSize);
+            }
+            else
+            {
+                block = std::malloc(size + BlockHeaderSize);
+            }
+            if (block == nullptr)
+            {
+                return nullptr;
+            }
+
+            *reinterpret_cast<SIZE_T*>(block) = size;
+
+            m_totalBytes += size;
+            const uint64_t current = (m_currentBytes += size);
+            uint64_t peak = m_peakBytes;
+            while ((current > peak) && !m_peakBytes.compare_exchange_weak(peak, current))
+            {
+            }
+
+            return reinterpret_cast<uint8_t*>(block) + BlockHeaderSize;
+        }
+
+        void* STDMETHODCALLTYPE Realloc(void* ptr, SIZE_T size) override
+        {
+            if (ptr == nullptr)
+            {
+                return this->Alloc(size);
+            }
+            if (size == 0)
+            {
+                this->Free(ptr);
+                return nullptr;
+            }
+
+            void* newPtr = this->Alloc(size);
+            if (newPtr != nullptr)
+            {
+                std::memcpy(newPtr, ptr, std::min(size, this->GetSize(ptr)));
+                this->Free(ptr);
+            }
+            return newPtr;
+        }
+
+        void STDMETHODCALLTYPE Free(void* ptr) override
+        {
+            if (ptr == nullptr)
+            {
+                return;
+            }
+
+            void* block = reinterpret_cast<uint8_t*>(ptr) - BlockHeaderSize;
+            m_currentBytes -= *reinterpret_cast<SIZE_T*>(block);
+            if (m_allocator != nullptr)
+            {
+                m_allocator->free(m_allocator->userData, block);
+            }
+            else
+            {
+                std::free(block);
+            }
+        }
+
+        SIZE_T STDMETHODCALLTYPE GetSize(void* ptr) override
+        {
+            return *reinterpret_cast<SIZE_T*>(reinterpret_cast<uint8_t*>(ptr) - BlockHeaderSize);
+        }
+
+        int STDMETHODCALLTYPE DidAlloc(void* ptr) override
+        {
+            SC_UNUSED(ptr);
+            return -1;
+        }
+
+        void STDMETHODCALLTYPE HeapMinimize() override
+        {
+        }
+
+        ULONG STDMETHODCALLTYPE AddRef() override
+        {
+            return ++m_ref;
+        }
+
+        ULONG STDMETHODCALLTYPE Release() override
+        {
+            const ULONG result = --m_ref;
+            if (result == 0)
+            {
+                delete this;
+            }
+            return result;
+        }
+
+        HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, void** object) override
+        {
+            if (IsEqualIID(iid, __uuidof(IMalloc)))
+            {
+                *object = dynamic_cast<IMalloc*>(this);
+                this->AddRef();
+                return S_OK;
+            }
+            else if (IsEqualIID(iid, __uuidof(IUnknown)))
+            {
+                *object = dynamic_cast<IUnknown*>(this);
+                this->AddRef();
+                return S_OK;
+            }
+            else
+            {
+                return E_NOINTERFACE;
+            }
+        }
+
+        uint64_t TotalBytes() const
+        {
+            return m_totalBytes;
+        }
+
+        uint64_t PeakBytes() const
+        {
+            return m_peakBytes;
+        }
+
+    private:
+        // Keeps the size of each block in front of it, with the 16-byte alignment of malloc
+        static constexpr size_t BlockHeaderSize = 16;
+
+        const Compiler::MemoryAllocator* m_allocator;
+
+        // Blobs can be freed on another thread
+        std::atomic<uint64_t> m_totalBytes{0};
+        std::atomic<uint64_t> m_currentBytes{0};
+        std::atomic<uint64_t> m_peakBytes{0};
+
+        std::atomic<ULONG> m_ref{0};
+    };
+
+    // Set on a thread whose compile has a deadline, to learn which stage it got to
+    thread_local std::function<void(CompileStage stage)> stageObserver;
+
+    void EnterStage(CompileStage stage)
+    {
+        if (stageObserver)
+        {
+            stageObserver(stage);
+        }
+    }
+
+    const char* CompileStageName(CompileStage stage)
+    {
+        switch (stage)
+        {
+        case CompileStage::Dxc:
+            return "DXC";
+        case CompileStage::SpirvCross:
+            return "SPIRV-Cross";
+
+        default:
+            llvm_unreachable("Invalid compile stage.");
+        }
+    }
+
     Blob DefaultLoadCallback(const char* includeName)
     {
         std::vector<char> ret;
@@ -312,945 +616,6616 @@ namespace
         result.hasError = true;
     }
 
-#ifdef LLVM_ON_WIN32
-    template <typename T>
-    HRESULT CreateDxcReflectionFromBlob(IDxcBlob* dxilBlob, CComPtr<T>& outReflection)
+    struct BlobFrameHeader
     {
-        IDxcContainerReflection* containReflection = Dxcompiler::Instance().ContainerReflection();
-        IFT(containReflection->Load(dxilBlob));
-
-        uint32_t dxilPartIndex = ~0u;
-        IFT(containReflection->FindFirstPartKind(hlsl::DFCC_DXIL, &dxilPartIndex));
-        HRESULT result = containReflection->GetPartReflection(dxilPartIndex, __uuidof(T), reinterpret_cast<void**>(&outReflection));
-
-        return result;
-    }
+        uint32_t magic;
+        CompressionCodec codec;
+        uint32_t rawSize;
+        uint32_t payloadSize;
+    };
+    constexpr uint32_t BlobFrameMagic = 0x46424353; // "SCBF"
 
-    void ShaderReflection(Compiler::ReflectionResultDesc& result, IDxcBlob* dxilBlob)
+    struct ResultArchiveHeader
     {
-        CComPtr<ID3D12ShaderReflection> shaderReflection;
-        IFT(CreateDxcReflectionFromBlob(dxilBlob, shaderReflection));
+        uint32_t magic;
+        uint32_t version;
+        uint32_t flags;
+        uint32_t descCount;
+        uint32_t instructionCount;
+        uint32_t numFrames; // Each frame is a uint32_t size followed by a serialized Blob
+    };
+    constexpr uint32_t ResultArchiveMagic = 0x41524353; // "SCRA"
+    constexpr uint32_t ResultArchiveVersion = 2; // Bump with any change to the archive, or to the compact reflection layout inside it
+    constexpr uint32_t ResultArchiveFlagText = 1UL << 0;
+    constexpr uint32_t ResultArchiveFlagError = 1UL << 1;
 
-        D3D12_SHADER_DESC shaderDesc;
-        shaderReflection->GetDesc(&shaderDesc);
+    enum ResultArchiveFrame : uint32_t
+    {
+        ResultArchiveFrameTarget = 0,
+        ResultArchiveFrameErrorWarningMsg,
+        ResultArchiveFrameReflectionDescs,
+        ResultArchiveFrameCompactReflectionDescs,
+        ResultArchiveFrameMemoryStats, // allocatedBytes and peakAllocatedBytes
+        ResultArchiveFrameDependencies,
+        ResultArchiveFrameCost, // CostReport as is
+
+        NumResultArchiveFrames,
+    };
 
-        std::vector<Compiler::ReflectionDesc> vecReflectionDescs;
-        for (uint32_t resourceIndex = 0; resourceIndex < shaderDesc.BoundResources; ++resourceIndex)
+    // Returns an empty vector if the codec can't make the data smaller
+    std::vector<uint8_t> CompressPayload(CompressionCodec codec, int level, const void* data, uint32_t size)
+    {
+        std::vector<uint8_t> ret;
+        switch (codec)
         {
-            D3D12_SHADER_INPUT_BIND_DESC bindDesc;
-            shaderReflection->GetResourceBindingDesc(resourceIndex, &bindDesc);
-
-            Compiler::ReflectionDesc reflectionDesc{};
+        case CompressionCodec::None:
+            break;
 
-            if (bindDesc.Type == D3D_SIT_CBUFFER || bindDesc.Type == D3D_SIT_TBUFFER)
+        case CompressionCodec::Lz4:
+        {
+            ret.resize(LZ4_compressBound(static_cast<int>(size)));
+            const char* src = reinterpret_cast<const char*>(data);
+            char* dst = reinterpret_cast<char*>(ret.data());
+            int compressedSize;
+            if (level <= 0)
             {
-                ID3D12ShaderReflectionConstantBuffer* constantBuffer = shaderReflection->GetConstantBufferByName(bindDesc.Name);
-
-                D3D12_SHADER_BUFFER_DESC bufferDesc;
-                constantBuffer->GetDesc(&bufferDesc);
-
-                if (strcmp(bufferDesc.Name, "$Globals") == 0)
-                {
-                    for (uint32_t variableIndex = 0; variableIndex < bufferDesc.Variables; ++variableIndex)
-                    {
-                        ID3D12ShaderReflectionVariable* variable = constantBuffer->GetVariableByIndex(variableIndex);
-                        D3D12_SHADER_VARIABLE_DESC variableDesc;
-                        variable->GetDesc(&variableDesc);
-
-                        std::strncpy(reflectionDesc.name, variableDesc.Name,
-                                     std::min(std::strlen(variableDesc.Name) + 1, sizeof(reflectionDesc.name)));
-
-                        reflectionDesc.type = ShaderResourceType::Parameter;
-                        reflectionDesc.bufferBindPoint = bindDesc.BindPoint;
-                        reflectionDesc.bindPoint = variableDesc.StartOffset;
-                        reflectionDesc.bindCount = variableDesc.Size;
-                    }
-                }
-                else
-                {
-                    std::strncpy(reflectionDesc.name, bufferDesc.Name,
-                                 std::min(std::strlen(bufferDesc.Name) + 1, sizeof(reflectionDesc.name)));
-
-                    reflectionDesc.type = ShaderResourceType::ConstantBuffer;
-                    reflectionDesc.bufferBindPoint = bindDesc.BindPoint;
-                    reflectionDesc.bindPoint = 0;
-                    reflectionDesc.bindCount = 0;
-                }
+                compressedSize = LZ4_compress_default(src, dst, static_cast<int>(size), static_cast<int>(ret.size()));
             }
             else
             {
-                switch (bindDesc.Type)
-                {
-                case D3D_SIT_TEXTURE:
-                    reflectionDesc.type = ShaderResourceType::Texture;
-                    break;
+                compressedSize = LZ4_compress_HC(src, dst, static_cast<int>(size), static_cast<int>(ret.size()), level);
+            }
+            ret.resize(compressedSize > 0 ? compressedSize : 0);
+            break;
+        }
 
-                case D3D_SIT_SAMPLER:
-                    reflectionDesc.type = ShaderResourceType::Sampler;
-                    break;
+        case CompressionCodec::Zstd:
+        {
+            ret.resize(ZSTD_compressBound(size));
+            const size_t compressedSize = ZSTD_compress(ret.data(), ret.size(), data, size, (level == 0) ? 3 : level);
+            ret.resize(ZSTD_isError(compressedSize) ? 0 : compressedSize);
+            break;
+        }
 
-                case D3D_SIT_STRUCTURED:
-                case D3D_SIT_BYTEADDRESS:
-                    reflectionDesc.type = ShaderResourceType::ShaderResourceView;
-                    break;
+        default:
+            llvm_unreachable("Invalid compression codec.");
+        }
 
-                case D3D_SIT_UAV_RWTYPED:
-                case D3D_SIT_UAV_RWSTRUCTURED:
-                case D3D_SIT_UAV_RWBYTEADDRESS:
-                case D3D_SIT_UAV_APPEND_STRUCTURED:
-                case D3D_SIT_UAV_CONSUME_STRUCTURED:
-                case D3D_SIT_UAV_RWSTRUCTURED_WITH_COUNTER:
-                    reflectionDesc.type = ShaderResourceType::UnorderedAccessView;
-                    break;
+        if (ret.size() >= size)
+        {
+            ret.clear();
+        }
+        return ret;
+    }
 
-                default:
-                    llvm_unreachable("Unknown bind type.");
-                    break;
-                }
+    // The frame header isn't trusted for the allocation: LZ4 can't expand more than 255 times, and a zstd frame records its own size
+    bool RawSizePlausible(CompressionCodec codec, const void* payload, uint32_t payloadSize, uint32_t rawSize) noexcept
+    {
+        switch (codec)
+        {
+        case CompressionCodec::None:
+            return payloadSize == rawSize;
 
-                std::strncpy(reflectionDesc.name, bindDesc.Name, std::min(std::strlen(bindDesc.Name) + 1, sizeof(reflectionDesc.name)));
+        case CompressionCodec::Lz4:
+            return rawSize <= static_cast<uint64_t>(payloadSize) * 255;
 
-                reflectionDesc.bufferBindPoint = 0;
-                reflectionDesc.bindPoint = bindDesc.BindPoint;
-                reflectionDesc.bindCount = bindDesc.BindCount;
-            }
+        case CompressionCodec::Zstd:
+            return ZSTD_getFrameContentSize(payload, payloadSize) == rawSize;
 
-            vecReflectionDescs.push_back(reflectionDesc);
+        default:
+            return false;
         }
-
-        result.descCount = static_cast<uint32_t>(vecReflectionDescs.size());
-        result.descs.Reset(vecReflectionDescs.data(), sizeof(Compiler::ReflectionDesc) * result.descCount);
-        result.instructionCount = shaderDesc.InstructionCount;
     }
-#endif
 
-    std::wstring ShaderProfileName(ShaderStage stage, Compiler::ShaderModel shaderModel)
+    bool DecompressPayload(CompressionCodec codec, const void* payload, uint32_t payloadSize, void* dst, uint32_t rawSize) noexcept
     {
-        std::wstring shaderProfile;
-        switch (stage)
+        switch (codec)
         {
-        case ShaderStage::VertexShader:
-            shaderProfile = L"vs";
-            break;
-
-        case ShaderStage::PixelShader:
-            shaderProfile = L"ps";
-            break;
-
-        case ShaderStage::GeometryShader:
-            shaderProfile = L"gs";
-            break;
-
-        case ShaderStage::HullShader:
-            shaderProfile = L"hs";
-            break;
+        case CompressionCodec::None:
+            if (payloadSize != rawSize)
+            {
+                return false;
+            }
+            std::memcpy(dst, payload, rawSize);
+            return true;
 
-        case ShaderStage::DomainShader:
-            shaderProfile = L"ds";
-            break;
+        case CompressionCodec::Lz4:
+            return LZ4_decompress_safe(reinterpret_cast<const char*>(payload), reinterpret_cast<char*>(dst), static_cast<int>(payloadSize),
+                                       static_cast<int>(rawSize)) == static_cast<int>(rawSize);
 
-        case ShaderStage::ComputeShader:
-            shaderProfile = L"cs";
-            break;
+        case CompressionCodec::Zstd:
+        {
+            const size_t decompressedSize = ZSTD_decompress(dst, rawSize, payload, payloadSize);
+            return !ZSTD_isError(decompressedSize) && (decompressedSize == rawSize);
+        }
 
         default:
-            llvm_unreachable("Invalid shader stage.");
+            return false;
         }
-
-        shaderProfile.push_back(L'_');
-        shaderProfile.push_back(L'0' + shaderModel.major_ver);
-        shaderProfile.push_back(L'_');
-        shaderProfile.push_back(L'0' + shaderModel.minor_ver);
-
-        return shaderProfile;
     }
 
-    void ConvertDxcResult(Compiler::ResultDesc& result, IDxcOperationResult* dxcResult, ShadingLanguage targetLanguage, bool asModule)
+    // Creating a spv_context builds the grammar tables, which costs more than disassembling a small shader. Keep one per thread.
+    class SpirvToolsContext
     {
-        HRESULT status;
-        IFT(dxcResult->GetStatus(&status));
-
-        result.target.Reset();
-        result.errorWarningMsg.Reset();
-
-        CComPtr<IDxcBlobEncoding> errors;
-        IFT(dxcResult->GetErrorBuffer(&errors));
-        if (errors != nullptr)
+    public:
+        SpirvToolsContext() : m_context(spvContextCreate(SPV_ENV_UNIVERSAL_1_3))
         {
-            result.errorWarningMsg.Reset(errors->GetBufferPointer(), static_cast<uint32_t>(errors->GetBufferSize()));
-            errors = nullptr;
         }
 
-        result.hasError = true;
-        if (SUCCEEDED(status))
+        ~SpirvToolsContext()
         {
-            CComPtr<IDxcBlob> program;
-            IFT(dxcResult->GetResult(&program));
-            dxcResult = nullptr;
-            if (program != nullptr)
-            {
-                result.target.Reset(program->GetBufferPointer(), static_cast<uint32_t>(program->GetBufferSize()));
-                result.hasError = false;
-            }
+            spvContextDestroy(m_context);
+        }
 
-#ifdef LLVM_ON_WIN32
-            if ((targetLanguage == ShadingLanguage::Dxil) && !asModule)
-            {
-                // Gather reflection information only for ShadingLanguage::Dxil
-                ShaderReflection(result.reflection, program);
-            }
-#else
-            SC_UNUSED(targetLanguage);
-            SC_UNUSED(asModule);
-#endif
+        SpirvToolsContext(const SpirvToolsContext& other) = delete;
+        SpirvToolsContext& operator=(const SpirvToolsContext& other) = delete;
+
+        static spv_context ThreadInstance()
+        {
+            thread_local SpirvToolsContext instance;
+            return instance.m_context;
         }
-    }
 
-    Compiler::ResultDesc CompileToBinary(const Compiler::SourceDesc& source, const Compiler::Options& options,
-                                         ShadingLanguage targetLanguage, bool asModule)
-    {
-        assert((targetLanguage == ShadingLanguage::Dxil) || (targetLanguage == ShadingLanguage::SpirV));
+    private:
+        spv_context m_context;
+    };
 
-        std::wstring shaderProfile;
-        if (asModule)
+    // Walks a SPIR-V module once. Types and constants come before the functions, so interface sizes can be resolved as the
+    // variables are seen.
+    class SpirvCostAnalyzer
+    {
+    public:
+        static Compiler::CostReport Analyze(const Blob& spirv)
         {
-            if (targetLanguage == ShadingLanguage::Dxil)
-            {
-                shaderProfile = L"lib_6_x";
-            }
-            else
+            SpirvCostAnalyzer analyzer;
+            spv_diagnostic diagnostic = nullptr;
+            const spv_result_t result =
+                spvBinaryParse(SpirvToolsContext::ThreadInstance(), &analyzer, reinterpret_cast<const uint32_t*>(spirv.Data()),
+                               spirv.Size() / sizeof(uint32_t), nullptr, OnInstruction, &diagnostic);
+            spvDiagnosticDestroy(diagnostic);
+            if (result != SPV_SUCCESS)
             {
-                llvm_unreachable("Spir-V module is not supported.");
+                return Compiler::CostReport{};
             }
+            return analyzer.m_report;
         }
-        else
+
+    private:
+        static spv_result_t OnInstruction(void* userData, const spv_parsed_instruction_t* instruction)
         {
-            shaderProfile = ShaderProfileName(source.stage, options.shaderModel);
+            static_cast<SpirvCostAnalyzer*>(userData)->Add(*instruction);
+            return SPV_SUCCESS;
         }
 
-        std::vector<DxcDefine> dxcDefines;
-        std::vector<std::wstring> dxcDefineStrings;
-        // Need to reserve capacity so that small-string optimization does not
-        // invalidate the pointers to internal string data while resizing.
-        dxcDefineStrings.reserve(source.numDefines * 2);
-        for (size_t i = 0; i < source.numDefines; ++i)
+        void Add(const spv_parsed_instruction_t& instruction)
         {
-            const auto& define = source.defines[i];
+            const uint32_t* words = instruction.words;
+            const uint32_t id = instruction.result_id;
+            switch (instruction.opcode)
+            {
+            case spv::OpTypeVoid:
+                m_voidType = id;
+                return;
 
-            std::wstring nameUtf16Str;
-            Unicode::UTF8ToUTF16String(define.name, &nameUtf16Str);
-            dxcDefineStrings.emplace_back(std::move(nameUtf16Str));
-            const wchar_t* nameUtf16 = dxcDefineStrings.back().c_str();
+            case spv::OpTypeBool:
+            case spv::OpTypeInt:
+            case spv::OpTypeFloat:
+                m_components[id] = 1;
+                return;
 
-            const wchar_t* valueUtf16;
-            if (define.value != nullptr)
+            case spv::OpTypeVector:
+            case spv::OpTypeMatrix:
+                m_components[id] = Components(words[2]) * words[3];
+                return;
+
+            case spv::OpTypeArray:
             {
-                std::wstring valueUtf16Str;
-                Unicode::UTF8ToUTF16String(define.value, &valueUtf16Str);
-                dxcDefineStrings.emplace_back(std::move(valueUtf16Str));
-                valueUtf16 = dxcDefineStrings.back().c_str();
+                const auto length = m_constants.find(words[3]);
+                m_components[id] = Components(words[2]) * (length != m_constants.end() ? length->second : 1);
+                return;
             }
-            else
+
+            case spv::OpTypeStruct:
             {
-                valueUtf16 = nullptr;
+                uint32_t components = 0;
+                for (uint32_t i = 2; i < instruction.num_words; ++i)
+                {
+                    components += Components(words[i]);
+                }
+                m_components[id] = components;
+                return;
             }
 
-            dxcDefines.push_back({nameUtf16, valueUtf16});
-        }
+            case spv::OpTypePointer:
+                m_pointees[id] = words[3];
+                return;
 
-        CComPtr<IDxcBlobEncoding> sourceBlob;
-        IFT(Dxcompiler::Instance().Library()->CreateBlobWithEncodingOnHeapCopy(
-            source.source, static_cast<UINT32>(std::strlen(source.source)), CP_UTF8, &sourceBlob));
-        IFTARG(sourceBlob->GetBufferSize() >= 4);
+            case spv::OpConstant:
+                m_constants[id] = words[3];
+                return;
 
-        std::wstring shaderNameUtf16;
-        Unicode::UTF8ToUTF16String(source.fileName, &shaderNameUtf16);
+            case spv::OpEntryPoint:
+                // Execution model, function and name, then the interface
+                for (uint32_t i = 3; i < instruction.num_operands; ++i)
+                {
+                    m_interface.insert(words[instruction.operands[i].offset]);
+                }
+                return;
 
-        std::wstring entryPointUtf16;
-        Unicode::UTF8ToUTF16String(source.entryPoint, &entryPointUtf16);
+            case spv::OpFunction:
+                m_inFunction = true;
+                m_position = 0;
+                m_defs.clear();
+                m_lastUses.clear();
+                return;
 
-        std::vector<std::wstring> dxcArgStrings;
+            case spv::OpFunctionEnd:
+                EndFunction();
+                m_inFunction = false;
+                return;
 
-        // HLSL matrices are translated into SPIR-V OpTypeMatrixs in a transposed manner,
-        // See also https://antiagainst.github.io/post/hlsl-for-vulkan-matrices/
-        if (options.packMatricesInRowMajor)
-        {
-            dxcArgStrings.push_back(L"-Zpr");
+            default:
+                break;
+            }
+
+            if (!m_inFunction)
+            {
+                if ((instruction.opcode == spv::OpVariable) && (m_interface.find(id) != m_interface.end()))
+                {
+                    const auto pointee = m_pointees.find(instruction.type_id);
+                    const uint32_t components = pointee != m_pointees.end() ? Components(pointee->second) : 0;
+                    if (words[3] == spv::StorageClassInput)
+                    {
+                        m_report.inputComponents += components;
+                    }
+                    else if (words[3] == spv::StorageClassOutput)
+                    {
+                        m_report.outputComponents += components;
+                    }
+                }
+                return;
+            }
+
+            ++m_position;
+            for (uint32_t i = 0; i < instruction.num_operands; ++i)
+            {
+                const spv_parsed_operand_t& operand = instruction.operands[i];
+                if ((operand.type == SPV_OPERAND_TYPE_ID) || (operand.type == SPV_OPERAND_TYPE_MEMORY_SEMANTICS_ID) ||
+                    (operand.type == SPV_OPERAND_TYPE_SCOPE_ID))
+                {
+                    m_lastUses[words[operand.offset]] = m_position;
+                }
+            }
+            if ((id != 0) && (instruction.type_id != 0) && (instruction.type_id != m_voidType))
+            {
+                m_defs.emplace_back(id, m_position);
+                ++m_report.temporaries;
+            }
+
+            Classify(static_cast<spv::Op>(instruction.opcode));
         }
-        else
+
+        void Classify(spv::Op op)
         {
-            dxcArgStrings.push_back(L"-Zpc");
+            switch (op)
+            {
+            case spv::OpFunctionParameter:
+            case spv::OpLabel:
+            case spv::OpLine:
+            case spv::OpNoLine:
+            case spv::OpVariable:
+            case spv::OpSelectionMerge:
+                return;
+
+            case spv::OpLoopMerge:
+                ++m_report.loops;
+                return;
+
+            case spv::OpLoad:
+                ++m_report.loads;
+                break;
+
+            case spv::OpStore:
+            case spv::OpImageWrite:
+                ++m_report.stores;
+                break;
+
+            case spv::OpCopyMemory:
+                ++m_report.loads;
+                ++m_report.stores;
+                break;
+
+            case spv::OpImageFetch:
+            case spv::OpImageRead:
+            case spv::OpImageSparseFetch:
+            case spv::OpImageSparseRead:
+                ++m_report.textureFetches;
+                break;
+
+            case spv::OpImageGather:
+            case spv::OpImageDrefGather:
+            case spv::OpImageSparseGather:
+            case spv::OpImageSparseDrefGather:
+                ++m_report.textureSamples;
+                break;
+
+            case spv::OpControlBarrier:
+            case spv::OpMemoryBarrier:
+                ++m_report.barriers;
+                break;
+
+            case spv::OpBranchConditional:
+            case spv::OpSwitch:
+                ++m_report.branches;
+                break;
+
+            case spv::OpExtInst:
+                ++m_report.aluInstructions;
+                break;
+
+            default:
+                if (((op >= spv::OpImageSampleImplicitLod) && (op <= spv::OpImageSampleProjDrefExplicitLod)) ||
+                    ((op >= spv::OpImageSparseSampleImplicitLod) && (op <= spv::OpImageSparseSampleProjDrefExplicitLod)))
+                {
+                    ++m_report.textureSamples;
+                }
+                else if ((op >= spv::OpAtomicLoad) && (op <= spv::OpAtomicXor))
+                {
+                    ++m_report.atomics;
+                }
+                else if (((op >= spv::OpConvertFToU) && (op <= spv::OpBitcast)) ||
+                         ((op >= spv::OpSNegate) && (op <= spv::OpSMulExtended)) ||
+                         ((op >= spv::OpAny) && (op <= spv::OpFUnordGreaterThanEqual)) ||
+                         ((op >= spv::OpShiftRightLogical) && (op <= spv::OpBitCount)) ||
+                         ((op >= spv::OpDPdx) && (op <= spv::OpFwidthCoarse)))
+                {
+                    ++m_report.aluInstructions;
+                }
+                break;
+            }
+
+            ++m_report.totalInstructions;
         }
 
-        if (options.enable16bitTypes)
+        // A value is live from its definition to its last use in instruction order. Values carried around a loop through a phi
+        // are live longer than that, so this is a lower bound.
+        void EndFunction()
         {
-            if (options.shaderModel >= Compiler::ShaderModel{6, 2})
+            std::vector<int32_t> deltas(m_position + 2, 0);
+            for (const auto& def : m_defs)
             {
-                dxcArgStrings.push_back(L"-enable-16bit-types");
+                const auto lastUse = m_lastUses.find(def.first);
+                const uint32_t end = (lastUse != m_lastUses.end()) ? std::max(lastUse->second, def.second) : def.second;
+                ++deltas[def.second];
+                --deltas[end + 1];
             }
-            else
+
+            int32_t live = 0;
+            for (const int32_t delta : deltas)
             {
-                throw std::runtime_error("16-bit types requires shader model 6.2 or up.");
+                live += delta;
+                m_report.maxLiveValues = std::max(m_report.maxLiveValues, static_cast<uint32_t>(live));
             }
         }
 
-        if (options.enableDebugInfo)
+        uint32_t Components(uint32_t type) const
         {
-            dxcArgStrings.push_back(L"-Zi");
+            const auto iter = m_components.find(type);
+            return iter != m_components.end() ? iter->second : 0;
         }
 
-        if (options.disableOptimizations)
+    private:
+        Compiler::CostReport m_report;
+
+        std::unordered_map<uint32_t, uint32_t> m_components;
+        std::unordered_map<uint32_t, uint32_t> m_pointees;
+        std::unordered_map<uint32_t, uint32_t> m_constants;
+        std::unordered_set<uint32_t> m_interface;
+        uint32_t m_voidType = 0;
+
+        bool m_inFunction = false;
+        uint32_t m_position = 0;
+        std::vector<std::pair<uint32_t, uint32_t>> m_defs;
+        std::unordered_map<uint32_t, uint32_t> m_lastUses;
+    };
+
+    uint32_t HalfToFloatBits(uint32_t half)
+    {
+        const uint32_t sign = (half & 0x8000U) << 16;
+        int32_t exponent = (half >> 10) & 0x1F;
+        uint32_t mantissa = half & 0x3FFU;
+        if (exponent == 0x1F)
         {
-            dxcArgStrings.push_back(L"-Od");
+            return sign | 0x7F800000U | (mantissa << 13);
         }
-        else
+        if (exponent == 0)
         {
-            if (options.optimizationLevel < 4)
+            if (mantissa == 0)
             {
-                dxcArgStrings.push_back(std::wstring(L"-O") + static_cast<wchar_t>(L'0' + options.optimizationLevel));
+                return sign;
             }
-            else
+
+            // Denormal halfs are normal floats
+            exponent = 1;
+            while ((mantissa & 0x400U) == 0)
             {
-                llvm_unreachable("Invalid optimization level.");
+                mantissa <<= 1;
+                --exponent;
             }
+            mantissa &= 0x3FFU;
         }
+        return sign | (static_cast<uint32_t>(exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
 
-        if (options.shiftAllCBuffersBindings > 0)
+    // Widens 16-bit floats to 32 bits in place and lists the IDs whose type was built on them, to be decorated RelaxedPrecision.
+    // Constants are converted, the capabilities that need 16-bit support become Shader. A widened member would no longer match the
+    // offsets of its buffer's layout, so 16-bit floats in uniform, storage and push constant blocks fail the lowering instead.
+    class Float16Lowering
+    {
+    public:
+        // False if a block has 16-bit floats. A module that doesn't parse is left as it is.
+        static bool Lower(const uint32_t* words, size_t numWords, std::vector<uint32_t>& lowered, std::vector<uint32_t>& relaxedIds)
         {
-            dxcArgStrings.push_back(L"-fvk-b-shift");
-            dxcArgStrings.push_back(std::to_wstring(options.shiftAllCBuffersBindings));
-            dxcArgStrings.push_back(L"all");
-        }
+            Float16Lowering lowering(words, numWords);
+            spv_diagnostic diagnostic = nullptr;
+            const spv_result_t result =
+                spvBinaryParse(SpirvToolsContext::ThreadInstance(), &lowering, words, numWords, nullptr, OnInstruction, &diagnostic);
+            spvDiagnosticDestroy(diagnostic);
+            if (result != SPV_SUCCESS)
+            {
+                relaxedIds.clear();
+                lowered.assign(words, words + numWords);
+                return true;
+            }
+            if (lowering.m_halfInBlock)
+            {
+                return false;
+            }
 
-        if (options.shiftAllUABuffersBindings > 0)
-        {
-            dxcArgStrings.push_back(L"-fvk-u-shift");
-            dxcArgStrings.push_back(std::to_wstring(options.shiftAllUABuffersBindings));
-            dxcArgStrings.push_back(L"all");
+            relaxedIds = std::move(lowering.m_relaxedIds);
+            lowered = std::move(lowering.m_words);
+            return true;
         }
 
-        if (options.shiftAllSamplersBindings > 0)
+    private:
+        Float16Lowering(const uint32_t* words, size_t numWords) : m_base(words), m_words(words, words + numWords)
         {
-            dxcArgStrings.push_back(L"-fvk-s-shift");
-            dxcArgStrings.push_back(std::to_wstring(options.shiftAllSamplersBindings));
-            dxcArgStrings.push_back(L"all");
         }
 
-        if (options.shiftAllTexturesBindings > 0)
+        static spv_result_t OnInstruction(void* userData, const spv_parsed_instruction_t* instruction)
         {
-            dxcArgStrings.push_back(L"-fvk-t-shift");
-            dxcArgStrings.push_back(std::to_wstring(options.shiftAllTexturesBindings));
-            dxcArgStrings.push_back(L"all");
+            static_cast<Float16Lowering*>(userData)->Lower(*instruction);
+            return SPV_SUCCESS;
         }
 
-        switch (targetLanguage)
+        void Lower(const spv_parsed_instruction_t& instruction)
         {
-        case ShadingLanguage::Dxil:
-            break;
+            // The parser points into the module when it doesn't have to swap bytes, which is always the case for DXC's output
+            const size_t offset = instruction.words - m_base;
+            if (offset >= m_words.size())
+            {
+                return;
+            }
 
-        case ShadingLanguage::SpirV:
-        case ShadingLanguage::Hlsl:
-        case ShadingLanguage::Glsl:
-        case ShadingLanguage::Essl:
-        case ShadingLanguage::Msl_macOS:
-        case ShadingLanguage::Msl_iOS:
-            dxcArgStrings.push_back(L"-spirv");
-            break;
+            const uint32_t* words = instruction.words;
+            const uint32_t id = instruction.result_id;
+            switch (instruction.opcode)
+            {
+            case spv::OpCapability:
+                switch (words[1])
+                {
+                case spv::CapabilityFloat16:
+                case spv::CapabilityStorageBuffer16BitAccess:
+                case spv::CapabilityUniformAndStorageBuffer16BitAccess:
+                case spv::CapabilityStoragePushConstant16:
+                case spv::CapabilityStorageInputOutput16:
+                    m_words[offset + 1] = spv::CapabilityShader;
+                    break;
 
-        default:
-            llvm_unreachable("Invalid shading language.");
-        }
+                default:
+                    break;
+                }
+                return;
 
-        std::vector<const wchar_t*> dxcArgs;
-        dxcArgs.reserve(dxcArgStrings.size());
-        for (const auto& arg : dxcArgStrings)
-        {
-            dxcArgs.push_back(arg.c_str());
-        }
+            case spv::OpTypeFloat:
+                if (words[2] == 16)
+                {
+                    m_words[offset + 2] = 32;
+                    m_halfTypes.insert(id);
+                }
+                return;
 
-        CComPtr<IDxcIncludeHandler> includeHandler = new ScIncludeHandler(std::move(source.loadIncludeCallback));
+            case spv::OpTypeVector:
+            case spv::OpTypeMatrix:
+            case spv::OpTypeArray:
+            case spv::OpTypeRuntimeArray:
+                if (m_halfTypes.find(words[2]) != m_halfTypes.end())
+                {
+                    m_halfTypes.insert(id);
+                }
+                else if (m_halfStructs.find(words[2]) != m_halfStructs.end())
+                {
+                    m_halfStructs.insert(id);
+                }
+                return;
+
+            case spv::OpTypeStruct:
+                for (uint16_t i = 2; i < instruction.num_words; ++i)
+                {
+                    if ((m_halfTypes.find(words[i]) != m_halfTypes.end()) || (m_halfStructs.find(words[i]) != m_halfStructs.end()))
+                    {
+                        m_halfStructs.insert(id);
+                        break;
+                    }
+                }
+                return;
+
+            case spv::OpTypePointer:
+                if (m_halfTypes.find(words[3]) != m_halfTypes.end())
+                {
+                    m_halfTypes.insert(id);
+                }
+                if ((m_halfTypes.find(words[3]) != m_halfTypes.end()) || (m_halfStructs.find(words[3]) != m_halfStructs.end()))
+                {
+                    switch (words[2])
+                    {
+                    case spv::StorageClassUniform:
+                    case spv::StorageClassStorageBuffer:
+                    case spv::StorageClassPushConstant:
+                        m_halfInBlock = true;
+                        break;
+
+                    default:
+                        break;
+                    }
+                }
+                return;
+
+            case spv::OpConstant:
+            case spv::OpSpecConstant:
+                if (m_halfTypes.find(instruction.type_id) != m_halfTypes.end())
+                {
+                    m_words[offset + 3] = HalfToFloatBits(words[3] & 0xFFFFU);
+                }
+                break;
+
+            default:
+                break;
+            }
+
+            if ((id != 0) && (m_halfTypes.find(instruction.type_id) != m_halfTypes.end()))
+            {
+                m_relaxedIds.push_back(id);
+            }
+        }
+
+    private:
+        const uint32_t* m_base;
+        std::vector<uint32_t> m_words;
+        std::unordered_set<uint32_t> m_halfTypes;
+        std::unordered_set<uint32_t> m_halfStructs; // Structs, and arrays of them, with 16-bit float members
+        std::vector<uint32_t> m_relaxedIds;
+        bool m_halfInBlock = false;
+    };
+
+    // Turns stage inputs and outputs into private variables, which takes them out of the interface between stages. The stores to the
+    // former outputs are left for the driver's compiler to remove as dead code.
+    class InterfacePrivatizer
+    {
+    public:
+        static std::vector<uint32_t> Privatize(const std::vector<uint32_t>& module, const std::unordered_set<uint32_t>& variables)
+        {
+            if (variables.empty())
+            {
+                return module;
+            }
+
+            InterfacePrivatizer privatizer(module, variables);
+            spv_diagnostic diagnostic = nullptr;
+            const spv_result_t result = spvBinaryParse(SpirvToolsContext::ThreadInstance(), &privatizer, module.data(), module.size(),
+                                                       nullptr, OnInstruction, &diagnostic);
+            spvDiagnosticDestroy(diagnostic);
+            if ((result != SPV_SUCCESS) || !privatizer.m_valid)
+            {
+                return module;
+            }
+
+            return privatizer.Emit();
+        }
+
+    private:
+        struct Instruction
+        {
+            size_t offset;
+            uint32_t numWords;
+            uint32_t opcode;
+            uint32_t interfaceOffset; // Where the interface IDs of an OpEntryPoint start
+        };
+
+        InterfacePrivatizer(const std::vector<uint32_t>& module, const std::unordered_set<uint32_t>& variables)
+            : m_module(module), m_privatized(variables)
+        {
+        }
+
+        static spv_result_t OnInstruction(void* userData, const spv_parsed_instruction_t* instruction)
+        {
+            static_cast<InterfacePrivatizer*>(userData)->Collect(*instruction);
+            return SPV_SUCCESS;
+        }
+
+        void Collect(const spv_parsed_instruction_t& instruction)
+        {
+            // The parser points into the module when it doesn't have to swap bytes, which is always the case for DXC's output
+            const size_t offset = instruction.words - m_module.data();
+            if (offset >= m_module.size())
+            {
+                m_valid = false;
+                return;
+            }
+
+            uint32_t interfaceOffset = instruction.num_words;
+            switch (instruction.opcode)
+            {
+            case spv::OpEntryPoint:
+                if (instruction.num_operands > 3)
+                {
+                    interfaceOffset = instruction.operands[3].offset;
+                }
+                break;
+
+            case spv::OpVariable:
+                if (m_privatized.find(instruction.result_id) != m_privatized.end())
+                {
+                    m_pointerTypes.insert(instruction.type_id);
+                }
+                break;
+
+            case spv::OpAccessChain:
+            case spv::OpInBoundsAccessChain:
+            case spv::OpPtrAccessChain:
+            case spv::OpCopyObject:
+                // Pointers into a privatized variable become private pointers too
+                if (m_privatized.find(instruction.words[3]) != m_privatized.end())
+                {
+                    m_privatized.insert(instruction.result_id);
+                    m_pointerTypes.insert(instruction.type_id);
+                }
+                break;
+
+            default:
+                break;
+            }
+
+            m_instructions.push_back({offset, instruction.num_words, instruction.opcode, interfaceOffset});
+        }
+
+        std::vector<uint32_t> Emit() const
+        {
+            // From SPIR-V 1.4 on, the interface of an entry point lists the private variables as well
+            const bool interfaceHasPrivates = (m_module[1] >= 0x00010400);
+
+            uint32_t bound = m_module[3];
+            std::unordered_map<uint32_t, uint32_t> privatePointers;
+            std::vector<uint32_t> words(m_module.begin(), m_module.begin() + 5);
+            words.reserve(m_module.size() + m_pointerTypes.size() * 4);
+            for (const auto& instruction : m_instructions)
+            {
+                const uint32_t* src = &m_module[instruction.offset];
+                const size_t begin = words.size();
+                switch (instruction.opcode)
+                {
+                case spv::OpEntryPoint:
+                    words.insert(words.end(), src, src + instruction.interfaceOffset);
+                    for (uint32_t i = instruction.interfaceOffset; i < instruction.numWords; ++i)
+                    {
+                        if (interfaceHasPrivates || (m_privatized.find(src[i]) == m_privatized.end()))
+                        {
+                            words.push_back(src[i]);
+                        }
+                    }
+                    words[begin] = (static_cast<uint32_t>(words.size() - begin) << 16) | spv::OpEntryPoint;
+                    continue;
+
+                case spv::OpDecorate:
+                case spv::OpDecorateId:
+                case spv::OpDecorateString:
+                    // Locations, semantics and interpolation modes don't apply to private variables
+                    if (m_privatized.find(src[1]) != m_privatized.end())
+                    {
+                        continue;
+                    }
+                    break;
+
+                default:
+                    break;
+                }
+
+                words.insert(words.end(), src, src + instruction.numWords);
+                switch (instruction.opcode)
+                {
+                case spv::OpTypePointer:
+                    if (m_pointerTypes.find(src[1]) != m_pointerTypes.end())
+                    {
+                        privatePointers[src[1]] = bound;
+                        words.insert(words.end(), {(4U << 16) | spv::OpTypePointer, bound, spv::StorageClassPrivate, src[3]});
+                        ++bound;
+                    }
+                    break;
+
+                case spv::OpVariable:
+                case spv::OpAccessChain:
+                case spv::OpInBoundsAccessChain:
+                case spv::OpPtrAccessChain:
+                case spv::OpCopyObject:
+                    if (m_privatized.find(src[2]) != m_privatized.end())
+                    {
+                        words[begin + 1] = privatePointers.at(src[1]);
+                        if (instruction.opcode == spv::OpVariable)
+                        {
+                            words[begin + 3] = spv::StorageClassPrivate;
+                        }
+                    }
+                    break;
+
+                default:
+                    break;
+                }
+            }
+            words[3] = bound;
+
+            return words;
+        }
+
+    private:
+        const std::vector<uint32_t>& m_module;
+        std::unordered_set<uint32_t> m_privatized;
+        std::unordered_set<uint32_t> m_pointerTypes;
+        std::vector<Instruction> m_instructions;
+        bool m_valid = true;
+    };
+
+    // Collects the IDs whose names stay inside the shader: functions other than the entry points, their parameters and temporaries,
+    // and private variables. Also the names in the module, which new names mustn't collide with.
+    class LocalIdCollector
+    {
+    public:
+        static void Collect(const uint32_t* words, size_t numWords, std::vector<uint32_t>& ids, std::unordered_set<std::string>& names)
+        {
+            LocalIdCollector collector;
+            spv_diagnostic diagnostic = nullptr;
+            const spv_result_t result =
+                spvBinaryParse(SpirvToolsContext::ThreadInstance(), &collector, words, numWords, nullptr, OnInstruction, &diagnostic);
+            spvDiagnosticDestroy(diagnostic);
+            if (result != SPV_SUCCESS)
+            {
+                ids.clear();
+                return;
+            }
+
+            ids = std::move(collector.m_ids);
+            names = std::move(collector.m_names);
+        }
+
+    private:
+        static spv_result_t OnInstruction(void* userData, const spv_parsed_instruction_t* instruction)
+        {
+            static_cast<LocalIdCollector*>(userData)->Collect(*instruction);
+            return SPV_SUCCESS;
+        }
+
+        void Collect(const spv_parsed_instruction_t& instruction)
+        {
+            const uint32_t* words = instruction.words;
+            const uint32_t id = instruction.result_id;
+            switch (instruction.opcode)
+            {
+            case spv::OpEntryPoint:
+                m_entryPoints.insert(words[2]);
+                return;
+
+            case spv::OpName:
+                m_names.insert(reinterpret_cast<const char*>(&words[2]));
+                return;
+
+            case spv::OpFunction:
+                if (m_entryPoints.find(id) == m_entryPoints.end())
+                {
+                    m_ids.push_back(id);
+                }
+                m_inFunction = true;
+                return;
+
+            case spv::OpFunctionEnd:
+                m_inFunction = false;
+                return;
+
+            case spv::OpLabel:
+                return;
+
+            case spv::OpVariable:
+                if (words[3] == spv::StorageClassPrivate)
+                {
+                    m_ids.push_back(id);
+                    return;
+                }
+                break;
+
+            default:
+                break;
+            }
+
+            if (m_inFunction && (id != 0))
+            {
+                m_ids.push_back(id);
+            }
+        }
+
+    private:
+        std::unordered_set<uint32_t> m_entryPoints;
+        std::vector<uint32_t> m_ids;
+        std::unordered_set<std::string> m_names;
+        bool m_inFunction = false;
+    };
+
+    // Builds the compact reflection layout. Names are interned into one string table shared by all records.
+    class ReflectionBuilder
+    {
+    public:
+        void Add(const char* name, ShaderResourceType type, uint32_t bufferBindPoint, uint32_t bindPoint, uint32_t bindCount)
+        {
+            Compiler::CompactReflectionDesc desc;
+            desc.nameOffset = this->InternString(name);
+            desc.type = type;
+            desc.bufferBindPoint = bufferBindPoint;
+            desc.bindPoint = bindPoint;
+            desc.bindCount = bindCount;
+            m_descs.push_back(desc);
+        }
+
+        void AddMember(const char* name, uint32_t bufferBindPoint, uint32_t offset, uint32_t size, ShaderDataType dataType, uint32_t rows,
+                       uint32_t columns, uint32_t elements)
+        {
+            Compiler::CompactMemberDesc member;
+            member.nameOffset = this->InternString(name);
+            member.bufferBindPoint = bufferBindPoint;
+            member.offset = offset;
+            member.size = size;
+            member.dataType = dataType;
+            member.rows = rows;
+            member.columns = columns;
+            member.elements = elements;
+            m_members.push_back(member);
+        }
+
+        void AddParameter(bool isOutput, const char* semantic, uint32_t semanticIndex, uint32_t location, ShaderDataType dataType,
+                          uint32_t columns)
+        {
+            Compiler::CompactParameterDesc param;
+            param.semanticOffset = this->InternString(semantic);
+            param.semanticIndex = semanticIndex;
+            param.location = location;
+            param.dataType = dataType;
+            param.columns = columns;
+            (isOutput ? m_outputs : m_inputs).push_back(param);
+        }
+
+        void AddSpecConstant(const char* name, uint32_t id, ShaderDataType dataType, uint32_t defaultValue)
+        {
+            Compiler::CompactSpecConstantDesc specConstant;
+            specConstant.nameOffset = this->InternString(name);
+            specConstant.id = id;
+            specConstant.dataType = dataType;
+            specConstant.defaultValue = defaultValue;
+            m_specConstants.push_back(specConstant);
+        }
+
+        void AddArgument(const char* name, ShaderResourceType type, uint32_t argumentBuffer, uint32_t id, uint32_t count)
+        {
+            Compiler::CompactArgumentDesc argument;
+            argument.nameOffset = this->InternString(name);
+            argument.type = type;
+            argument.argumentBuffer = argumentBuffer;
+            argument.id = id;
+            argument.count = count;
+            m_arguments.push_back(argument);
+        }
+
+        void AddBinding(const char* name, ShaderResourceType type, uint32_t descriptorSet, uint32_t originalBinding, uint32_t binding)
+        {
+            Compiler::CompactBindingDesc desc;
+            desc.nameOffset = this->InternString(name);
+            desc.type = type;
+            desc.descriptorSet = descriptorSet;
+            desc.originalBinding = originalBinding;
+            desc.binding = binding;
+            m_bindings.push_back(desc);
+        }
+
+        void SetWorkgroupSize(uint32_t x, uint32_t y, uint32_t z)
+        {
+            m_workgroupSize[0] = x;
+            m_workgroupSize[1] = y;
+            m_workgroupSize[2] = z;
+        }
+
+        void Finish(Compiler::ReflectionResultDesc& result, bool compactOnly)
+        {
+            Compiler::CompactReflectionHeader header;
+            header.descCount = static_cast<uint32_t>(m_descs.size());
+            header.memberCount = static_cast<uint32_t>(m_members.size());
+            header.inputCount = static_cast<uint32_t>(m_inputs.size());
+            header.outputCount = static_cast<uint32_t>(m_outputs.size());
+            header.specConstantCount = static_cast<uint32_t>(m_specConstants.size());
+            header.argumentCount = static_cast<uint32_t>(m_arguments.size());
+            header.bindingCount = static_cast<uint32_t>(m_bindings.size());
+            std::copy(std::begin(m_workgroupSize), std::end(m_workgroupSize), header.workgroupSize);
+            header.stringTableOffset = static_cast<uint32_t>(
+                sizeof(header) + m_descs.size() * sizeof(Compiler::CompactReflectionDesc) +
+                m_members.size() * sizeof(Compiler::CompactMemberDesc) +
+                (m_inputs.size() + m_outputs.size()) * sizeof(Compiler::CompactParameterDesc) +
+                m_specConstants.size() * sizeof(Compiler::CompactSpecConstantDesc) +
+                m_arguments.size() * sizeof(Compiler::CompactArgumentDesc) + m_bindings.size() * sizeof(Compiler::CompactBindingDesc));
+            header.stringTableSize = static_cast<uint32_t>(m_stringTable.size());
+
+            std::vector<uint8_t> compact(header.stringTableOffset + header.stringTableSize);
+            uint8_t* ptr = compact.data();
+            auto write = [&ptr](const void* data, size_t size) {
+                if (size > 0)
+                {
+                    std::memcpy(ptr, data, size);
+                    ptr += size;
+                }
+            };
+            write(&header, sizeof(header));
+            write(m_descs.data(), m_descs.size() * sizeof(Compiler::CompactReflectionDesc));
+            write(m_members.data(), m_members.size() * sizeof(Compiler::CompactMemberDesc));
+            write(m_inputs.data(), m_inputs.size() * sizeof(Compiler::CompactParameterDesc));
+            write(m_outputs.data(), m_outputs.size() * sizeof(Compiler::CompactParameterDesc));
+            write(m_specConstants.data(), m_specConstants.size() * sizeof(Compiler::CompactSpecConstantDesc));
+            write(m_arguments.data(), m_arguments.size() * sizeof(Compiler::CompactArgumentDesc));
+            write(m_bindings.data(), m_bindings.size() * sizeof(Compiler::CompactBindingDesc));
+            write(m_stringTable.data(), m_stringTable.size());
+            result.compactDescs.Reset(compact.data(), static_cast<uint32_t>(compact.size()));
+
+            // descCount always describes descs, use CompactReflectionView::Count() for the compact records
+            result.descCount = compactOnly ? 0 : header.descCount;
+            result.descs.Reset();
+            if (!compactOnly)
+            {
+                std::vector<Compiler::ReflectionDesc> descs(m_descs.size());
+                for (size_t i = 0; i < m_descs.size(); ++i)
+                {
+                    const char* name = &m_stringTable[m_descs[i].nameOffset];
+                    std::strncpy(descs[i].name, name, sizeof(descs[i].name) - 1);
+                    descs[i].name[sizeof(descs[i].name) - 1] = '\0';
+                    descs[i].type = m_descs[i].type;
+                    descs[i].bufferBindPoint = m_descs[i].bufferBindPoint;
+                    descs[i].bindPoint = m_descs[i].bindPoint;
+                    descs[i].bindCount = m_descs[i].bindCount;
+                }
+                result.descs.Reset(descs.data(), static_cast<uint32_t>(sizeof(Compiler::ReflectionDesc) * descs.size()));
+            }
+        }
+
+    private:
+        uint32_t InternString(const char* str)
+        {
+            auto iter = m_stringOffsets.find(str);
+            if (iter == m_stringOffsets.end())
+            {
+                const uint32_t offset = static_cast<uint32_t>(m_stringTable.size());
+                m_stringTable.append(str);
+                m_stringTable.push_back('\0');
+                iter = m_stringOffsets.emplace(str, offset).first;
+            }
+            return iter->second;
+        }
+
+    private:
+        std::vector<Compiler::CompactReflectionDesc> m_descs;
+        std::vector<Compiler::CompactMemberDesc> m_members;
+        std::vector<Compiler::CompactParameterDesc> m_inputs;
+        std::vector<Compiler::CompactParameterDesc> m_outputs;
+        std::vector<Compiler::CompactSpecConstantDesc> m_specConstants;
+        std::vector<Compiler::CompactArgumentDesc> m_arguments;
+        std::vector<Compiler::CompactBindingDesc> m_bindings;
+        uint32_t m_workgroupSize[3] = {0, 0, 0};
+        std::string m_stringTable;
+        std::unordered_map<std::string, uint32_t> m_stringOffsets;
+    };
+
+#ifdef LLVM_ON_WIN32
+    template <typename T>
+    HRESULT CreateDxcReflectionFromBlob(IDxcBlob* dxilBlob, CComPtr<T>& outReflection)
+    {
+        IDxcContainerReflection* containReflection = Dxcompiler::Instance().ContainerReflection();
+        IFT(containReflection->Load(dxilBlob));
+
+        uint32_t dxilPartIndex = ~0u;
+        IFT(containReflection->FindFirstPartKind(hlsl::DFCC_DXIL, &dxilPartIndex));
+        HRESULT result = containReflection->GetPartReflection(dxilPartIndex, __uuidof(T), reinterpret_cast<void**>(&outReflection));
+
+        return result;
+    }
+
+    ShaderDataType DxilDataType(const D3D12_SHADER_TYPE_DESC& typeDesc)
+    {
+        if (typeDesc.Class == D3D_SVC_STRUCT)
+        {
+            return ShaderDataType::Struct;
+        }
+
+        switch (typeDesc.Type)
+        {
+        case D3D_SVT_BOOL:
+            return ShaderDataType::Bool;
+        case D3D_SVT_INT:
+            return ShaderDataType::Int;
+        case D3D_SVT_UINT:
+            return ShaderDataType::UInt;
+        case D3D_SVT_FLOAT:
+            return ShaderDataType::Float;
+        case D3D_SVT_DOUBLE:
+            return ShaderDataType::Double;
+        case D3D_SVT_MIN16FLOAT:
+        case D3D_SVT_FLOAT16:
+            return ShaderDataType::Half;
+        case D3D_SVT_MIN16INT:
+        case D3D_SVT_INT16:
+            return ShaderDataType::Int16;
+        case D3D_SVT_MIN16UINT:
+        case D3D_SVT_UINT16:
+            return ShaderDataType::UInt16;
+        case D3D_SVT_INT64:
+            return ShaderDataType::Int64;
+        case D3D_SVT_UINT64:
+            return ShaderDataType::UInt64;
+        default:
+            return ShaderDataType::Unknown;
+        }
+    }
+
+    void ShaderReflection(Compiler::ReflectionResultDesc& result, IDxcBlob* dxilBlob, bool compactOnly)
+    {
+        CComPtr<ID3D12ShaderReflection> shaderReflection;
+        IFT(CreateDxcReflectionFromBlob(dxilBlob, shaderReflection));
+
+        D3D12_SHADER_DESC shaderDesc;
+        shaderReflection->GetDesc(&shaderDesc);
+
+        ReflectionBuilder builder;
+        for (uint32_t resourceIndex = 0; resourceIndex < shaderDesc.BoundResources; ++resourceIndex)
+        {
+            D3D12_SHADER_INPUT_BIND_DESC bindDesc;
+            shaderReflection->GetResourceBindingDesc(resourceIndex, &bindDesc);
+
+            if (bindDesc.Type == D3D_SIT_CBUFFER || bindDesc.Type == D3D_SIT_TBUFFER)
+            {
+                ID3D12ShaderReflectionConstantBuffer* constantBuffer = shaderReflection->GetConstantBufferByName(bindDesc.Name);
+
+                D3D12_SHADER_BUFFER_DESC bufferDesc;
+                constantBuffer->GetDesc(&bufferDesc);
+
+                const bool isGlobals = (strcmp(bufferDesc.Name, "$Globals") == 0);
+                if (!isGlobals)
+                {
+                    builder.Add(bufferDesc.Name, ShaderResourceType::ConstantBuffer, bindDesc.BindPoint, 0, 0);
+                }
+
+                for (uint32_t variableIndex = 0; variableIndex < bufferDesc.Variables; ++variableIndex)
+                {
+                    ID3D12ShaderReflectionVariable* variable = constantBuffer->GetVariableByIndex(variableIndex);
+                    D3D12_SHADER_VARIABLE_DESC variableDesc;
+                    variable->GetDesc(&variableDesc);
+
+                    if (isGlobals)
+                    {
+                        builder.Add(variableDesc.Name, ShaderResourceType::Parameter, bindDesc.BindPoint, variableDesc.StartOffset,
+                                    variableDesc.Size);
+                    }
+
+                    D3D12_SHADER_TYPE_DESC typeDesc;
+                    variable->GetType()->GetDesc(&typeDesc);
+                    builder.AddMember(variableDesc.Name, bindDesc.BindPoint, variableDesc.StartOffset, variableDesc.Size, DxilDataType(typeDesc),
+                                      typeDesc.Rows, typeDesc.Columns, typeDesc.Elements);
+                }
+            }
+            else
+            {
+                ShaderResourceType type;
+                switch (bindDesc.Type)
+                {
+                case D3D_SIT_TEXTURE:
+                    type = ShaderResourceType::Texture;
+                    break;
+
+                case D3D_SIT_SAMPLER:
+                    type = ShaderResourceType::Sampler;
+                    break;
+
+                case D3D_SIT_STRUCTURED:
+                case D3D_SIT_BYTEADDRESS:
+                    type = ShaderResourceType::ShaderResourceView;
+                    break;
+
+                case D3D_SIT_UAV_RWTYPED:
+                case D3D_SIT_UAV_RWSTRUCTURED:
+                case D3D_SIT_UAV_RWBYTEADDRESS:
+                case D3D_SIT_UAV_APPEND_STRUCTURED:
+                case D3D_SIT_UAV_CONSUME_STRUCTURED:
+                case D3D_SIT_UAV_RWSTRUCTURED_WITH_COUNTER:
+                    type = ShaderResourceType::UnorderedAccessView;
+                    break;
+
+                default:
+                    llvm_unreachable("Unknown bind type.");
+                    break;
+                }
+
+                builder.Add(bindDesc.Name, type, 0, bindDesc.BindPoint, bindDesc.BindCount);
+            }
+        }
+
+        for (uint32_t paramIndex = 0; paramIndex < shaderDesc.InputParameters + shaderDesc.OutputParameters; ++paramIndex)
+        {
+            const bool isOutput = (paramIndex >= shaderDesc.InputParameters);
+
+            D3D12_SIGNATURE_PARAMETER_DESC paramDesc;
+            if (isOutput)
+            {
+                shaderReflection->GetOutputParameterDesc(paramIndex - shaderDesc.InputParameters, &paramDesc);
+            }
+            else
+            {
+                shaderReflection->GetInputParameterDesc(paramIndex, &paramDesc);
+            }
+
+            ShaderDataType dataType;
+            switch (paramDesc.ComponentType)
+            {
+            case D3D_REGISTER_COMPONENT_UINT32:
+                dataType = ShaderDataType::UInt;
+                break;
+            case D3D_REGISTER_COMPONENT_SINT32:
+                dataType = ShaderDataType::Int;
+                break;
+            case D3D_REGISTER_COMPONENT_FLOAT32:
+                dataType = ShaderDataType::Float;
+                break;
+            default:
+                dataType = ShaderDataType::Unknown;
+                break;
+            }
+
+            uint32_t columns = 0;
+            for (uint32_t mask = paramDesc.Mask; mask != 0; mask >>= 1)
+            {
+                columns += mask & 1;
+            }
+
+            builder.AddParameter(isOutput, paramDesc.SemanticName, paramDesc.SemanticIndex,
+                                 (paramDesc.SystemValueType == D3D_NAME_UNDEFINED) ? paramDesc.Register : ~0U, dataType, columns);
+        }
+
+        UINT groupSizeX = 0;
+        UINT groupSizeY = 0;
+        UINT groupSizeZ = 0;
+        shaderReflection->GetThreadGroupSize(&groupSizeX, &groupSizeY, &groupSizeZ);
+        builder.SetWorkgroupSize(groupSizeX, groupSizeY, groupSizeZ);
+
+        builder.Finish(result, compactOnly);
+        result.instructionCount = shaderDesc.InstructionCount;
+    }
+#endif
+
+    ShaderDataType SpirvDataType(const spirv_cross::SPIRType& type)
+    {
+        switch (type.basetype)
+        {
+        case spirv_cross::SPIRType::Boolean:
+            return ShaderDataType::Bool;
+        case spirv_cross::SPIRType::Short:
+            return ShaderDataType::Int16;
+        case spirv_cross::SPIRType::UShort:
+            return ShaderDataType::UInt16;
+        case spirv_cross::SPIRType::Int:
+            return ShaderDataType::Int;
+        case spirv_cross::SPIRType::UInt:
+            return ShaderDataType::UInt;
+        case spirv_cross::SPIRType::Int64:
+            return ShaderDataType::Int64;
+        case spirv_cross::SPIRType::UInt64:
+            return ShaderDataType::UInt64;
+        case spirv_cross::SPIRType::Half:
+            return ShaderDataType::Half;
+        case spirv_cross::SPIRType::Float:
+            return ShaderDataType::Float;
+        case spirv_cross::SPIRType::Double:
+            return ShaderDataType::Double;
+        case spirv_cross::SPIRType::Struct:
+            return ShaderDataType::Struct;
+        default:
+            return ShaderDataType::Unknown;
+        }
+    }
+
+    // DXC names stage variables after their semantics, such as in.var.TEXCOORD0. Legacy GLSL renames them to varying_TEXCOORD0.
+    void SplitSemantic(const std::string& varName, std::string& semantic, uint32_t& semanticIndex)
+    {
+        static const char* prefixes[] = {"in.var.", "out.var.", "in_var_", "out_var_", "varying_"};
+
+        semantic = varName;
+        for (const char* prefix : prefixes)
+        {
+            if (varName.find(prefix) == 0)
+            {
+                semantic = varName.substr(std::strlen(prefix));
+                break;
+            }
+        }
+
+        size_t indexPos = semantic.size();
+        while ((indexPos > 0) && (semantic[indexPos - 1] >= '0') && (semantic[indexPos - 1] <= '9'))
+        {
+            --indexPos;
+        }
+        semanticIndex = (indexPos < semantic.size()) ? static_cast<uint32_t>(std::stoul(semantic.substr(indexPos))) : 0;
+        semantic.resize(indexPos);
+    }
+
+    // The HLSL system value a built-in came from, nullptr for the ones without a stage parameter in DXIL
+    const char* BuiltInSemantic(spv::BuiltIn builtIn, spv::ExecutionModel model)
+    {
+        switch (builtIn)
+        {
+        case spv::BuiltInPosition:
+        case spv::BuiltInFragCoord:
+            return "SV_Position";
+        case spv::BuiltInClipDistance:
+            return "SV_ClipDistance";
+        case spv::BuiltInCullDistance:
+            return "SV_CullDistance";
+        case spv::BuiltInVertexIndex:
+            return "SV_VertexID";
+        case spv::BuiltInInstanceIndex:
+            return "SV_InstanceID";
+        case spv::BuiltInPrimitiveId:
+            return "SV_PrimitiveID";
+        case spv::BuiltInInvocationId:
+            return (model == spv::ExecutionModelGeometry) ? "SV_GSInstanceID" : "SV_OutputControlPointID";
+        case spv::BuiltInLayer:
+            return "SV_RenderTargetArrayIndex";
+        case spv::BuiltInViewportIndex:
+            return "SV_ViewportArrayIndex";
+        case spv::BuiltInTessLevelOuter:
+            return "SV_TessFactor";
+        case spv::BuiltInTessLevelInner:
+            return "SV_InsideTessFactor";
+        case spv::BuiltInTessCoord:
+            return "SV_DomainLocation";
+        case spv::BuiltInFrontFacing:
+            return "SV_IsFrontFace";
+        case spv::BuiltInSampleId:
+            return "SV_SampleIndex";
+        case spv::BuiltInSampleMask:
+            return "SV_Coverage";
+        case spv::BuiltInFragDepth:
+            return "SV_Depth";
+        case spv::BuiltInViewIndex:
+            return "SV_ViewID";
+        default:
+            return nullptr;
+        }
+    }
+
+    struct MslArgument
+    {
+        std::string name;
+        ShaderResourceType type;
+        uint32_t descriptorSet;
+        uint32_t id;
+        uint32_t count;
+    };
+
+    struct BindingRemap
+    {
+        std::string name;
+        ShaderResourceType type;
+        uint32_t descriptorSet;
+        uint32_t originalBinding;
+        uint32_t binding;
+        uint32_t id; // SPIR-V ID of the variable
+        bool active;
+    };
+
+    // Works on any platform. The resources are gathered from the active variables of the current entry point.
+    void ShaderReflection(Compiler::ReflectionResultDesc& result, const spirv_cross::Compiler& compiler, bool compactOnly,
+                          const std::vector<MslArgument>& arguments = {}, const std::vector<BindingRemap>& bindings = {})
+    {
+        const auto resources = compiler.get_shader_resources(compiler.get_active_interface_variables());
+
+        ReflectionBuilder builder;
+        auto appendResource = [&compiler, &builder](const spirv_cross::Resource& resource, ShaderResourceType type) {
+            const std::string& name = compiler.get_name(resource.id);
+            if (name.find("counter.var.") == 0)
+            {
+                // Counters of RW/Append/Consume structured buffers are part of the buffer itself in HLSL
+                return;
+            }
+
+            const auto& spirvType = compiler.get_type(resource.type_id);
+            builder.Add(name.empty() ? resource.name.c_str() : name.c_str(), type, 0,
+                        compiler.get_decoration(resource.id, spv::DecorationBinding),
+                        spirvType.array.empty() ? 1 : spirvType.array[0]); // 0 for unbounded arrays
+        };
+
+        for (const auto& resource : resources.uniform_buffers)
+        {
+            const uint32_t binding = compiler.get_decoration(resource.id, spv::DecorationBinding);
+            const std::string& name = compiler.get_name(resource.id);
+            const bool isGlobals = (name == "$Globals");
+            if (!isGlobals)
+            {
+                builder.Add(name.empty() ? resource.name.c_str() : name.c_str(), ShaderResourceType::ConstantBuffer, binding, 0, 0);
+            }
+
+            const auto& bufferType = compiler.get_type(resource.base_type_id);
+            for (uint32_t memberIndex = 0; memberIndex < bufferType.member_types.size(); ++memberIndex)
+            {
+                const std::string& memberName = compiler.get_member_name(resource.base_type_id, memberIndex);
+                const uint32_t offset = compiler.get_member_decoration(resource.base_type_id, memberIndex, spv::DecorationOffset);
+                const uint32_t size = static_cast<uint32_t>(compiler.get_declared_struct_member_size(bufferType, memberIndex));
+                if (isGlobals)
+                {
+                    builder.Add(memberName.c_str(), ShaderResourceType::Parameter, binding, offset, size);
+                }
+
+                // HLSL rows map to SPIR-V matrix columns, and HLSL columns to the SPIR-V column vector size
+                const auto& memberType = compiler.get_type(bufferType.member_types[memberIndex]);
+                builder.AddMember(memberName.c_str(), binding, offset, size, SpirvDataType(memberType), memberType.columns,
+                                  memberType.vecsize, memberType.array.empty() ? 0 : memberType.array[0]);
+            }
+        }
+
+        for (const auto& resource : resources.storage_buffers)
+        {
+            // (RW)StructuredBuffer and (RW)ByteAddressBuffer. Read-only ones have all members decorated NonWritable.
+            const bool readOnly = compiler.get_buffer_block_flags(resource.id).get(spv::DecorationNonWritable);
+            appendResource(resource, readOnly ? ShaderResourceType::ShaderResourceView : ShaderResourceType::UnorderedAccessView);
+        }
+        for (const auto& resource : resources.storage_images)
+        {
+            appendResource(resource, ShaderResourceType::UnorderedAccessView);
+        }
+        for (const auto& resource : resources.separate_images)
+        {
+            appendResource(resource, ShaderResourceType::Texture);
+        }
+        for (const auto& resource : resources.sampled_images)
+        {
+            appendResource(resource, ShaderResourceType::Texture);
+        }
+        for (const auto& resource : resources.separate_samplers)
+        {
+            appendResource(resource, ShaderResourceType::Sampler);
+        }
+
+        std::string semantic;
+        uint32_t semanticIndex;
+        for (const auto* params : {&resources.stage_inputs, &resources.stage_outputs})
+        {
+            for (const auto& resource : *params)
+            {
+                SplitSemantic(compiler.get_name(resource.id), semantic, semanticIndex);
+                const auto& paramType = compiler.get_type(resource.type_id);
+                const uint32_t location =
+                    compiler.has_decoration(resource.id, spv::DecorationLocation) ? compiler.get_decoration(resource.id, spv::DecorationLocation) : ~0U;
+                builder.AddParameter(params == &resources.stage_outputs, semantic.c_str(), semanticIndex, location, SpirvDataType(paramType),
+                                     paramType.vecsize);
+            }
+        }
+
+        // Built-ins aren't in stage_inputs and stage_outputs. They're the system values of DXIL, reported the same way: no location.
+        // Compute shaders have no stage parameters in DXIL either.
+        const spv::ExecutionModel model = compiler.get_execution_model();
+        if (model != spv::ExecutionModelGLCompute)
+        {
+            const auto activeVariables = compiler.get_active_interface_variables();
+            std::vector<uint32_t> builtIns(activeVariables.begin(), activeVariables.end());
+            std::sort(builtIns.begin(), builtIns.end());
+            for (const uint32_t id : builtIns)
+            {
+                const spv::StorageClass storage = compiler.get_storage_class(id);
+                if (((storage != spv::StorageClassInput) && (storage != spv::StorageClassOutput)) ||
+                    !compiler.has_decoration(id, spv::DecorationBuiltIn))
+                {
+                    continue;
+                }
+
+                const char* builtInSemantic =
+                    BuiltInSemantic(static_cast<spv::BuiltIn>(compiler.get_decoration(id, spv::DecorationBuiltIn)), model);
+                if (builtInSemantic != nullptr)
+                {
+                    const auto& paramType = compiler.get_type_from_variable(id);
+                    builder.AddParameter(storage == spv::StorageClassOutput, builtInSemantic, 0, ~0U, SpirvDataType(paramType),
+                                         paramType.vecsize);
+                }
+            }
+        }
+
+        for (const auto& specConstant : compiler.get_specialization_constants())
+        {
+            const auto& constant = compiler.get_constant(specConstant.id);
+            builder.AddSpecConstant(compiler.get_name(specConstant.id).c_str(), specConstant.constant_id,
+                                    SpirvDataType(compiler.get_type(constant.constant_type)), constant.scalar());
+        }
+
+        for (const auto& argument : arguments)
+        {
+            builder.AddArgument(argument.name.c_str(), argument.type, argument.descriptorSet, argument.id, argument.count);
+        }
+
+        for (const auto& binding : bindings)
+        {
+            if (binding.active)
+            {
+                builder.AddBinding(binding.name.c_str(), binding.type, binding.descriptorSet, binding.originalBinding, binding.binding);
+            }
+        }
+
+        if (compiler.get_execution_model() == spv::ExecutionModelGLCompute)
+        {
+            builder.SetWorkgroupSize(compiler.get_execution_mode_argument(spv::ExecutionModeLocalSize, 0),
+                                     compiler.get_execution_mode_argument(spv::ExecutionModeLocalSize, 1),
+                                     compiler.get_execution_mode_argument(spv::ExecutionModeLocalSize, 2));
+        }
+
+        builder.Finish(result, compactOnly);
+    }
+
+    std::wstring ShaderProfileName(ShaderStage stage, Compiler::ShaderModel shaderModel)
+    {
+        std::wstring shaderProfile;
+        switch (stage)
+        {
+        case ShaderStage::VertexShader:
+            shaderProfile = L"vs";
+            break;
+
+        case ShaderStage::PixelShader:
+            shaderProfile = L"ps";
+            break;
+
+        case ShaderStage::GeometryShader:
+            shaderProfile = L"gs";
+            break;
+
+        case ShaderStage::HullShader:
+            shaderProfile = L"hs";
+            break;
+
+        case ShaderStage::DomainShader:
+            shaderProfile = L"ds";
+            break;
+
+        case ShaderStage::ComputeShader:
+            shaderProfile = L"cs";
+            break;
+
+        default:
+            llvm_unreachable("Invalid shader stage.");
+        }
+
+        shaderProfile.push_back(L'_');
+        shaderProfile.push_back(L'0' + shaderModel.major_ver);
+        shaderProfile.push_back(L'_');
+        shaderProfile.push_back(L'0' + shaderModel.minor_ver);
+
+        return shaderProfile;
+    }
+
+    void ConvertDxcResult(Compiler::ResultDesc& result, IDxcOperationResult* dxcResult, ShadingLanguage targetLanguage, bool asModule,
+                          const Compiler::Options& options)
+    {
+        HRESULT status;
+        IFT(dxcResult->GetStatus(&status));
+
+        result.target.Reset();
+        result.errorWarningMsg.Reset();
+
+        CComPtr<IDxcBlobEncoding> errors;
+        IFT(dxcResult->GetErrorBuffer(&errors));
+        if (errors != nullptr)
+        {
+            result.errorWarningMsg.Reset(errors->GetBufferPointer(), static_cast<uint32_t>(errors->GetBufferSize()));
+            errors = nullptr;
+        }
+
+        result.hasError = true;
+        if (SUCCEEDED(status))
+        {
+            CComPtr<IDxcBlob> program;
+            IFT(dxcResult->GetResult(&program));
+            dxcResult = nullptr;
+            if (program != nullptr)
+            {
+                result.target.Reset(program->GetBufferPointer(), static_cast<uint32_t>(program->GetBufferSize()));
+                result.hasError = false;
+            }
+
+#ifdef LLVM_ON_WIN32
+            if ((targetLanguage == ShadingLanguage::Dxil) && !asModule)
+            {
+                // Gather reflection information only for ShadingLanguage::Dxil
+                ShaderReflection(result.reflection, program, options.compactReflectionOnly);
+            }
+#else
+            SC_UNUSED(targetLanguage);
+            SC_UNUSED(asModule);
+            SC_UNUSED(options);
+#endif
+        }
+    }
+
+    void ConvertDefines(const Compiler::SourceDesc& source, ShadingLanguage targetLanguage, std::vector<DxcDefine>& dxcDefines,
+                        std::vector<std::wstring>& dxcDefineStrings)
+    {
+        // Need to reserve capacity so that small-string optimization does not
+        // invalidate the pointers to internal string data while resizing.
+        dxcDefineStrings.reserve(source.numDefines * 2);
+        for (size_t i = 0; i < source.numDefines; ++i)
+        {
+            const auto& define = source.defines[i];
+            if (define.specConstant && (targetLanguage != ShadingLanguage::Dxil))
+            {
+                continue;
+            }
+
+            std::wstring nameUtf16Str;
+            Unicode::UTF8ToUTF16String(define.name, &nameUtf16Str);
+            dxcDefineStrings.emplace_back(std::move(nameUtf16Str));
+            const wchar_t* nameUtf16 = dxcDefineStrings.back().c_str();
+
+            const wchar_t* valueUtf16;
+            if (define.value != nullptr)
+            {
+                std::wstring valueUtf16Str;
+                Unicode::UTF8ToUTF16String(define.value, &valueUtf16Str);
+                dxcDefineStrings.emplace_back(std::move(valueUtf16Str));
+                valueUtf16 = dxcDefineStrings.back().c_str();
+            }
+            else
+            {
+                valueUtf16 = nullptr;
+            }
+
+            dxcDefines.push_back({nameUtf16, valueUtf16});
+        }
+    }
+
+    const char* SpecConstantTypeName(const char* value)
+    {
+        if ((std::strcmp(value, "true") == 0) || (std::strcmp(value, "false") == 0))
+        {
+            return "bool";
+        }
+
+        const size_t length = std::strlen(value);
+        const bool isHex = (length > 1) && (value[0] == '0') && ((value[1] == 'x') || (value[1] == 'X'));
+        const char suffix = (length > 0) ? value[length - 1] : '\0';
+        if (!isHex && ((std::strpbrk(value, ".eE") != nullptr) || (suffix == 'f') || (suffix == 'F')))
+        {
+            return "float";
+        }
+        return ((suffix == 'u') || (suffix == 'U')) ? "uint" : "int";
+    }
+
+    // Prepends a [[vk::constant_id]] declaration for each MacroDefine::specConstant. The #line keeps diagnostics on the lines of
+    // the original source.
+    std::string SourceWithSpecConstants(const Compiler::SourceDesc& source, ShadingLanguage targetLanguage)
+    {
+        std::string declarations;
+        if (targetLanguage != ShadingLanguage::Dxil)
+        {
+            uint32_t id = 0;
+            for (uint32_t i = 0; i < source.numDefines; ++i)
+            {
+                const MacroDefine& define = source.defines[i];
+                if (define.specConstant)
+                {
+                    const char* value = (define.value != nullptr) ? define.value : "1";
+                    declarations += "[[vk::constant_id(" + std::to_string(id) + ")]] const " + SpecConstantTypeName(value) + " " +
+                                    define.name + " = " + value + ";\n";
+                    ++id;
+                }
+            }
+        }
+        if (declarations.empty())
+        {
+            return source.source;
+        }
+        return declarations + "#line 1\n" + source.source;
+    }
+
+    // Expands the includes and macros, so the text can be compiled for several entry points without loading and preprocessing again.
+    // The predefined macros differ between Dxil and SPIR-V, so each needs its own preprocessed text.
+    Compiler::ResultDesc PreprocessSource(const Compiler::SourceDesc& source, const Compiler::Options& options,
+                                          ShadingLanguage targetLanguage)
+    {
+        assert((targetLanguage == ShadingLanguage::Dxil) || (targetLanguage == ShadingLanguage::SpirV));
+
+        std::vector<DxcDefine> dxcDefines;
+        std::vector<std::wstring> dxcDefineStrings;
+        ConvertDefines(source, targetLanguage, dxcDefines, dxcDefineStrings);
+
+        const std::string sourceText = SourceWithSpecConstants(source, targetLanguage);
+        CComPtr<IDxcBlobEncoding> sourceBlob;
+        IFT(Dxcompiler::Instance().Library()->CreateBlobWithEncodingOnHeapCopy(
+            sourceText.c_str(), static_cast<UINT32>(sourceText.size()), CP_UTF8, &sourceBlob));
+        IFTARG(sourceBlob->GetBufferSize() >= 4);
+
+        std::wstring shaderNameUtf16;
+        Unicode::UTF8ToUTF16String(source.fileName, &shaderNameUtf16);
+
+        // The profile defines __SHADER_TARGET_STAGE/MAJOR/MINOR, so the text is only valid for source.stage and options.shaderModel
+        const std::wstring shaderProfile = ShaderProfileName(source.stage, options.shaderModel);
+
+        std::vector<const wchar_t*> dxcArgs;
+        dxcArgs.push_back(L"-T");
+        dxcArgs.push_back(shaderProfile.c_str());
+        if (targetLanguage == ShadingLanguage::SpirV)
+        {
+            dxcArgs.push_back(L"-spirv");
+        }
+        if (options.enable16bitTypes && (options.shaderModel >= Compiler::ShaderModel{6, 2}))
+        {
+            dxcArgs.push_back(L"-enable-16bit-types");
+        }
+
+        std::vector<uint8_t> dependencies;
+        AppendDependency(dependencies, source.fileName, HashContent(source.source, std::strlen(source.source)));
+
+        CComPtr<IDxcIncludeHandler> includeHandler = new ScIncludeHandler(std::move(source.loadIncludeCallback), &dependencies);
+        CComPtr<IDxcOperationResult> preprocessResult;
+        IFT(Dxcompiler::Instance().Compiler()->Preprocess(sourceBlob, shaderNameUtf16.c_str(), dxcArgs.data(),
+                                                          static_cast<UINT32>(dxcArgs.size()), dxcDefines.data(),
+                                                          static_cast<UINT32>(dxcDefines.size()), includeHandler, &preprocessResult));
+
+        Compiler::ResultDesc ret{};
+        ret.isText = true;
+        ret.hasError = true;
+        ret.dependencies.Reset(dependencies.data(), static_cast<uint32_t>(dependencies.size()));
+
+        HRESULT status;
+        IFT(preprocessResult->GetStatus(&status));
+
+        CComPtr<IDxcBlobEncoding> errors;
+        IFT(preprocessResult->GetErrorBuffer(&errors));
+        if (errors != nullptr)
+        {
+            ret.errorWarningMsg.Reset(errors->GetBufferPointer(), static_cast<uint32_t>(errors->GetBufferSize()));
+        }
+
+        if (SUCCEEDED(status))
+        {
+            CComPtr<IDxcBlob> text;
+            IFT(preprocessResult->GetResult(&text));
+            if (text != nullptr)
+            {
+                // Keep the trailing \0, the text is used as SourceDesc::source
+                std::string textStr(reinterpret_cast<const char*>(text->GetBufferPointer()), text->GetBufferSize());
+                textStr.resize(std::strlen(textStr.c_str()));
+                ret.target.Reset(textStr.c_str(), static_cast<uint32_t>(textStr.size() + 1));
+                ret.hasError = false;
+            }
+        }
+
+        return ret;
+    }
+
+    Compiler::ResultDesc CompileToBinary(const Compiler::SourceDesc& source, const Compiler::Options& options,
+                                         ShadingLanguage targetLanguage, bool asModule)
+    {
+        assert((targetLanguage == ShadingLanguage::Dxil) || (targetLanguage == ShadingLanguage::SpirV));
+
+        EnterStage(CompileStage::Dxc);
+
+        std::wstring shaderProfile;
+        if (asModule)
+        {
+            if (targetLanguage == ShadingLanguage::Dxil)
+            {
+                shaderProfile = L"lib_6_x";
+            }
+            else
+            {
+                llvm_unreachable("Spir-V module is not supported.");
+            }
+        }
+        else
+        {
+            shaderProfile = ShaderProfileName(source.stage, options.shaderModel);
+        }
+
+        std::vector<DxcDefine> dxcDefines;
+        std::vector<std::wstring> dxcDefineStrings;
+        ConvertDefines(source, targetLanguage, dxcDefines, dxcDefineStrings);
+
+        const std::string sourceText = SourceWithSpecConstants(source, targetLanguage);
+        CComPtr<IDxcBlobEncoding> sourceBlob;
+        IFT(Dxcompiler::Instance().Library()->CreateBlobWithEncodingOnHeapCopy(
+            sourceText.c_str(), static_cast<UINT32>(sourceText.size()), CP_UTF8, &sourceBlob));
+        IFTARG(sourceBlob->GetBufferSize() >= 4);
+
+        std::wstring shaderNameUtf16;
+        Unicode::UTF8ToUTF16String(source.fileName, &shaderNameUtf16);
+
+        std::wstring entryPointUtf16;
+        Unicode::UTF8ToUTF16String(source.entryPoint, &entryPointUtf16);
+
+        std::vector<std::wstring> dxcArgStrings;
+
+        // HLSL matrices are translated into SPIR-V OpTypeMatrixs in a transposed manner,
+        // See also https://antiagainst.github.io/post/hlsl-for-vulkan-matrices/
+        if (options.packMatricesInRowMajor)
+        {
+            dxcArgStrings.push_back(L"-Zpr");
+        }
+        else
+        {
+            dxcArgStrings.push_back(L"-Zpc");
+        }
+
+        if (options.enable16bitTypes)
+        {
+            if (options.shaderModel >= Compiler::ShaderModel{6, 2})
+            {
+                dxcArgStrings.push_back(L"-enable-16bit-types");
+            }
+            else
+            {
+                throw std::runtime_error("16-bit types requires shader model 6.2 or up.");
+            }
+        }
+
+        if (options.enableDebugInfo)
+        {
+            dxcArgStrings.push_back(L"-Zi");
+        }
+
+        if (options.disableOptimizations)
+        {
+            dxcArgStrings.push_back(L"-Od");
+        }
+        else
+        {
+            if (options.optimizationLevel < 4)
+            {
+                dxcArgStrings.push_back(std::wstring(L"-O") + static_cast<wchar_t>(L'0' + options.optimizationLevel));
+            }
+            else
+            {
+                llvm_unreachable("Invalid optimization level.");
+            }
+        }
+
+        if (options.shiftAllCBuffersBindings > 0)
+        {
+            dxcArgStrings.push_back(L"-fvk-b-shift");
+            dxcArgStrings.push_back(std::to_wstring(options.shiftAllCBuffersBindings));
+            dxcArgStrings.push_back(L"all");
+        }
+
+        if (options.shiftAllUABuffersBindings > 0)
+        {
+            dxcArgStrings.push_back(L"-fvk-u-shift");
+            dxcArgStrings.push_back(std::to_wstring(options.shiftAllUABuffersBindings));
+            dxcArgStrings.push_back(L"all");
+        }
+
+        if (options.shiftAllSamplersBindings > 0)
+        {
+            dxcArgStrings.push_back(L"-fvk-s-shift");
+            dxcArgStrings.push_back(std::to_wstring(options.shiftAllSamplersBindings));
+            dxcArgStrings.push_back(L"all");
+        }
+
+        if (options.shiftAllTexturesBindings > 0)
+        {
+            dxcArgStrings.push_back(L"-fvk-t-shift");
+            dxcArgStrings.push_back(std::to_wstring(options.shiftAllTexturesBindings));
+            dxcArgStrings.push_back(L"all");
+        }
+
+        switch (targetLanguage)
+        {
+        case ShadingLanguage::Dxil:
+            break;
+
+        case ShadingLanguage::SpirV:
+        case ShadingLanguage::Hlsl:
+        case ShadingLanguage::Glsl:
+        case ShadingLanguage::Essl:
+        case ShadingLanguage::Msl_macOS:
+        case ShadingLanguage::Msl_iOS:
+            dxcArgStrings.push_back(L"-spirv");
+            break;
+
+        default:
+            llvm_unreachable("Invalid shading language.");
+        }
+
+        std::vector<const wchar_t*> dxcArgs;
+        dxcArgs.reserve(dxcArgStrings.size());
+        for (const auto& arg : dxcArgStrings)
+        {
+            dxcArgs.push_back(arg.c_str());
+        }
+
+        CComPtr<ScMalloc> malloc = new ScMalloc(options.allocator);
+        CComPtr<IDxcCompiler> compiler = Dxcompiler::Instance().CreateCompiler(malloc);
+
+        std::vector<uint8_t> dependencies;
+        AppendDependency(dependencies, source.fileName, HashContent(source.source, std::strlen(source.source)));
+
+        CComPtr<IDxcIncludeHandler> includeHandler = new ScIncludeHandler(std::move(source.loadIncludeCallback), &dependencies);
         CComPtr<IDxcOperationResult> compileResult;
-        IFT(Dxcompiler::Instance().Compiler()->Compile(sourceBlob, shaderNameUtf16.c_str(), entryPointUtf16.c_str(), shaderProfile.c_str(),
-                                                       dxcArgs.data(), static_cast<UINT32>(dxcArgs.size()), dxcDefines.data(),
-                                                       static_cast<UINT32>(dxcDefines.size()), includeHandler, &compileResult));
+        IFT(compiler->Compile(sourceBlob, shaderNameUtf16.c_str(), entryPointUtf16.c_str(), shaderProfile.c_str(), dxcArgs.data(),
+                              static_cast<UINT32>(dxcArgs.size()), dxcDefines.data(), static_cast<UINT32>(dxcDefines.size()),
+                              includeHandler, &compileResult));
+
+        Compiler::ResultDesc ret{};
+        ConvertDxcResult(ret, compileResult, targetLanguage, asModule, options);
+        if (options.costReport && (targetLanguage != ShadingLanguage::Dxil) && !ret.hasError)
+        {
+            ret.cost = SpirvCostAnalyzer::Analyze(ret.target);
+        }
+        ret.allocatedBytes = malloc->TotalBytes();
+        ret.peakAllocatedBytes = malloc->PeakBytes();
+        ret.dependencies.Reset(dependencies.data(), static_cast<uint32_t>(dependencies.size()));
+
+        return ret;
+    }
+
+    // Gives each resource an [[id]] in the argument buffer of its descriptor set, in binding order, and hands them to SPIRV-Cross.
+    // SPIRV-Cross looks the IDs up by set and binding, with one slot each for a buffer, a texture and a sampler, so two buffers, or
+    // two textures, on one binding can't be told apart. Returns false for those.
+    bool AssignMslArguments(spirv_cross::CompilerMSL& compiler, spv::ExecutionModel model, std::vector<MslArgument>& arguments)
+    {
+        enum ArgumentKind : uint32_t
+        {
+            ArgumentKindBuffer,
+            ArgumentKindTexture,
+            ArgumentKindSampler,
+        };
+
+        struct Entry
+        {
+            uint32_t descriptorSet;
+            uint32_t binding;
+            ArgumentKind kind;
+            ShaderResourceType type;
+            const spirv_cross::Resource* resource;
+        };
+
+        const auto resources = compiler.get_shader_resources(compiler.get_active_interface_variables());
+        std::vector<Entry> entries;
+        auto appendResources = [&compiler, &entries](const spirv_cross::SmallVector<spirv_cross::Resource>& list, ArgumentKind kind,
+                                                     ShaderResourceType type) {
+            for (const auto& resource : list)
+            {
+                entries.push_back({compiler.get_decoration(resource.id, spv::DecorationDescriptorSet),
+                                   compiler.get_decoration(resource.id, spv::DecorationBinding), kind, type, &resource});
+            }
+        };
+        appendResources(resources.uniform_buffers, ArgumentKindBuffer, ShaderResourceType::ConstantBuffer);
+        for (const auto& resource : resources.storage_buffers)
+        {
+            const bool readOnly = compiler.get_buffer_block_flags(resource.id).get(spv::DecorationNonWritable);
+            entries.push_back({compiler.get_decoration(resource.id, spv::DecorationDescriptorSet),
+                               compiler.get_decoration(resource.id, spv::DecorationBinding), ArgumentKindBuffer,
+                               readOnly ? ShaderResourceType::ShaderResourceView : ShaderResourceType::UnorderedAccessView, &resource});
+        }
+        appendResources(resources.separate_images, ArgumentKindTexture, ShaderResourceType::Texture);
+        appendResources(resources.storage_images, ArgumentKindTexture, ShaderResourceType::UnorderedAccessView);
+        appendResources(resources.separate_samplers, ArgumentKindSampler, ShaderResourceType::Sampler);
+
+        std::sort(entries.begin(), entries.end(), [](const Entry& lhs, const Entry& rhs) {
+            return std::tie(lhs.descriptorSet, lhs.binding, lhs.kind) < std::tie(rhs.descriptorSet, rhs.binding, rhs.kind);
+        });
+
+        spirv_cross::MSLResourceBinding binding;
+        bool hasBinding = false;
+        uint32_t id = 0;
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            const Entry& entry = entries[i];
+            if ((i > 0) && (entries[i - 1].descriptorSet == entry.descriptorSet) && (entries[i - 1].binding == entry.binding) &&
+                (entries[i - 1].kind == entry.kind))
+            {
+                return false;
+            }
+
+            if (!hasBinding || (binding.desc_set != entry.descriptorSet) || (binding.binding != entry.binding))
+            {
+                if (hasBinding)
+                {
+                    compiler.add_msl_resource_binding(binding);
+                }
+                if (hasBinding && (binding.desc_set != entry.descriptorSet))
+                {
+                    id = 0;
+                }
+
+                binding = spirv_cross::MSLResourceBinding{};
+                binding.stage = model;
+                binding.desc_set = entry.descriptorSet;
+                binding.binding = entry.binding;
+                hasBinding = true;
+            }
+
+            switch (entry.kind)
+            {
+            case ArgumentKindBuffer:
+                binding.msl_buffer = id;
+                break;
+
+            case ArgumentKindTexture:
+                binding.msl_texture = id;
+                break;
+
+            case ArgumentKindSampler:
+                binding.msl_sampler = id;
+                break;
+
+            default:
+                llvm_unreachable("Invalid argument kind.");
+            }
+
+            const auto& type = compiler.get_type(entry.resource->type_id);
+            const uint32_t count = type.array.empty() ? 1 : type.array[0];
+            const std::string& name = compiler.get_name(entry.resource->id);
+            arguments.push_back({name.empty() ? entry.resource->name : name, entry.type, entry.descriptorSet, id, count});
+            id += std::max(count, 1U);
+        }
+        if (hasBinding)
+        {
+            compiler.add_msl_resource_binding(binding);
+        }
+
+        return true;
+    }
+
+    // Renumbers the resources from 0 in every register type of the target, in the order of their original bindings. The unused ones
+    // are numbered after the used ones, so they can't collide where the target still declares them.
+    void RemapDenseBindings(spirv_cross::Compiler& compiler, ShadingLanguage language, spv::ExecutionModel model,
+                            std::vector<BindingRemap>& bindings)
+    {
+        enum BindingClass : uint32_t
+        {
+            BindingClassConstantBuffer,
+            BindingClassReadOnlyBuffer,
+            BindingClassStorageBuffer,
+            BindingClassTexture,
+            BindingClassStorageImage,
+            BindingClassSampler,
+
+            NumBindingClasses
+        };
+
+        // Register type of each BindingClass
+        static const uint32_t spirvRegisters[NumBindingClasses] = {0, 0, 0, 0, 0, 0};
+        static const uint32_t hlslRegisters[NumBindingClasses] = {0, 1, 2, 1, 2, 3}; // b, t, u, t, u, s
+        static const uint32_t glslRegisters[NumBindingClasses] = {0, 1, 1, 2, 3, 4};
+        static const uint32_t mslRegisters[NumBindingClasses] = {0, 0, 0, 1, 1, 2};
+
+        const uint32_t* registers;
+        bool numberEachSet;
+        switch (language)
+        {
+        case ShadingLanguage::SpirV:
+            registers = spirvRegisters;
+            numberEachSet = true;
+            break;
+
+        case ShadingLanguage::Hlsl:
+            registers = hlslRegisters;
+            numberEachSet = true;
+            break;
+
+        case ShadingLanguage::Glsl:
+        case ShadingLanguage::Essl:
+            registers = glslRegisters;
+            numberEachSet = false;
+            break;
+
+        case ShadingLanguage::Msl_macOS:
+        case ShadingLanguage::Msl_iOS:
+            registers = mslRegisters;
+            numberEachSet = false;
+            break;
+
+        default:
+            llvm_unreachable("Invalid shading language.");
+        }
+
+        struct Entry
+        {
+            uint32_t registerType;
+            uint32_t descriptorSet;
+            bool inactive;
+            uint32_t binding;
+            BindingClass bindingClass;
+            const spirv_cross::Resource* resource;
+        };
+
+        const auto resources = compiler.get_shader_resources();
+        const auto activeVariables = compiler.get_active_interface_variables();
+        std::vector<Entry> entries;
+        auto appendResource = [&](const spirv_cross::Resource& resource, BindingClass bindingClass) {
+            entries.push_back({registers[bindingClass], compiler.get_decoration(resource.id, spv::DecorationDescriptorSet),
+                               activeVariables.find(resource.id) == activeVariables.end(),
+                               compiler.get_decoration(resource.id, spv::DecorationBinding), bindingClass, &resource});
+        };
+        for (const auto& resource : resources.uniform_buffers)
+        {
+            appendResource(resource, BindingClassConstantBuffer);
+        }
+        for (const auto& resource : resources.storage_buffers)
+        {
+            const bool readOnly = compiler.get_buffer_block_flags(resource.id).get(spv::DecorationNonWritable);
+            appendResource(resource, readOnly ? BindingClassReadOnlyBuffer : BindingClassStorageBuffer);
+        }
+        for (const auto* list : {&resources.separate_images, &resources.sampled_images})
+        {
+            for (const auto& resource : *list)
+            {
+                appendResource(resource, BindingClassTexture);
+            }
+        }
+        for (const auto& resource : resources.storage_images)
+        {
+            appendResource(resource, BindingClassStorageImage);
+        }
+        for (const auto& resource : resources.separate_samplers)
+        {
+            appendResource(resource, BindingClassSampler);
+        }
+
+        if (!numberEachSet)
+        {
+            for (auto& entry : entries)
+            {
+                entry.descriptorSet = 0;
+            }
+        }
+        std::stable_sort(entries.begin(), entries.end(), [](const Entry& lhs, const Entry& rhs) {
+            return std::tie(lhs.registerType, lhs.descriptorSet, lhs.inactive, lhs.binding, lhs.bindingClass) <
+                   std::tie(rhs.registerType, rhs.descriptorSet, rhs.inactive, rhs.binding, rhs.bindingClass);
+        });
+
+        static const ShaderResourceType types[NumBindingClasses] = {
+            ShaderResourceType::ConstantBuffer, ShaderResourceType::ShaderResourceView, ShaderResourceType::UnorderedAccessView,
+            ShaderResourceType::Texture,        ShaderResourceType::UnorderedAccessView, ShaderResourceType::Sampler,
+        };
+
+        std::set<std::pair<uint32_t, uint32_t>> mslBindings;
+        uint32_t next = 0;
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            const Entry& entry = entries[i];
+            if ((i > 0) && ((entries[i - 1].registerType != entry.registerType) || (entries[i - 1].descriptorSet != entry.descriptorSet)))
+            {
+                next = 0;
+            }
+
+            const uint32_t id = entry.resource->id;
+            const uint32_t descriptorSet = compiler.get_decoration(id, spv::DecorationDescriptorSet);
+            const std::string& name = compiler.get_name(id);
+            bindings.push_back({name.empty() ? entry.resource->name : name, types[entry.bindingClass], descriptorSet, entry.binding, next,
+                                id, !entry.inactive});
+            compiler.set_decoration(id, spv::DecorationBinding, next);
+            mslBindings.emplace(descriptorSet, next);
+
+            const auto& type = compiler.get_type(entry.resource->type_id);
+            next += type.array.empty() ? 1 : std::max(type.array[0], 1U);
+        }
+
+        if ((language == ShadingLanguage::Msl_macOS) || (language == ShadingLanguage::Msl_iOS))
+        {
+            // Otherwise SPIRV-Cross numbers the MSL resources by itself. Every register type has its own numbering, so one entry can
+            // serve a buffer, a texture and a sampler that share a binding.
+            auto& mslCompiler = static_cast<spirv_cross::CompilerMSL&>(compiler);
+            for (const auto& setBinding : mslBindings)
+            {
+                spirv_cross::MSLResourceBinding binding;
+                binding.stage = model;
+                binding.desc_set = setBinding.first;
+                binding.binding = setBinding.second;
+                binding.msl_buffer = setBinding.second;
+                binding.msl_texture = setBinding.second;
+                binding.msl_sampler = setBinding.second;
+                mslCompiler.add_msl_resource_binding(binding);
+            }
+        }
+    }
+
+    // Unused resources can't be dropped from SPIR-V here, but dxcompiler's optimizer has usually removed them already
+    Blob RemapSpirvBindings(const Blob& spirv, std::vector<BindingRemap>& bindings)
+    {
+        std::vector<uint32_t> words(spirv.Size() / sizeof(uint32_t));
+        std::memcpy(words.data(), spirv.Data(), words.size() * sizeof(uint32_t));
+
+        spirv_cross::Compiler compiler(words.data(), words.size());
+        RemapDenseBindings(compiler, ShadingLanguage::SpirV, compiler.get_execution_model(), bindings);
+        for (const auto& binding : bindings)
+        {
+            uint32_t offset;
+            if (compiler.get_binary_offset_for_decoration(binding.id, spv::DecorationBinding, offset))
+            {
+                words[offset] = binding.binding;
+            }
+        }
+
+        return Blob(words.data(), static_cast<uint32_t>(words.size() * sizeof(uint32_t)));
+    }
+
+    spirv_cross::CompilerGLSL::Options::Precision EsslPrecision(FloatPrecision precision)
+    {
+        switch (precision)
+        {
+        case FloatPrecision::Low:
+            return spirv_cross::CompilerGLSL::Options::Lowp;
+
+        case FloatPrecision::Medium:
+            return spirv_cross::CompilerGLSL::Options::Mediump;
+
+        case FloatPrecision::High:
+            return spirv_cross::CompilerGLSL::Options::Highp;
+
+        default:
+            llvm_unreachable("Invalid precision.");
+        }
+    }
+
+    const char* EsslPrecisionName(FloatPrecision precision)
+    {
+        switch (precision)
+        {
+        case FloatPrecision::Low:
+            return "lowp";
+
+        case FloatPrecision::Medium:
+            return "mediump";
+
+        case FloatPrecision::High:
+            return "highp";
+
+        default:
+            llvm_unreachable("Invalid precision.");
+        }
+    }
+
+    spv::ExecutionModel SpirvExecutionModel(ShaderStage stage)
+    {
+        switch (stage)
+        {
+        case ShaderStage::VertexShader:
+            return spv::ExecutionModelVertex;
+
+        case ShaderStage::HullShader:
+            return spv::ExecutionModelTessellationControl;
+
+        case ShaderStage::DomainShader:
+            return spv::ExecutionModelTessellationEvaluation;
+
+        case ShaderStage::GeometryShader:
+            return spv::ExecutionModelGeometry;
+
+        case ShaderStage::PixelShader:
+            return spv::ExecutionModelFragment;
+
+        case ShaderStage::ComputeShader:
+            return spv::ExecutionModelGLCompute;
+
+        default:
+            llvm_unreachable("Invalid shader stage.");
+        }
+    }
+
+    const char* ShaderStageName(ShaderStage stage)
+    {
+        switch (stage)
+        {
+        case ShaderStage::VertexShader:
+            return "vertex shader";
+
+        case ShaderStage::HullShader:
+            return "hull shader";
+
+        case ShaderStage::DomainShader:
+            return "domain shader";
+
+        case ShaderStage::GeometryShader:
+            return "geometry shader";
+
+        case ShaderStage::PixelShader:
+            return "pixel shader";
+
+        case ShaderStage::ComputeShader:
+            return "compute shader";
+
+        default:
+            llvm_unreachable("Invalid shader stage.");
+        }
+    }
+
+    // A stage input or output other than a built-in. HS, DS and GS inputs, and HS outputs, have an extra array of vertices around
+    // the varying, which is left out of arrayDims and numLocations.
+    struct StageVarying
+    {
+        uint32_t id;
+        std::string semantic; // Upper case, with the index
+        const spirv_cross::SPIRType* type;
+        size_t arrayDims;
+        bool patch;
+        uint32_t location;
+        uint32_t numLocations;
+    };
+
+    uint32_t VaryingLocations(const spirv_cross::Compiler& compiler, const spirv_cross::SPIRType& type, size_t arrayDims)
+    {
+        uint32_t locations;
+        if (type.basetype == spirv_cross::SPIRType::Struct)
+        {
+            locations = 0;
+            for (const auto memberTypeId : type.member_types)
+            {
+                const auto& memberType = compiler.get_type(memberTypeId);
+                locations += VaryingLocations(compiler, memberType, memberType.array.size());
+            }
+        }
+        else
+        {
+            // 64-bit vectors of 3 or 4 components take 2 locations per column
+            locations = type.columns * (((type.width == 64) && (type.vecsize > 2)) ? 2 : 1);
+        }
+
+        // The outermost dimension is the last
+        for (size_t i = 0; i < arrayDims; ++i)
+        {
+            locations *= std::max(type.array[i], 1U);
+        }
+        return locations;
+    }
+
+    std::vector<StageVarying> StageVaryings(const spirv_cross::Compiler& compiler,
+                                            const spirv_cross::SmallVector<spirv_cross::Resource>& resources, bool perVertexArray)
+    {
+        std::vector<StageVarying> varyings;
+        std::string semantic;
+        uint32_t semanticIndex;
+        for (const auto& resource : resources)
+        {
+            if (compiler.has_decoration(resource.id, spv::DecorationBuiltIn))
+            {
+                continue;
+            }
+
+            SplitSemantic(compiler.get_name(resource.id), semantic, semanticIndex);
+            std::transform(semantic.begin(), semantic.end(), semantic.begin(), [](char ch) { return static_cast<char>(std::toupper(ch)); });
+
+            const auto& type = compiler.get_type(resource.type_id);
+            const bool patch = compiler.has_decoration(resource.id, spv::DecorationPatch);
+            const size_t arrayDims = type.array.size() - ((perVertexArray && !patch && !type.array.empty()) ? 1 : 0);
+            const uint32_t location = compiler.get_decoration(resource.id, spv::DecorationLocation);
+            varyings.push_back({resource.id, semantic + std::to_string(semanticIndex), &type, arrayDims, patch, location,
+                                VaryingLocations(compiler, type, arrayDims)});
+        }
+
+        std::stable_sort(varyings.begin(), varyings.end(),
+                         [](const StageVarying& lhs, const StageVarying& rhs) { return lhs.location < rhs.location; });
+        return varyings;
+    }
+
+    // An input can read fewer vector components than the output has
+    bool VaryingsMatch(const StageVarying& output, const StageVarying& input)
+    {
+        const spirv_cross::SPIRType& outputType = *output.type;
+        const spirv_cross::SPIRType& inputType = *input.type;
+        if ((output.patch != input.patch) || (outputType.basetype != inputType.basetype) || (outputType.width != inputType.width) ||
+            (outputType.columns != inputType.columns) || (outputType.vecsize < inputType.vecsize) || (output.arrayDims != input.arrayDims))
+        {
+            return false;
+        }
+        return std::equal(outputType.array.begin(), outputType.array.begin() + output.arrayDims, inputType.array.begin());
+    }
+
+    // Matches the outputs of a stage with the inputs of the next one by semantic. The outputs the next stage doesn't read, and the
+    // inputs it declares but never uses, become private variables. The rest get consecutive locations in the order of the outputs.
+    bool LinkStageInterface(std::vector<uint32_t>& producer, const Compiler::SourceDesc& producerSource, std::vector<uint32_t>& consumer,
+                            const Compiler::SourceDesc& consumerSource, std::string& errorMsg)
+    {
+        spirv_cross::Compiler producerCompiler(producer.data(), producer.size());
+        producerCompiler.set_entry_point(producerSource.entryPoint, SpirvExecutionModel(producerSource.stage));
+        spirv_cross::Compiler consumerCompiler(consumer.data(), consumer.size());
+        consumerCompiler.set_entry_point(consumerSource.entryPoint, SpirvExecutionModel(consumerSource.stage));
+
+        const std::vector<StageVarying> outputs = StageVaryings(producerCompiler, producerCompiler.get_shader_resources().stage_outputs,
+                                                                producerSource.stage == ShaderStage::HullShader);
+        const std::vector<StageVarying> inputs =
+            StageVaryings(consumerCompiler, consumerCompiler.get_shader_resources().stage_inputs,
+                          (consumerSource.stage == ShaderStage::HullShader) || (consumerSource.stage == ShaderStage::DomainShader) ||
+                              (consumerSource.stage == ShaderStage::GeometryShader));
+        const auto activeInputs = consumerCompiler.get_active_interface_variables();
+
+        std::unordered_map<std::string, const StageVarying*> outputsBySemantic;
+        for (const auto& output : outputs)
+        {
+            outputsBySemantic.emplace(output.semantic, &output);
+        }
+
+        const std::string consumerName = ShaderStageName(consumerSource.stage);
+        const std::string producerName = ShaderStageName(producerSource.stage);
+        std::unordered_map<uint32_t, std::vector<const StageVarying*>> readers;
+        std::unordered_set<uint32_t> unusedInputs;
+        for (const auto& input : inputs)
+        {
+            if (activeInputs.find(input.id) == activeInputs.end())
+            {
+                unusedInputs.insert(input.id);
+                continue;
+            }
+
+            const auto iter = outputsBySemantic.find(input.semantic);
+            if (iter == outputsBySemantic.end())
+            {
+                errorMsg += "The " + consumerName + " reads " + input.semantic + ", which the " + producerName + " doesn't write.\n";
+            }
+            else if (!VaryingsMatch(*iter->second, input))
+            {
+                errorMsg += "The " + consumerName + " reads " + input.semantic + " as a different type than the " + producerName +
+                            " writes.\n";
+            }
+            else
+            {
+                readers[iter->second->id].push_back(&input);
+            }
+        }
+        if (!errorMsg.empty())
+        {
+            errorMsg.pop_back();
+            return false;
+        }
+
+        auto setLocation = [](std::vector<uint32_t>& module, const spirv_cross::Compiler& compiler, uint32_t id, uint32_t location) {
+            uint32_t offset;
+            if (compiler.get_binary_offset_for_decoration(id, spv::DecorationLocation, offset))
+            {
+                module[offset] = location;
+            }
+        };
+
+        std::unordered_set<uint32_t> unusedOutputs;
+        uint32_t location = 0;
+        for (const auto& output : outputs)
+        {
+            const auto iter = readers.find(output.id);
+            if (iter == readers.end())
+            {
+                unusedOutputs.insert(output.id);
+                continue;
+            }
+
+            setLocation(producer, producerCompiler, output.id, location);
+            for (const auto* input : iter->second)
+            {
+                setLocation(consumer, consumerCompiler, input->id, location);
+            }
+            location += output.numLocations;
+        }
+
+        producer = InterfacePrivatizer::Privatize(producer, unusedOutputs);
+        consumer = InterfacePrivatizer::Privatize(consumer, unusedInputs);
+        return true;
+    }
+
+    // _a to _z, then _aa, _ba and on. The underscore keeps them clear of keywords and built-in functions, and the lower case letter after
+    // it clear of the names C++ reserves, and of SPIRV-Cross's _123 temporaries.
+    std::string ShortName(uint32_t index)
+    {
+        static const char digits[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+
+        std::string name = "_";
+        name.push_back(digits[index % 26]);
+        index /= 26;
+        while (index > 0)
+        {
+            --index;
+            name.push_back(digits[index % 36]);
+            index /= 36;
+        }
+        return name;
+    }
+
+    // Drops the comments, and the whitespace that doesn't keep two tokens apart. Preprocessor directives stay on lines of their own.
+    std::string MinifyText(const std::string& text)
+    {
+        auto isIdentifierChar = [](char ch) { return (std::isalnum(static_cast<unsigned char>(ch)) != 0) || (ch == '_'); };
+        auto isOperatorChar = [](char ch) { return (ch != '\0') && (std::strchr("+-*/%&|^<>=!.", ch) != nullptr); };
+
+        std::string ret;
+        ret.reserve(text.size());
+        bool lineStart = true;
+        bool pendingSpace = false;
+        size_t i = 0;
+        while (i < text.size())
+        {
+            const char ch = text[i];
+            if (lineStart && (ch == '#'))
+            {
+                size_t end = i;
+                do
+                {
+                    end = text.find('\n', end + 1);
+                    if (end == std::string::npos)
+                    {
+                        end = text.size();
+                    }
+                } while ((end < text.size()) && (end > i) && (text[end - 1] == '\\'));
+
+                size_t last = end;
+                while ((last > i) && std::isspace(static_cast<unsigned char>(text[last - 1])))
+                {
+                    --last;
+                }
+
+                if (!ret.empty() && (ret.back() != '\n'))
+                {
+                    ret.push_back('\n');
+                }
+                ret.append(text, i, last - i);
+                ret.push_back('\n');
+
+                i = end + 1;
+                pendingSpace = false;
+                continue;
+            }
+
+            if (ch == '\n')
+            {
+                lineStart = true;
+                pendingSpace = true;
+                ++i;
+                continue;
+            }
+            if (std::isspace(static_cast<unsigned char>(ch)))
+            {
+                pendingSpace = true;
+                ++i;
+                continue;
+            }
+            if ((ch == '/') && (i + 1 < text.size()) && (text[i + 1] == '/'))
+            {
+                i = text.find('\n', i);
+                if (i == std::string::npos)
+                {
+                    i = text.size();
+                }
+                pendingSpace = true;
+                continue;
+            }
+            if ((ch == '/') && (i + 1 < text.size()) && (text[i + 1] == '*'))
+            {
+                const size_t end = text.find("*/", i + 2);
+                i = (end == std::string::npos) ? text.size() : end + 2;
+                pendingSpace = true;
+                continue;
+            }
+
+            if (pendingSpace && !ret.empty())
+            {
+                // Keeps a b, and a - -b, apart
+                const char prev = ret.back();
+                if ((isIdentifierChar(prev) && isIdentifierChar(ch)) || (isOperatorChar(prev) && isOperatorChar(ch)))
+                {
+                    ret.push_back(' ');
+                }
+            }
+            ret.push_back(ch);
+            lineStart = false;
+            pendingSpace = false;
+            ++i;
+        }
+        if (!ret.empty() && (ret.back() != '\n'))
+        {
+            ret.push_back('\n');
+        }
+
+        return ret;
+    }
+
+    Compiler::ResultDesc CrossCompile(const Compiler::ResultDesc& binaryResult, const Compiler::SourceDesc& source,
+                                      const Compiler::Options& options, const Compiler::TargetDesc& target)
+    {
+        assert((target.language != ShadingLanguage::Dxil) && (target.language != ShadingLanguage::SpirV));
+        assert((binaryResult.target.Size() & (sizeof(uint32_t) - 1)) == 0);
+
+        EnterStage(CompileStage::SpirvCross);
+
+        Compiler::ResultDesc ret;
+
+        ret.errorWarningMsg = binaryResult.errorWarningMsg;
+        ret.isText = true;
+        ret.allocatedBytes = binaryResult.allocatedBytes;
+        ret.peakAllocatedBytes = binaryResult.peakAllocatedBytes;
+        ret.dependencies = binaryResult.dependencies;
+        ret.cost = binaryResult.cost;
+
+        uint32_t intVersion = 0;
+        if (target.version != nullptr)
+        {
+            intVersion = std::stoi(target.version);
+        }
+
+        const uint32_t* spirvIr = reinterpret_cast<const uint32_t*>(binaryResult.target.Data());
+        size_t spirvSize = binaryResult.target.Size() / sizeof(uint32_t);
+
+        std::vector<uint32_t> loweredIr;
+        std::vector<uint32_t> relaxedIds;
+        if (options.float16AsMediump && (target.language == ShadingLanguage::Essl))
+        {
+            if (!Float16Lowering::Lower(spirvIr, spirvSize, loweredIr, relaxedIds))
+            {
+                AppendError(ret, "float16AsMediump can't lower 16-bit floats in uniform, storage or push constant buffers, whose layout "
+                                 "would change. Use 32-bit floats in buffers.");
+                return ret;
+            }
+            spirvIr = loweredIr.data();
+            spirvSize = loweredIr.size();
+        }
+
+        std::unique_ptr<spirv_cross::CompilerGLSL> compiler;
+        bool combinedImageSamplers = false;
+        bool buildDummySampler = false;
+
+        switch (target.language)
+        {
+        case ShadingLanguage::Hlsl:
+            if ((source.stage == ShaderStage::GeometryShader) || (source.stage == ShaderStage::HullShader) ||
+                (source.stage == ShaderStage::DomainShader))
+            {
+                // Check https://github.com/KhronosGroup/SPIRV-Cross/issues/121 for details
+                AppendError(ret, "GS, HS, and DS has not been supported yet.");
+                return ret;
+            }
+            if ((source.stage == ShaderStage::GeometryShader) && (intVersion < 40))
+            {
+                AppendError(ret, "HLSL shader model earlier than 4.0 doesn't have GS or CS.");
+                return ret;
+            }
+            if ((source.stage == ShaderStage::ComputeShader) && (intVersion < 50))
+            {
+                AppendError(ret, "CS in HLSL shader model earlier than 5.0 is not supported.");
+                return ret;
+            }
+            if (((source.stage == ShaderStage::HullShader) || (source.stage == ShaderStage::DomainShader)) && (intVersion < 50))
+            {
+                AppendError(ret, "HLSL shader model earlier than 5.0 doesn't have HS or DS.");
+                return ret;
+            }
+            compiler = std::make_unique<spirv_cross::CompilerHLSL>(spirvIr, spirvSize);
+            break;
+
+        case ShadingLanguage::Glsl:
+        case ShadingLanguage::Essl:
+            compiler = std::make_unique<spirv_cross::CompilerGLSL>(spirvIr, spirvSize);
+            combinedImageSamplers = true;
+            buildDummySampler = true;
+
+            for (const uint32_t id : relaxedIds)
+            {
+                compiler->set_decoration(id, spv::DecorationRelaxedPrecision);
+            }
+
+            // Legacy GLSL fixups
+            if (intVersion <= 300)
+            {
+                auto vars = compiler->get_active_interface_variables();
+                for (auto& var : vars)
+                {
+                    auto varClass = compiler->get_storage_class(var);
+
+                    // Make VS out and PS in variable names match
+                    if ((source.stage == ShaderStage::VertexShader) && (varClass == spv::StorageClass::StorageClassOutput))
+                    {
+                        auto name = compiler->get_name(var);
+                        if ((name.find("out_var_") == 0) || (name.find("out.var.") == 0))
+                        {
+                            name.replace(0, 8, "varying_");
+                            compiler->set_name(var, name);
+                        }
+                    }
+                    else if ((source.stage == ShaderStage::PixelShader) && (varClass == spv::StorageClass::StorageClassInput))
+                    {
+                        auto name = compiler->get_name(var);
+                        if ((name.find("in_var_") == 0) || (name.find("in.var.") == 0))
+                        {
+                            name.replace(0, 7, "varying_");
+                            compiler->set_name(var, name);
+                        }
+                    }
+                }
+            }
+            break;
+
+        case ShadingLanguage::Msl_macOS:
+        case ShadingLanguage::Msl_iOS:
+            if (source.stage == ShaderStage::GeometryShader)
+            {
+                AppendError(ret, "MSL doesn't have GS.");
+                return ret;
+            }
+            compiler = std::make_unique<spirv_cross::CompilerMSL>(spirvIr, spirvSize);
+            break;
+
+        default:
+            llvm_unreachable("Invalid target language.");
+        }
+
+        const spv::ExecutionModel model = SpirvExecutionModel(source.stage);
+        compiler->set_entry_point(source.entryPoint, model);
+
+        std::vector<MslArgument> mslArguments;
+        spirv_cross::CompilerGLSL::Options opts = compiler->get_common_options();
+        if (target.version != nullptr)
+        {
+            opts.version = intVersion;
+        }
+        opts.es = (target.language == ShadingLanguage::Essl);
+        opts.force_temporary = false;
+        opts.separate_shader_objects = true;
+        opts.flatten_multidimensional_arrays = false;
+        opts.enable_420pack_extension =
+            (target.language == ShadingLanguage::Glsl) && ((target.version == nullptr) || (opts.version >= 420));
+        opts.vulkan_semantics = false;
+        opts.vertex.fixup_clipspace = false;
+        opts.vertex.flip_vert_y = false;
+        opts.vertex.support_nonzero_base_instance = true;
+        if (target.language == ShadingLanguage::Essl)
+        {
+            const FloatPrecision precision = options.defaultFloatPrecision[static_cast<uint32_t>(source.stage)];
+            if (precision != FloatPrecision::Default)
+            {
+                if (source.stage == ShaderStage::PixelShader)
+                {
+                    opts.fragment.default_float_precision = EsslPrecision(precision);
+                }
+                else
+                {
+                    // SPIRV-Cross only declares the default precision of fragment shaders
+                    compiler->add_header_line(std::string("precision ") + EsslPrecisionName(precision) + " float;");
+                }
+            }
+        }
+        compiler->set_common_options(opts);
+
+        if (target.language == ShadingLanguage::Hlsl)
+        {
+            auto* hlslCompiler = static_cast<spirv_cross::CompilerHLSL*>(compiler.get());
+            auto hlslOpts = hlslCompiler->get_hlsl_options();
+            if (target.version != nullptr)
+            {
+                if (opts.version < 30)
+                {
+                    AppendError(ret, "HLSL shader model earlier than 3.0 is not supported.");
+                    return ret;
+                }
+                hlslOpts.shader_model = opts.version;
+            }
+
+            if (hlslOpts.shader_model <= 30)
+            {
+                combinedImageSamplers = true;
+                buildDummySampler = true;
+            }
+
+            hlslCompiler->set_hlsl_options(hlslOpts);
+        }
+        else if ((target.language == ShadingLanguage::Msl_macOS) || (target.language == ShadingLanguage::Msl_iOS))
+        {
+            auto* mslCompiler = static_cast<spirv_cross::CompilerMSL*>(compiler.get());
+            auto mslOpts = mslCompiler->get_msl_options();
+            if (target.version != nullptr)
+            {
+                mslOpts.msl_version = opts.version;
+            }
+            mslOpts.swizzle_texture_samples = false;
+            mslOpts.platform = (target.language == ShadingLanguage::Msl_iOS) ? spirv_cross::CompilerMSL::Options::iOS
+                                                                             : spirv_cross::CompilerMSL::Options::macOS;
+
+            if (options.mslArgumentBuffers)
+            {
+                if (mslOpts.msl_version < spirv_cross::CompilerMSL::Options::make_msl_version(2))
+                {
+                    AppendError(ret, "MSL argument buffers need MSL 2.0 or later.");
+                    return ret;
+                }
+                mslOpts.argument_buffers = true;
+            }
+
+            mslCompiler->set_msl_options(mslOpts);
+
+            if (options.mslArgumentBuffers)
+            {
+                if (!AssignMslArguments(*mslCompiler, model, mslArguments))
+                {
+                    AppendError(ret, "MSL argument buffers can't hold two buffers or two textures on the same binding. "
+                                     "Separate the register types with the shiftAll*Bindings options.");
+                    return ret;
+                }
+            }
+            else if (!options.denseBindings)
+            {
+                const auto& resources = mslCompiler->get_shader_resources();
+
+                uint32_t textureBinding = 0;
+                for (const auto& image : resources.separate_images)
+                {
+                    mslCompiler->set_decoration(image.id, spv::DecorationBinding, textureBinding);
+                    ++textureBinding;
+                }
+
+                uint32_t samplerBinding = 0;
+                for (const auto& sampler : resources.separate_samplers)
+                {
+                    mslCompiler->set_decoration(sampler.id, spv::DecorationBinding, samplerBinding);
+                    ++samplerBinding;
+                }
+            }
+        }
+
+        std::vector<BindingRemap> bindings;
+        if (options.denseBindings)
+        {
+            compiler->set_enabled_interface_variables(compiler->get_active_interface_variables());
+
+            // The IDs in MSL argument buffers are dense already
+            if (mslArguments.empty())
+            {
+                RemapDenseBindings(*compiler, target.language, model, bindings);
+            }
+        }
+
+        // Gather before the combined image samplers are built, so the reflection has the HLSL textures and samplers
+        Compiler::ReflectionResultDesc reflection;
+        ShaderReflection(reflection, *compiler, options.compactReflectionOnly, mslArguments, bindings);
+
+        if (options.minifyOutput)
+        {
+            // The resources, stage variables and spec constants keep their names, the reflection refers to them by name
+            std::vector<uint32_t> localIds;
+            std::unordered_set<std::string> names;
+            LocalIdCollector::Collect(spirvIr, spirvSize, localIds, names);
+
+            uint32_t index = 0;
+            for (const uint32_t id : localIds)
+            {
+                std::string name;
+                do
+                {
+                    name = ShortName(index);
+                    ++index;
+                } while (names.find(name) != names.end());
+                compiler->set_name(id, name);
+            }
+        }
+
+        if (buildDummySampler)
+        {
+            const uint32_t sampler = compiler->build_dummy_sampler_for_combined_images();
+            if (sampler != 0)
+            {
+                compiler->set_decoration(sampler, spv::DecorationDescriptorSet, 0);
+                compiler->set_decoration(sampler, spv::DecorationBinding, 0);
+            }
+        }
+
+        if (combinedImageSamplers)
+        {
+            compiler->build_combined_image_samplers();
+
+            if (options.inheritCombinedSamplerBindings)
+            {
+                spirv_cross_util::inherit_combined_sampler_bindings(*compiler);
+            }
+
+            for (auto& remap : compiler->get_combined_image_samplers())
+            {
+                if (options.minifyOutput)
+                {
+                    compiler->set_name(remap.combined_id, compiler->get_name(remap.image_id) + "_" + compiler->get_name(remap.sampler_id));
+                }
+                else
+                {
+                    compiler->set_name(remap.combined_id,
+                                       "SPIRV_Cross_Combined" + compiler->get_name(remap.image_id) + compiler->get_name(remap.sampler_id));
+                }
+            }
+        }
+
+        if (target.language == ShadingLanguage::Hlsl)
+        {
+            auto* hlslCompiler = static_cast<spirv_cross::CompilerHLSL*>(compiler.get());
+            const uint32_t newBuiltin = hlslCompiler->remap_num_workgroups_builtin();
+            if (newBuiltin)
+            {
+                compiler->set_decoration(newBuiltin, spv::DecorationDescriptorSet, 0);
+                compiler->set_decoration(newBuiltin, spv::DecorationBinding, 0);
+            }
+        }
+
+        std::string targetStr = compiler->compile();
+        if (options.minifyOutput)
+        {
+            targetStr = MinifyText(targetStr);
+        }
+        ret.target.Reset(targetStr.data(), static_cast<uint32_t>(targetStr.size()));
+        ret.hasError = false;
+        ret.reflection = std::move(reflection);
+
+        return ret;
+    }
+
+    Compiler::ResultDesc ConvertBinary(const Compiler::ResultDesc& binaryResult, const Compiler::SourceDesc& source,
+                                       const Compiler::Options& options, const Compiler::TargetDesc& target)
+    {
+        if (!binaryResult.hasError)
+        {
+            if (target.asModule)
+            {
+                return binaryResult;
+            }
+            else
+            {
+                // SPIRV-Cross throws from the moment it parses the module: SPIR-V from Compiler::CrossCompile can be malformed or
+                // lack the entry point. Those fail like any other compile error.
+                try
+                {
+                    switch (target.language)
+                    {
+                    case ShadingLanguage::Dxil:
+                        return binaryResult;
+
+                    case ShadingLanguage::SpirV:
+                    {
+                        Compiler::ResultDesc ret = binaryResult;
+                        std::vector<BindingRemap> bindings;
+                        if (options.denseBindings)
+                        {
+                            ret.target = RemapSpirvBindings(binaryResult.target, bindings);
+                        }
+                        spirv_cross::Compiler compiler(reinterpret_cast<const uint32_t*>(ret.target.Data()),
+                                                       ret.target.Size() / sizeof(uint32_t));
+                        compiler.set_entry_point(source.entryPoint, SpirvExecutionModel(source.stage));
+                        ShaderReflection(ret.reflection, compiler, options.compactReflectionOnly, {}, bindings);
+                        return ret;
+                    }
+
+                    case ShadingLanguage::Hlsl:
+                    case ShadingLanguage::Glsl:
+                    case ShadingLanguage::Essl:
+                    case ShadingLanguage::Msl_macOS:
+                    case ShadingLanguage::Msl_iOS:
+                        return CrossCompile(binaryResult, source, options, target);
+
+                    default:
+                        llvm_unreachable("Invalid shading language.");
+                        break;
+                    }
+                }
+                catch (spirv_cross::CompilerError& error)
+                {
+                    Compiler::ResultDesc ret = binaryResult;
+                    ret.target.Reset();
+                    ret.isText = (target.language != ShadingLanguage::SpirV);
+                    ret.reflection = Compiler::ReflectionResultDesc{};
+                    const char* errorMsg = error.what();
+                    ret.errorWarningMsg.Reset(errorMsg, static_cast<uint32_t>(std::strlen(errorMsg)));
+                    ret.hasError = true;
+                    return ret;
+                }
+            }
+        }
+        else
+        {
+            return binaryResult;
+        }
+    }
+
+#ifdef _WIN32
+    using SocketHandle = SOCKET;
+    const SocketHandle InvalidSocket = INVALID_SOCKET;
+    const int SocketSendFlags = 0;
+
+    void CloseSocket(SocketHandle socket)
+    {
+        ::closesocket(socket);
+    }
+
+    int PollSockets(pollfd* fds, uint32_t numFds, int timeoutMs)
+    {
+        return ::WSAPoll(fds, numFds, timeoutMs);
+    }
+
+    void StartSockets()
+    {
+        static const bool started = [] {
+            WSADATA data;
+            return ::WSAStartup(MAKEWORD(2, 2), &data) == 0;
+        }();
+        if (!started)
+        {
+            throw std::runtime_error("COULDN'T start Winsock.");
+        }
+    }
+
+    // Sends and receives that take longer than timeoutMs fail
+    void SetSocketTimeout(SocketHandle socket, uint32_t timeoutMs)
+    {
+        const DWORD timeout = timeoutMs;
+        ::setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+        ::setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+    }
+
+    bool SetSocketBlocking(SocketHandle socket, bool blocking)
+    {
+        u_long nonBlocking = blocking ? 0 : 1;
+        return ::ioctlsocket(socket, FIONBIO, &nonBlocking) == 0;
+    }
+
+    bool ConnectInProgress()
+    {
+        return ::WSAGetLastError() == WSAEWOULDBLOCK;
+    }
+
+    void ShutdownSocket(SocketHandle socket)
+    {
+        ::shutdown(socket, SD_BOTH);
+    }
+#else
+    using SocketHandle = int;
+    const SocketHandle InvalidSocket = -1;
+#ifdef MSG_NOSIGNAL
+    const int SocketSendFlags = MSG_NOSIGNAL;
+#else
+    const int SocketSendFlags = 0;
+#endif
+
+    void CloseSocket(SocketHandle socket)
+    {
+        ::close(socket);
+    }
+
+    int PollSockets(pollfd* fds, uint32_t numFds, int timeoutMs)
+    {
+        return ::poll(fds, numFds, timeoutMs);
+    }
+
+    void StartSockets()
+    {
+    }
+
+    // Sends and receives that take longer than timeoutMs fail
+    void SetSocketTimeout(SocketHandle socket, uint32_t timeoutMs)
+    {
+        timeval timeout;
+        timeout.tv_sec = static_cast<time_t>(timeoutMs / 1000);
+        timeout.tv_usec = static_cast<suseconds_t>((timeoutMs % 1000) * 1000);
+        ::setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        ::setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+
+    bool SetSocketBlocking(SocketHandle socket, bool blocking)
+    {
+        const int flags = ::fcntl(socket, F_GETFL);
+        return (flags != -1) && (::fcntl(socket, F_SETFL, blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK)) != -1);
+    }
+
+    bool ConnectInProgress()
+    {
+        return errno == EINPROGRESS;
+    }
+
+    void ShutdownSocket(SocketHandle socket)
+    {
+        ::shutdown(socket, SHUT_RDWR);
+    }
+#endif
+
+    // Where MSG_NOSIGNAL is missing, a peer that went away would otherwise raise SIGPIPE
+    void DisableSigPipe(SocketHandle socket)
+    {
+#ifdef SO_NOSIGPIPE
+        const int noSigPipe = 1;
+        ::setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+#else
+        SC_UNUSED(socket);
+#endif
+    }
+
+    // Gives up after timeoutMs instead of waiting for the system's connect timeout, which can be minutes
+    bool ConnectSocket(SocketHandle socket, const sockaddr* address, socklen_t addressSize, uint32_t timeoutMs)
+    {
+        if (!SetSocketBlocking(socket, false))
+        {
+            return false;
+        }
+        bool connected = (::connect(socket, address, addressSize) == 0);
+        if (!connected && ConnectInProgress())
+        {
+            pollfd pollFd = {socket, POLLOUT, 0};
+            if (PollSockets(&pollFd, 1, static_cast<int>(timeoutMs)) == 1)
+            {
+                int error = 0;
+                socklen_t errorSize = sizeof(error);
+                connected =
+                    (::getsockopt(socket, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &errorSize) == 0) && (error == 0);
+            }
+        }
+        return connected && SetSocketBlocking(socket, true);
+    }
+
+    bool SendAll(SocketHandle socket, const void* data, size_t size)
+    {
+        const char* bytes = reinterpret_cast<const char*>(data);
+        while (size > 0)
+        {
+            const int sent = static_cast<int>(::send(socket, bytes, static_cast<int>(std::min<size_t>(size, 1 << 30)), SocketSendFlags));
+            if (sent <= 0)
+            {
+                return false;
+            }
+            bytes += sent;
+            size -= static_cast<size_t>(sent);
+        }
+        return true;
+    }
+
+    void FillTimedOutResults(Compiler::ResultDesc* results, uint32_t numTargets, CompileStage stage)
+    {
+        const std::string msg = std::string("Compile timed out in ") + CompileStageName(stage) + ".";
+        for (uint32_t i = 0; i < numTargets; ++i)
+        {
+            results[i] = Compiler::ResultDesc{};
+            results[i].isText = false;
+            results[i].errorWarningMsg.Reset(msg.data(), static_cast<uint32_t>(msg.size()));
+            results[i].hasError = true;
+            results[i].timedOut = true;
+            results[i].timeoutStage = stage;
+        }
+    }
+
+#ifdef _WIN32
+    // There is no fork, and a thread can't be stopped safely. Abandoning one would leave it using the caller's allocator and include
+    // callback after Compile returns, so the compile always runs to its end on the calling thread. If it ends after the deadline,
+    // the results are dropped and reported as timed out in the stage that was running at the deadline.
+    void CompileWithDeadline(const Compiler::SourceDesc& source, const Compiler::Options& options, const Compiler::TargetDesc* targets,
+                             uint32_t numTargets, Compiler::ResultDesc* results)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(options.timeoutMs);
+
+        CompileStage stage = CompileStage::Dxc;
+        bool missed = false;
+        CompileStage missedStage = CompileStage::Dxc;
+        auto checkDeadline = [&] {
+            if (!missed && (std::chrono::steady_clock::now() >= deadline))
+            {
+                missed = true;
+                missedStage = stage;
+            }
+        };
+
+        const std::function<void(CompileStage stage)> outerObserver = stageObserver;
+        stageObserver = [&](CompileStage nextStage) {
+            checkDeadline();
+            stage = nextStage;
+            if (outerObserver)
+            {
+                outerObserver(nextStage);
+            }
+        };
+
+        Compiler::Options innerOptions = options;
+        innerOptions.timeoutMs = 0;
+        try
+        {
+            Compiler::Compile(source, innerOptions, targets, numTargets, results);
+        }
+        catch (...)
+        {
+            stageObserver = outerObserver;
+            throw;
+        }
+        stageObserver = outerObserver;
+
+        checkDeadline();
+        if (missed)
+        {
+            FillTimedOutResults(results, numTargets, missedStage);
+        }
+    }
+#else
+    // Neither end is inherited through exec
+    bool CreateSocketPair(int sockets[2])
+    {
+#ifdef SOCK_CLOEXEC
+        if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) != 0)
+        {
+            return false;
+        }
+#else
+        if (::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0)
+        {
+            return false;
+        }
+        ::fcntl(sockets[0], F_SETFD, FD_CLOEXEC);
+        ::fcntl(sockets[1], F_SETFD, FD_CLOEXEC);
+#endif
+        DisableSigPipe(sockets[0]);
+        DisableSigPipe(sockets[1]);
+        return true;
+    }
+
+    bool ReceiveAll(int socket, void* data, size_t size)
+    {
+        uint8_t* bytes = reinterpret_cast<uint8_t*>(data);
+        while (size > 0)
+        {
+            const ssize_t received = ::recv(socket, bytes, size, 0);
+            if (received <= 0)
+            {
+                if ((received < 0) && (errno == EINTR))
+                {
+                    continue;
+                }
+                return false;
+            }
+            bytes += received;
+            size -= static_cast<size_t>(received);
+        }
+        return true;
+    }
+
+    // Forks processes on request. The server itself is forked once, at a point where this process has no other threads, and it
+    // never starts one. So the processes it forks don't inherit locks that were held by other threads of this process, such as
+    // the ones inside dxcompiler, which a process forked straight from a busy thread pool could deadlock on.
+    class ForkServer
+    {
+    public:
+        // childMain runs in each forked process, with the argument given to Fork and the process's end of a socket pair
+        explicit ForkServer(std::function<void(uint32_t arg, int socket)> childMain)
+        {
+            int sockets[2];
+            if (!CreateSocketPair(sockets))
+            {
+                throw std::runtime_error("COULDN'T create the socket to the fork server.");
+            }
+
+            m_pid = ::fork();
+            if (m_pid < 0)
+            {
+                ::close(sockets[0]);
+                ::close(sockets[1]);
+                throw std::runtime_error("COULDN'T fork the fork server.");
+            }
+
+            if (m_pid == 0)
+            {
+                ::close(sockets[0]);
+                ServerMain(childMain, sockets[1]);
+            }
+
+            ::close(sockets[1]);
+            m_socket = sockets[0];
+        }
+
+        ~ForkServer() noexcept
+        {
+            // The server waits for the processes it forked, and exits
+            ::close(m_socket);
+            int status;
+            while ((::waitpid(m_pid, &status, 0) < 0) && (errno == EINTR))
+            {
+            }
+        }
+
+        ForkServer(const ForkServer& other) = delete;
+        ForkServer& operator=(const ForkServer& other) = delete;
+
+        // Returns the pid of the new process, and puts this process's end of the socket pair in socket
+        pid_t Fork(uint32_t arg, int& socket)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            const uint32_t request[] = {RequestFork, arg};
+            if (!SendAll(m_socket, request, sizeof(request)))
+            {
+                throw std::runtime_error("COULDN'T reach the fork server.");
+            }
+
+            int32_t pid = -1;
+            char control[CMSG_SPACE(sizeof(int))];
+            iovec iov = {&pid, sizeof(pid)};
+            msghdr msg{};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+#ifdef MSG_CMSG_CLOEXEC
+            const int receiveFlags = MSG_CMSG_CLOEXEC;
+#else
+            const int receiveFlags = 0;
+#endif
+            ssize_t received;
+            while (((received = ::recvmsg(m_socket, &msg, receiveFlags)) < 0) && (errno == EINTR))
+            {
+            }
+            const cmsghdr* cmsg = (received == sizeof(pid)) ? CMSG_FIRSTHDR(&msg) : nullptr;
+            if ((pid <= 0) || (cmsg == nullptr) || (cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS))
+            {
+                throw std::runtime_error("COULDN'T fork a process in the fork server.");
+            }
+            std::memcpy(&socket, CMSG_DATA(cmsg), sizeof(socket));
+#ifndef MSG_CMSG_CLOEXEC
+            ::fcntl(socket, F_SETFD, FD_CLOEXEC);
+#endif
+            return pid;
+        }
+
+        // Waits for a forked process that exited or was killed. It can be killed until then, since its pid isn't reused before.
+        void Reap(pid_t pid) noexcept
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            const uint32_t request[] = {RequestReap, static_cast<uint32_t>(pid)};
+            int32_t done;
+            if (SendAll(m_socket, request, sizeof(request)))
+            {
+                ReceiveAll(m_socket, &done, sizeof(done));
+            }
+        }
+
+    private:
+        enum Request : uint32_t
+        {
+            RequestFork = 0,
+            RequestReap,
+        };
+
+        [[noreturn]] static void ServerMain(const std::function<void(uint32_t arg, int socket)>& childMain, int socket)
+        {
+            // The owner's SIGCHLD handling could reap the processes before Reap asks for them
+            ::signal(SIGCHLD, SIG_DFL);
+
+            uint32_t request[2];
+            while (ReceiveAll(socket, request, sizeof(request)))
+            {
+                if (request[0] == RequestFork)
+                {
+                    int32_t pid = -1;
+                    int sockets[2];
+                    if (CreateSocketPair(sockets))
+                    {
+                        pid = ::fork();
+                        if (pid == 0)
+                        {
+                            ::close(socket);
+                            ::close(sockets[0]);
+                            childMain(request[1], sockets[1]);
+
+                            // The atexit handlers and static objects belong to the owner
+                            ::_exit(0);
+                        }
+                        ::close(sockets[1]);
+                        if (pid < 0)
+                        {
+                            ::close(sockets[0]);
+                        }
+                    }
+
+                    char control[CMSG_SPACE(sizeof(int))]{};
+                    iovec iov = {&pid, sizeof(pid)};
+                    msghdr msg{};
+                    msg.msg_iov = &iov;
+                    msg.msg_iovlen = 1;
+                    if (pid > 0)
+                    {
+                        msg.msg_control = control;
+                        msg.msg_controllen = sizeof(control);
+                        cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+                        cmsg->cmsg_level = SOL_SOCKET;
+                        cmsg->cmsg_type = SCM_RIGHTS;
+                        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+                        std::memcpy(CMSG_DATA(cmsg), &sockets[0], sizeof(int));
+                    }
+                    while ((::sendmsg(socket, &msg, SocketSendFlags) < 0) && (errno == EINTR))
+                    {
+                    }
+                    if (pid > 0)
+                    {
+                        ::close(sockets[0]);
+                    }
+                }
+                else
+                {
+                    int status;
+                    while ((::waitpid(static_cast<pid_t>(request[1]), &status, 0) < 0) && (errno == EINTR))
+                    {
+                    }
+                    const int32_t done = 0;
+                    SendAll(socket, &done, sizeof(done));
+                }
+            }
+
+            // The owner is gone. The processes left exit when their sockets close.
+            int status;
+            while ((::wait(&status) > 0) || (errno == EINTR))
+            {
+            }
+            ::_exit(0);
+        }
+
+    private:
+        pid_t m_pid;
+        int m_socket;
+        std::mutex m_mutex;
+    };
+
+    // Compile jobs run in worker processes, so a crash in DXC or SPIRV-Cross, or a deadline, only takes down one worker, which
+    // is then replaced. Workers are forked by a ForkServer started from a warmed-up dxcompiler. A job and its results travel
+    // through memory shared with the worker, and includes are loaded by the thread running the job.
+    class WorkerProcessPool
+    {
+    public:
+        // 0 workers means one per hardware thread. Without spawnNow, each worker is forked when a job first needs it.
+        WorkerProcessPool(uint32_t numWorkers, uint32_t sharedMemorySize, bool spawnNow) : m_sharedMemorySize(sharedMemorySize)
+        {
+            if (numWorkers == 0)
+            {
+                numWorkers = std::max(std::thread::hardware_concurrency(), 1U);
+            }
+            if (m_sharedMemorySize <= sizeof(ChannelHeader))
+            {
+                throw std::runtime_error("The shared memory of a compile worker is too small.");
+            }
+
+            // Workers start with dxcompiler loaded and its lazily built tables ready
+            Compiler::Initialize(true);
+
+            m_workers.resize(numWorkers);
+            std::vector<ChannelHeader*> channels;
+            for (uint32_t i = 0; i < numWorkers; ++i)
+            {
+                void* shared = ::mmap(nullptr, m_sharedMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+                if (shared == MAP_FAILED)
+                {
+                    this->Shutdown();
+                    throw std::runtime_error("COULDN'T map the shared memory of a compile worker.");
+                }
+                m_workers[i].index = i;
+                m_workers[i].channel = reinterpret_cast<ChannelHeader*>(shared);
+                channels.push_back(m_workers[i].channel);
+            }
+            try
+            {
+                // Forked after the shared memory is mapped, so every worker it forks has its channel
+                m_forkServer.reset(new ForkServer([channels, sharedMemorySize](uint32_t index, int socket) {
+                    WorkerMain(channels[index], sharedMemorySize, socket);
+                }));
+                if (spawnNow)
+                {
+                    for (auto& worker : m_workers)
+                    {
+                        this->Spawn(worker);
+                    }
+                }
+            }
+            catch (...)
+            {
+                this->Shutdown();
+                throw;
+            }
+        }
+
+        ~WorkerProcessPool() noexcept
+        {
+            this->Shutdown();
+        }
+
+        WorkerProcessPool(const WorkerProcessPool& other) = delete;
+        WorkerProcessPool& operator=(const WorkerProcessPool& other) = delete;
+
+        // Can be called from several threads, each job takes an idle worker or waits for one
+        void RunJob(const CompileScheduler::Job& job)
+        {
+            Worker& worker = this->AcquireWorker();
+            try
+            {
+                this->RunJob(worker, job);
+            }
+            catch (...)
+            {
+                this->ReleaseWorker(worker);
+                throw;
+            }
+            this->ReleaseWorker(worker);
+        }
+
+        uint32_t NumWorkers() const
+        {
+            return static_cast<uint32_t>(m_workers.size());
+        }
+
+        uint32_t NumRestarts() const
+        {
+            return m_numRestarts;
+        }
+
+    private:
+        enum WorkerMessage : uint32_t
+        {
+            WorkerMessageCompile = 0, // To the worker: a job
+            WorkerMessageInclude,     // To the parent: an include name
+            WorkerMessageIncludeData, // To the worker: the include's content
+            WorkerMessageIncludeFailed,
+            WorkerMessageResults, // To the parent: the serialized results
+            WorkerMessageError,   // To the parent: the message of an exception
+            WorkerMessageQuit,
+        };
+
+        // At the start of the shared memory, followed by size bytes of payload
+        struct ChannelHeader
+        {
+            std::atomic<uint32_t> stage;
+            uint32_t type;
+            uint32_t size;
+            uint32_t padding;
+        };
+        static_assert(std::is_trivially_copyable<Compiler::Options>::value, "Options are copied into the shared memory as bytes.");
+
+        struct Worker
+        {
+            uint32_t index = 0;
+            pid_t pid = -1;
+            int socket = -1; // Carries one byte per message. The message itself is in the shared memory.
+            ChannelHeader* channel = nullptr;
+            bool busy = false;
+        };
+
+        // Appends to the payload of a channel, and remembers if it ran out of room
+        class ChannelWriter
+        {
+        public:
+            ChannelWriter(ChannelHeader* channel, uint32_t capacity)
+                : m_data(reinterpret_cast<uint8_t*>(channel + 1)), m_capacity(capacity - sizeof(ChannelHeader))
+            {
+            }
+
+            void Write(const void* data, uint32_t size)
+            {
+                if (m_overflow || (m_capacity - m_size < size))
+                {
+                    m_overflow = true;
+                    return;
+                }
+                std::memcpy(m_data + m_size, data, size);
+                m_size += size;
+            }
+
+            void Write(uint32_t value)
+            {
+                this->Write(&value, sizeof(value));
+            }
+
+            // Null is kept apart from empty
+            void WriteString(const char* str)
+            {
+                if (str == nullptr)
+                {
+                    this->Write(0U);
+                }
+                else
+                {
+                    const uint32_t length = static_cast<uint32_t>(std::strlen(str));
+                    this->Write(length + 1);
+                    this->Write(str, length);
+                }
+            }
+
+            uint32_t Size() const
+            {
+                return m_size;
+            }
+
+            bool Overflow() const
+            {
+                return m_overflow;
+            }
+
+        private:
+            uint8_t* m_data;
+            uint32_t m_capacity;
+            uint32_t m_size = 0;
+            bool m_overflow = false;
+        };
+
+        class ChannelReader
+        {
+        public:
+            explicit ChannelReader(const ChannelHeader* channel)
+                : m_data(reinterpret_cast<const uint8_t*>(channel + 1)), m_size(channel->size)
+            {
+            }
+
+            // Reads past the message are zeroed and flagged
+            void Read(void* data, uint32_t size)
+            {
+                if (!this->Fits(size))
+                {
+                    std::memset(data, 0, size);
+                    return;
+                }
+                std::memcpy(data, m_data + m_offset, size);
+                m_offset += size;
+            }
+
+            uint32_t ReadUInt32()
+            {
+                uint32_t value;
+                this->Read(&value, sizeof(value));
+                return value;
+            }
+
+            // Null if the message is shorter than size
+            const uint8_t* Skip(uint32_t size)
+            {
+                if (!this->Fits(size))
+                {
+                    return nullptr;
+                }
+                const uint8_t* ret = m_data + m_offset;
+                m_offset += size;
+                return ret;
+            }
+
+            // Returns false for null
+            bool ReadString(std::string& str)
+            {
+                const uint32_t length = this->ReadUInt32();
+                if (length == 0)
+                {
+                    str.clear();
+                    return false;
+                }
+                const uint8_t* chars = this->Skip(length - 1);
+                if (chars == nullptr)
+                {
+                    str.clear();
+                    return false;
+                }
+                str.assign(reinterpret_cast<const char*>(chars), length - 1);
+                return true;
+            }
+
+            bool Overflow() const
+            {
+                return m_overflow;
+            }
+
+        private:
+            bool Fits(uint32_t size)
+            {
+                if (m_overflow || (m_size - m_offset < size))
+                {
+                    m_overflow = true;
+                }
+                return !m_overflow;
+            }
+
+        private:
+            const uint8_t* m_data;
+            uint32_t m_size;
+            uint32_t m_offset = 0;
+            bool m_overflow = false;
+        };
+
+    private:
+        static bool Signal(int socket)
+        {
+            const uint8_t doorbell = 0;
+            for (;;)
+            {
+                const ssize_t ret = ::send(socket, &doorbell, sizeof(doorbell), SocketSendFlags);
+                if (ret == sizeof(doorbell))
+                {
+                    return true;
+                }
+                if ((ret < 0) && (errno == EINTR))
+                {
+                    continue;
+                }
+                return false;
+            }
+        }
+
+        // 0 for signaled, 1 for timed out, -1 for the other side is gone. A negative timeout waits forever.
+        static int WaitSignal(int socket, int timeoutMs)
+        {
+            for (;;)
+            {
+                pollfd pollFd = {socket, POLLIN, 0};
+                const int pollRet = ::poll(&pollFd, 1, timeoutMs);
+                if (pollRet == 0)
+                {
+                    return 1;
+                }
+                if (pollRet < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    return -1;
+                }
+
+                uint8_t doorbell;
+                const ssize_t ret = ::recv(socket, &doorbell, sizeof(doorbell), 0);
+                if (ret == sizeof(doorbell))
+                {
+                    return 0;
+                }
+                if ((ret < 0) && (errno == EINTR))
+                {
+                    continue;
+                }
+                return -1;
+            }
+        }
+
+        Worker& AcquireWorker()
+        {
+            std::unique_lock<std::mutex> lock(m_workersMutex);
+            for (;;)
+            {
+                for (auto& worker : m_workers)
+                {
+                    if (!worker.busy)
+                    {
+                        worker.busy = true;
+                        return worker;
+                    }
+                }
+                m_workerReleased.wait(lock);
+            }
+        }
+
+        void ReleaseWorker(Worker& worker)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_workersMutex);
+                worker.busy = false;
+            }
+            m_workerReleased.notify_one();
+        }
+
+        void Spawn(Worker& worker)
+        {
+            worker.pid = m_forkServer->Fork(worker.index, worker.socket);
+        }
+
+        // Reaps a worker that crashed or was killed, and forks its replacement
+        void Restart(Worker& worker)
+        {
+            this->Reap(worker);
+            ++m_numRestarts;
+            this->Spawn(worker);
+        }
+
+        void Reap(Worker& worker)
+        {
+            if (worker.socket >= 0)
+            {
+                ::close(worker.socket);
+                worker.socket = -1;
+            }
+            if (worker.pid > 0)
+            {
+                m_forkServer->Reap(worker.pid);
+                worker.pid = -1;
+            }
+        }
+
+        void Shutdown()
+        {
+            for (auto& worker : m_workers)
+            {
+                if ((worker.pid > 0) && (worker.socket >= 0))
+                {
+                    worker.channel->type = WorkerMessageQuit;
+                    worker.channel->size = 0;
+                    if (!Signal(worker.socket))
+                    {
+                        ::kill(worker.pid, SIGKILL);
+                    }
+                }
+            }
+            for (auto& worker : m_workers)
+            {
+                this->Reap(worker);
+                if (worker.channel != nullptr)
+                {
+                    ::munmap(worker.channel, m_sharedMemorySize);
+                    worker.channel = nullptr;
+                }
+            }
+            m_forkServer.reset();
+        }
+
+        void RunJob(Worker& worker, const CompileScheduler::Job& job)
+        {
+            if (worker.pid < 0)
+            {
+                this->Spawn(worker);
+            }
+
+            ChannelHeader* channel = worker.channel;
+            {
+                ChannelWriter writer(channel, m_sharedMemorySize);
+                Compiler::Options options = job.options;
+                options.allocator = nullptr;
+                options.timeoutMs = 0;
+                writer.Write(&options, sizeof(options));
+                writer.WriteString(job.source.source);
+                writer.WriteString(job.source.fileName);
+                writer.WriteString(job.source.entryPoint);
+                writer.Write(static_cast<uint32_t>(job.source.stage));
+                writer.Write(job.source.numDefines);
+                for (uint32_t i = 0; i < job.source.numDefines; ++i)
+                {
+                    writer.WriteString(job.source.defines[i].name);
+                    writer.WriteString(job.source.defines[i].value);
+                    writer.Write(static_cast<uint32_t>(job.source.defines[i].specConstant));
+                }
+                writer.Write(job.numTargets);
+                for (uint32_t i = 0; i < job.numTargets; ++i)
+                {
+                    writer.Write(static_cast<uint32_t>(job.targets[i].language));
+                    writer.WriteString(job.targets[i].version);
+                    writer.Write(job.targets[i].asModule ? 1U : 0U);
+                }
+                if (writer.Overflow())
+                {
+                    throw std::runtime_error("The compile job doesn't fit in the shared memory of a compile worker.");
+                }
+
+                channel->stage = static_cast<uint32_t>(CompileStage::Dxc);
+                channel->type = WorkerMessageCompile;
+                channel->size = writer.Size();
+            }
+
+            const bool hasDeadline = job.options.timeoutMs > 0;
+            const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(job.options.timeoutMs);
+
+            bool sent = Signal(worker.socket);
+            if (!sent)
+            {
+                // Died while idle
+                this->Restart(worker);
+                sent = Signal(worker.socket);
+            }
+
+            int waitRet = sent ? 0 : -1;
+            while (waitRet == 0)
+            {
+                int timeoutMs = -1;
+                if (hasDeadline)
+                {
+                    const auto remaining =
+                        std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+                    timeoutMs = static_cast<int>(std::max<int64_t>(remaining.count(), 0));
+                }
+                waitRet = WaitSignal(worker.socket, timeoutMs);
+                if (waitRet != 0)
+                {
+                    break;
+                }
+
+                switch (channel->type)
+                {
+                case WorkerMessageInclude:
+                {
+                    std::string includeName;
+                    ChannelReader(channel).ReadString(includeName);
+                    this->ServeInclude(worker, job, includeName.c_str());
+                    waitRet = Signal(worker.socket) ? 0 : -1;
+                    break;
+                }
+
+                case WorkerMessageResults:
+                {
+                    if (this->ReadResults(channel, job))
+                    {
+                        return;
+                    }
+                    waitRet = -2;
+                    break;
+                }
+
+                case WorkerMessageError:
+                    throw std::runtime_error(std::string(reinterpret_cast<const char*>(channel + 1), channel->size));
+
+                default:
+                    // A worker that scribbles over its channel can't be trusted with the next job either
+                    waitRet = -2;
+                    break;
+                }
+            }
+
+            const CompileStage stage = static_cast<CompileStage>(channel->stage.load());
+            if (waitRet > 0)
+            {
+                ::kill(worker.pid, SIGKILL);
+                FillTimedOutResults(job.results, job.numTargets, stage);
+            }
+            else
+            {
+                if (waitRet == -2)
+                {
+                    ::kill(worker.pid, SIGKILL);
+                }
+                const std::string msg = (waitRet == -2) ? std::string("The compile worker sent malformed results.")
+                                                        : std::string("The compile worker crashed in ") + CompileStageName(stage) + ".";
+                for (uint32_t i = 0; i < job.numTargets; ++i)
+                {
+                    job.results[i] = Compiler::ResultDesc{};
+                    job.results[i].errorWarningMsg.Reset(msg.data(), static_cast<uint32_t>(msg.size()));
+                    job.results[i].hasError = true;
+                }
+            }
+            this->Restart(worker);
+        }
+
+        // False if the message doesn't hold exactly one result per target
+        static bool ReadResults(const ChannelHeader* channel, const CompileScheduler::Job& job)
+        {
+            ChannelReader reader(channel);
+            const uint32_t numResults = reader.ReadUInt32();
+            if (reader.Overflow() || (numResults != job.numTargets))
+            {
+                return false;
+            }
+            for (uint32_t i = 0; i < numResults; ++i)
+            {
+                const uint32_t size = reader.ReadUInt32();
+                const uint8_t* data = reader.Skip(size);
+                if (data == nullptr)
+                {
+                    return false;
+                }
+                try
+                {
+                    job.results[i] = Compiler::DeserializeResult(data, size);
+                }
+                catch (const std::runtime_error&)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        void ServeInclude(Worker& worker, const CompileScheduler::Job& job, const char* includeName)
+        {
+            ChannelWriter writer(worker.channel, m_sharedMemorySize);
+            try
+            {
+                const Blob content = job.source.loadIncludeCallback ? job.source.loadIncludeCallback(includeName)
+                                                                    : DefaultLoadCallback(includeName);
+                writer.Write(content.Data(), content.Size());
+                if (writer.Overflow())
+                {
+                    throw std::runtime_error(std::string("Included file ") + includeName +
+                                             " doesn't fit in the shared memory of a compile worker.");
+                }
+                worker.channel->type = WorkerMessageIncludeData;
+                worker.channel->size = writer.Size();
+            }
+            catch (...)
+            {
+                worker.channel->type = WorkerMessageIncludeFailed;
+                worker.channel->size = 0;
+            }
+        }
+
+        [[noreturn]] static void WorkerMain(ChannelHeader* channel, uint32_t sharedMemorySize, int socket)
+        {
+            stageObserver = [channel](CompileStage stage) { channel->stage = static_cast<uint32_t>(stage); };
+
+            for (;;)
+            {
+                if ((WaitSignal(socket, -1) != 0) || (channel->type == WorkerMessageQuit))
+                {
+                    // The parent is gone or done with us
+                    ::_exit(0);
+                }
+                assert(channel->type == WorkerMessageCompile);
+
+                // Everything is copied out, because includes and results reuse the shared memory
+                ChannelReader reader(channel);
+                Compiler::Options options;
+                reader.Read(&options, sizeof(options));
+
+                std::string source;
+                std::string fileName;
+                std::string entryPoint;
+                reader.ReadString(source);
+                const bool hasFileName = reader.ReadString(fileName);
+                const bool hasEntryPoint = reader.ReadString(entryPoint);
+                const ShaderStage stage = static_cast<ShaderStage>(reader.ReadUInt32());
+
+                const uint32_t numDefines = reader.ReadUInt32();
+                std::vector<std::string> defineStrings(numDefines * 2);
+                std::vector<MacroDefine> defines(numDefines);
+                for (uint32_t i = 0; i < numDefines; ++i)
+                {
+                    reader.ReadString(defineStrings[i * 2]);
+                    defines[i].name = defineStrings[i * 2].c_str();
+                    defines[i].value = reader.ReadString(defineStrings[i * 2 + 1]) ? defineStrings[i * 2 + 1].c_str() : nullptr;
+                    defines[i].specConstant = reader.ReadUInt32() != 0;
+                }
+
+                const uint32_t numTargets = reader.ReadUInt32();
+                std::vector<std::string> versions(numTargets);
+                std::vector<Compiler::TargetDesc> targets(numTargets);
+                for (uint32_t i = 0; i < numTargets; ++i)
+                {
+                    targets[i].language = static_cast<ShadingLanguage>(reader.ReadUInt32());
+                    targets[i].version = reader.ReadString(versions[i]) ? versions[i].c_str() : nullptr;
+                    targets[i].asModule = reader.ReadUInt32() != 0;
+                }
+
+                Compiler::SourceDesc sourceDesc{};
+                sourceDesc.source = source.c_str();
+                sourceDesc.fileName = hasFileName ? fileName.c_str() : nullptr;
+                sourceDesc.entryPoint = hasEntryPoint ? entryPoint.c_str() : nullptr;
+                sourceDesc.stage = stage;
+                sourceDesc.defines = defines.data();
+                sourceDesc.numDefines = numDefines;
+                sourceDesc.loadIncludeCallback = [channel, sharedMemorySize, socket](const char* includeName) {
+                    ChannelWriter writer(channel, sharedMemorySize);
+                    writer.WriteString(includeName);
+                    channel->type = WorkerMessageInclude;
+                    channel->size = writer.Size();
+                    if (!Signal(socket) || (WaitSignal(socket, -1) != 0))
+                    {
+                        ::_exit(0);
+                    }
+                    if (channel->type != WorkerMessageIncludeData)
+                    {
+                        throw std::runtime_error(std::string("COULDN'T load included file ") + includeName + ".");
+                    }
+                    return Blob(channel + 1, channel->size);
+                };
+
+                ChannelWriter writer(channel, sharedMemorySize);
+                try
+                {
+                    std::vector<Compiler::ResultDesc> results(numTargets);
+                    Compiler::Compile(sourceDesc, options, targets.data(), numTargets, results.data());
+
+                    writer.Write(numTargets);
+                    for (const auto& result : results)
+                    {
+                        const Blob archive = Compiler::SerializeResult(result);
+                        writer.Write(archive.Size());
+                        writer.Write(archive.Data(), archive.Size());
+                    }
+                    if (writer.Overflow())
+                    {
+                        throw std::runtime_error("The compile results don't fit in the shared memory of a compile worker.");
+                    }
+                    channel->type = WorkerMessageResults;
+                }
+                catch (const std::exception& ex)
+                {
+                    writer = ChannelWriter(channel, sharedMemorySize);
+                    writer.Write(ex.what(), static_cast<uint32_t>(std::strlen(ex.what())));
+                    channel->type = WorkerMessageError;
+                }
+                channel->size = writer.Size();
+
+                if (!Signal(socket))
+                {
+                    ::_exit(0);
+                }
+            }
+        }
+
+    private:
+        const uint32_t m_sharedMemorySize;
+        std::vector<Worker> m_workers;
+        std::unique_ptr<ForkServer> m_forkServer;
+        std::mutex m_workersMutex;
+        std::condition_variable m_workerReleased;
+        std::atomic<uint32_t> m_numRestarts{0};
+    };
+
+    // Forked on the first compile with a deadline, unless Compiler::Initialize started it earlier
+    WorkerProcessPool& DeadlineWorkers()
+    {
+        static WorkerProcessPool workers(0, 64 * 1024 * 1024, false);
+        return workers;
+    }
+
+    // The compile runs in a worker process, which is killed at the deadline and replaced
+    void CompileWithDeadline(const Compiler::SourceDesc& source, const Compiler::Options& options, const Compiler::TargetDesc* targets,
+                             uint32_t numTargets, Compiler::ResultDesc* results)
+    {
+        DeadlineWorkers().RunJob({source, options, targets, numTargets, results});
+    }
+#endif
+
+    std::string DxcompilerVersion()
+    {
+        static const std::string version = [] {
+            CComPtr<IDxcVersionInfo> versionInfo;
+            UINT32 major = 0;
+            UINT32 minor = 0;
+            UINT32 flags = 0;
+            if (SUCCEEDED(Dxcompiler::Instance().Compiler()->QueryInterface(__uuidof(IDxcVersionInfo),
+                                                                             reinterpret_cast<void**>(&versionInfo))))
+            {
+                IFT(versionInfo->GetVersion(&major, &minor));
+                IFT(versionInfo->GetFlags(&flags));
+            }
+            return std::to_string(major) + "." + std::to_string(minor) + "." + std::to_string(flags);
+        }();
+        return version;
+    }
+
+    // #line markers name the files where this machine found them. Keeping only the file names lets checkouts in different directories
+    // share cache entries.
+    std::string StripLineMarkerPaths(const char* text, size_t size)
+    {
+        auto skipSpaces = [](const char* ptr, const char* end) {
+            while ((ptr < end) && ((*ptr == ' ') || (*ptr == '\t')))
+            {
+                ++ptr;
+            }
+            return ptr;
+        };
+
+        std::string ret;
+        ret.reserve(size);
+        const char* const end = text + size;
+        for (const char* line = text; line < end;)
+        {
+            const char* const lineEnd = std::find(line, end, '\n');
+
+            // #line 12 "path" or # 12 "path"
+            const char* ptr = skipSpaces(line, lineEnd);
+            bool marker = false;
+            if ((ptr < lineEnd) && (*ptr == '#'))
+            {
+                ptr = skipSpaces(ptr + 1, lineEnd);
+                if ((lineEnd - ptr >= 4) && (std::strncmp(ptr, "line", 4) == 0))
+                {
+                    ptr = skipSpaces(ptr + 4, lineEnd);
+                }
+                marker = (ptr < lineEnd) && std::isdigit(static_cast<unsigned char>(*ptr));
+            }
+
+            const char* const openQuote = marker ? std::find(ptr, lineEnd, '"') : lineEnd;
+            const char* closeQuote = lineEnd;
+            if (openQuote != lineEnd)
+            {
+                closeQuote = std::find(openQuote + 1, lineEnd, '"');
+            }
+            if (closeQuote != lineEnd)
+            {
+                const char* name = closeQuote;
+                while ((name > openQuote + 1) && (name[-1] != '/') && (name[-1] != '\\'))
+                {
+                    --name;
+                }
+                ret.append(line, openQuote + 1);
+                ret.append(name, lineEnd);
+            }
+            else
+            {
+                ret.append(line, lineEnd);
+            }
+
+            if (lineEnd != end)
+            {
+                ret += '\n';
+            }
+            line = lineEnd + 1;
+        }
+        return ret;
+    }
+
+    // Preprocesses once per binary language, and leaves the key empty where preprocessing fails. dependencies, if given, gets the
+    // dependencies found on this machine for each target, since a cache hit carries the ones of the machine that put it.
+    void ComputeCacheKeys(const Compiler::SourceDesc& source, const Compiler::Options& options, const Compiler::TargetDesc* targets,
+                          uint32_t numTargets, Compiler::CacheKey* keys, Blob* dependencies = nullptr)
+    {
+        Compiler::SourceDesc sourceOverride = source;
+        if (!sourceOverride.entryPoint || (std::strlen(sourceOverride.entryPoint) == 0))
+        {
+            sourceOverride.entryPoint = "main";
+        }
+        if (!sourceOverride.loadIncludeCallback)
+        {
+            sourceOverride.loadIncludeCallback = DefaultLoadCallback;
+        }
+
+        Blob preprocessed[2]; // Dxil, SpirV
+        Blob preprocessDependencies[2];
+        bool preprocessDone[2] = {false, false};
+        for (uint32_t i = 0; i < numTargets; ++i)
+        {
+            keys[i].str[0] = '\0';
+
+            const ShadingLanguage binaryLanguage =
+                (targets[i].language == ShadingLanguage::Dxil) ? ShadingLanguage::Dxil : ShadingLanguage::SpirV;
+            const uint32_t binaryIndex = (binaryLanguage == ShadingLanguage::Dxil) ? 0 : 1;
+            if (!preprocessDone[binaryIndex])
+            {
+                const Compiler::ResultDesc result = PreprocessSource(sourceOverride, options, binaryLanguage);
+                if (!result.hasError)
+                {
+                    // With debug info the paths end up in the output, so they stay in the key
+                    if (options.enableDebugInfo)
+                    {
+                        preprocessed[binaryIndex].Reset(result.target.Data(), result.target.Size());
+                    }
+                    else
+                    {
+                        const std::string stripped =
+                            StripLineMarkerPaths(reinterpret_cast<const char*>(result.target.Data()), result.target.Size());
+                        preprocessed[binaryIndex].Reset(stripped.data(), static_cast<uint32_t>(stripped.size()));
+                    }
+                    preprocessDependencies[binaryIndex] = result.dependencies;
+                }
+                preprocessDone[binaryIndex] = true;
+            }
+            if (preprocessed[binaryIndex].Size() == 0)
+            {
+                continue;
+            }
+            if (dependencies != nullptr)
+            {
+                dependencies[i] = preprocessDependencies[binaryIndex];
+            }
+
+            llvm::MD5 md5;
+            auto hashBytes = [&md5](const void* data, size_t size) {
+                md5.update(llvm::ArrayRef<uint8_t>(reinterpret_cast<const uint8_t*>(data), size));
+            };
+            auto hashString = [&hashBytes](const char* str) {
+                if (str == nullptr)
+                {
+                    str = "";
+                }
+                hashBytes(str, std::strlen(str) + 1);
+            };
+            auto hashValue = [&hashBytes](uint32_t value) { hashBytes(&value, sizeof(value)); };
+
+            // Bump when the key changes, or when the archives stored under it change
+            hashString("ShaderConductor cache key 2");
+            hashString(DxcompilerVersion().c_str());
+            hashBytes(preprocessed[binaryIndex].Data(), preprocessed[binaryIndex].Size());
+            hashString(sourceOverride.entryPoint);
+            hashValue(static_cast<uint32_t>(sourceOverride.stage));
+
+            // Everything in Options but the allocator and timeout, which don't change the output
+            hashValue(options.packMatricesInRowMajor);
+            hashValue(options.enable16bitTypes);
+            hashValue(options.enableDebugInfo);
+            hashValue(options.disableOptimizations);
+            hashValue(options.inheritCombinedSamplerBindings);
+            hashValue(options.compactReflectionOnly);
+            hashValue(options.costReport);
+            hashValue(options.mslArgumentBuffers);
+            hashValue(options.denseBindings);
+            hashValue(options.minifyOutput);
+            hashValue(options.float16AsMediump);
+            for (const FloatPrecision precision : options.defaultFloatPrecision)
+            {
+                hashValue(static_cast<uint32_t>(precision));
+            }
+            hashValue(static_cast<uint32_t>(options.optimizationLevel));
+            hashValue(options.shaderModel.FullVersion());
+            hashValue(static_cast<uint32_t>(options.shiftAllTexturesBindings));
+            hashValue(static_cast<uint32_t>(options.shiftAllSamplersBindings));
+            hashValue(static_cast<uint32_t>(options.shiftAllCBuffersBindings));
+            hashValue(static_cast<uint32_t>(options.shiftAllUABuffersBindings));
+
+            hashValue(static_cast<uint32_t>(targets[i].language));
+            hashString(targets[i].version);
+            hashValue(targets[i].asModule);
+
+            llvm::MD5::MD5Result digest;
+            md5.final(digest);
+            llvm::SmallString<32> digestStr;
+            llvm::MD5::stringifyResult(digest, digestStr);
+            std::memcpy(keys[i].str, digestStr.data(), sizeof(keys[i].str) - 1);
+            keys[i].str[sizeof(keys[i].str) - 1] = '\0';
+        }
+    }
+
+    // Keys become file names and URL paths
+    bool IsValidCacheKey(const char* key)
+    {
+        if ((key == nullptr) || (key[0] == '\0'))
+        {
+            return false;
+        }
+        for (const char* p = key; *p != '\0'; ++p)
+        {
+            if (!std::isalnum(static_cast<unsigned char>(*p)) && (*p != '-') && (*p != '_'))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool MakeDirectory(const std::string& path)
+    {
+#ifdef _WIN32
+        return (::_mkdir(path.c_str()) == 0) || (errno == EEXIST);
+#else
+        return (::mkdir(path.c_str(), 0755) == 0) || (errno == EEXIST);
+#endif
+    }
+
+    // Reads one HTTP message with a Content-Length, or no body. Returns the start line.
+    bool ReceiveHttpMessage(SocketHandle socket, std::string& startLine, std::vector<uint8_t>& body)
+    {
+        std::string head;
+        body.clear();
+
+        char chunk[64 * 1024];
+        size_t headEnd = std::string::npos;
+        while (headEnd == std::string::npos)
+        {
+            const int received = static_cast<int>(::recv(socket, chunk, sizeof(chunk), 0));
+            if (received <= 0)
+            {
+                return false;
+            }
+            head.append(chunk, received);
+            headEnd = head.find("\r\n\r\n");
+        }
+        body.assign(head.begin() + headEnd + 4, head.end());
+        head.resize(headEnd + 2);
+
+        startLine = head.substr(0, head.find("\r\n"));
+
+        uint64_t contentLength = 0;
+        std::string lowerHead = head;
+        std::transform(lowerHead.begin(), lowerHead.end(), lowerHead.begin(), [](char ch) { return static_cast<char>(std::tolower(ch)); });
+        const size_t lengthPos = lowerHead.find("\r\ncontent-length:");
+        if (lengthPos != std::string::npos)
+        {
+            contentLength = std::strtoull(head.c_str() + lengthPos + 17, nullptr, 10);
+        }
+
+        while (body.size() < contentLength)
+        {
+            const int received = static_cast<int>(::recv(socket, chunk, sizeof(chunk), 0));
+            if (received <= 0)
+            {
+                return false;
+            }
+            body.insert(body.end(), chunk, chunk + received);
+        }
+        body.resize(static_cast<size_t>(contentLength));
+
+        return true;
+    }
+
+    bool SendHttpMessage(SocketHandle socket, const std::string& startLine, const std::string& extraHeaders, const void* body,
+                         uint32_t bodySize)
+    {
+        const std::string head =
+            startLine + "\r\n" + extraHeaders + "Content-Length: " + std::to_string(bodySize) + "\r\nConnection: close\r\n\r\n";
+        return SendAll(socket, head.data(), head.size()) && ((bodySize == 0) || SendAll(socket, body, bodySize));
+    }
+
+    const uint32_t HttpCacheBatchMiss = 0xFFFFFFFF;
+
+    Compiler::ResultDesc LinkModules(IDxcLinker* linker, const char* entryPoint, ShaderStage stage,
+                                     const std::vector<const wchar_t*>& moduleNames, const Compiler::Options& options,
+                                     const Compiler::TargetDesc& target)
+    {
+        std::wstring entryPointUtf16;
+        Unicode::UTF8ToUTF16String(entryPoint, &entryPointUtf16);
+
+        const std::wstring shaderProfile = ShaderProfileName(stage, options.shaderModel);
+        CComPtr<IDxcOperationResult> linkResult;
+        IFT(linker->Link(entryPointUtf16.c_str(), shaderProfile.c_str(), moduleNames.data(), static_cast<UINT32>(moduleNames.size()),
+                         nullptr, 0, &linkResult));
+
+        Compiler::ResultDesc binaryResult{};
+        ConvertDxcResult(binaryResult, linkResult, ShadingLanguage::Dxil, false, options);
+
+        Compiler::SourceDesc source{};
+        source.entryPoint = entryPoint;
+        source.stage = stage;
+        return ConvertBinary(binaryResult, source, options, target);
+    }
+} // namespace
+
+namespace ShaderConductor
+{
+    class Blob::BlobImpl
+    {
+    public:
+        BlobImpl(const void* data, uint32_t size) noexcept
+            : m_data(reinterpret_cast<const uint8_t*>(data), reinterpret_cast<const uint8_t*>(data) + size)
+        {
+        }
+
+        explicit BlobImpl(std::vector<uint8_t>&& data) noexcept : m_data(std::move(data))
+        {
+        }
+
+        // Keeps the payload compressed until it's accessed
+        BlobImpl(CompressionCodec codec, const void* payload, uint32_t payloadSize, uint32_t rawSize)
+            : m_codec(codec), m_compressed(reinterpret_cast<const uint8_t*>(payload), reinterpret_cast<const uint8_t*>(payload) + payloadSize),
+              m_rawSize(rawSize), m_inflated(false)
+        {
+        }
+
+        const void* Data() const
+        {
+            this->Inflate();
+            return m_data.data();
+        }
+
+        uint32_t Size() const
+        {
+            this->Inflate();
+            return static_cast<uint32_t>(m_data.size());
+        }
+
+    private:
+        // A corrupt payload throws on every access, it's never mistaken for empty data
+        void Inflate() const
+        {
+            if (!m_inflated.load(std::memory_order_acquire))
+            {
+                std::lock_guard<std::mutex> lock(m_inflateMutex);
+                if (!m_inflated.load(std::memory_order_relaxed))
+                {
+                    if (!RawSizePlausible(m_codec, m_compressed.data(), static_cast<uint32_t>(m_compressed.size()), m_rawSize))
+                    {
+                        throw std::runtime_error("COULDN'T decompress the blob.");
+                    }
+                    std::vector<uint8_t> raw(m_rawSize);
+                    if (!DecompressPayload(m_codec, m_compressed.data(), static_cast<uint32_t>(m_compressed.size()), raw.data(), m_rawSize))
+                    {
+                        throw std::runtime_error("COULDN'T decompress the blob.");
+                    }
+                    m_data = std::move(raw);
+                    m_compressed.clear();
+                    m_compressed.shrink_to_fit();
+
+                    m_inflated.store(true, std::memory_order_release);
+                }
+            }
+        }
+
+    private:
+        mutable std::vector<uint8_t> m_data;
+
+        CompressionCodec m_codec = CompressionCodec::None;
+        mutable std::vector<uint8_t> m_compressed;
+        uint32_t m_rawSize = 0;
+        mutable std::atomic<bool> m_inflated{true};
+        mutable std::mutex m_inflateMutex;
+    };
+
+    Blob::Blob() noexcept = default;
+
+    Blob::Blob(const void* data, uint32_t size)
+    {
+        this->Reset(data, size);
+    }
+
+    Blob::Blob(const Blob& other)
+    {
+        this->Reset(other.Data(), other.Size());
+    }
+
+    Blob::Blob(Blob&& other) noexcept : m_impl(std::move(other.m_impl))
+    {
+        other.m_impl = nullptr;
+    }
+
+    Blob::~Blob() noexcept
+    {
+        delete m_impl;
+    }
+
+    Blob& Blob::operator=(const Blob& other)
+    {
+        if (this != &other)
+        {
+            this->Reset(other.Data(), other.Size());
+        }
+        return *this;
+    }
+
+    Blob& Blob::operator=(Blob&& other) noexcept
+    {
+        if (this != &other)
+        {
+            delete m_impl;
+            m_impl = other.m_impl;
+            other.m_impl = nullptr;
+        }
+        return *this;
+    }
+
+    void Blob::Reset()
+    {
+        delete m_impl;
+        m_impl = nullptr;
+    }
+
+    void Blob::Reset(const void* data, uint32_t size)
+    {
+        this->Reset();
+        if ((data != nullptr) && (size > 0))
+        {
+            m_impl = new BlobImpl(data, size);
+        }
+    }
+
+    const void* Blob::Data() const
+    {
+        return m_impl ? m_impl->Data() : nullptr;
+    }
+
+    uint32_t Blob::Size() const
+    {
+        return m_impl ? m_impl->Size() : 0;
+    }
+
+    Blob Blob::Serialize(CompressionCodec codec, int level) const
+    {
+        const void* rawData = this->Data();
+        const uint32_t rawSize = this->Size();
+
+        std::vector<uint8_t> payload;
+        if (rawSize > 0)
+        {
+            payload = CompressPayload(codec, level, rawData, rawSize);
+        }
+
+        BlobFrameHeader header;
+        header.magic = BlobFrameMagic;
+        header.rawSize = rawSize;
+        if (payload.empty())
+        {
+            // Incompressible, store the raw bytes
+            header.codec = CompressionCodec::None;
+            header.payloadSize = rawSize;
+        }
+        else
+        {
+            header.codec = codec;
+            header.payloadSize = static_cast<uint32_t>(payload.size());
+        }
+
+        std::vector<uint8_t> frame(sizeof(header) + header.payloadSize);
+        std::memcpy(frame.data(), &header, sizeof(header));
+        if (header.payloadSize > 0)
+        {
+            std::memcpy(frame.data() + sizeof(header), payload.empty() ? rawData : payload.data(), header.payloadSize);
+        }
+
+        Blob ret;
+        ret.m_impl = new BlobImpl(std::move(frame));
+        return ret;
+    }
+
+    Blob Blob::Deserialize(const void* data, uint32_t size, bool decompressOnAccess)
+    {
+        BlobFrameHeader header;
+        if ((data == nullptr) || (size < sizeof(header)))
+        {
+            throw std::runtime_error("Invalid blob frame.");
+        }
+        std::memcpy(&header, data, sizeof(header));
+        if ((header.magic != BlobFrameMagic) || (header.codec >= CompressionCodec::NumCompressionCodecs) ||
+            (header.payloadSize != size - sizeof(header)) || ((header.codec == CompressionCodec::None) && (header.payloadSize != header.rawSize)))
+        {
+            throw std::runtime_error("Invalid blob frame.");
+        }
+
+        const uint8_t* payload = reinterpret_cast<const uint8_t*>(data) + sizeof(header);
+
+        Blob ret;
+        if (header.rawSize > 0)
+        {
+            if (header.codec == CompressionCodec::None)
+            {
+                ret.Reset(payload, header.rawSize);
+            }
+            else if (decompressOnAccess)
+            {
+                ret.m_impl = new BlobImpl(header.codec, payload, header.payloadSize, header.rawSize);
+            }
+            else
+            {
+                if (!RawSizePlausible(header.codec, payload, header.payloadSize, header.rawSize))
+                {
+                    throw std::runtime_error("COULDN'T decompress the blob.");
+                }
+                std::vector<uint8_t> raw(header.rawSize);
+                if (!DecompressPayload(header.codec, payload, header.payloadSize, raw.data(), header.rawSize))
+                {
+                    throw std::runtime_error("COULDN'T decompress the blob.");
+                }
+                ret.m_impl = new BlobImpl(std::move(raw));
+            }
+        }
+        return ret;
+    }
+
+
+    void Compiler::Initialize(bool warmUp, bool forkDeadlineHelper)
+    {
+        Dxcompiler::Instance();
+
+#ifndef _WIN32
+        if (forkDeadlineHelper)
+        {
+            // Warms up before forking the helper
+            DeadlineWorkers();
+            return;
+        }
+#else
+        SC_UNUSED(forkDeadlineHelper);
+#endif
+
+        if (warmUp)
+        {
+            // Touches the DXC front end and both back ends, and SPIRV-Cross, so their lazily built tables are ready
+            static const char warmUpSource[] = "float4 main(float4 pos : SV_Position) : SV_Target\n"
+                                               "{\n"
+                                               "    return pos;\n"
+                                               "}\n";
+            const TargetDesc targets[] = {{ShadingLanguage::Dxil, ""}, {ShadingLanguage::SpirV, ""}, {ShadingLanguage::Glsl, "410"}};
+            ResultDesc results[sizeof(targets) / sizeof(targets[0])];
+            Compiler::Compile({warmUpSource, "WarmUp.hlsl", "main", ShaderStage::PixelShader}, {}, targets,
+                              static_cast<uint32_t>(sizeof(targets) / sizeof(targets[0])), results);
+        }
+    }
+
+    Compiler::ResultDesc Compiler::Compile(const SourceDesc& source, const Options& options, const TargetDesc& target)
+    {
+        ResultDesc result;
+        Compiler::Compile(source, options, &target, 1, &result);
+        return result;
+    }
+
+    void Compiler::Compile(const SourceDesc& source, const Options& options, const TargetDesc* targets, uint32_t numTargets,
+                           ResultDesc* results)
+    {
+        if (options.timeoutMs > 0)
+        {
+            CompileWithDeadline(source, options, targets, numTargets, results);
+            return;
+        }
+
+        SourceDesc sourceOverride = source;
+        if (!sourceOverride.entryPoint || (std::strlen(sourceOverride.entryPoint) == 0))
+        {
+            sourceOverride.entryPoint = "main";
+        }
+        if (!sourceOverride.loadIncludeCallback)
+        {
+            sourceOverride.loadIncludeCallback = DefaultLoadCallback;
+        }
+
+        bool hasDxil = false;
+        bool hasDxilModule = false;
+        bool hasSpirV = false;
+        for (uint32_t i = 0; i < numTargets; ++i)
+        {
+            if (targets[i].language == ShadingLanguage::Dxil)
+            {
+                hasDxil = true;
+                if (targets[i].asModule)
+                {
+                    hasDxilModule = true;
+                }
+            }
+            else
+            {
+                hasSpirV = true;
+            }
+        }
+
+        ResultDesc dxilBinaryResult{};
+        if (hasDxil)
+        {
+            dxilBinaryResult = CompileToBinary(sourceOverride, options, ShadingLanguage::Dxil, false);
+        }
+
+        ResultDesc dxilModuleBinaryResult{};
+        if (hasDxilModule)
+        {
+            dxilModuleBinaryResult = CompileToBinary(sourceOverride, options, ShadingLanguage::Dxil, true);
+        }
+
+        ResultDesc spirvBinaryResult{};
+        if (hasSpirV)
+        {
+            spirvBinaryResult = CompileToBinary(sourceOverride, options, ShadingLanguage::SpirV, false);
+        }
+
+        for (uint32_t i = 0; i < numTargets; ++i)
+        {
+            ResultDesc binaryResult;
+            if (targets[i].language == ShadingLanguage::Dxil)
+            {
+                if (targets[i].asModule)
+                {
+                    binaryResult = dxilModuleBinaryResult;
+                }
+                else
+                {
+                    binaryResult = dxilBinaryResult;
+                }
+            }
+            else
+            {
+                binaryResult = spirvBinaryResult;
+            }
+
+            results[i] = ConvertBinary(binaryResult, sourceOverride, options, targets[i]);
+        }
+    }
+
+    void Compiler::CompileEntryPoints(const SourceDesc& source, const EntryPointDesc* entryPoints, uint32_t numEntryPoints,
+                                      const Options& options, const TargetDesc* targets, uint32_t numTargets, ResultDesc* results)
+    {
+        SourceDesc sourceOverride = source;
+        if (!sourceOverride.loadIncludeCallback)
+        {
+            sourceOverride.loadIncludeCallback = DefaultLoadCallback;
+        }
+
+        for (const auto language : {ShadingLanguage::Dxil, ShadingLanguage::SpirV})
+        {
+            std::vector<uint32_t> targetIndices;
+            std::vector<TargetDesc> languageTargets;
+            for (uint32_t i = 0; i < numTargets; ++i)
+            {
+                if ((targets[i].language == ShadingLanguage::Dxil) == (language == ShadingLanguage::Dxil))
+                {
+                    targetIndices.push_back(i);
+                    languageTargets.push_back(targets[i]);
+                }
+            }
+            if (targetIndices.empty())
+            {
+                continue;
+            }
+
+            // The profile's macros depend on the stage, so entry points only share the text of their stage
+            ResultDesc stagePreprocessed[static_cast<uint32_t>(ShaderStage::NumShaderStages)];
+            bool stageDone[static_cast<uint32_t>(ShaderStage::NumShaderStages)]{};
+
+            std::vector<ResultDesc> languageResults(languageTargets.size());
+            for (uint32_t entry = 0; entry < numEntryPoints; ++entry)
+            {
+                const uint32_t stageIndex = static_cast<uint32_t>(entryPoints[entry].stage);
+                if (!stageDone[stageIndex])
+                {
+                    SourceDesc stageSource = sourceOverride;
+                    stageSource.stage = entryPoints[entry].stage;
+                    stagePreprocessed[stageIndex] = PreprocessSource(stageSource, options, language);
+                    stageDone[stageIndex] = true;
+                }
+                const ResultDesc& preprocessed = stagePreprocessed[stageIndex];
+
+                if (preprocessed.hasError)
+                {
+                    for (const uint32_t targetIndex : targetIndices)
+                    {
+                        ResultDesc& result = results[entry * numTargets + targetIndex];
+                        result.target.Reset();
+                        result.isText = false;
+                        result.errorWarningMsg = preprocessed.errorWarningMsg;
+                        result.hasError = true;
+                        result.dependencies = preprocessed.dependencies;
+                    }
+                    continue;
+                }
+
+                SourceDesc entrySource = sourceOverride;
+                entrySource.source = reinterpret_cast<const char*>(preprocessed.target.Data());
+                entrySource.defines = nullptr;
+                entrySource.numDefines = 0;
+                entrySource.entryPoint = entryPoints[entry].entryPoint;
+                entrySource.stage = entryPoints[entry].stage;
+                Compiler::Compile(entrySource, options, languageTargets.data(), static_cast<uint32_t>(languageTargets.size()),
+                                  languageResults.data());
+                for (size_t i = 0; i < targetIndices.size(); ++i)
+                {
+                    // The entry point compiled the preprocessed text, the includes were seen by the preprocessor
+                    ResultDesc& result = results[entry * numTargets + targetIndices[i]];
+                    result = languageResults[i];
+                    result.dependencies = preprocessed.dependencies;
+                }
+            }
+        }
+    }
+
+    void Compiler::CompilePipeline(const SourceDesc* stages, uint32_t numStages, const Options& options, const TargetDesc& target,
+                                   ResultDesc* results)
+    {
+        // A null or empty entry point is main, as in Compile. Linking looks the entry points up by name.
+        std::vector<SourceDesc> pipelineStages(stages, stages + numStages);
+        for (auto& stage : pipelineStages)
+        {
+            if (!stage.entryPoint || (std::strlen(stage.entryPoint) == 0))
+            {
+                stage.entryPoint = "main";
+            }
+            if (!stage.loadIncludeCallback)
+            {
+                stage.loadIncludeCallback = DefaultLoadCallback;
+            }
+        }
+
+        std::string errorMsg;
+        if ((target.language == ShadingLanguage::Dxil) || target.asModule)
+        {
+            errorMsg = "Pipelines are linked in SPIR-V, they can't be compiled to DXIL or to modules.";
+        }
+        else
+        {
+            // VS, HS, DS, GS, PS
+            static const uint32_t pipelineOrder[] = {0, 4, 3, 1, 2, ~0U};
+            static_assert(sizeof(pipelineOrder) / sizeof(pipelineOrder[0]) == static_cast<uint32_t>(ShaderStage::NumShaderStages),
+                          "pipelineOrder doesn't cover all shader stages.");
+
+            bool hasHullShader = false;
+            bool hasDomainShader = false;
+            for (uint32_t i = 0; i < numStages; ++i)
+            {
+                const uint32_t order = pipelineOrder[static_cast<uint32_t>(pipelineStages[i].stage)];
+                if ((order == ~0U) || ((i > 0) && (order <= pipelineOrder[static_cast<uint32_t>(pipelineStages[i - 1].stage)])))
+                {
+                    errorMsg = "The stages of a pipeline must be graphics stages in pipeline order, each at most once.";
+                }
+                hasHullShader |= (pipelineStages[i].stage == ShaderStage::HullShader);
+                hasDomainShader |= (pipelineStages[i].stage == ShaderStage::DomainShader);
+            }
+            if (hasHullShader != hasDomainShader)
+            {
+                errorMsg = "A pipeline has either both of the hull and domain shaders, or neither.";
+            }
+        }
+        if (!errorMsg.empty())
+        {
+            for (uint32_t i = 0; i < numStages; ++i)
+            {
+                results[i] = ResultDesc{};
+                AppendError(results[i], errorMsg);
+            }
+            return;
+        }
+
+        // The bindings are compacted, and the cost measured, once the interfaces are linked
+        Options spirvOptions = options;
+        spirvOptions.denseBindings = false;
+        spirvOptions.costReport = false;
+
+        std::vector<ResultDesc> binaries(numStages);
+        std::vector<std::vector<uint32_t>> modules(numStages);
+        bool hasError = false;
+        for (uint32_t i = 0; i < numStages; ++i)
+        {
+            binaries[i] = Compiler::Compile(pipelineStages[i], spirvOptions, {ShadingLanguage::SpirV, nullptr, false});
+            if (binaries[i].hasError)
+            {
+                hasError = true;
+            }
+            else
+            {
+                const uint32_t* words = reinterpret_cast<const uint32_t*>(binaries[i].target.Data());
+                modules[i].assign(words, words + binaries[i].target.Size() / sizeof(uint32_t));
+            }
+        }
+
+        // From the last stage back, so each stage's outputs are trimmed to what the next stage reads
+        for (uint32_t i = numStages; !hasError && (i > 1); --i)
+        {
+            const uint32_t producer = i - 2;
+            const uint32_t consumer = i - 1;
+            std::string linkError;
+            try
+            {
+                if (!LinkStageInterface(modules[producer], pipelineStages[producer], modules[consumer], pipelineStages[consumer],
+                                        linkError))
+                {
+                    hasError = true;
+                }
+            }
+            catch (spirv_cross::CompilerError& error)
+            {
+                linkError = error.what();
+                hasError = true;
+            }
+
+            if (hasError)
+            {
+                AppendError(binaries[producer], linkError);
+                AppendError(binaries[consumer], linkError);
+            }
+        }
+
+        for (uint32_t i = 0; i < numStages; ++i)
+        {
+            if (hasError)
+            {
+                if (!binaries[i].hasError)
+                {
+                    AppendError(binaries[i], "Another stage of the pipeline has errors.");
+                }
+                binaries[i].target.Reset();
+                results[i] = binaries[i];
+                continue;
+            }
+
+            binaries[i].target.Reset(modules[i].data(), static_cast<uint32_t>(modules[i].size() * sizeof(uint32_t)));
+            if (options.costReport)
+            {
+                binaries[i].cost = SpirvCostAnalyzer::Analyze(binaries[i].target);
+            }
+            results[i] = ConvertBinary(binaries[i], pipelineStages[i], options, target);
+        }
+    }
+
+    Compiler::ResultDesc Compiler::Disassemble(const DisassembleDesc& source)
+    {
+        assert((source.language == ShadingLanguage::SpirV) || (source.language == ShadingLanguage::Dxil));
+
+        Compiler::ResultDesc ret;
+
+        ret.isText = true;
+
+        if (source.language == ShadingLanguage::SpirV)
+        {
+            const uint32_t* spirvIr = reinterpret_cast<const uint32_t*>(source.binary);
+            const size_t spirvSize = source.binarySize / sizeof(uint32_t);
+
+            spv_context context = SpirvToolsContext::ThreadInstance();
+            uint32_t options = SPV_BINARY_TO_TEXT_OPTION_NONE | SPV_BINARY_TO_TEXT_OPTION_INDENT | SPV_BINARY_TO_TEXT_OPTION_FRIENDLY_NAMES;
+            spv_text text = nullptr;
+            spv_diagnostic diagnostic = nullptr;
+
+            spv_result_t error = spvBinaryToText(context, spirvIr, spirvSize, options, &text, &diagnostic);
+
+            if (error)
+            {
+                ret.errorWarningMsg.Reset(diagnostic->error, static_cast<uint32_t>(std::strlen(diagnostic->error)));
+                ret.hasError = true;
+                spvDiagnosticDestroy(diagnostic);
+            }
+            else
+            {
+                const std::string disassemble = text->str;
+                ret.target.Reset(disassemble.data(), static_cast<uint32_t>(disassemble.size()));
+                ret.hasError = false;
+            }
+
+            spvTextDestroy(text);
+        }
+        else
+        {
+            CComPtr<IDxcBlobEncoding> blob;
+            CComPtr<IDxcBlobEncoding> disassembly;
+            IFT(Dxcompiler::Instance().Library()->CreateBlobWithEncodingOnHeapCopy(source.binary, source.binarySize, CP_UTF8, &blob));
+            IFT(Dxcompiler::Instance().Compiler()->Disassemble(blob, &disassembly));
+
+            if (disassembly != nullptr)
+            {
+                // Remove the tailing \0
+                ret.target.Reset(disassembly->GetBufferPointer(), static_cast<uint32_t>(disassembly->GetBufferSize() - 1));
+                ret.hasError = false;
+            }
+            else
+            {
+                ret.hasError = true;
+            }
+        }
+
+        return ret;
+    }
+
+    void Compiler::Disassemble(const DisassembleDesc* sources, uint32_t numSources, ResultDesc* results, uint32_t numThreads)
+    {
+        if (numThreads == 0)
+        {
+            numThreads = std::max(std::thread::hardware_concurrency(), 1U);
+        }
+        numThreads = std::min(numThreads, numSources);
+
+        std::atomic<uint32_t> nextSource(0);
+        std::exception_ptr exception;
+        std::mutex exceptionMutex;
+        auto worker = [&]() {
+            for (uint32_t i = nextSource++; i < numSources; i = nextSource++)
+            {
+                try
+                {
+                    results[i] = Compiler::Disassemble(sources[i]);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(exceptionMutex);
+                    if (!exception)
+                    {
+                        exception = std::current_exception();
+                    }
+                }
+            }
+        };
+
+        // The calling thread is one of the workers
+        std::vector<std::thread> threads;
+        for (uint32_t i = 1; i < numThreads; ++i)
+        {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        if (exception)
+        {
+            std::rethrow_exception(exception);
+        }
+    }
+
+    Compiler::ResultDesc Compiler::CrossCompile(const SpirvDesc& spirv, const Options& options, const TargetDesc& target)
+    {
+        if ((target.language == ShadingLanguage::Dxil) || target.asModule)
+        {
+            throw std::runtime_error("COULDN'T generate Dxil or modules from SPIR-V.");
+        }
+        if ((spirv.binarySize == 0) || ((spirv.binarySize & (sizeof(uint32_t) - 1)) != 0))
+        {
+            throw std::runtime_error("Invalid SPIR-V binary.");
+        }
+
+        Compiler::ResultDesc binaryResult{};
+        binaryResult.target.Reset(spirv.binary, spirv.binarySize);
+        binaryResult.isText = false;
+        binaryResult.hasError = false;
+
+        Compiler::SourceDesc source{};
+        source.entryPoint = ((spirv.entryPoint == nullptr) || (std::strlen(spirv.entryPoint) == 0)) ? "main" : spirv.entryPoint;
+        source.stage = spirv.stage;
+        if (options.costReport)
+        {
+            binaryResult.cost = SpirvCostAnalyzer::Analyze(binaryResult.target);
+        }
+        return ConvertBinary(binaryResult, source, options, target);
+    }
+
+    Blob Compiler::MinifyText(const char* text, uint32_t size)
+    {
+        const std::string minified = ::MinifyText(std::string(text, size));
+        return Blob(minified.data(), static_cast<uint32_t>(minified.size()));
+    }
+
+    Blob Compiler::SerializeResult(const ResultDesc& result, CompressionCodec codec, int level)
+    {
+        Blob frames[NumResultArchiveFrames];
+        frames[ResultArchiveFrameTarget] = result.target.Serialize(codec, level);
+        frames[ResultArchiveFrameErrorWarningMsg] = result.errorWarningMsg.Serialize(codec, level);
+        frames[ResultArchiveFrameReflectionDescs] = result.reflection.descs.Serialize(codec, level);
+        frames[ResultArchiveFrameCompactReflectionDescs] = result.reflection.compactDescs.Serialize(codec, level);
+        const uint64_t memoryStats[] = {result.allocatedBytes, result.peakAllocatedBytes};
+        frames[ResultArchiveFrameMemoryStats] = Blob(memoryStats, sizeof(memoryStats)).Serialize();
+        frames[ResultArchiveFrameDependencies] = result.dependencies.Serialize(codec, level);
+        frames[ResultArchiveFrameCost] = Blob(&result.cost, sizeof(result.cost)).Serialize();
+
+        ResultArchiveHeader header;
+        header.magic = ResultArchiveMagic;
+        header.version = ResultArchiveVersion;
+        header.flags = (result.isText ? ResultArchiveFlagText : 0) | (result.hasError ? ResultArchiveFlagError : 0);
+        header.descCount = result.reflection.descCount;
+        header.instructionCount = result.reflection.instructionCount;
+        header.numFrames = NumResultArchiveFrames;
+
+        size_t archiveSize = sizeof(header);
+        for (const auto& frame : frames)
+        {
+            archiveSize += sizeof(uint32_t) + frame.Size();
+        }
+
+        std::vector<uint8_t> archive(archiveSize);
+        uint8_t* ptr = archive.data();
+        std::memcpy(ptr, &header, sizeof(header));
+        ptr += sizeof(header);
+        for (const auto& frame : frames)
+        {
+            const uint32_t frameSize = frame.Size();
+            std::memcpy(ptr, &frameSize, sizeof(frameSize));
+            ptr += sizeof(frameSize);
+            std::memcpy(ptr, frame.Data(), frameSize);
+            ptr += frameSize;
+        }
+
+        return Blob(archive.data(), static_cast<uint32_t>(archive.size()));
+    }
+
+    Compiler::ResultDesc Compiler::DeserializeResult(const void* data, uint32_t size, bool decompressOnAccess)
+    {
+        ResultArchiveHeader header;
+        if ((data == nullptr) || (size < sizeof(header)))
+        {
+            throw std::runtime_error("Invalid result archive.");
+        }
+        std::memcpy(&header, data, sizeof(header));
+        if ((header.magic != ResultArchiveMagic) || (header.version != ResultArchiveVersion))
+        {
+            throw std::runtime_error("Invalid result archive.");
+        }
+
+        Blob frames[NumResultArchiveFrames];
+        const uint8_t* ptr = reinterpret_cast<const uint8_t*>(data) + sizeof(header);
+        const uint8_t* const end = reinterpret_cast<const uint8_t*>(data) + size;
+        for (uint32_t i = 0; i < header.numFrames; ++i)
+        {
+            uint32_t frameSize;
+            if (static_cast<size_t>(end - ptr) < sizeof(frameSize))
+            {
+                throw std::runtime_error("Invalid result archive.");
+            }
+            std::memcpy(&frameSize, ptr, sizeof(frameSize));
+            ptr += sizeof(frameSize);
+            if (static_cast<size_t>(end - ptr) < frameSize)
+            {
+                throw std::runtime_error("Invalid result archive.");
+            }
+
+            // Frames from newer archives are skipped
+            if (i < NumResultArchiveFrames)
+            {
+                frames[i] = Blob::Deserialize(ptr, frameSize, decompressOnAccess);
+            }
+            ptr += frameSize;
+        }
+
+        ResultDesc ret{};
+        ret.target = std::move(frames[ResultArchiveFrameTarget]);
+        ret.isText = (header.flags & ResultArchiveFlagText) != 0;
+        ret.errorWarningMsg = std::move(frames[ResultArchiveFrameErrorWarningMsg]);
+        ret.hasError = (header.flags & ResultArchiveFlagError) != 0;
+        ret.reflection.descs = std::move(frames[ResultArchiveFrameReflectionDescs]);
+        ret.reflection.compactDescs = std::move(frames[ResultArchiveFrameCompactReflectionDescs]);
+        ret.reflection.descCount = header.descCount;
+        ret.reflection.instructionCount = header.instructionCount;
+
+        uint64_t memoryStats[2];
+        if (frames[ResultArchiveFrameMemoryStats].Size() == sizeof(memoryStats))
+        {
+            std::memcpy(memoryStats, frames[ResultArchiveFrameMemoryStats].Data(), sizeof(memoryStats));
+            ret.allocatedBytes = memoryStats[0];
+            ret.peakAllocatedBytes = memoryStats[1];
+        }
+        ret.dependencies = std::move(frames[ResultArchiveFrameDependencies]);
+        if (frames[ResultArchiveFrameCost].Size() == sizeof(ret.cost))
+        {
+            std::memcpy(&ret.cost, frames[ResultArchiveFrameCost].Data(), sizeof(ret.cost));
+        }
+
+        return ret;
+    }
+
+    Compiler::CacheKey Compiler::ComputeCacheKey(const SourceDesc& source, const Options& options, const TargetDesc& target)
+    {
+        CacheKey key;
+        ComputeCacheKeys(source, options, &target, 1, &key);
+        return key;
+    }
+
+    void Compiler::Compile(const SourceDesc& source, const Options& options, const TargetDesc* targets, uint32_t numTargets,
+                           ResultDesc* results, CacheBackend& cache)
+    {
+        std::vector<CacheKey> keys(numTargets);
+        std::vector<Blob> dependencies(numTargets);
+        ComputeCacheKeys(source, options, targets, numTargets, keys.data(), dependencies.data());
+
+        std::vector<const char*> lookupKeys;
+        std::vector<uint32_t> lookupTargets;
+        for (uint32_t i = 0; i < numTargets; ++i)
+        {
+            if (keys[i].str[0] != '\0')
+            {
+                lookupKeys.push_back(keys[i].str);
+                lookupTargets.push_back(i);
+            }
+        }
+
+        std::vector<bool> hits(numTargets, false);
+        if (!lookupKeys.empty())
+        {
+            std::vector<Blob> values(lookupKeys.size());
+            std::unique_ptr<bool[]> found(new bool[lookupKeys.size()]);
+            cache.BatchGet(lookupKeys.data(), static_cast<uint32_t>(lookupKeys.size()), values.data(), found.get());
+            for (size_t i = 0; i < lookupKeys.size(); ++i)
+            {
+                if (found[i])
+                {
+                    try
+                    {
+                        results[lookupTargets[i]] = DeserializeResult(values[i].Data(), values[i].Size());
+                        results[lookupTargets[i]].dependencies = dependencies[lookupTargets[i]];
+                        hits[lookupTargets[i]] = true;
+                    }
+                    catch (const std::runtime_error&)
+                    {
+                        // A damaged entry is a miss, and gets overwritten below
+                    }
+                }
+            }
+        }
+
+        std::vector<TargetDesc> missTargets;
+        std::vector<uint32_t> missIndices;
+        for (uint32_t i = 0; i < numTargets; ++i)
+        {
+            if (!hits[i])
+            {
+                missTargets.push_back(targets[i]);
+                missIndices.push_back(i);
+            }
+        }
+        if (missTargets.empty())
+        {
+            return;
+        }
+
+        std::vector<ResultDesc> missResults(missTargets.size());
+        Compile(source, options, missTargets.data(), static_cast<uint32_t>(missTargets.size()), missResults.data());
+        for (size_t i = 0; i < missTargets.size(); ++i)
+        {
+            const uint32_t index = missIndices[i];
+            results[index] = missResults[i];
+            if (!missResults[i].hasError && (keys[index].str[0] != '\0'))
+            {
+                cache.Put(keys[index].str, SerializeResult(missResults[i]));
+            }
+        }
+    }
 
-        Compiler::ResultDesc ret{};
-        ConvertDxcResult(ret, compileResult, targetLanguage, asModule);
+    bool Compiler::LinkSupport()
+    {
+        return Dxcompiler::Instance().LinkerSupport();
+    }
 
-        return ret;
+    Compiler::ResultDesc Compiler::Link(const LinkDesc& modules, const Compiler::Options& options, const TargetDesc& target)
+    {
+        auto linker = Dxcompiler::Instance().CreateLinker();
+        IFTPTR(linker);
+
+        auto* library = Dxcompiler::Instance().Library();
+
+        std::vector<std::wstring> moduleNames(modules.numModules);
+        std::vector<const wchar_t*> moduleNamesUtf16(modules.numModules);
+        std::vector<CComPtr<IDxcBlobEncoding>> moduleBlobs(modules.numModules);
+        for (uint32_t i = 0; i < modules.numModules; ++i)
+        {
+            IFTARG(modules.modules[i] != nullptr);
+
+            IFT(library->CreateBlobWithEncodingOnHeapCopy(modules.modules[i]->target.Data(), modules.modules[i]->target.Size(), CP_UTF8,
+                                                          &moduleBlobs[i]));
+            IFTARG(moduleBlobs[i]->GetBufferSize() >= 4);
+
+            Unicode::UTF8ToUTF16String(modules.modules[i]->name, &moduleNames[i]);
+            moduleNamesUtf16[i] = moduleNames[i].c_str();
+            IFT(linker->RegisterLibrary(moduleNamesUtf16[i], moduleBlobs[i]));
+        }
+
+        return LinkModules(linker, modules.entryPoint, modules.stage, moduleNamesUtf16, options, target);
     }
 
-    Compiler::ResultDesc CrossCompile(const Compiler::ResultDesc& binaryResult, const Compiler::SourceDesc& source,
-                                      const Compiler::Options& options, const Compiler::TargetDesc& target)
+    class LinkerSession::LinkerSessionImpl
     {
-        assert((target.language != ShadingLanguage::Dxil) && (target.language != ShadingLanguage::SpirV));
-        assert((binaryResult.target.Size() & (sizeof(uint32_t) - 1)) == 0);
+    public:
+        void RegisterModule(const Compiler::ModuleDesc& module)
+        {
+            Module newModule;
+            Unicode::UTF8ToUTF16String(module.name, &newModule.name);
+            IFT(Dxcompiler::Instance().Library()->CreateBlobWithEncodingOnHeapCopy(module.target.Data(), module.target.Size(), CP_UTF8,
+                                                                                   &newModule.blob));
+            IFTARG(newModule.blob->GetBufferSize() >= 4);
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (const auto& existing : m_modules)
+            {
+                if (existing.name == newModule.name)
+                {
+                    throw std::runtime_error(std::string("Module ") + module.name + " is already registered.");
+                }
+            }
+            m_modules.push_back(std::move(newModule));
+        }
 
-        Compiler::ResultDesc ret;
+        Compiler::ResultDesc Link(const char* entryPoint, ShaderStage stage, const char* const* moduleNames, uint32_t numModules,
+                                  const Compiler::Options& options, const Compiler::TargetDesc& target)
+        {
+            std::vector<std::wstring> moduleNamesUtf16Str(numModules);
+            std::vector<const wchar_t*> moduleNamesUtf16(numModules);
+            for (uint32_t i = 0; i < numModules; ++i)
+            {
+                Unicode::UTF8ToUTF16String(moduleNames[i], &moduleNamesUtf16Str[i]);
+                moduleNamesUtf16[i] = moduleNamesUtf16Str[i].c_str();
+            }
 
-        ret.errorWarningMsg = binaryResult.errorWarningMsg;
-        ret.isText = true;
+            PooledLinker linker = this->AcquireLinker();
+            try
+            {
+                auto ret = LinkModules(linker.linker, entryPoint, stage, moduleNamesUtf16, options, target);
+                this->ReleaseLinker(std::move(linker));
+                return ret;
+            }
+            catch (...)
+            {
+                this->ReleaseLinker(std::move(linker));
+                throw;
+            }
+        }
 
-        uint32_t intVersion = 0;
-        if (target.version != nullptr)
+    private:
+        struct Module
         {
-            intVersion = std::stoi(target.version);
+            std::wstring name;
+            CComPtr<IDxcBlobEncoding> blob;
+        };
+
+        // IDxcLinker isn't thread safe. Each concurrent Link gets its own linker, and idle linkers are kept for later calls.
+        struct PooledLinker
+        {
+            CComPtr<IDxcLinker> linker;
+            size_t numRegistered = 0;
+        };
+
+        PooledLinker AcquireLinker()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            PooledLinker ret;
+            if (m_idleLinkers.empty())
+            {
+                lock.unlock();
+                ret.linker = Dxcompiler::Instance().CreateLinker();
+                IFTPTR(ret.linker);
+                lock.lock();
+            }
+            else
+            {
+                ret = std::move(m_idleLinkers.back());
+                m_idleLinkers.pop_back();
+            }
+
+            // Only the modules registered since this linker was last used. The linker is owned by this call now, so the
+            // registration runs outside the lock and doesn't stall the other Link calls.
+            const std::vector<Module> newModules(m_modules.begin() + ret.numRegistered, m_modules.end());
+            lock.unlock();
+
+            for (const auto& module : newModules)
+            {
+                IFT(ret.linker->RegisterLibrary(module.name.c_str(), module.blob));
+                ++ret.numRegistered;
+            }
+
+            return ret;
         }
 
-        const uint32_t* spirvIr = reinterpret_cast<const uint32_t*>(binaryResult.target.Data());
-        const size_t spirvSize = binaryResult.target.Size() / sizeof(uint32_t);
+        void ReleaseLinker(PooledLinker&& linker)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_idleLinkers.push_back(std::move(linker));
+        }
 
-        std::unique_ptr<spirv_cross::CompilerGLSL> compiler;
-        bool combinedImageSamplers = false;
-        bool buildDummySampler = false;
+    private:
+        std::mutex m_mutex;
+        std::vector<Module> m_modules;
+        std::vector<PooledLinker> m_idleLinkers;
+    };
 
-        switch (target.language)
+    LinkerSession::LinkerSession() : m_impl(new LinkerSessionImpl)
+    {
+    }
+
+    LinkerSession::~LinkerSession() noexcept
+    {
+        delete m_impl;
+    }
+
+    void LinkerSession::RegisterModule(const Compiler::ModuleDesc& module)
+    {
+        IFTARG(module.name != nullptr);
+        m_impl->RegisterModule(module);
+    }
+
+    Compiler::ResultDesc LinkerSession::Link(const char* entryPoint, ShaderStage stage, const char* const* moduleNames, uint32_t numModules,
+                                             const Compiler::Options& options, const Compiler::TargetDesc& target)
+    {
+        return m_impl->Link(entryPoint, stage, moduleNames, numModules, options, target);
+    }
+
+    class CompileScheduler::CompileSchedulerImpl
+    {
+    public:
+        CompileSchedulerImpl(uint64_t memoryBudget, uint32_t numThreads) : m_memoryBudget(memoryBudget), m_numThreads(numThreads)
         {
-        case ShadingLanguage::Hlsl:
-            if ((source.stage == ShaderStage::GeometryShader) || (source.stage == ShaderStage::HullShader) ||
-                (source.stage == ShaderStage::DomainShader))
+            if (m_numThreads == 0)
             {
-                // Check https://github.com/KhronosGroup/SPIRV-Cross/issues/121 for details
-                AppendError(ret, "GS, HS, and DS has not been supported yet.");
-                return ret;
+                m_numThreads = std::max(std::thread::hardware_concurrency(), 1U);
             }
-            if ((source.stage == ShaderStage::GeometryShader) && (intVersion < 40))
+        }
+
+        void Run(const Job* jobs, uint32_t numJobs)
+        {
+            std::vector<std::pair<uint64_t, uint32_t>> pending(numJobs); // (estimated peak, job index)
+            for (uint32_t i = 0; i < numJobs; ++i)
             {
-                AppendError(ret, "HLSL shader model earlier than 4.0 doesn't have GS or CS.");
-                return ret;
+                pending[i] = {this->EstimatedPeakBytes(jobs[i]), i};
             }
-            if ((source.stage == ShaderStage::ComputeShader) && (intVersion < 50))
+            std::stable_sort(pending.begin(), pending.end(),
+                             [](const std::pair<uint64_t, uint32_t>& lhs, const std::pair<uint64_t, uint32_t>& rhs) {
+                                 return lhs.first > rhs.first;
+                             });
+
+            std::mutex runMutex;
+            std::condition_variable runCondition;
+            uint64_t usedBytes = 0;
+            uint32_t numRunning = 0;
+            std::exception_ptr exception;
+
+            auto worker = [&]() {
+                std::unique_lock<std::mutex> lock(runMutex);
+                for (;;)
+                {
+                    auto next = pending.end();
+                    runCondition.wait(lock, [&] {
+                        next = std::find_if(pending.begin(), pending.end(), [&](const std::pair<uint64_t, uint32_t>& job) {
+                            return (numRunning == 0) || (usedBytes + job.first <= m_memoryBudget);
+                        });
+                        return pending.empty() || (next != pending.end());
+                    });
+                    if (pending.empty())
+                    {
+                        break;
+                    }
+
+                    const uint64_t estimate = next->first;
+                    const Job& job = jobs[next->second];
+                    pending.erase(next);
+                    usedBytes += estimate;
+                    ++numRunning;
+                    lock.unlock();
+
+                    uint64_t peak = 0;
+                    try
+                    {
+                        Compiler::Compile(job.source, job.options, job.targets, job.numTargets, job.results);
+                        for (uint32_t i = 0; i < job.numTargets; ++i)
+                        {
+                            peak = std::max(peak, job.results[i].peakAllocatedBytes);
+                        }
+                    }
+                    catch (...)
+                    {
+                        std::lock_guard<std::mutex> exceptionLock(runMutex);
+                        if (!exception)
+                        {
+                            exception = std::current_exception();
+                        }
+                    }
+
+                    if (peak > 0)
+                    {
+                        this->RecordPeak(job, peak);
+                    }
+
+                    lock.lock();
+                    usedBytes -= estimate;
+                    --numRunning;
+                    runCondition.notify_all();
+                }
+            };
+
+            std::vector<std::thread> threads;
+            for (uint32_t i = 1; i < std::min(m_numThreads, numJobs); ++i)
             {
-                AppendError(ret, "CS in HLSL shader model earlier than 5.0 is not supported.");
-                return ret;
+                threads.emplace_back(worker);
             }
-            if (((source.stage == ShaderStage::HullShader) || (source.stage == ShaderStage::DomainShader)) && (intVersion < 50))
+            worker();
+            for (auto& thread : threads)
             {
-                AppendError(ret, "HLSL shader model earlier than 5.0 doesn't have HS or DS.");
-                return ret;
+                thread.join();
             }
-            compiler = std::make_unique<spirv_cross::CompilerHLSL>(spirvIr, spirvSize);
-            break;
 
-        case ShadingLanguage::Glsl:
-        case ShadingLanguage::Essl:
-            compiler = std::make_unique<spirv_cross::CompilerGLSL>(spirvIr, spirvSize);
-            combinedImageSamplers = true;
-            buildDummySampler = true;
+            if (exception)
+            {
+                std::rethrow_exception(exception);
+            }
+        }
 
-            // Legacy GLSL fixups
-            if (intVersion <= 300)
+        uint64_t EstimatedPeakBytes(const Job& job) const
+        {
+            std::lock_guard<std::mutex> lock(m_historyMutex);
+
+            auto iter = m_history.find(JobHash(job));
+            if (iter != m_history.end())
             {
-                auto vars = compiler->get_active_interface_variables();
-                for (auto& var : vars)
+                return iter->second;
+            }
+            // Never 0, a job that costs nothing would always fit in the budget
+            return (m_maxPeak > 0) ? m_maxPeak : std::max<uint64_t>(m_memoryBudget / m_numThreads, 1);
+        }
+
+        Blob SaveHistory() const
+        {
+            std::lock_guard<std::mutex> lock(m_historyMutex);
+
+            std::vector<uint64_t> data;
+            data.reserve(1 + m_history.size() * 2);
+            data.push_back((static_cast<uint64_t>(SchedulerHistoryVersion) << 32) | SchedulerHistoryMagic);
+            for (const auto& entry : m_history)
+            {
+                data.push_back(entry.first);
+                data.push_back(entry.second);
+            }
+            return Blob(data.data(), static_cast<uint32_t>(data.size() * sizeof(uint64_t)));
+        }
+
+        void LoadHistory(const void* data, uint32_t size)
+        {
+            const uint64_t* entries = reinterpret_cast<const uint64_t*>(data);
+            if ((size < sizeof(uint64_t)) || (size % (sizeof(uint64_t) * 2) != sizeof(uint64_t)) ||
+                (entries[0] != ((static_cast<uint64_t>(SchedulerHistoryVersion) << 32) | SchedulerHistoryMagic)))
+            {
+                throw std::runtime_error("Invalid scheduler history.");
+            }
+
+            std::lock_guard<std::mutex> lock(m_historyMutex);
+            const uint32_t numEntries = size / (sizeof(uint64_t) * 2);
+            for (uint32_t i = 0; i < numEntries; ++i)
+            {
+                const uint64_t peak = entries[1 + i * 2 + 1];
+                m_history[entries[1 + i * 2]] = peak;
+                m_maxPeak = std::max(m_maxPeak, peak);
+            }
+        }
+
+    private:
+        // Everything that decides what DXC compiles. Includes are not followed.
+        static uint64_t JobHash(const Job& job)
+        {
+            uint64_t hash = HashContent(nullptr, 0);
+            auto hashBytes = [&hash](const void* data, size_t size) { hash = HashContent(data, size, hash); };
+            auto hashString = [&hashBytes](const char* str) {
+                if (str != nullptr)
                 {
-                    auto varClass = compiler->get_storage_class(var);
+                    hashBytes(str, std::strlen(str) + 1);
+                }
+                else
+                {
+                    hashBytes("", 1);
+                }
+            };
 
-                    // Make VS out and PS in variable names match
-                    if ((source.stage == ShaderStage::VertexShader) && (varClass == spv::StorageClass::StorageClassOutput))
+            hashString(job.source.source);
+            hashString(job.source.entryPoint);
+            hashBytes(&job.source.stage, sizeof(job.source.stage));
+            for (uint32_t i = 0; i < job.source.numDefines; ++i)
+            {
+                hashString(job.source.defines[i].name);
+                hashString(job.source.defines[i].value);
+                hashBytes(&job.source.defines[i].specConstant, sizeof(job.source.defines[i].specConstant));
+            }
+            const uint32_t optionBits = (job.options.enable16bitTypes ? 1 : 0) | (job.options.enableDebugInfo ? 2 : 0) |
+                                        (job.options.disableOptimizations ? 4 : 0) | (job.options.packMatricesInRowMajor ? 8 : 0) |
+                                        (job.options.optimizationLevel << 4);
+            hashBytes(&optionBits, sizeof(optionBits));
+            const uint32_t shaderModel = job.options.shaderModel.FullVersion();
+            hashBytes(&shaderModel, sizeof(shaderModel));
+            const int shifts[] = {job.options.shiftAllTexturesBindings, job.options.shiftAllSamplersBindings,
+                                  job.options.shiftAllCBuffersBindings, job.options.shiftAllUABuffersBindings};
+            hashBytes(shifts, sizeof(shifts));
+
+            return hash;
+        }
+
+        void RecordPeak(const Job& job, uint64_t peak)
+        {
+            std::lock_guard<std::mutex> lock(m_historyMutex);
+            m_history[JobHash(job)] = peak;
+            m_maxPeak = std::max(m_maxPeak, peak);
+        }
+
+    private:
+        static constexpr uint32_t SchedulerHistoryMagic = 0x48534353; // 'SCSH'
+        static constexpr uint32_t SchedulerHistoryVersion = 2;
+
+        const uint64_t m_memoryBudget;
+        uint32_t m_numThreads;
+
+        mutable std::mutex m_historyMutex;
+        std::unordered_map<uint64_t, uint64_t> m_history;
+        uint64_t m_maxPeak = 0;
+    };
+
+    CompileScheduler::CompileScheduler(uint64_t memoryBudget, uint32_t numThreads)
+        : m_impl(new CompileSchedulerImpl(memoryBudget, numThreads))
+    {
+    }
+
+    CompileScheduler::~CompileScheduler() noexcept
+    {
+        delete m_impl;
+    }
+
+    void CompileScheduler::Run(const Job* jobs, uint32_t numJobs)
+    {
+        m_impl->Run(jobs, numJobs);
+    }
+
+    uint64_t CompileScheduler::EstimatedPeakBytes(const Job& job) const
+    {
+        return m_impl->EstimatedPeakBytes(job);
+    }
+
+    Blob CompileScheduler::SaveHistory() const
+    {
+        return m_impl->SaveHistory();
+    }
+
+    void CompileScheduler::LoadHistory(const void* data, uint32_t size)
+    {
+        m_impl->LoadHistory(data, size);
+    }
+
+#ifdef _WIN32
+    // There is no fork. Jobs run on threads in this process, without the isolation.
+    class CompileWorkerPool::CompileWorkerPoolImpl
+    {
+    public:
+        CompileWorkerPoolImpl(uint32_t numWorkers, uint32_t sharedMemorySize) : m_numWorkers(numWorkers)
+        {
+            SC_UNUSED(sharedMemorySize);
+
+            if (m_numWorkers == 0)
+            {
+                m_numWorkers = std::max(std::thread::hardware_concurrency(), 1U);
+            }
+            Compiler::Initialize(true);
+        }
+
+        void Run(const CompileScheduler::Job* jobs, uint32_t numJobs)
+        {
+            std::atomic<uint32_t> nextJob{0};
+            std::mutex exceptionMutex;
+            std::exception_ptr exception;
+
+            auto worker = [&]() {
+                for (uint32_t i = nextJob++; i < numJobs; i = nextJob++)
+                {
+                    const CompileScheduler::Job& job = jobs[i];
+                    try
                     {
-                        auto name = compiler->get_name(var);
-                        if ((name.find("out_var_") == 0) || (name.find("out.var.") == 0))
+                        Compiler::Compile(job.source, job.options, job.targets, job.numTargets, job.results);
+                    }
+                    catch (...)
+                    {
+                        std::lock_guard<std::mutex> lock(exceptionMutex);
+                        if (!exception)
                         {
-                            name.replace(0, 8, "varying_");
-                            compiler->set_name(var, name);
+                            exception = std::current_exception();
                         }
                     }
-                    else if ((source.stage == ShaderStage::PixelShader) && (varClass == spv::StorageClass::StorageClassInput))
+                }
+            };
+
+            std::vector<std::thread> threads;
+            for (uint32_t i = 1; i < std::min(m_numWorkers, numJobs); ++i)
+            {
+                threads.emplace_back(worker);
+            }
+            worker();
+            for (auto& thread : threads)
+            {
+                thread.join();
+            }
+
+            if (exception)
+            {
+                std::rethrow_exception(exception);
+            }
+        }
+
+        uint32_t NumRestarts() const
+        {
+            return 0;
+        }
+
+    private:
+        uint32_t m_numWorkers;
+    };
+#else
+    class CompileWorkerPool::CompileWorkerPoolImpl
+    {
+    public:
+        CompileWorkerPoolImpl(uint32_t numWorkers, uint32_t sharedMemorySize) : m_workers(numWorkers, sharedMemorySize, true)
+        {
+        }
+
+        void Run(const CompileScheduler::Job* jobs, uint32_t numJobs)
+        {
+            std::atomic<uint32_t> nextJob{0};
+            std::mutex exceptionMutex;
+            std::exception_ptr exception;
+
+            auto dispatcher = [&]() {
+                for (uint32_t i = nextJob++; i < numJobs; i = nextJob++)
+                {
+                    try
+                    {
+                        m_workers.RunJob(jobs[i]);
+                    }
+                    catch (...)
                     {
-                        auto name = compiler->get_name(var);
-                        if ((name.find("in_var_") == 0) || (name.find("in.var.") == 0))
+                        std::lock_guard<std::mutex> lock(exceptionMutex);
+                        if (!exception)
                         {
-                            name.replace(0, 7, "varying_");
-                            compiler->set_name(var, name);
+                            exception = std::current_exception();
                         }
                     }
                 }
-            }
-            break;
+            };
 
-        case ShadingLanguage::Msl_macOS:
-        case ShadingLanguage::Msl_iOS:
-            if (source.stage == ShaderStage::GeometryShader)
+            std::vector<std::thread> threads;
+            for (uint32_t i = 1; i < std::min(m_workers.NumWorkers(), numJobs); ++i)
             {
-                AppendError(ret, "MSL doesn't have GS.");
-                return ret;
+                threads.emplace_back(dispatcher);
+            }
+            dispatcher();
+            for (auto& thread : threads)
+            {
+                thread.join();
             }
-            compiler = std::make_unique<spirv_cross::CompilerMSL>(spirvIr, spirvSize);
-            break;
 
-        default:
-            llvm_unreachable("Invalid target language.");
+            if (exception)
+            {
+                std::rethrow_exception(exception);
+            }
         }
 
-        spv::ExecutionModel model;
-        switch (source.stage)
+        uint32_t NumRestarts() const
         {
-        case ShaderStage::VertexShader:
-            model = spv::ExecutionModelVertex;
-            break;
+            return m_workers.NumRestarts();
+        }
 
-        case ShaderStage::HullShader:
-            model = spv::ExecutionModelTessellationControl;
-            break;
+    private:
+        WorkerProcessPool m_workers;
+    };
+#endif
 
-        case ShaderStage::DomainShader:
-            model = spv::ExecutionModelTessellationEvaluation;
-            break;
+    CompileWorkerPool::CompileWorkerPool(uint32_t numWorkers, uint32_t sharedMemorySize)
+        : m_impl(new CompileWorkerPoolImpl(numWorkers, sharedMemorySize))
+    {
+    }
 
-        case ShaderStage::GeometryShader:
-            model = spv::ExecutionModelGeometry;
-            break;
+    CompileWorkerPool::~CompileWorkerPool() noexcept
+    {
+        delete m_impl;
+    }
 
-        case ShaderStage::PixelShader:
-            model = spv::ExecutionModelFragment;
-            break;
+    void CompileWorkerPool::Run(const CompileScheduler::Job* jobs, uint32_t numJobs)
+    {
+        m_impl->Run(jobs, numJobs);
+    }
 
-        case ShaderStage::ComputeShader:
-            model = spv::ExecutionModelGLCompute;
-            break;
+    uint32_t CompileWorkerPool::NumRestarts() const
+    {
+        return m_impl->NumRestarts();
+    }
 
-        default:
-            llvm_unreachable("Invalid shader stage.");
+    class DependencyIndex::DependencyIndexImpl
+    {
+    public:
+        void Record(const char* sourceName, const Compiler::ResultDesc& result)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            this->RemoveLocked(sourceName);
+
+            std::vector<uint32_t>& files = m_sources[sourceName];
+            const uint8_t* data = reinterpret_cast<const uint8_t*>(result.dependencies.Data());
+            const uint8_t* end = data + result.dependencies.Size();
+            while (end - data > static_cast<ptrdiff_t>(sizeof(uint64_t)))
+            {
+                uint64_t hash;
+                std::memcpy(&hash, data, sizeof(hash));
+                const char* name = reinterpret_cast<const char*>(data + sizeof(hash));
+                const size_t nameLength = strnlen(name, end - data - sizeof(hash));
+                data += sizeof(hash) + nameLength + 1;
+
+                const uint32_t file = this->FileId(std::string(name, nameLength));
+                m_fileHashes[file] = hash;
+                m_dependents[file].insert(sourceName);
+                files.push_back(file);
+            }
         }
-        compiler->set_entry_point(source.entryPoint, model);
 
-        spirv_cross::CompilerGLSL::Options opts = compiler->get_common_options();
-        if (target.version != nullptr)
+        void Remove(const char* sourceName)
         {
-            opts.version = intVersion;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            this->RemoveLocked(sourceName);
         }
-        opts.es = (target.language == ShadingLanguage::Essl);
-        opts.force_temporary = false;
-        opts.separate_shader_objects = true;
-        opts.flatten_multidimensional_arrays = false;
-        opts.enable_420pack_extension =
-            (target.language == ShadingLanguage::Glsl) && ((target.version == nullptr) || (opts.version >= 420));
-        opts.vulkan_semantics = false;
-        opts.vertex.fixup_clipspace = false;
-        opts.vertex.flip_vert_y = false;
-        opts.vertex.support_nonzero_base_instance = true;
-        compiler->set_common_options(opts);
 
-        if (target.language == ShadingLanguage::Hlsl)
+        Blob AffectedSources(const char* const* changedFiles, uint32_t numChangedFiles, bool compareContent,
+                             const std::function<Blob(const char* fileName)>& loadCallback) const
         {
-            auto* hlslCompiler = static_cast<spirv_cross::CompilerHLSL*>(compiler.get());
-            auto hlslOpts = hlslCompiler->get_hlsl_options();
-            if (target.version != nullptr)
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            std::vector<std::string> affected;
+            std::unordered_set<std::string> seen;
+            for (uint32_t i = 0; i < numChangedFiles; ++i)
             {
-                if (opts.version < 30)
+                auto iter = m_fileIds.find(NormalizeDependencyName(changedFiles[i]));
+                if (iter == m_fileIds.end())
                 {
-                    AppendError(ret, "HLSL shader model earlier than 3.0 is not supported.");
-                    return ret;
+                    continue;
+                }
+
+                const uint32_t file = iter->second;
+                if (compareContent)
+                {
+                    uint64_t hash = 0;
+                    try
+                    {
+                        const Blob content =
+                            loadCallback ? loadCallback(m_fileNames[file].c_str()) : DefaultLoadCallback(m_fileNames[file].c_str());
+                        hash = HashContent(content.Data(), content.Size());
+                    }
+                    catch (const std::runtime_error&)
+                    {
+                        // Missing, which matches a missing include
+                    }
+                    if (hash == m_fileHashes[file])
+                    {
+                        continue;
+                    }
+                }
+
+                for (const auto& source : m_dependents[file])
+                {
+                    if (seen.insert(source).second)
+                    {
+                        affected.push_back(source);
+                    }
                 }
-                hlslOpts.shader_model = opts.version;
             }
 
-            if (hlslOpts.shader_model <= 30)
+            std::vector<char> ret;
+            for (const auto& source : affected)
             {
-                combinedImageSamplers = true;
-                buildDummySampler = true;
+                ret.insert(ret.end(), source.c_str(), source.c_str() + source.size() + 1);
             }
-
-            hlslCompiler->set_hlsl_options(hlslOpts);
+            return Blob(ret.data(), static_cast<uint32_t>(ret.size()));
         }
-        else if ((target.language == ShadingLanguage::Msl_macOS) || (target.language == ShadingLanguage::Msl_iOS))
+
+        // A header, the file records, the source records, the file ids of all sources, and a string table. Files that no source
+        // depends on anymore are dropped.
+        Blob Save() const
         {
-            auto* mslCompiler = static_cast<spirv_cross::CompilerMSL*>(compiler.get());
-            auto mslOpts = mslCompiler->get_msl_options();
-            if (target.version != nullptr)
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            std::vector<uint32_t> newFileIds(m_fileNames.size(), InvalidId);
+            std::vector<SavedFile> files;
+            std::vector<SavedSource> sources;
+            std::vector<uint32_t> sourceFiles;
+            std::vector<char> strings;
+            auto addString = [&strings](const std::string& str) {
+                const uint32_t offset = static_cast<uint32_t>(strings.size());
+                strings.insert(strings.end(), str.c_str(), str.c_str() + str.size() + 1);
+                return offset;
+            };
+
+            for (const auto& source : m_sources)
             {
-                mslOpts.msl_version = opts.version;
+                SavedSource savedSource;
+                savedSource.nameOffset = addString(source.first);
+                savedSource.firstFile = static_cast<uint32_t>(sourceFiles.size());
+                savedSource.numFiles = static_cast<uint32_t>(source.second.size());
+                sources.push_back(savedSource);
+
+                for (const uint32_t file : source.second)
+                {
+                    if (newFileIds[file] == InvalidId)
+                    {
+                        newFileIds[file] = static_cast<uint32_t>(files.size());
+
+                        SavedFile savedFile;
+                        savedFile.hash = m_fileHashes[file];
+                        savedFile.nameOffset = addString(m_fileNames[file]);
+                        savedFile.padding = 0;
+                        files.push_back(savedFile);
+                    }
+                    sourceFiles.push_back(newFileIds[file]);
+                }
             }
-            mslOpts.swizzle_texture_samples = false;
-            mslOpts.platform = (target.language == ShadingLanguage::Msl_iOS) ? spirv_cross::CompilerMSL::Options::iOS
-                                                                             : spirv_cross::CompilerMSL::Options::macOS;
 
-            mslCompiler->set_msl_options(mslOpts);
+            SavedHeader header;
+            header.magic = DependencyIndexMagic;
+            header.version = DependencyIndexVersion;
+            header.numFiles = static_cast<uint32_t>(files.size());
+            header.numSources = static_cast<uint32_t>(sources.size());
+            header.numSourceFiles = static_cast<uint32_t>(sourceFiles.size());
+            header.stringTableSize = static_cast<uint32_t>(strings.size());
+
+            std::vector<uint8_t> ret;
+            auto append = [&ret](const void* data, size_t size) {
+                ret.insert(ret.end(), reinterpret_cast<const uint8_t*>(data), reinterpret_cast<const uint8_t*>(data) + size);
+            };
+            append(&header, sizeof(header));
+            append(files.data(), files.size() * sizeof(SavedFile));
+            append(sources.data(), sources.size() * sizeof(SavedSource));
+            append(sourceFiles.data(), sourceFiles.size() * sizeof(uint32_t));
+            append(strings.data(), strings.size());
+
+            return Blob(ret.data(), static_cast<uint32_t>(ret.size()));
+        }
 
-            const auto& resources = mslCompiler->get_shader_resources();
+        void Load(const void* data, uint32_t size)
+        {
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
 
-            uint32_t textureBinding = 0;
-            for (const auto& image : resources.separate_images)
+            SavedHeader header;
+            if (size < sizeof(header))
             {
-                mslCompiler->set_decoration(image.id, spv::DecorationBinding, textureBinding);
-                ++textureBinding;
+                throw std::runtime_error("Invalid dependency index.");
             }
-
-            uint32_t samplerBinding = 0;
-            for (const auto& sampler : resources.separate_samplers)
+            std::memcpy(&header, bytes, sizeof(header));
+            const uint64_t expectedSize = sizeof(header) + static_cast<uint64_t>(header.numFiles) * sizeof(SavedFile) +
+                                          static_cast<uint64_t>(header.numSources) * sizeof(SavedSource) +
+                                          static_cast<uint64_t>(header.numSourceFiles) * sizeof(uint32_t) + header.stringTableSize;
+            if ((header.magic != DependencyIndexMagic) || (header.version != DependencyIndexVersion) || (size != expectedSize) ||
+                (header.stringTableSize == 0) || (bytes[size - 1] != '\0'))
             {
-                mslCompiler->set_decoration(sampler.id, spv::DecorationBinding, samplerBinding);
-                ++samplerBinding;
+                throw std::runtime_error("Invalid dependency index.");
             }
-        }
 
-        if (buildDummySampler)
-        {
-            const uint32_t sampler = compiler->build_dummy_sampler_for_combined_images();
-            if (sampler != 0)
+            std::vector<SavedFile> files(header.numFiles);
+            std::vector<SavedSource> sources(header.numSources);
+            std::vector<uint32_t> sourceFiles(header.numSourceFiles);
+            const uint8_t* ptr = bytes + sizeof(header);
+            auto read = [&ptr](void* dst, size_t readSize) {
+                std::memcpy(dst, ptr, readSize);
+                ptr += readSize;
+            };
+            read(files.data(), files.size() * sizeof(SavedFile));
+            read(sources.data(), sources.size() * sizeof(SavedSource));
+            read(sourceFiles.data(), sourceFiles.size() * sizeof(uint32_t));
+            const char* strings = reinterpret_cast<const char*>(ptr);
+
+            for (const auto& file : files)
             {
-                compiler->set_decoration(sampler, spv::DecorationDescriptorSet, 0);
-                compiler->set_decoration(sampler, spv::DecorationBinding, 0);
+                if (file.nameOffset >= header.stringTableSize)
+                {
+                    throw std::runtime_error("Invalid dependency index.");
+                }
             }
-        }
-
-        if (combinedImageSamplers)
-        {
-            compiler->build_combined_image_samplers();
-
-            if (options.inheritCombinedSamplerBindings)
+            for (const auto& source : sources)
             {
-                spirv_cross_util::inherit_combined_sampler_bindings(*compiler);
+                if ((source.nameOffset >= header.stringTableSize) || (source.firstFile > header.numSourceFiles) ||
+                    (source.numFiles > header.numSourceFiles - source.firstFile))
+                {
+                    throw std::runtime_error("Invalid dependency index.");
+                }
+            }
+            for (const uint32_t file : sourceFiles)
+            {
+                if (file >= header.numFiles)
+                {
+                    throw std::runtime_error("Invalid dependency index.");
+                }
             }
 
-            for (auto& remap : compiler->get_combined_image_samplers())
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            for (const auto& source : sources)
             {
-                compiler->set_name(remap.combined_id,
-                                   "SPIRV_Cross_Combined" + compiler->get_name(remap.image_id) + compiler->get_name(remap.sampler_id));
+                const std::string sourceName = strings + source.nameOffset;
+                this->RemoveLocked(sourceName);
+
+                std::vector<uint32_t>& sourceFileIds = m_sources[sourceName];
+                for (uint32_t i = 0; i < source.numFiles; ++i)
+                {
+                    const SavedFile& savedFile = files[sourceFiles[source.firstFile + i]];
+                    const uint32_t file = this->FileId(strings + savedFile.nameOffset);
+                    m_fileHashes[file] = savedFile.hash;
+                    m_dependents[file].insert(sourceName);
+                    sourceFileIds.push_back(file);
+                }
             }
         }
 
-        if (target.language == ShadingLanguage::Hlsl)
+    private:
+        uint32_t FileId(const std::string& name)
         {
-            auto* hlslCompiler = static_cast<spirv_cross::CompilerHLSL*>(compiler.get());
-            const uint32_t newBuiltin = hlslCompiler->remap_num_workgroups_builtin();
-            if (newBuiltin)
+            auto iter = m_fileIds.find(name);
+            if (iter != m_fileIds.end())
             {
-                compiler->set_decoration(newBuiltin, spv::DecorationDescriptorSet, 0);
-                compiler->set_decoration(newBuiltin, spv::DecorationBinding, 0);
+                return iter->second;
             }
-        }
 
-        try
-        {
-            const std::string targetStr = compiler->compile();
-            ret.target.Reset(targetStr.data(), static_cast<uint32_t>(targetStr.size()));
-            ret.hasError = false;
-            ret.reflection.descs.Reset(binaryResult.reflection.descs.Data(),
-                                       sizeof(Compiler::ReflectionDesc) * binaryResult.reflection.descCount);
-            ret.reflection.descCount = binaryResult.reflection.descCount;
-            ret.reflection.instructionCount = binaryResult.reflection.instructionCount;
-        }
-        catch (spirv_cross::CompilerError& error)
-        {
-            const char* errorMsg = error.what();
-            ret.errorWarningMsg.Reset(errorMsg, static_cast<uint32_t>(std::strlen(errorMsg)));
-            ret.hasError = true;
+            const uint32_t file = static_cast<uint32_t>(m_fileNames.size());
+            m_fileIds.emplace(name, file);
+            m_fileNames.push_back(name);
+            m_fileHashes.push_back(0);
+            m_dependents.emplace_back();
+            return file;
         }
 
-        return ret;
-    }
-
-    Compiler::ResultDesc ConvertBinary(const Compiler::ResultDesc& binaryResult, const Compiler::SourceDesc& source,
-                                       const Compiler::Options& options, const Compiler::TargetDesc& target)
-    {
-        if (!binaryResult.hasError)
+        void RemoveLocked(const std::string& sourceName)
         {
-            if (target.asModule)
-            {
-                return binaryResult;
-            }
-            else
+            auto iter = m_sources.find(sourceName);
+            if (iter != m_sources.end())
             {
-                switch (target.language)
+                for (const uint32_t file : iter->second)
                 {
-                case ShadingLanguage::Dxil:
-                case ShadingLanguage::SpirV:
-                    return binaryResult;
-
-                case ShadingLanguage::Hlsl:
-                case ShadingLanguage::Glsl:
-                case ShadingLanguage::Essl:
-                case ShadingLanguage::Msl_macOS:
-                case ShadingLanguage::Msl_iOS:
-                    return CrossCompile(binaryResult, source, options, target);
-
-                default:
-                    llvm_unreachable("Invalid shading language.");
-                    break;
+                    m_dependents[file].erase(sourceName);
                 }
+                m_sources.erase(iter);
             }
         }
-        else
-        {
-            return binaryResult;
-        }
-    }
-} // namespace
 
-namespace ShaderConductor
-{
-    class Blob::BlobImpl
-    {
-    public:
-        BlobImpl(const void* data, uint32_t size) noexcept
-            : m_data(reinterpret_cast<const uint8_t*>(data), reinterpret_cast<const uint8_t*>(data) + size)
-        {
-        }
+    private:
+        static constexpr uint32_t DependencyIndexMagic = 0x49444353; // 'SCDI'
+        static constexpr uint32_t DependencyIndexVersion = 1;
+        static constexpr uint32_t InvalidId = 0xFFFFFFFF;
 
-        const void* Data() const noexcept
+        struct SavedHeader
         {
-            return m_data.data();
-        }
+            uint32_t magic;
+            uint32_t version;
+            uint32_t numFiles;
+            uint32_t numSources;
+            uint32_t numSourceFiles;
+            uint32_t stringTableSize;
+        };
+
+        struct SavedFile
+        {
+            uint64_t hash; // Of the content the compile saw, 0 for missing
+            uint32_t nameOffset;
+            uint32_t padding;
+        };
 
-        uint32_t Size() const noexcept
+        struct SavedSource
         {
-            return static_cast<uint32_t>(m_data.size());
-        }
+            uint32_t nameOffset;
+            uint32_t firstFile;
+            uint32_t numFiles;
+        };
 
-    private:
-        std::vector<uint8_t> m_data;
+        mutable std::mutex m_mutex;
+
+        std::vector<std::string> m_fileNames;
+        std::vector<uint64_t> m_fileHashes;
+        std::vector<std::unordered_set<std::string>> m_dependents; // Source names by file
+        std::unordered_map<std::string, uint32_t> m_fileIds;
+
+        std::unordered_map<std::string, std::vector<uint32_t>> m_sources; // File ids by source name
     };
 
-    Blob::Blob() noexcept = default;
+    DependencyIndex::DependencyIndex() : m_impl(new DependencyIndexImpl)
+    {
+    }
 
-    Blob::Blob(const void* data, uint32_t size)
+    DependencyIndex::~DependencyIndex() noexcept
     {
-        this->Reset(data, size);
+        delete m_impl;
     }
 
-    Blob::Blob(const Blob& other)
+    void DependencyIndex::Record(const char* sourceName, const Compiler::ResultDesc& result)
     {
-        this->Reset(other.Data(), other.Size());
+        m_impl->Record(sourceName, result);
     }
 
-    Blob::Blob(Blob&& other) noexcept : m_impl(std::move(other.m_impl))
+    void DependencyIndex::Remove(const char* sourceName)
     {
-        other.m_impl = nullptr;
+        m_impl->Remove(sourceName);
     }
 
-    Blob::~Blob() noexcept
+    Blob DependencyIndex::AffectedSources(const char* const* changedFiles, uint32_t numChangedFiles, bool compareContent,
+                                          const std::function<Blob(const char* fileName)>& loadCallback) const
     {
-        delete m_impl;
+        return m_impl->AffectedSources(changedFiles, numChangedFiles, compareContent, loadCallback);
     }
 
-    Blob& Blob::operator=(const Blob& other)
+    Blob DependencyIndex::Save() const
     {
-        if (this != &other)
+        return m_impl->Save();
+    }
+
+    void DependencyIndex::Load(const void* data, uint32_t size)
+    {
+        m_impl->Load(data, size);
+    }
+
+    CacheBackend::~CacheBackend() noexcept = default;
+
+    void CacheBackend::BatchGet(const char* const* keys, uint32_t numKeys, Blob* values, bool* found)
+    {
+        for (uint32_t i = 0; i < numKeys; ++i)
         {
-            this->Reset(other.Data(), other.Size());
+            found[i] = this->Get(keys[i], values[i]);
         }
-        return *this;
     }
 
-    Blob& Blob::operator=(Blob&& other) noexcept
+    class FileSystemCache::FileSystemCacheImpl
     {
-        if (this != &other)
+    public:
+        explicit FileSystemCacheImpl(const char* directory) : m_directory(directory)
         {
-            m_impl = std::move(other.m_impl);
-            other.m_impl = nullptr;
+            while (!m_directory.empty() && ((m_directory.back() == '/') || (m_directory.back() == '\\')))
+            {
+                m_directory.pop_back();
+            }
+            if (!MakeDirectory(m_directory))
+            {
+                throw std::runtime_error("COULDN'T create the cache directory " + m_directory + ".");
+            }
+        }
+
+        bool Get(const char* key, Blob& value)
+        {
+            if (!IsValidCacheKey(key))
+            {
+                return false;
+            }
+
+            std::ifstream file(this->FilePath(key), std::ios_base::binary);
+            if (!file)
+            {
+                return false;
+            }
+            file.seekg(0, std::ios::end);
+            std::vector<char> content(static_cast<size_t>(file.tellg()));
+            file.seekg(0, std::ios::beg);
+            file.read(content.data(), content.size());
+            if (static_cast<size_t>(file.gcount()) != content.size())
+            {
+                return false;
+            }
+
+            value.Reset(content.data(), static_cast<uint32_t>(content.size()));
+            return true;
+        }
+
+        void Put(const char* key, const Blob& value)
+        {
+            if (!IsValidCacheKey(key))
+            {
+                return;
+            }
+
+            // Two characters of sharding keep the directories small
+            const std::string shard = m_directory + "/" + std::string(key, std::min<size_t>(std::strlen(key), 2));
+            MakeDirectory(shard);
+
+            // Unique among the processes and threads sharing the directory, so readers never see a partial file
+            static std::atomic<uint32_t> counter{0};
+            const std::string path = this->FilePath(key);
+            const std::string tempPath = path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + "." +
+                                         std::to_string(reinterpret_cast<uintptr_t>(this)) + "." + std::to_string(counter++) +
+                                         ".tmp";
+            bool written;
+            {
+                std::ofstream file(tempPath, std::ios_base::binary);
+                file.write(reinterpret_cast<const char*>(value.Data()), value.Size());
+                file.close();
+                written = !file.fail();
+            }
+            if (!written)
+            {
+                // A full disk or a read-only share. The entry is skipped, like a put to an unreachable HttpCache.
+                std::remove(tempPath.c_str());
+                return;
+            }
+            if (std::rename(tempPath.c_str(), path.c_str()) != 0)
+            {
+                // On Windows the rename fails if another writer got there first. The content is the same, since the key is.
+                std::remove(tempPath.c_str());
+            }
+        }
+
+    private:
+        std::string FilePath(const char* key) const
+        {
+            return m_directory + "/" + std::string(key, std::min<size_t>(std::strlen(key), 2)) + "/" + key;
         }
-        return *this;
-    }
 
-    void Blob::Reset()
-    {
-        delete m_impl;
-        m_impl = nullptr;
-    }
+    private:
+        std::string m_directory;
+    };
 
-    void Blob::Reset(const void* data, uint32_t size)
+    FileSystemCache::FileSystemCache(const char* directory) : m_impl(new FileSystemCacheImpl(directory))
     {
-        this->Reset();
-        if ((data != nullptr) && (size > 0))
-        {
-            m_impl = new BlobImpl(data, size);
-        }
     }
 
-    const void* Blob::Data() const noexcept
+    FileSystemCache::~FileSystemCache() noexcept
     {
-        return m_impl ? m_impl->Data() : nullptr;
+        delete m_impl;
     }
 
-    uint32_t Blob::Size() const noexcept
+    bool FileSystemCache::Get(const char* key, Blob& value)
     {
-        return m_impl ? m_impl->Size() : 0;
+        return m_impl->Get(key, value);
     }
 
-
-    Compiler::ResultDesc Compiler::Compile(const SourceDesc& source, const Options& options, const TargetDesc& target)
+    void FileSystemCache::Put(const char* key, const Blob& value)
     {
-        ResultDesc result;
-        Compiler::Compile(source, options, &target, 1, &result);
-        return result;
+        m_impl->Put(key, value);
     }
 
-    void Compiler::Compile(const SourceDesc& source, const Options& options, const TargetDesc* targets, uint32_t numTargets,
-                           ResultDesc* results)
+    class HttpCache::HttpCacheImpl
     {
-        SourceDesc sourceOverride = source;
-        if (!sourceOverride.entryPoint || (std::strlen(sourceOverride.entryPoint) == 0))
-        {
-            sourceOverride.entryPoint = "main";
-        }
-        if (!sourceOverride.loadIncludeCallback)
+    public:
+        HttpCacheImpl(const char* host, uint16_t port, uint32_t timeoutMs) : m_host(host), m_port(port), m_timeoutMs(timeoutMs)
         {
-            sourceOverride.loadIncludeCallback = DefaultLoadCallback;
+            StartSockets();
         }
 
-        bool hasDxil = false;
-        bool hasDxilModule = false;
-        bool hasSpirV = false;
-        for (uint32_t i = 0; i < numTargets; ++i)
+        bool Get(const char* key, Blob& value)
         {
-            if (targets[i].language == ShadingLanguage::Dxil)
+            if (!IsValidCacheKey(key))
             {
-                hasDxil = true;
-                if (targets[i].asModule)
-                {
-                    hasDxilModule = true;
-                }
+                return false;
             }
-            else
+
+            std::vector<uint8_t> response;
+            if (this->Request("GET", std::string("/cache/") + key, nullptr, 0, response) != 200)
             {
-                hasSpirV = true;
+                return false;
             }
+            value.Reset(response.data(), static_cast<uint32_t>(response.size()));
+            return true;
         }
 
-        ResultDesc dxilBinaryResult{};
-        if (hasDxil)
+        void Put(const char* key, const Blob& value)
         {
-            dxilBinaryResult = CompileToBinary(sourceOverride, options, ShadingLanguage::Dxil, false);
-        }
+            if (!IsValidCacheKey(key))
+            {
+                return;
+            }
 
-        ResultDesc dxilModuleBinaryResult{};
-        if (hasDxilModule)
-        {
-            dxilModuleBinaryResult = CompileToBinary(sourceOverride, options, ShadingLanguage::Dxil, true);
+            std::vector<uint8_t> response;
+            this->Request("PUT", std::string("/cache/") + key, value.Data(), value.Size(), response);
         }
 
-        ResultDesc spirvBinaryResult{};
-        if (hasSpirV)
+        void BatchGet(const char* const* keys, uint32_t numKeys, Blob* values, bool* found)
         {
-            spirvBinaryResult = CompileToBinary(sourceOverride, options, ShadingLanguage::SpirV, false);
+            std::string body;
+            for (uint32_t i = 0; i < numKeys; ++i)
+            {
+                found[i] = false;
+                body += IsValidCacheKey(keys[i]) ? keys[i] : "-";
+                body += '\n';
+            }
+
+            std::vector<uint8_t> response;
+            if (this->Request("POST", "/batch", body.data(), static_cast<uint32_t>(body.size()), response) != 200)
+            {
+                return;
+            }
+
+            size_t offset = 0;
+            for (uint32_t i = 0; i < numKeys; ++i)
+            {
+                uint32_t size;
+                if (response.size() - offset < sizeof(size))
+                {
+                    break;
+                }
+                std::memcpy(&size, &response[offset], sizeof(size));
+                offset += sizeof(size);
+                if (size == HttpCacheBatchMiss)
+                {
+                    continue;
+                }
+                if (response.size() - offset < size)
+                {
+                    break;
+                }
+                values[i].Reset(&response[offset], size);
+                found[i] = true;
+                offset += size;
+            }
         }
 
-        for (uint32_t i = 0; i < numTargets; ++i)
+    private:
+        // Returns the HTTP status, or 0 if the server can't be reached
+        int Request(const char* method, const std::string& path, const void* body, uint32_t bodySize, std::vector<uint8_t>& response)
         {
-            ResultDesc binaryResult;
-            if (targets[i].language == ShadingLanguage::Dxil)
+            addrinfo hints{};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            addrinfo* addresses = nullptr;
+            if (::getaddrinfo(m_host.c_str(), std::to_string(m_port).c_str(), &hints, &addresses) != 0)
             {
-                if (targets[i].asModule)
+                return 0;
+            }
+
+            SocketHandle socket = InvalidSocket;
+            for (addrinfo* address = addresses; address != nullptr; address = address->ai_next)
+            {
+                socket = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+                if (socket == InvalidSocket)
                 {
-                    binaryResult = dxilModuleBinaryResult;
+                    continue;
                 }
-                else
+                DisableSigPipe(socket);
+                if (ConnectSocket(socket, address->ai_addr, static_cast<socklen_t>(address->ai_addrlen), m_timeoutMs))
                 {
-                    binaryResult = dxilBinaryResult;
+                    SetSocketTimeout(socket, m_timeoutMs);
+                    break;
                 }
+                CloseSocket(socket);
+                socket = InvalidSocket;
             }
-            else
+            ::freeaddrinfo(addresses);
+            if (socket == InvalidSocket)
             {
-                binaryResult = spirvBinaryResult;
+                return 0;
             }
 
-            results[i] = ConvertBinary(binaryResult, sourceOverride, options, targets[i]);
+            int status = 0;
+            std::string statusLine;
+            if (SendHttpMessage(socket, std::string(method) + " " + path + " HTTP/1.1",
+                                "Host: " + m_host + ":" + std::to_string(m_port) + "\r\n", body, bodySize) &&
+                ReceiveHttpMessage(socket, statusLine, response))
+            {
+                // HTTP/1.1 200 OK
+                const size_t space = statusLine.find(' ');
+                if (space != std::string::npos)
+                {
+                    status = std::atoi(statusLine.c_str() + space + 1);
+                }
+            }
+            CloseSocket(socket);
+
+            return status;
         }
+
+    private:
+        const std::string m_host;
+        const uint16_t m_port;
+        const uint32_t m_timeoutMs;
+    };
+
+    HttpCache::HttpCache(const char* host, uint16_t port, uint32_t timeoutMs) : m_impl(new HttpCacheImpl(host, port, timeoutMs))
+    {
     }
 
-    Compiler::ResultDesc Compiler::Disassemble(const DisassembleDesc& source)
+    HttpCache::~HttpCache() noexcept
     {
-        assert((source.language == ShadingLanguage::SpirV) || (source.language == ShadingLanguage::Dxil));
+        delete m_impl;
+    }
 
-        Compiler::ResultDesc ret;
+    bool HttpCache::Get(const char* key, Blob& value)
+    {
+        return m_impl->Get(key, value);
+    }
 
-        ret.isText = true;
+    void HttpCache::Put(const char* key, const Blob& value)
+    {
+        m_impl->Put(key, value);
+    }
 
-        if (source.language == ShadingLanguage::SpirV)
-        {
-            const uint32_t* spirvIr = reinterpret_cast<const uint32_t*>(source.binary);
-            const size_t spirvSize = source.binarySize / sizeof(uint32_t);
+    void HttpCache::BatchGet(const char* const* keys, uint32_t numKeys, Blob* values, bool* found)
+    {
+        m_impl->BatchGet(keys, numKeys, values, found);
+    }
 
-            spv_context context = spvContextCreate(SPV_ENV_UNIVERSAL_1_3);
-            uint32_t options = SPV_BINARY_TO_TEXT_OPTION_NONE | SPV_BINARY_TO_TEXT_OPTION_INDENT | SPV_BINARY_TO_TEXT_OPTION_FRIENDLY_NAMES;
-            spv_text text = nullptr;
-            spv_diagnostic diagnostic = nullptr;
+    class HttpCacheServer::HttpCacheServerImpl
+    {
+    public:
+        HttpCacheServerImpl(CacheBackend& storage, const char* address, uint16_t port) : m_storage(storage)
+        {
+            StartSockets();
 
-            spv_result_t error = spvBinaryToText(context, spirvIr, spirvSize, options, &text, &diagnostic);
-            spvContextDestroy(context);
+            sockaddr_in bindAddress{};
+            bindAddress.sin_family = AF_INET;
+            bindAddress.sin_port = htons(port);
+            if (::inet_pton(AF_INET, address, &bindAddress.sin_addr) != 1)
+            {
+                throw std::runtime_error(std::string("Invalid cache server address ") + address + ".");
+            }
 
-            if (error)
+            m_socket = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            if (m_socket == InvalidSocket)
             {
-                ret.errorWarningMsg.Reset(diagnostic->error, static_cast<uint32_t>(std::strlen(diagnostic->error)));
-                ret.hasError = true;
-                spvDiagnosticDestroy(diagnostic);
+                throw std::runtime_error("COULDN'T create the cache server socket.");
             }
-            else
+            const int reuse = 1;
+            ::setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+            sockaddr_in boundAddress{};
+            socklen_t boundAddressSize = sizeof(boundAddress);
+            if ((::bind(m_socket, reinterpret_cast<const sockaddr*>(&bindAddress), sizeof(bindAddress)) != 0) ||
+                (::listen(m_socket, SOMAXCONN) != 0) ||
+                (::getsockname(m_socket, reinterpret_cast<sockaddr*>(&boundAddress), &boundAddressSize) != 0))
             {
-                const std::string disassemble = text->str;
-                ret.target.Reset(disassemble.data(), static_cast<uint32_t>(disassemble.size()));
-                ret.hasError = false;
+                CloseSocket(m_socket);
+                throw std::runtime_error("COULDN'T listen on the cache server port " + std::to_string(port) + ".");
             }
+            m_port = ntohs(boundAddress.sin_port);
 
-            spvTextDestroy(text);
+            m_thread = std::thread([this] { this->Serve(); });
         }
-        else
+
+        ~HttpCacheServerImpl() noexcept
         {
-            CComPtr<IDxcBlobEncoding> blob;
-            CComPtr<IDxcBlobEncoding> disassembly;
-            IFT(Dxcompiler::Instance().Library()->CreateBlobWithEncodingOnHeapCopy(source.binary, source.binarySize, CP_UTF8, &blob));
-            IFT(Dxcompiler::Instance().Compiler()->Disassemble(blob, &disassembly));
+            m_stop = true;
+            m_thread.join();
+            CloseSocket(m_socket);
 
-            if (disassembly != nullptr)
+            // Wakes up the connections still waiting on their clients
+            for (auto& connection : m_connections)
             {
-                // Remove the tailing \0
-                ret.target.Reset(disassembly->GetBufferPointer(), static_cast<uint32_t>(disassembly->GetBufferSize() - 1));
-                ret.hasError = false;
+                if (!connection->done)
+                {
+                    ShutdownSocket(connection->client);
+                }
             }
-            else
+            while (!m_connections.empty())
             {
-                ret.hasError = true;
+                this->CloseConnection(m_connections.begin());
             }
         }
 
-        return ret;
-    }
+        uint16_t Port() const
+        {
+            return m_port;
+        }
 
-    bool Compiler::LinkSupport()
-    {
-        return Dxcompiler::Instance().LinkerSupport();
-    }
+    private:
+        // The client socket is only closed by the accept thread, after the connection's thread is joined, so it can be shut down from
+        // the destructor without racing a reuse of the handle
+        struct Connection
+        {
+            SocketHandle client;
+            std::thread thread;
+            std::atomic<bool> done{false};
+        };
 
-    Compiler::ResultDesc Compiler::Link(const LinkDesc& modules, const Compiler::Options& options, const TargetDesc& target)
-    {
-        auto linker = Dxcompiler::Instance().CreateLinker();
-        IFTPTR(linker);
+        void Serve()
+        {
+            while (!m_stop)
+            {
+                for (auto iter = m_connections.begin(); iter != m_connections.end();)
+                {
+                    auto next = std::next(iter);
+                    if ((*iter)->done)
+                    {
+                        this->CloseConnection(iter);
+                    }
+                    iter = next;
+                }
 
-        auto* library = Dxcompiler::Instance().Library();
+                // Wakes up now and then to see if the server is being destroyed
+                pollfd pollFd = {m_socket, POLLIN, 0};
+                if (PollSockets(&pollFd, 1, 100) <= 0)
+                {
+                    continue;
+                }
 
-        std::vector<std::wstring> moduleNames(modules.numModules);
-        std::vector<const wchar_t*> moduleNamesUtf16(modules.numModules);
-        std::vector<CComPtr<IDxcBlobEncoding>> moduleBlobs(modules.numModules);
-        for (uint32_t i = 0; i < modules.numModules; ++i)
+                const SocketHandle client = ::accept(m_socket, nullptr, nullptr);
+                if (client == InvalidSocket)
+                {
+                    continue;
+                }
+                DisableSigPipe(client);
+                SetSocketTimeout(client, ClientTimeoutMs);
+
+                // Each connection gets its own thread, so a slow or silent client doesn't hold up the others
+                std::unique_ptr<Connection> connection(new Connection);
+                connection->client = client;
+                Connection* rawConnection = connection.get();
+                try
+                {
+                    connection->thread = std::thread([this, rawConnection] {
+                        this->ServeConnection(rawConnection->client);
+                        rawConnection->done = true;
+                    });
+                }
+                catch (const std::system_error&)
+                {
+                    CloseSocket(client);
+                    continue;
+                }
+                m_connections.push_back(std::move(connection));
+            }
+        }
+
+        void ServeConnection(SocketHandle client)
         {
-            IFTARG(modules.modules[i] != nullptr);
+            try
+            {
+                this->HandleRequest(client);
+            }
+            catch (const std::exception& ex)
+            {
+                const std::string msg = ex.what();
+                SendHttpMessage(client, "HTTP/1.1 500 Internal Server Error", "", msg.data(), static_cast<uint32_t>(msg.size()));
+            }
+        }
 
-            IFT(library->CreateBlobWithEncodingOnHeapCopy(modules.modules[i]->target.Data(), modules.modules[i]->target.Size(), CP_UTF8,
-                                                          &moduleBlobs[i]));
-            IFTARG(moduleBlobs[i]->GetBufferSize() >= 4);
+        void CloseConnection(std::list<std::unique_ptr<Connection>>::iterator iter)
+        {
+            (*iter)->thread.join();
+            CloseSocket((*iter)->client);
+            m_connections.erase(iter);
+        }
 
-            Unicode::UTF8ToUTF16String(modules.modules[i]->name, &moduleNames[i]);
-            moduleNamesUtf16[i] = moduleNames[i].c_str();
-            IFT(linker->RegisterLibrary(moduleNamesUtf16[i], moduleBlobs[i]));
+        void HandleRequest(SocketHandle client)
+        {
+            std::string requestLine;
+            std::vector<uint8_t> body;
+            if (!ReceiveHttpMessage(client, requestLine, body))
+            {
+                return;
+            }
+
+            // GET /cache/<key> HTTP/1.1
+            const size_t methodEnd = requestLine.find(' ');
+            const size_t pathEnd = requestLine.find(' ', methodEnd + 1);
+            if ((methodEnd == std::string::npos) || (pathEnd == std::string::npos))
+            {
+                SendHttpMessage(client, "HTTP/1.1 400 Bad Request", "", nullptr, 0);
+                return;
+            }
+            const std::string method = requestLine.substr(0, methodEnd);
+            const std::string path = requestLine.substr(methodEnd + 1, pathEnd - methodEnd - 1);
+
+            static const std::string cachePrefix = "/cache/";
+            if ((path.compare(0, cachePrefix.size(), cachePrefix) == 0) && IsValidCacheKey(path.c_str() + cachePrefix.size()))
+            {
+                const char* key = path.c_str() + cachePrefix.size();
+                if (method == "GET")
+                {
+                    Blob value;
+                    if (m_storage.Get(key, value))
+                    {
+                        SendHttpMessage(client, "HTTP/1.1 200 OK", "Content-Type: application/octet-stream\r\n", value.Data(),
+                                        value.Size());
+                    }
+                    else
+                    {
+                        SendHttpMessage(client, "HTTP/1.1 404 Not Found", "", nullptr, 0);
+                    }
+                    return;
+                }
+                if (method == "PUT")
+                {
+                    m_storage.Put(key, Blob(body.data(), static_cast<uint32_t>(body.size())));
+                    SendHttpMessage(client, "HTTP/1.1 204 No Content", "", nullptr, 0);
+                    return;
+                }
+            }
+            else if ((path == "/batch") && (method == "POST"))
+            {
+                std::vector<std::string> keys;
+                std::string line;
+                for (uint8_t ch : body)
+                {
+                    if (ch == '\n')
+                    {
+                        keys.push_back(line);
+                        line.clear();
+                    }
+                    else if (ch != '\r')
+                    {
+                        line += static_cast<char>(ch);
+                    }
+                }
+                if (!line.empty())
+                {
+                    keys.push_back(line);
+                }
+
+                std::vector<const char*> keyStrs;
+                for (const auto& key : keys)
+                {
+                    keyStrs.push_back(key.c_str());
+                }
+                std::vector<Blob> values(keys.size());
+                std::unique_ptr<bool[]> found(new bool[keys.size() + 1]);
+                m_storage.BatchGet(keyStrs.data(), static_cast<uint32_t>(keys.size()), values.data(), found.get());
+
+                std::vector<uint8_t> response;
+                for (size_t i = 0; i < keys.size(); ++i)
+                {
+                    const uint32_t size = found[i] ? values[i].Size() : HttpCacheBatchMiss;
+                    const uint8_t* sizeBytes = reinterpret_cast<const uint8_t*>(&size);
+                    response.insert(response.end(), sizeBytes, sizeBytes + sizeof(size));
+                    if (found[i])
+                    {
+                        const uint8_t* data = reinterpret_cast<const uint8_t*>(values[i].Data());
+                        response.insert(response.end(), data, data + values[i].Size());
+                    }
+                }
+                SendHttpMessage(client, "HTTP/1.1 200 OK", "Content-Type: application/octet-stream\r\n", response.data(),
+                                static_cast<uint32_t>(response.size()));
+                return;
+            }
+
+            SendHttpMessage(client, "HTTP/1.1 404 Not Found", "", nullptr, 0);
         }
 
-        std::wstring entryPointUtf16;
-        Unicode::UTF8ToUTF16String(modules.entryPoint, &entryPointUtf16);
+    private:
+        CacheBackend& m_storage;
+        SocketHandle m_socket = InvalidSocket;
+        uint16_t m_port = 0;
 
-        const std::wstring shaderProfile = ShaderProfileName(modules.stage, options.shaderModel);
-        CComPtr<IDxcOperationResult> linkResult;
-        IFT(linker->Link(entryPointUtf16.c_str(), shaderProfile.c_str(), moduleNamesUtf16.data(),
-                         static_cast<UINT32>(moduleNamesUtf16.size()), nullptr, 0, &linkResult));
+        std::atomic<bool> m_stop{false};
+        std::thread m_thread;
 
-        Compiler::ResultDesc binaryResult{};
-        ConvertDxcResult(binaryResult, linkResult, ShadingLanguage::Dxil, false);
+        // Only touched by the accept thread, and by the destructor once that thread is joined
+        std::list<std::unique_ptr<Connection>> m_connections;
 
-        Compiler::SourceDesc source{};
-        source.entryPoint = modules.entryPoint;
-        source.stage = modules.stage;
-        return ConvertBinary(binaryResult, source, options, target);
+        static const uint32_t ClientTimeoutMs = 10000;
+    };
+
+    HttpCacheServer::HttpCacheServer(CacheBackend& storage, const char* address, uint16_t port)
+        : m_impl(new HttpCacheServerImpl(storage, address, port))
+    {
+    }
+
+    HttpCacheServer::~HttpCacheServer() noexcept
+    {
+        delete m_impl;
+    }
+
+    uint16_t HttpCacheServer::Port() const
+    {
+        return m_impl->Port();
     }
 } // namespace ShaderConductor
 
@@ -0,0 +1,23 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+cbuffer cbFrame : register(b0, space0)
+{
+    float4 tint;
+};
+
+Texture2D frameTex : register(t0, space0);
+SamplerState frameSampler : register(s0, space0);
+
+cbuffer cbMaterial : register(b0, space1)
+{
+    float4 materialColor;
+};
+
+SamplerState materialSampler : register(s0, space1);
+Texture2D materialTex : register(t1, space1);
+
+float4 main(float2 tex : TEXCOORD0) : SV_Target
+{
+    return frameTex.Sample(frameSampler, tex) * materialTex.Sample(materialSampler, tex) * tint * materialColor;
+}
@@ -0,0 +1,24 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+cbuffer cbUnused : register(b0)
+{
+    float4 unusedColor;
+};
+
+cbuffer cbUsed : register(b3)
+{
+    float4 tint;
+};
+
+Texture2D unusedTex : register(t1);
+Texture2D albedoTex : register(t4);
+Texture2D detailTex : register(t7);
+
+SamplerState unusedSampler : register(s0);
+SamplerState linearSampler : register(s2);
+
+float4 main(float2 tex : TEXCOORD0) : SV_Target
+{
+    return albedoTex.Sample(linearSampler, tex) * detailTex.Sample(linearSampler, tex * 8) * tint;
+}
@@ -0,0 +1,12 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+cbuffer HalfParams
+{
+	half4 halfTint;
+};
+
+float4 main() : SV_Target0
+{
+	return halfTint;
+}
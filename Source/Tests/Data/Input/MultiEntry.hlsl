@@ -0,0 +1,32 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include "Common.hlsli"
+
+struct VSOutput
+{
+    float4 pos : SV_Position;
+    float2 tex : TEXCOORD0;
+};
+
+Texture2D colorTex : register(t0);
+
+// Expands differently per entry point, the shared preprocessing must honor each stage's profile
+#if __SHADER_TARGET_STAGE == __SHADER_STAGE_PIXEL
+#define STAGE_SCALE 0.5f
+#else
+#define STAGE_SCALE 2.0f
+#endif
+
+VSOutput VSMain(float4 pos : POSITION, float2 tex : TEXCOORD0)
+{
+    VSOutput output;
+    output.pos = pos * STAGE_SCALE;
+    output.tex = tex;
+    return output;
+}
+
+float4 PSMain(VSOutput input) : SV_Target
+{
+    return colorTex.Sample(pointSampler, input.tex) * STAGE_SCALE;
+}
@@ -0,0 +1,35 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+struct VSOutput
+{
+    float4 pos : SV_Position;
+    float3 normal : NORMAL;
+    float4 color : COLOR0;
+    float2 tex : TEXCOORD0;
+    float fog : FOG;
+};
+
+VSOutput VSMain(float4 pos : POSITION, float3 normal : NORMAL, float4 color : COLOR0, float2 tex : TEXCOORD0)
+{
+    VSOutput output;
+    output.pos = pos;
+    output.normal = normal;
+    output.color = color;
+    output.tex = tex;
+    output.fog = pos.z * 0.01f;
+    return output;
+}
+
+Texture2D colorTex : register(t0);
+SamplerState linearSampler : register(s0);
+
+float4 PSMain(float4 color : COLOR0, float2 tex : TEXCOORD0) : SV_Target
+{
+    return colorTex.Sample(linearSampler, tex) * color;
+}
+
+float4 PSMismatch(float4 color : COLOR0, float3 tangent : TANGENT) : SV_Target
+{
+    return color + float4(tangent, 0);
+}
@@ -0,0 +1,111 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+struct VSOutput
+{
+    float4 pos : POSITION;
+    float3 normal : NORMAL;
+    float2 tex : TEXCOORD0;
+};
+
+VSOutput VSMain(float4 pos : POSITION, float3 normal : NORMAL, float2 tex : TEXCOORD0)
+{
+    VSOutput output;
+    output.pos = pos;
+    output.normal = normal;
+    output.tex = tex;
+    return output;
+}
+
+// The DS doesn't read NORMAL
+struct HSOutput
+{
+    float4 pos : POSITION;
+    float3 normal : NORMAL;
+    float2 tex : TEXCOORD0;
+};
+
+// The DS doesn't read AREA
+struct HSPatchOutput
+{
+    float edges[3] : SV_TessFactor;
+    float inside : SV_InsideTessFactor;
+    float3 center : CENTER;
+    float area : AREA;
+};
+
+HSPatchOutput PatchMain(InputPatch<VSOutput, 3> patch)
+{
+    HSPatchOutput output;
+    output.edges[0] = 4;
+    output.edges[1] = 4;
+    output.edges[2] = 4;
+    output.inside = 4;
+    output.center = (patch[0].pos.xyz + patch[1].pos.xyz + patch[2].pos.xyz) / 3;
+    output.area = length(cross(patch[1].pos.xyz - patch[0].pos.xyz, patch[2].pos.xyz - patch[0].pos.xyz)) / 2;
+    return output;
+}
+
+[domain("tri")]
+[partitioning("integer")]
+[outputtopology("triangle_cw")]
+[outputcontrolpoints(3)]
+[patchconstantfunc("PatchMain")]
+HSOutput HSMain(InputPatch<VSOutput, 3> patch, uint id : SV_OutputControlPointID)
+{
+    HSOutput output;
+    output.pos = patch[id].pos;
+    output.normal = patch[id].normal;
+    output.tex = patch[id].tex;
+    return output;
+}
+
+struct DSPatchInput
+{
+    float edges[3] : SV_TessFactor;
+    float inside : SV_InsideTessFactor;
+    float3 center : CENTER;
+};
+
+// The PS doesn't read CENTER after the GS
+struct DSOutput
+{
+    float4 pos : POSITION;
+    float2 tex : TEXCOORD0;
+    float3 center : CENTER;
+};
+
+[domain("tri")]
+DSOutput DSMain(DSPatchInput patchInput, float3 uvw : SV_DomainLocation, const OutputPatch<HSOutput, 3> patch)
+{
+    DSOutput output;
+    output.pos = patch[0].pos * uvw.x + patch[1].pos * uvw.y + patch[2].pos * uvw.z;
+    output.tex = patch[0].tex * uvw.x + patch[1].tex * uvw.y + patch[2].tex * uvw.z;
+    output.center = patchInput.center;
+    return output;
+}
+
+struct GSOutput
+{
+    float4 pos : SV_Position;
+    float2 tex : TEXCOORD0;
+    float3 center : CENTER;
+};
+
+[maxvertexcount(3)]
+void GSMain(triangle DSOutput input[3], inout TriangleStream<GSOutput> stream)
+{
+    for (uint i = 0; i < 3; ++i)
+    {
+        GSOutput output;
+        output.pos = input[i].pos;
+        output.tex = input[i].tex;
+        output.center = input[i].center;
+        stream.Append(output);
+    }
+}
+
+float4 PSMain(float2 tex : TEXCOORD0) : SV_Target
+{
+    return float4(tex, 0, 1);
+}
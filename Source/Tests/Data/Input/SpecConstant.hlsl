@@ -0,0 +1,15 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+Texture2D colorTex : register(t0);
+SamplerState pointSampler : register(s0);
+
+float4 main(float2 tex : TEXCOORD0) : SV_Target
+{
+    float4 color = colorTex.Sample(pointSampler, tex);
+    if (USE_TINT)
+    {
+        color.rgb *= TINT_SCALE;
+    }
+    return color;
+}
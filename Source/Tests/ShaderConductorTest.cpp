@@ -26,17 +26,41 @@
 #include <ShaderConductor/ShaderConductor.hpp>
 
 #include <gtest/gtest.h>
+#include <spirv-tools/libspirv.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <tuple>
+#include <unordered_map>
 #include <vector>
 
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <unistd.h>
+#endif
+
 using namespace ShaderConductor;
 
 namespace
 {
+    // Set from the command line in main
+    bool updateBaselines = false; // --update-baselines records the cost baselines instead of checking them
+    double costThreshold = 0.05;  // --cost-threshold=<percent>, how much a metric may grow over its baseline
+
     std::vector<uint8_t> LoadFile(const std::string& name, bool isText)
     {
         std::vector<uint8_t> ret;
@@ -57,6 +81,33 @@ namespace
         return ret;
     }
 
+    std::string TempDirectory()
+    {
+        for (const char* name : {"TMPDIR", "TEMP", "TMP"})
+        {
+            const char* dir = std::getenv(name);
+            if ((dir != nullptr) && (dir[0] != '\0'))
+            {
+                return dir;
+            }
+        }
+#ifdef _WIN32
+        return ".";
+#else
+        return "/tmp";
+#endif
+    }
+
+    // Only removes empty directories
+    void RemoveEmptyDirectory(const std::string& path)
+    {
+#ifdef _WIN32
+        _rmdir(path.c_str());
+#else
+        rmdir(path.c_str());
+#endif
+    }
+
     void CompareWithExpected(const std::vector<uint8_t>& actual, bool isText, const std::string& compareName)
     {
         std::vector<uint8_t> expected = LoadFile(TEST_DATA_DIR "Expected/" + compareName, isText);
@@ -77,6 +128,86 @@ namespace
         EXPECT_EQ(std::string(expected.begin(), expected.end()), std::string(actual.begin(), actual.end()));
     }
 
+    // Output size and the cost report, in baseline file order
+    std::vector<std::pair<std::string, uint32_t>> CostMetrics(const Compiler::ResultDesc& result)
+    {
+        const Compiler::CostReport& cost = result.cost;
+        return {
+            {"size", result.target.Size()},
+            {"totalInstructions", cost.totalInstructions},
+            {"aluInstructions", cost.aluInstructions},
+            {"textureSamples", cost.textureSamples},
+            {"textureFetches", cost.textureFetches},
+            {"loads", cost.loads},
+            {"stores", cost.stores},
+            {"atomics", cost.atomics},
+            {"barriers", cost.barriers},
+            {"branches", cost.branches},
+            {"loops", cost.loops},
+            {"temporaries", cost.temporaries},
+            {"maxLiveValues", cost.maxLiveValues},
+            {"inputComponents", cost.inputComponents},
+            {"outputComponents", cost.outputComponents},
+        };
+    }
+
+    // Fails on any metric that grew more than costThreshold over Baseline/<compareName>.cost, or that the baseline doesn't have, and
+    // writes the new metrics to Result/.
+    void CompareWithBaseline(const Compiler::ResultDesc& result, const std::string& compareName)
+    {
+        const auto metrics = CostMetrics(result);
+        std::string metricsText;
+        for (const auto& metric : metrics)
+        {
+            metricsText += metric.first + " " + std::to_string(metric.second) + "\n";
+        }
+
+        const std::string baselineName = TEST_DATA_DIR "Baseline/" + compareName + ".cost";
+        if (updateBaselines)
+        {
+            std::ofstream baselineFile(baselineName);
+            baselineFile << metricsText;
+            EXPECT_TRUE(static_cast<bool>(baselineFile)) << "Couldn't write " << baselineName;
+            return;
+        }
+
+        std::unordered_map<std::string, uint32_t> baseline;
+        std::ifstream baselineFile(baselineName);
+        EXPECT_TRUE(static_cast<bool>(baselineFile)) << compareName << ": no cost baseline, record it with --update-baselines";
+        std::string name;
+        uint32_t value;
+        while (baselineFile >> name >> value)
+        {
+            baseline[name] = value;
+        }
+
+        bool regressed = false;
+        for (const auto& metric : metrics)
+        {
+            const auto iter = baseline.find(metric.first);
+            if (iter == baseline.end())
+            {
+                if (baselineFile.is_open())
+                {
+                    ADD_FAILURE() << compareName << ": " << metric.first << " is missing from the cost baseline";
+                }
+                regressed = true;
+                continue;
+            }
+
+            const double limit = iter->second * (1 + costThreshold);
+            EXPECT_LE(metric.second, limit) << compareName << ": " << metric.first << " regressed from " << iter->second << " to "
+                                            << metric.second;
+            regressed |= (metric.second > limit);
+        }
+
+        if (regressed)
+        {
+            std::ofstream actualFile(TEST_DATA_DIR "Result/" + compareName + ".cost");
+            actualFile << metricsText;
+        }
+    }
+
     void HlslToAnyTest(const std::string& name, const Compiler::SourceDesc& source, const Compiler::Options& options,
                        const std::vector<Compiler::TargetDesc>& targets, const std::vector<bool>& expectSuccessFlags)
     {
@@ -84,8 +215,11 @@ namespace
         static_assert(sizeof(extMap) / sizeof(extMap[0]) == static_cast<uint32_t>(ShadingLanguage::NumShadingLanguages),
                       "extMap doesn't match with the number of shading languages.");
 
+        Compiler::Options costOptions = options;
+        costOptions.costReport = true;
+
         std::vector<Compiler::ResultDesc> results(targets.size());
-        Compiler::Compile(source, options, targets.data(), static_cast<uint32_t>(targets.size()), results.data());
+        Compiler::Compile(source, costOptions, targets.data(), static_cast<uint32_t>(targets.size()), results.data());
         for (size_t i = 0; i < targets.size(); ++i)
         {
             const auto& result = results[i];
@@ -104,6 +238,7 @@ namespace
 
                 const uint8_t* target_ptr = reinterpret_cast<const uint8_t*>(result.target.Data());
                 CompareWithExpected(std::vector<uint8_t>(target_ptr, target_ptr + result.target.Size()), result.isText, compareName);
+                CompareWithBaseline(result, compareName);
             }
             else
             {
@@ -596,6 +731,88 @@ namespace
         CompareWithExpected(std::vector<uint8_t>(target_ptr, target_ptr + result.target.Size()), result.isText, "HalfOutParamPS.glsl");
     }
 
+    TEST(HalfDataTypeTest, Float16AsMediump)
+    {
+        const std::string fileName = TEST_DATA_DIR "Input/HalfDataType.hlsl";
+
+        std::vector<uint8_t> input = LoadFile(fileName, true);
+        const std::string source = std::string(reinterpret_cast<char*>(input.data()), input.size());
+
+        Compiler::Options option;
+        option.shaderModel = {6, 2};
+        option.enable16bitTypes = true;
+        option.disableOptimizations = true; // Keep the half locals from being folded away
+        option.float16AsMediump = true;
+
+        const Compiler::TargetDesc targets[] = {{ShadingLanguage::Essl, "310"}, {ShadingLanguage::Msl_iOS, ""}};
+        Compiler::ResultDesc results[2];
+        Compiler::Compile({source.c_str(), fileName.c_str(), "DotHalfPS", ShaderStage::PixelShader}, option, targets, 2, results);
+        for (const auto& result : results)
+        {
+            EXPECT_FALSE(result.hasError);
+            EXPECT_TRUE(result.isText);
+        }
+
+        const std::string essl(reinterpret_cast<const char*>(results[0].target.Data()), results[0].target.Size());
+        EXPECT_EQ(essl.find("float16_t"), std::string::npos);
+        EXPECT_NE(essl.find("mediump vec3"), std::string::npos);
+
+        const std::string msl(reinterpret_cast<const char*>(results[1].target.Data()), results[1].target.Size());
+        EXPECT_NE(msl.find("half3"), std::string::npos);
+
+        // Widening a cbuffer member would move the ones after it
+        const std::string cbufferFileName = TEST_DATA_DIR "Input/HalfCBuffer.hlsl";
+        input = LoadFile(cbufferFileName, true);
+        const std::string cbufferSource = std::string(reinterpret_cast<char*>(input.data()), input.size());
+        Compiler::Compile({cbufferSource.c_str(), cbufferFileName.c_str(), "main", ShaderStage::PixelShader}, option, targets, 2,
+                          results);
+        EXPECT_TRUE(results[0].hasError);
+        const std::string error(reinterpret_cast<const char*>(results[0].errorWarningMsg.Data()), results[0].errorWarningMsg.Size());
+        EXPECT_NE(error.find("float16AsMediump"), std::string::npos);
+        EXPECT_FALSE(results[1].hasError);
+    }
+
+    TEST(HalfDataTypeTest, DefaultPrecision)
+    {
+        const std::string fileName = TEST_DATA_DIR "Input/HalfDataType.hlsl";
+
+        std::vector<uint8_t> input = LoadFile(fileName, true);
+        const std::string source = std::string(reinterpret_cast<char*>(input.data()), input.size());
+
+        const Compiler::SourceDesc sourceDesc = {source.c_str(), fileName.c_str(), "HalfOutParamPS", ShaderStage::PixelShader};
+        const Compiler::TargetDesc target = {ShadingLanguage::Essl, "300"};
+
+        const auto defaultResult = Compiler::Compile(sourceDesc, {}, target);
+        EXPECT_FALSE(defaultResult.hasError);
+        const std::string defaultEssl(reinterpret_cast<const char*>(defaultResult.target.Data()), defaultResult.target.Size());
+        EXPECT_NE(defaultEssl.find("precision mediump float;"), std::string::npos);
+
+        Compiler::Options option;
+        option.defaultFloatPrecision[static_cast<uint32_t>(ShaderStage::PixelShader)] = FloatPrecision::High;
+        const auto highResult = Compiler::Compile(sourceDesc, option, target);
+        EXPECT_FALSE(highResult.hasError);
+        const std::string highEssl(reinterpret_cast<const char*>(highResult.target.Data()), highResult.target.Size());
+        EXPECT_NE(highEssl.find("precision highp float;"), std::string::npos);
+        EXPECT_EQ(highEssl.find("precision mediump float;"), std::string::npos);
+
+        // Other stages get a header line
+        const std::string vsFileName = TEST_DATA_DIR "Input/PassThrough_VS.hlsl";
+        input = LoadFile(vsFileName, true);
+        const std::string vsSource = std::string(reinterpret_cast<char*>(input.data()), input.size());
+        const Compiler::SourceDesc vsDesc = {vsSource.c_str(), vsFileName.c_str(), "VSMain", ShaderStage::VertexShader};
+
+        const auto vsDefaultResult = Compiler::Compile(vsDesc, {}, target);
+        EXPECT_FALSE(vsDefaultResult.hasError);
+        const std::string vsDefaultEssl(reinterpret_cast<const char*>(vsDefaultResult.target.Data()), vsDefaultResult.target.Size());
+        EXPECT_EQ(vsDefaultEssl.find("precision mediump float;"), std::string::npos);
+
+        option.defaultFloatPrecision[static_cast<uint32_t>(ShaderStage::VertexShader)] = FloatPrecision::Medium;
+        const auto vsMediumResult = Compiler::Compile(vsDesc, option, target);
+        EXPECT_FALSE(vsMediumResult.hasError);
+        const std::string vsMediumEssl(reinterpret_cast<const char*>(vsMediumResult.target.Data()), vsMediumResult.target.Size());
+        EXPECT_NE(vsMediumEssl.find("precision mediump float;"), std::string::npos);
+    }
+
     TEST(LinkTest, LinkDxil)
     {
         if (!Compiler::LinkSupport())
@@ -641,11 +858,1559 @@ namespace
                                 expectedNames[i]);
         }
     }
-} // namespace
 
-int main(int argc, char** argv)
-{
-    testing::InitGoogleTest(&argc, argv);
+    TEST(LinkTest, LinkerSession)
+    {
+        if (!Compiler::LinkSupport())
+        {
+            GTEST_SKIP_("Link is not supported on this platform");
+        }
+
+        const Compiler::TargetDesc target = {ShadingLanguage::Dxil, "", true};
+        const Compiler::ModuleDesc dxilModules[] = {
+            CompileToModule("CalcLight", TEST_DATA_DIR "Input/CalcLight.hlsl", target),
+            CompileToModule("CalcLightDiffuse", TEST_DATA_DIR "Input/CalcLightDiffuse.hlsl", target),
+            CompileToModule("CalcLightDiffuseSpecular", TEST_DATA_DIR "Input/CalcLightDiffuseSpecular.hlsl", target),
+        };
+
+        LinkerSession session;
+        for (const auto& module : dxilModules)
+        {
+            session.RegisterModule(module);
+        }
+        EXPECT_THROW(session.RegisterModule(dxilModules[0]), std::runtime_error);
+
+        const char* testModuleNames[][2] = {
+            {"CalcLight", "CalcLightDiffuse"},
+            {"CalcLight", "CalcLightDiffuseSpecular"},
+        };
+        const Compiler::ModuleDesc* testModules[][2] = {
+            {&dxilModules[0], &dxilModules[1]},
+            {&dxilModules[0], &dxilModules[2]},
+        };
+
+        Compiler::ResultDesc expected[2];
+        for (size_t i = 0; i < 2; ++i)
+        {
+            expected[i] = Compiler::Link({"main", ShaderStage::PixelShader, testModules[i], 2}, {}, {ShadingLanguage::Dxil, ""});
+        }
+
+        Compiler::ResultDesc results[8];
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < 8; ++i)
+        {
+            threads.emplace_back([&, i] {
+                results[i] = session.Link("main", ShaderStage::PixelShader, testModuleNames[i % 2], 2, {}, {ShadingLanguage::Dxil, ""});
+            });
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        for (size_t i = 0; i < 8; ++i)
+        {
+            EXPECT_FALSE(results[i].hasError);
+            ASSERT_EQ(results[i].target.Size(), expected[i % 2].target.Size());
+            EXPECT_EQ(std::memcmp(results[i].target.Data(), expected[i % 2].target.Data(), results[i].target.Size()), 0);
+        }
+    }
+
+    const Compiler::ReflectionDesc* FindReflectionDesc(const Compiler::ReflectionResultDesc& reflection, const char* name)
+    {
+        const auto* descs = reinterpret_cast<const Compiler::ReflectionDesc*>(reflection.descs.Data());
+        for (uint32_t i = 0; i < reflection.descCount; ++i)
+        {
+            if (std::string(descs[i].name) == name)
+            {
+                return &descs[i];
+            }
+        }
+        return nullptr;
+    }
+
+    TEST(ReflectionTest, SpirvReflection)
+    {
+        const std::string fileName = TEST_DATA_DIR "Input/ToneMapping_PS.hlsl";
+
+        std::vector<uint8_t> input = LoadFile(fileName, true);
+        const std::string source = std::string(reinterpret_cast<char*>(input.data()), input.size());
+
+        const Compiler::TargetDesc targets[] = {{ShadingLanguage::SpirV}, {ShadingLanguage::Glsl, "410"}, {ShadingLanguage::Essl, "300"}};
+        Compiler::ResultDesc results[sizeof(targets) / sizeof(targets[0])];
+        Compiler::Compile({source.c_str(), fileName.c_str(), "", ShaderStage::PixelShader}, {}, targets,
+                          static_cast<uint32_t>(sizeof(targets) / sizeof(targets[0])), results);
+
+        for (const auto& result : results)
+        {
+            EXPECT_FALSE(result.hasError);
+            EXPECT_EQ(result.reflection.descCount, 6U);
+
+            const auto* cbuffer = FindReflectionDesc(result.reflection, "cbPS");
+            ASSERT_NE(cbuffer, nullptr);
+            EXPECT_EQ(cbuffer->type, ShaderResourceType::ConstantBuffer);
+            EXPECT_EQ(cbuffer->bufferBindPoint, 0U);
+
+            const char* textureNames[] = {"colorTex", "lumTex", "bloomTex"};
+            for (uint32_t i = 0; i < 3; ++i)
+            {
+                const auto* texture = FindReflectionDesc(result.reflection, textureNames[i]);
+                ASSERT_NE(texture, nullptr);
+                EXPECT_EQ(texture->type, ShaderResourceType::Texture);
+                EXPECT_EQ(texture->bindPoint, i);
+                EXPECT_EQ(texture->bindCount, 1U);
+            }
+
+            const auto* sampler = FindReflectionDesc(result.reflection, "linearSampler");
+            ASSERT_NE(sampler, nullptr);
+            EXPECT_EQ(sampler->type, ShaderResourceType::Sampler);
+            EXPECT_EQ(sampler->bindPoint, 1U);
+        }
+    }
+
+    TEST(ReflectionTest, SpirvStructuredBuffers)
+    {
+        const std::string fileName = TEST_DATA_DIR "Input/Fluid_CS.hlsl";
+
+        std::vector<uint8_t> input = LoadFile(fileName, true);
+        const std::string source = std::string(reinterpret_cast<char*>(input.data()), input.size());
+
+        const auto result =
+            Compiler::Compile({source.c_str(), fileName.c_str(), "", ShaderStage::ComputeShader}, {}, {ShadingLanguage::Glsl, "410"});
+        EXPECT_FALSE(result.hasError);
+
+        const auto* particlesRW = FindReflectionDesc(result.reflection, "particlesRW");
+        ASSERT_NE(particlesRW, nullptr);
+        EXPECT_EQ(particlesRW->type, ShaderResourceType::UnorderedAccessView);
+
+        const auto* particlesRO = FindReflectionDesc(result.reflection, "particlesRO");
+        ASSERT_NE(particlesRO, nullptr);
+        EXPECT_EQ(particlesRO->type, ShaderResourceType::ShaderResourceView);
+
+        const auto* particlesForcesRO = FindReflectionDesc(result.reflection, "particlesForcesRO");
+        ASSERT_NE(particlesForcesRO, nullptr);
+        EXPECT_EQ(particlesForcesRO->type, ShaderResourceType::ShaderResourceView);
+        EXPECT_EQ(particlesForcesRO->bindPoint, 2U);
+    }
+
+    TEST(ReflectionTest, CompactReflection)
+    {
+        const std::string fileName = TEST_DATA_DIR "Input/ToneMapping_PS.hlsl";
+
+        std::vector<uint8_t> input = LoadFile(fileName, true);
+        const std::string source = std::string(reinterpret_cast<char*>(input.data()), input.size());
+
+        const auto result =
+            Compiler::Compile({source.c_str(), fileName.c_str(), "", ShaderStage::PixelShader}, {}, {ShadingLanguage::Glsl, "410"});
+        EXPECT_FALSE(result.hasError);
+
+        const Compiler::CompactReflectionView compactView(result.reflection.compactDescs);
+        ASSERT_EQ(compactView.Count(), result.reflection.descCount);
+        EXPECT_LT(result.reflection.compactDescs.Size(), result.reflection.descs.Size());
+
+        const auto* descs = reinterpret_cast<const Compiler::ReflectionDesc*>(result.reflection.descs.Data());
+        for (uint32_t i = 0; i < compactView.Count(); ++i)
+        {
+            EXPECT_STREQ(compactView.Name(compactView[i]), descs[i].name);
+            EXPECT_EQ(compactView[i].type, descs[i].type);
+            EXPECT_EQ(compactView[i].bufferBindPoint, descs[i].bufferBindPoint);
+            EXPECT_EQ(compactView[i].bindPoint, descs[i].bindPoint);
+            EXPECT_EQ(compactView[i].bindCount, descs[i].bindCount);
+        }
+
+        Compiler::Options options;
+        options.compactReflectionOnly = true;
+        const auto compactResult =
+            Compiler::Compile({source.c_str(), fileName.c_str(), "", ShaderStage::PixelShader}, options, {ShadingLanguage::Glsl, "410"});
+        EXPECT_FALSE(compactResult.hasError);
+        EXPECT_EQ(compactResult.reflection.descs.Size(), 0U);
+        EXPECT_EQ(compactResult.reflection.descCount, 0U);
+        EXPECT_EQ(Compiler::CompactReflectionView(compactResult.reflection.compactDescs).Count(), result.reflection.descCount);
+        EXPECT_EQ(compactResult.reflection.compactDescs.Size(), result.reflection.compactDescs.Size());
+
+        // Counts or a string table that run past the blob read as empty
+        const uint8_t* compactData = reinterpret_cast<const uint8_t*>(result.reflection.compactDescs.Data());
+        const std::vector<uint8_t> original(compactData, compactData + result.reflection.compactDescs.Size());
+        Compiler::CompactReflectionHeader header;
+        std::memcpy(&header, original.data(), sizeof(header));
+        const auto viewWith = [&original](const Compiler::CompactReflectionHeader& newHeader, uint32_t size) {
+            std::vector<uint8_t> bytes = original;
+            std::memcpy(bytes.data(), &newHeader, sizeof(newHeader));
+            return Blob(bytes.data(), size);
+        };
+        const uint32_t fullSize = static_cast<uint32_t>(original.size());
+
+        Compiler::CompactReflectionHeader badHeader = header;
+        badHeader.bindingCount = 0x10000000;
+        EXPECT_EQ(Compiler::CompactReflectionView(viewWith(badHeader, fullSize)).Count(), 0U);
+
+        badHeader = header;
+        badHeader.stringTableSize += 16;
+        const Blob badStrings = viewWith(badHeader, fullSize);
+        const Compiler::CompactReflectionView badStringsView(badStrings);
+        EXPECT_EQ(badStringsView.Count(), 0U);
+        EXPECT_STREQ(badStringsView.String(0), "");
+
+        EXPECT_EQ(Compiler::CompactReflectionView(viewWith(header, fullSize - 1)).Count(), 0U);
+        EXPECT_EQ(Compiler::CompactReflectionView(viewWith(header, fullSize)).Count(), result.reflection.descCount);
+    }
+
+    TEST(ReflectionTest, RichReflection)
+    {
+        {
+            const std::string fileName = TEST_DATA_DIR "Input/Fluid_CS.hlsl";
+
+            std::vector<uint8_t> input = LoadFile(fileName, true);
+            const std::string source = std::string(reinterpret_cast<char*>(input.data()), input.size());
+
+            const auto result =
+                Compiler::Compile({source.c_str(), fileName.c_str(), "", ShaderStage::ComputeShader}, {}, {ShadingLanguage::Glsl, "410"});
+            EXPECT_FALSE(result.hasError);
+
+            const Compiler::CompactReflectionView compactView(result.reflection.compactDescs);
+            EXPECT_EQ(compactView.WorkgroupSize(0), 256U);
+            EXPECT_EQ(compactView.WorkgroupSize(1), 1U);
+            EXPECT_EQ(compactView.WorkgroupSize(2), 1U);
+            EXPECT_EQ(compactView.WorkgroupSize(3), 0U);
+
+            bool foundTimeStep = false;
+            bool foundGravity = false;
+            bool foundPlanes = false;
+            for (uint32_t i = 0; i < compactView.MemberCount(); ++i)
+            {
+                const auto& member = compactView.Members()[i];
+                const std::string name = compactView.Name(member);
+                if (name == "timeStep")
+                {
+                    foundTimeStep = true;
+                    EXPECT_EQ(member.offset, 0U);
+                    EXPECT_EQ(member.size, 4U);
+                    EXPECT_EQ(member.dataType, ShaderDataType::Float);
+                }
+                else if (name == "gravity")
+                {
+                    foundGravity = true;
+                    EXPECT_EQ(member.offset, 16U);
+                    EXPECT_EQ(member.columns, 4U);
+                }
+                else if (name == "planes")
+                {
+                    foundPlanes = true;
+                    EXPECT_EQ(member.columns, 3U);
+                    EXPECT_EQ(member.elements, 4U);
+                }
+            }
+            EXPECT_TRUE(foundTimeStep);
+            EXPECT_TRUE(foundGravity);
+            EXPECT_TRUE(foundPlanes);
+        }
+        {
+            const std::string fileName = TEST_DATA_DIR "Input/ToneMapping_PS.hlsl";
+
+            std::vector<uint8_t> input = LoadFile(fileName, true);
+            const std::string source = std::string(reinterpret_cast<char*>(input.data()), input.size());
+
+            const auto result =
+                Compiler::Compile({source.c_str(), fileName.c_str(), "", ShaderStage::PixelShader}, {}, {ShadingLanguage::Glsl, "410"});
+            EXPECT_FALSE(result.hasError);
+
+            const Compiler::CompactReflectionView compactView(result.reflection.compactDescs);
+            EXPECT_EQ(compactView.WorkgroupSize(0), 0U);
+
+            bool foundTexCoord = false;
+            for (uint32_t i = 0; i < compactView.InputCount(); ++i)
+            {
+                const auto& param = compactView.Inputs()[i];
+                if (std::string(compactView.Semantic(param)) == "TEXCOORD")
+                {
+                    foundTexCoord = true;
+                    EXPECT_EQ(param.semanticIndex, 0U);
+                    EXPECT_EQ(param.dataType, ShaderDataType::Float);
+                    EXPECT_EQ(param.columns, 2U);
+                }
+            }
+            EXPECT_TRUE(foundTexCoord);
+            EXPECT_GE(compactView.OutputCount(), 1U);
+        }
+        {
+            const std::string fileName = TEST_DATA_DIR "Input/Transform_VS.hlsl";
+
+            std::vector<uint8_t> input = LoadFile(fileName, true);
+            const std::string source = std::string(reinterpret_cast<char*>(input.data()), input.size());
+
+            // Built-ins are reported like the DXIL system values, without a location
+            const Compiler::TargetDesc targets[] = {{ShadingLanguage::SpirV, nullptr}, {ShadingLanguage::Glsl, "410"}};
+            for (const auto& target : targets)
+            {
+                const auto result = Compiler::Compile({source.c_str(), fileName.c_str(), "", ShaderStage::VertexShader}, {}, target);
+                EXPECT_FALSE(result.hasError);
+
+                const Compiler::CompactReflectionView compactView(result.reflection.compactDescs);
+                ASSERT_EQ(compactView.OutputCount(), 1U);
+                const auto& param = compactView.Outputs()[0];
+                EXPECT_STREQ(compactView.Semantic(param), "SV_Position");
+                EXPECT_EQ(param.semanticIndex, 0U);
+                EXPECT_EQ(param.location, ~0U);
+                EXPECT_EQ(param.dataType, ShaderDataType::Float);
+                EXPECT_EQ(param.columns, 4U);
+
+                ASSERT_EQ(compactView.InputCount(), 1U);
+                EXPECT_STREQ(compactView.Semantic(compactView.Inputs()[0]), "POSITION");
+                EXPECT_NE(compactView.Inputs()[0].location, ~0U);
+            }
+        }
+    }
+
+    std::vector<Compiler::ResultDesc> CompileSpirvBinaries()
+    {
+        std::vector<Compiler::ResultDesc> binaries;
+        for (const auto& shader : {std::make_tuple("ToneMapping_PS", ShaderStage::PixelShader),
+                                   std::make_tuple("Transform_VS", ShaderStage::VertexShader),
+                                   std::make_tuple("Fluid_CS", ShaderStage::ComputeShader)})
+        {
+            const std::string fileName = std::string(TEST_DATA_DIR "Input/") + std::get<0>(shader) + ".hlsl";
+
+            std::vector<uint8_t> input = LoadFile(fileName, true);
+            const std::string source = std::string(reinterpret_cast<char*>(input.data()), input.size());
+
+            binaries.push_back(
+                Compiler::Compile({source.c_str(), fileName.c_str(), "", std::get<1>(shader)}, {}, {ShadingLanguage::SpirV, ""}));
+            EXPECT_FALSE(binaries.back().hasError);
+        }
+        return binaries;
+    }
+
+    std::vector<Compiler::DisassembleDesc> MakeDisassembleDescs(const std::vector<Compiler::ResultDesc>& binaries, size_t count)
+    {
+        std::vector<Compiler::DisassembleDesc> descs(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            const auto& binary = binaries[i % binaries.size()];
+            descs[i].language = ShadingLanguage::SpirV;
+            descs[i].binary = reinterpret_cast<const uint8_t*>(binary.target.Data());
+            descs[i].binarySize = binary.target.Size();
+        }
+        return descs;
+    }
+
+    TEST(DisassembleTest, Batch)
+    {
+        const auto binaries = CompileSpirvBinaries();
+        const auto descs = MakeDisassembleDescs(binaries, 64);
+
+        std::vector<Compiler::ResultDesc> results(descs.size());
+        Compiler::Disassemble(descs.data(), static_cast<uint32_t>(descs.size()), results.data(), 4);
+
+        for (size_t i = 0; i < descs.size(); ++i)
+        {
+            const auto expected = Compiler::Disassemble(descs[i]);
+            EXPECT_FALSE(results[i].hasError);
+            EXPECT_TRUE(results[i].isText);
+            ASSERT_EQ(results[i].target.Size(), expected.target.Size());
+            EXPECT_EQ(std::memcmp(results[i].target.Data(), expected.target.Data(), expected.target.Size()), 0);
+        }
+    }
+
+    // Run with --gtest_also_run_disabled_tests to compare one-by-one and batched disassembly
+    TEST(DisassembleTest, DISABLED_Benchmark)
+    {
+        const auto binaries = CompileSpirvBinaries();
+        const auto descs = MakeDisassembleDescs(binaries, 10000);
+        std::vector<Compiler::ResultDesc> results(descs.size());
+
+        auto timeIt = [&descs](const char* name, const std::function<void()>& func) {
+            const auto start = std::chrono::high_resolution_clock::now();
+            func();
+            const auto elapsed = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - start);
+            std::cout << name << ": " << elapsed.count() / descs.size() << " us per binary" << std::endl;
+        };
+
+        // What Disassemble cost before the spv_context was cached per thread
+        timeIt("Context per call", [&] {
+            for (size_t i = 0; i < descs.size(); ++i)
+            {
+                spv_context context = spvContextCreate(SPV_ENV_UNIVERSAL_1_3);
+                spv_text text = nullptr;
+                spv_diagnostic diagnostic = nullptr;
+                spvBinaryToText(context, reinterpret_cast<const uint32_t*>(descs[i].binary), descs[i].binarySize / sizeof(uint32_t),
+                                SPV_BINARY_TO_TEXT_OPTION_INDENT | SPV_BINARY_TO_TEXT_OPTION_FRIENDLY_NAMES, &text, &diagnostic);
+                spvTextDestroy(text);
+                spvDiagnosticDestroy(diagnostic);
+                spvContextDestroy(context);
+            }
+        });
+        timeIt("One by one", [&] {
+            for (size_t i = 0; i < descs.size(); ++i)
+            {
+                results[i] = Compiler::Disassemble(descs[i]);
+            }
+        });
+        timeIt("Batch, 1 thread", [&] { Compiler::Disassemble(descs.data(), static_cast<uint32_t>(descs.size()), results.data(), 1); });
+        timeIt("Batch, all threads", [&] { Compiler::Disassemble(descs.data(), static_cast<uint32_t>(descs.size()), results.data()); });
+    }
+
+    TEST(CrossCompileTest, SpirvInput)
+    {
+        const std::string fileName = TEST_DATA_DIR "Input/ToneMapping_PS.hlsl";
+
+        std::vector<uint8_t> input = LoadFile(fileName, true);
+        const std::string source = std::string(reinterpret_cast<char*>(input.data()), input.size());
+
+        const auto spirvResult =
+            Compiler::Compile({source.c_str(), fileName.c_str(), "", ShaderStage::PixelShader}, {}, {ShadingLanguage::SpirV, ""});
+        EXPECT_FALSE(spirvResult.hasError);
+
+        Compiler::SpirvDesc spirv;
+        spirv.entryPoint = "main";
+        spirv.stage = ShaderStage::PixelShader;
+        spirv.binary = reinterpret_cast<const uint8_t*>(spirvResult.target.Data());
+        spirv.binarySize = spirvResult.target.Size();
+
+        for (const auto& target : {std::make_tuple(ShadingLanguage::Glsl, "410", "ToneMapping_PS.410.glsl"),
+                                   std::make_tuple(ShadingLanguage::Essl, "300", "ToneMapping_PS.300.essl")})
+        {
+            const auto result = Compiler::CrossCompile(spirv, {}, {std::get<0>(target), std::get<1>(target)});
+            EXPECT_FALSE(result.hasError);
+            EXPECT_TRUE(result.isText);
+            EXPECT_EQ(result.reflection.descCount, spirvResult.reflection.descCount);
+
+            const uint8_t* target_ptr = reinterpret_cast<const uint8_t*>(result.target.Data());
+            CompareWithExpected(std::vector<uint8_t>(target_ptr, target_ptr + result.target.Size()), result.isText, std::get<2>(target));
+        }
+
+        EXPECT_THROW(Compiler::CrossCompile(spirv, {}, {ShadingLanguage::Dxil, ""}), std::runtime_error);
+
+        // SPIRV-Cross rejecting the module is a compile error, not an exception
+        const Compiler::TargetDesc targets[] = {{ShadingLanguage::SpirV, nullptr}, {ShadingLanguage::Glsl, "410"}};
+        for (const auto& target : targets)
+        {
+            Compiler::SpirvDesc badEntryPoint = spirv;
+            badEntryPoint.entryPoint = "NoSuchEntryPoint";
+            const auto entryPointResult = Compiler::CrossCompile(badEntryPoint, {}, target);
+            EXPECT_TRUE(entryPointResult.hasError);
+            EXPECT_GT(entryPointResult.errorWarningMsg.Size(), 0U);
+            EXPECT_EQ(entryPointResult.target.Size(), 0U);
+
+            Compiler::SpirvDesc truncated = spirv;
+            truncated.binarySize = (spirv.binarySize / 2) & ~3U;
+            const auto truncatedResult = Compiler::CrossCompile(truncated, {}, target);
+            EXPECT_TRUE(truncatedResult.hasError);
+            EXPECT_GT(truncatedResult.errorWarningMsg.Size(), 0U);
+            EXPECT_EQ(truncatedResult.target.Size(), 0U);
+        }
+    }
+
+    TEST(MultiEntryTest, SharedFrontEnd)
+    {
+        const std::string fileName = TEST_DATA_DIR "Input/MultiEntry.hlsl";
+
+        std::vector<uint8_t> input = LoadFile(fileName, true);
+        const std::string source = std::string(reinterpret_cast<char*>(input.data()), input.size());
+
+        const Compiler::EntryPointDesc entryPoints[] = {{"VSMain", ShaderStage::VertexShader}, {"PSMain", ShaderStage::PixelShader}};
+        const Compiler::TargetDesc targets[] = {{ShadingLanguage::SpirV, ""}, {ShadingLanguage::Glsl, "410"}};
+        constexpr uint32_t numEntryPoints = sizeof(entryPoints) / sizeof(entryPoints[0]);
+        constexpr uint32_t numTargets = sizeof(targets) / sizeof(targets[0]);
+
+        std::vector<Compiler::ResultDesc> results(numEntryPoints * numTargets);
+        Compiler::CompileEntryPoints({source.c_str(), fileName.c_str()}, entryPoints, numEntryPoints, {}, targets, numTargets,
+                                     results.data());
+
+        for (uint32_t entry = 0; entry < numEntryPoints; ++entry)
+        {
+            for (uint32_t target = 0; target < numTargets; ++target)
+            {
+                const auto& result = results[entry * numTargets + target];
+                EXPECT_FALSE(result.hasError);
+
+                const auto expected = Compiler::Compile(
+                    {source.c_str(), fileName.c_str(), entryPoints[entry].entryPoint, entryPoints[entry].stage}, {}, targets[target]);
+                EXPECT_FALSE(expected.hasError);
+                EXPECT_EQ(result.isText, expected.isText);
+                if (result.isText)
+                {
+                    const char* resultStr = reinterpret_cast<const char*>(result.target.Data());
+                    const char* expectedStr = reinterpret_cast<const char*>(expected.target.Data());
+                    EXPECT_EQ(std::string(resultStr, resultStr + result.target.Size()),
+                              std::string(expectedStr, expectedStr + expected.target.Size()));
+                }
+                EXPECT_EQ(result.reflection.descCount, expected.reflection.descCount);
+            }
+        }
+    }
+
+    TEST(MultiEntryTest, PreprocessError)
+    {
+        const std::string fileName = TEST_DATA_DIR "Input/IncludeNotExist.hlsl";
+
+        std::vector<uint8_t> input = LoadFile(fileName, true);
+        const std::string source = std::string(reinterpret_cast<char*>(input.data()), input.size());
+
+        const Compiler::EntryPointDesc entryPoints[] = {{"main", ShaderStage::PixelShader}, {"main2", ShaderStage::PixelShader}};
+        const Compiler::TargetDesc target = {ShadingLanguage::Glsl, "30"};
+
+        Compiler::ResultDesc results[2];
+        Compiler::CompileEntryPoints({source.c_str(), fileName.c_str()}, entryPoints, 2, {}, &target, 1, results);
+        for (const auto& result : results)
+        {
+            EXPECT_TRUE(result.hasError);
+            EXPECT_GT(result.errorWarningMsg.Size(), 0U);
+        }
+    }
+
+    TEST(InitializeTest, BackgroundWarmUp)
+    {
+        std::thread initThread([] { Compiler::Initialize(true); });
+
+        const std::string fileName = TEST_DATA_DIR "Input/PassThrough_PS.hlsl";
+
+        std::vector<uint8_t> input = LoadFile(fileName, true);
+        const std::string source = std::string(reinterpret_cast<char*>(input.data()), input.size());
+
+        const auto result =
+            Compiler::Compile({source.c_str(), fileName.c_str(), "PSMain", ShaderStage::PixelShader}, {}, {ShadingLanguage::Glsl, "410"});
+        EXPECT_FALSE(result.hasError);
+
+        initThread.join();
+        EXPECT_NO_THROW(Compiler::Initialize());
+    }
+
+    TEST(MemoryTest, CustomAllocator)
+    {
+        struct AllocatorStats
+        {
+            std::atomic<uint32_t> numAllocations{0};
+            std::atomic<uint32_t> numFrees{0};
+        } stats;
+
+        Compiler::MemoryAllocator allocator;
+        allocator.allocate = [](void* userData, size_t size) -> void* {
+            ++reinterpret_cast<AllocatorStats*>(userData)->numAllocations;
+            return std::malloc(size);
+        };
+        allocator.free = [](void* userData, void* ptr) {
+            ++reinterpret_cast<AllocatorStats*>(userData)->numFrees;
+            std::free(ptr);
+        };
+        allocator.userData = &stats;
+
+        Compiler::Options options;
+        options.allocator = &allocator;
+
+        const std::string fileName = TEST_DATA_DIR "Input/Transform_VS.hlsl";
+
+        std::vector<uint8_t> input = LoadFile(fileName, true);
+        const std::string source = std::string(reinterpret_cast<char*>(input.data()), input.size());
+
+        const Compiler::TargetDesc targets[] = {{ShadingLanguage::Dxil, ""}, {ShadingLanguage::Glsl, "410"}};
+        Compiler::ResultDesc results[2];
+        Compiler::Compile({source.c_str(), fileName.c_str(), "", ShaderStage::VertexShader}, options, targets, 2, results);
+
+        for (const auto& result : results)
+        {
+            EXPECT_FALSE(result.hasError);
+            EXPECT_GT(result.allocatedBytes, 0U);
+            EXPECT_GT(result.peakAllocatedBytes, 0U);
+            EXPECT_LE(result.peakAllocatedBytes, result.allocatedBytes);
+        }
+        EXPECT_GT(stats.numAllocations.load(), 0U);
+        EXPECT_GT(stats.numFrees.load(), 0U);
+    }
+
+    TEST(SchedulerTest, MemoryBudget)
+    {
+        const std::tuple<const char*, const char*, ShaderStage> shaders[] = {
+            std::make_tuple("ToneMapping_PS", "main", ShaderStage::PixelShader),
+            std::make_tuple("Transform_VS", "main", ShaderStage::VertexShader),
+            std::make_tuple("Fluid_CS", "main", ShaderStage::ComputeShader),
+            std::make_tuple("PassThrough_PS", "PSMain", ShaderStage::PixelShader),
+        };
+        constexpr uint32_t numJobs = sizeof(shaders) / sizeof(shaders[0]);
+        const Compiler::TargetDesc targets[] = {{ShadingLanguage::Dxil, ""}, {ShadingLanguage::Glsl, "410"}};
+        constexpr uint32_t numTargets = sizeof(targets) / sizeof(targets[0]);
+
+        // A job counts as running while it holds memory from its allocator
+        struct ConcurrencyTracker
+        {
+            std::mutex mutex;
+            uint32_t liveAllocations[numJobs] = {};
+            uint32_t numRunning = 0;
+            uint32_t maxRunning = 0;
+        } tracker;
+        struct JobAllocator
+        {
+            ConcurrencyTracker* tracker;
+            uint32_t jobIndex;
+        };
+
+        std::vector<std::string> fileNames(numJobs);
+        std::vector<std::string> sources(numJobs);
+        std::vector<Compiler::ResultDesc> results(numJobs * numTargets);
+        std::vector<JobAllocator> jobAllocators(numJobs);
+        std::vector<Compiler::MemoryAllocator> allocators(numJobs);
+        std::vector<CompileScheduler::Job> jobs(numJobs);
+        for (uint32_t i = 0; i < numJobs; ++i)
+        {
+            fileNames[i] = std::string(TEST_DATA_DIR "Input/") + std::get<0>(shaders[i]) + ".hlsl";
+            std::vector<uint8_t> input = LoadFile(fileNames[i], true);
+            sources[i] = std::string(reinterpret_cast<char*>(input.data()), input.size());
+
+            jobAllocators[i] = {&tracker, i};
+            allocators[i].allocate = [](void* userData, size_t size) -> void* {
+                const auto* jobAllocator = reinterpret_cast<JobAllocator*>(userData);
+                ConcurrencyTracker& state = *jobAllocator->tracker;
+                std::lock_guard<std::mutex> lock(state.mutex);
+                if (state.liveAllocations[jobAllocator->jobIndex]++ == 0)
+                {
+                    ++state.numRunning;
+                    state.maxRunning = std::max(state.maxRunning, state.numRunning);
+                }
+                return std::malloc(size);
+            };
+            allocators[i].free = [](void* userData, void* ptr) {
+                if (ptr != nullptr)
+                {
+                    const auto* jobAllocator = reinterpret_cast<JobAllocator*>(userData);
+                    ConcurrencyTracker& state = *jobAllocator->tracker;
+                    std::lock_guard<std::mutex> lock(state.mutex);
+                    if (--state.liveAllocations[jobAllocator->jobIndex] == 0)
+                    {
+                        --state.numRunning;
+                    }
+                    std::free(ptr);
+                }
+            };
+            allocators[i].userData = &jobAllocators[i];
+
+            jobs[i].source = {sources[i].c_str(), fileNames[i].c_str(), std::get<1>(shaders[i]), std::get<2>(shaders[i])};
+            jobs[i].options.allocator = &allocators[i];
+            jobs[i].targets = targets;
+            jobs[i].numTargets = numTargets;
+            jobs[i].results = &results[i * numTargets];
+        }
+
+        // A budget of 1 byte lets only one job run at a time
+        for (const uint64_t budget : {1ULL, 16ULL * 1024 * 1024 * 1024})
+        {
+            tracker.maxRunning = 0;
+
+            CompileScheduler scheduler(budget, 4);
+            scheduler.Run(jobs.data(), numJobs);
+            EXPECT_EQ(tracker.numRunning, 0U);
+            if (budget == 1)
+            {
+                EXPECT_EQ(tracker.maxRunning, 1U);
+            }
+
+            for (uint32_t i = 0; i < numJobs; ++i)
+            {
+                uint64_t peak = 0;
+                for (uint32_t j = 0; j < numTargets; ++j)
+                {
+                    EXPECT_FALSE(results[i * numTargets + j].hasError);
+                    peak = std::max(peak, results[i * numTargets + j].peakAllocatedBytes);
+                }
+                EXPECT_EQ(scheduler.EstimatedPeakBytes(jobs[i]), peak);
+            }
+
+            const Blob history = scheduler.SaveHistory();
+            CompileScheduler restored(budget, 4);
+            restored.LoadHistory(history.Data(), history.Size());
+            for (const auto& job : jobs)
+            {
+                EXPECT_EQ(restored.EstimatedPeakBytes(job), scheduler.EstimatedPeakBytes(job));
+            }
+        }
+    }
+
+    TEST(TimeoutTest, Deadline)
+    {
+        const std::string fileName = TEST_DATA_DIR "Input/Transform_VS.hlsl";
+
+        std::vector<uint8_t> input = LoadFile(fileName, true);
+        const std::string source = std::string(reinterpret_cast<char*>(input.data()), input.size());
+
+        const Compiler::TargetDesc targets[] = {{ShadingLanguage::SpirV, ""}, {ShadingLanguage::Glsl, "410"}};
+
+        Compiler::ResultDesc expected[2];
+        Compiler::Compile({source.c_str(), fileName.c_str(), "", ShaderStage::VertexShader}, {}, targets, 2, expected);
+
+        Compiler::Options options;
+        options.timeoutMs = 60 * 1000;
+        Compiler::ResultDesc results[2];
+        Compiler::Compile({source.c_str(), fileName.c_str(), "", ShaderStage::VertexShader}, options, targets, 2, results);
+        for (uint32_t i = 0; i < 2; ++i)
+        {
+            EXPECT_FALSE(results[i].hasError);
+            EXPECT_FALSE(results[i].timedOut);
+            ASSERT_EQ(results[i].target.Size(), expected[i].target.Size());
+            EXPECT_EQ(std::memcmp(results[i].target.Data(), expected[i].target.Data(), expected[i].target.Size()), 0);
+        }
+
+        // Compiles with a deadline from several threads at once share the worker processes
+        {
+            std::vector<std::thread> threads;
+            std::vector<std::array<Compiler::ResultDesc, 2>> threadResults(4);
+            for (auto& threadResult : threadResults)
+            {
+                threads.emplace_back([&] {
+                    Compiler::Compile({source.c_str(), fileName.c_str(), "", ShaderStage::VertexShader}, options, targets, 2,
+                                      threadResult.data());
+                });
+            }
+            for (auto& thread : threads)
+            {
+                thread.join();
+            }
+            for (const auto& threadResult : threadResults)
+            {
+                for (uint32_t i = 0; i < 2; ++i)
+                {
+                    EXPECT_FALSE(threadResult[i].hasError);
+                    ASSERT_EQ(threadResult[i].target.Size(), expected[i].target.Size());
+                    EXPECT_EQ(std::memcmp(threadResult[i].target.Data(), expected[i].target.Data(), expected[i].target.Size()), 0);
+                }
+            }
+        }
+
+        // Too short for any compile to finish
+        options.timeoutMs = 1;
+        Compiler::Compile({source.c_str(), fileName.c_str(), "", ShaderStage::VertexShader}, options, targets, 2, results);
+        for (const auto& result : results)
+        {
+            EXPECT_TRUE(result.hasError);
+            EXPECT_TRUE(result.timedOut);
+            EXPECT_LT(result.timeoutStage, CompileStage::NumCompileStages);
+        }
+    }
+
+    TEST(WorkerPoolTest, IsolatedJobs)
+    {
+        const std::string fileNames[] = {TEST_DATA_DIR "Input/Transform_VS.hlsl", TEST_DATA_DIR "Input/Constant_VS.hlsl"};
+        std::string sources[2];
+        for (uint32_t i = 0; i < 2; ++i)
+        {
+            std::vector<uint8_t> input = LoadFile(fileNames[i], true);
+            sources[i] = std::string(reinterpret_cast<char*>(input.data()), input.size());
+        }
+
+        const Compiler::TargetDesc targets[] = {{ShadingLanguage::SpirV, ""}, {ShadingLanguage::Glsl, "410"}};
+
+        CompileWorkerPool pool(2);
+
+        Compiler::ResultDesc expected[2][2];
+        Compiler::ResultDesc results[2][2];
+        CompileScheduler::Job jobs[2];
+        for (uint32_t i = 0; i < 2; ++i)
+        {
+            const Compiler::SourceDesc source = {sources[i].c_str(), fileNames[i].c_str(), "", ShaderStage::VertexShader};
+            Compiler::Compile(source, {}, targets, 2, expected[i]);
+            jobs[i] = {source, {}, targets, 2, results[i]};
+        }
+        pool.Run(jobs, 2);
+        for (uint32_t i = 0; i < 2; ++i)
+        {
+            for (uint32_t j = 0; j < 2; ++j)
+            {
+                EXPECT_FALSE(results[i][j].hasError);
+                ASSERT_EQ(results[i][j].target.Size(), expected[i][j].target.Size());
+                EXPECT_EQ(std::memcmp(results[i][j].target.Data(), expected[i][j].target.Data(), expected[i][j].target.Size()), 0);
+            }
+        }
+
+        // The worker is killed at the deadline and replaced
+        jobs[0].options.timeoutMs = 1;
+        pool.Run(jobs, 1);
+        EXPECT_TRUE(results[0][0].timedOut);
+#ifndef _WIN32
+        EXPECT_EQ(pool.NumRestarts(), 1U);
+#endif
+
+        jobs[0].options.timeoutMs = 0;
+        pool.Run(jobs, 2);
+        for (uint32_t i = 0; i < 2; ++i)
+        {
+            EXPECT_FALSE(results[i][0].hasError);
+            EXPECT_FALSE(results[i][1].hasError);
+        }
+    }
+
+    TEST(CacheTest, HttpOverFileSystem)
+    {
+        const std::string fileName = TEST_DATA_DIR "Input/Transform_VS.hlsl";
+
+        std::vector<uint8_t> input = LoadFile(fileName, true);
+        const std::string source = std::string(reinterpret_cast<char*>(input.data()), input.size());
+        const Compiler::SourceDesc sourceDesc = {source.c_str(), fileName.c_str(), "", ShaderStage::VertexShader};
+
+        const Compiler::TargetDesc targets[] = {{ShadingLanguage::SpirV, ""}, {ShadingLanguage::Glsl, "410"}};
+
+        const Compiler::CacheKey spirvKey = Compiler::ComputeCacheKey(sourceDesc, {}, targets[0]);
+        const Compiler::CacheKey glslKey = Compiler::ComputeCacheKey(sourceDesc, {}, targets[1]);
+        EXPECT_EQ(std::strlen(spirvKey.str), 32U);
+        EXPECT_STRNE(spirvKey.str, glslKey.str);
+
+        // #line paths only count by file name
+        const std::string movedFileName = "/Elsewhere/Transform_VS.hlsl";
+        const Compiler::SourceDesc movedSourceDesc = {source.c_str(), movedFileName.c_str(), "", ShaderStage::VertexShader};
+        EXPECT_STREQ(Compiler::ComputeCacheKey(movedSourceDesc, {}, targets[0]).str, spirvKey.str);
+        Compiler::Options debugOptions;
+        debugOptions.enableDebugInfo = true;
+        EXPECT_STRNE(Compiler::ComputeCacheKey(movedSourceDesc, debugOptions, targets[0]).str,
+                     Compiler::ComputeCacheKey(sourceDesc, debugOptions, targets[0]).str);
+
+        const std::string cacheDir = TempDirectory() + "/ShaderConductorTestCache" +
+                                     std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+        FileSystemCache storage(cacheDir.c_str());
+        HttpCacheServer server(storage);
+        HttpCache cache("127.0.0.1", server.Port());
+
+        // Bad puts are dropped
+        EXPECT_NO_THROW(storage.Put("../escape", Blob("x", 1)));
+        EXPECT_NO_THROW(cache.Put("../escape", Blob("x", 1)));
+
+        Compiler::ResultDesc expected[2];
+        Compiler::Compile(sourceDesc, {}, targets, 2, expected);
+
+        // The first run misses and puts, the second one hits
+        for (uint32_t run = 0; run < 2; ++run)
+        {
+            Compiler::ResultDesc results[2];
+            Compiler::Compile(sourceDesc, {}, targets, 2, results, cache);
+            for (uint32_t i = 0; i < 2; ++i)
+            {
+                EXPECT_FALSE(results[i].hasError);
+                ASSERT_EQ(results[i].target.Size(), expected[i].target.Size());
+                EXPECT_EQ(std::memcmp(results[i].target.Data(), expected[i].target.Data(), expected[i].target.Size()), 0);
+            }
+        }
+
+        const char* keys[] = {spirvKey.str, "0123456789abcdef0123456789abcdef", glslKey.str};
+        Blob values[3];
+        bool found[3];
+        cache.BatchGet(keys, 3, values, found);
+        EXPECT_TRUE(found[0]);
+        EXPECT_FALSE(found[1]);
+        EXPECT_TRUE(found[2]);
+
+        Blob fileValue;
+        EXPECT_TRUE(storage.Get(glslKey.str, fileValue));
+        EXPECT_EQ(fileValue.Size(), values[2].Size());
+
+        // A hit reports where the source is now, not where it was when the entry was put
+        Compiler::ResultDesc movedResult;
+        Compiler::Compile(movedSourceDesc, {}, &targets[0], 1, &movedResult, cache);
+        EXPECT_FALSE(movedResult.hasError);
+        const std::string firstDependency = reinterpret_cast<const char*>(movedResult.dependencies.Data()) + sizeof(uint64_t);
+        EXPECT_NE(firstDependency.find("Elsewhere"), std::string::npos);
+
+        for (const char* key : {spirvKey.str, glslKey.str})
+        {
+            const std::string shard = cacheDir + "/" + std::string(key, 2);
+            std::remove((shard + "/" + key).c_str());
+            RemoveEmptyDirectory(shard);
+        }
+        RemoveEmptyDirectory(cacheDir);
+    }
+
+    TEST(CacheTest, HttpTimeout)
+    {
+        class SlowStorage : public CacheBackend
+        {
+        public:
+            bool Get(const char* key, Blob& value) override
+            {
+                if (std::strcmp(key, "0123456789abcdef0123456789abcdef") == 0)
+                {
+                    std::this_thread::sleep_for(std::chrono::seconds(2));
+                }
+                value.Reset(key, static_cast<uint32_t>(std::strlen(key)));
+                return true;
+            }
+
+            void Put(const char* /*key*/, const Blob& /*value*/) override
+            {
+            }
+        };
+
+        SlowStorage storage;
+        HttpCacheServer server(storage);
+        HttpCache cache("127.0.0.1", server.Port(), 500);
+
+        // The slow get times out as a miss, and doesn't hold up the fast one
+        const auto start = std::chrono::steady_clock::now();
+        std::thread slowThread([&cache] {
+            Blob value;
+            EXPECT_FALSE(cache.Get("0123456789abcdef0123456789abcdef", value));
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        Blob value;
+        EXPECT_TRUE(cache.Get("fedcba9876543210fedcba9876543210", value));
+        slowThread.join();
+        EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(1500));
+    }
+
+    TEST(DependencyTest, NullFileName)
+    {
+        std::vector<uint8_t> input = LoadFile(TEST_DATA_DIR "Input/Transform_VS.hlsl", true);
+        const std::string source = std::string(reinterpret_cast<char*>(input.data()), input.size());
+
+        // A source without a file name compiles, and only the includes would be listed
+        const Compiler::SourceDesc sourceDesc = {source.c_str(), nullptr, "", ShaderStage::VertexShader};
+        const Compiler::TargetDesc target = {ShadingLanguage::Glsl, "410"};
+        const auto result = Compiler::Compile(sourceDesc, {}, target);
+        EXPECT_FALSE(result.hasError);
+        EXPECT_EQ(result.dependencies.Size(), 0U);
+
+        const Compiler::CacheKey key = Compiler::ComputeCacheKey(sourceDesc, {}, target);
+        EXPECT_EQ(std::strlen(key.str), 32U);
+
+        const Compiler::EntryPointDesc entryPoint = {"main", ShaderStage::VertexShader};
+        Compiler::ResultDesc entryPointResult;
+        Compiler::CompileEntryPoints({source.c_str(), nullptr}, &entryPoint, 1, {}, &target, 1, &entryPointResult);
+        EXPECT_FALSE(entryPointResult.hasError);
+        EXPECT_EQ(entryPointResult.dependencies.Size(), 0U);
+    }
+
+    TEST(DependencyTest, AffectedSources)
+    {
+        const std::string multiEntryName = TEST_DATA_DIR "Input/MultiEntry.hlsl";
+        const std::string transformName = TEST_DATA_DIR "Input/Transform_VS.hlsl";
+
+        std::vector<uint8_t> input = LoadFile(multiEntryName, true);
+        const std::string multiEntrySource = std::string(reinterpret_cast<char*>(input.data()), input.size());
+        input = LoadFile(transformName, true);
+        const std::string transformSource = std::string(reinterpret_cast<char*>(input.data()), input.size());
+
+        const Compiler::TargetDesc target = {ShadingLanguage::Glsl, "410"};
+        const auto multiEntryResult =
+            Compiler::Compile({multiEntrySource.c_str(), multiEntryName.c_str(), "PSMain", ShaderStage::PixelShader}, {}, target);
+        const auto transformResult =
+            Compiler::Compile({transformSource.c_str(), transformName.c_str(), "", ShaderStage::VertexShader}, {}, target);
+        EXPECT_FALSE(multiEntryResult.hasError);
+        EXPECT_FALSE(transformResult.hasError);
+
+        // The include's name is whatever DXC asked for
+        std::string includeName;
+        const char* dependencies = reinterpret_cast<const char*>(multiEntryResult.dependencies.Data());
+        for (uint32_t offset = 0; offset < multiEntryResult.dependencies.Size();)
+        {
+            const std::string name = dependencies + offset + sizeof(uint64_t);
+            if ((name.size() >= 12) && (name.compare(name.size() - 12, 12, "Common.hlsli") == 0))
+            {
+                includeName = name;
+            }
+            offset += static_cast<uint32_t>(sizeof(uint64_t) + name.size() + 1);
+        }
+        ASSERT_FALSE(includeName.empty());
+
+        DependencyIndex index;
+        index.Record("MultiEntry", multiEntryResult);
+        index.Record("Transform", transformResult);
+
+        auto affectedNames = [](const Blob& affected) {
+            std::vector<std::string> names;
+            const char* str = reinterpret_cast<const char*>(affected.Data());
+            for (uint32_t offset = 0; offset < affected.Size(); offset += static_cast<uint32_t>(names.back().size() + 1))
+            {
+                names.push_back(str + offset);
+            }
+            return names;
+        };
+
+        const char* changed[] = {includeName.c_str()};
+        EXPECT_EQ(affectedNames(index.AffectedSources(changed, 1)), std::vector<std::string>{"MultiEntry"});
+        // The include wasn't edited
+        EXPECT_TRUE(affectedNames(index.AffectedSources(changed, 1, true)).empty());
+        // Edited in the include callback's view, not on disk
+        const std::string editedInclude = "float4 Edited;\n";
+        const auto editedCallback = [&editedInclude](const char* /*fileName*/) {
+            return Blob(editedInclude.data(), static_cast<uint32_t>(editedInclude.size()));
+        };
+        EXPECT_EQ(affectedNames(index.AffectedSources(changed, 1, true, editedCallback)), std::vector<std::string>{"MultiEntry"});
+
+        const char* bothChanged[] = {transformName.c_str(), includeName.c_str()};
+        EXPECT_EQ(affectedNames(index.AffectedSources(bothChanged, 2)).size(), 2U);
+
+        const Blob saved = index.Save();
+        DependencyIndex loaded;
+        loaded.Load(saved.Data(), saved.Size());
+        EXPECT_EQ(affectedNames(loaded.AffectedSources(changed, 1)), std::vector<std::string>{"MultiEntry"});
+
+        loaded.Remove("MultiEntry");
+        EXPECT_TRUE(affectedNames(loaded.AffectedSources(changed, 1)).empty());
+    }
+
+    TEST(CostTest, ToneMapping)
+    {
+        const std::string fileName = TEST_DATA_DIR "Input/ToneMapping_PS.hlsl";
+        std::vector<uint8_t> input = LoadFile(fileName, true);
+        const std::string source = std::string(reinterpret_cast<char*>(input.data()), input.size());
+
+        Compiler::Options options;
+        options.costReport = true;
+        const Compiler::TargetDesc targets[] = {{ShadingLanguage::SpirV, ""}, {ShadingLanguage::Glsl, "410"}, {ShadingLanguage::Dxil, ""}};
+        Compiler::ResultDesc results[3];
+        Compiler::Compile({source.c_str(), fileName.c_str(), "main", ShaderStage::PixelShader}, options, targets, 3, results);
+        for (const auto& result : results)
+        {
+            EXPECT_FALSE(result.hasError);
+        }
+
+        const Compiler::CostReport& cost = results[0].cost;
+        EXPECT_EQ(cost.textureSamples, 3U);
+        EXPECT_EQ(cost.textureFetches, 0U);
+        EXPECT_EQ(cost.atomics, 0U);
+        EXPECT_EQ(cost.barriers, 0U);
+        EXPECT_EQ(cost.loops, 0U);
+        EXPECT_GT(cost.aluInstructions, 0U);
+        EXPECT_GE(cost.totalInstructions, cost.aluInstructions + cost.textureSamples + cost.loads + cost.stores);
+        EXPECT_GE(cost.temporaries, cost.maxLiveValues);
+        EXPECT_GT(cost.maxLiveValues, 0U);
+        EXPECT_EQ(cost.inputComponents, 6U); // SV_Position and TEXCOORD0
+        EXPECT_EQ(cost.outputComponents, 4U);
+
+        // The cross compiled target reports the module it came from, Dxil has no report
+        EXPECT_EQ(std::memcmp(&results[1].cost, &cost, sizeof(cost)), 0);
+        EXPECT_EQ(results[2].cost.totalInstructions, 0U);
+
+        const Blob archive = Compiler::SerializeResult(results[0]);
+        const Compiler::ResultDesc roundTrip = Compiler::DeserializeResult(archive.Data(), archive.Size());
+        EXPECT_EQ(std::memcmp(&roundTrip.cost, &cost, sizeof(cost)), 0);
+
+        const auto noReport = Compiler::Compile({source.c_str(), fileName.c_str(), "main", ShaderStage::PixelShader}, {}, targets[0]);
+        EXPECT_EQ(noReport.cost.totalInstructions, 0U);
+    }
+
+    TEST(SpecConstantTest, DefinesAsSpecConstants)
+    {
+        const std::string fileName = TEST_DATA_DIR "Input/SpecConstant.hlsl";
+        std::vector<uint8_t> input = LoadFile(fileName, true);
+        const std::string source = std::string(reinterpret_cast<char*>(input.data()), input.size());
+
+        MacroDefine defines[] = {{"USE_TINT", "true"}, {"TINT_SCALE", "2.0"}};
+        defines[0].specConstant = true;
+        defines[1].specConstant = true;
+
+        const Compiler::TargetDesc targets[] = {
+            {ShadingLanguage::SpirV, ""}, {ShadingLanguage::Glsl, "410"}, {ShadingLanguage::Msl_macOS, ""}, {ShadingLanguage::Dxil, ""}};
+        Compiler::ResultDesc results[4];
+        Compiler::Compile({source.c_str(), fileName.c_str(), "main", ShaderStage::PixelShader, defines, 2}, {}, targets, 4, results);
+        for (const auto& result : results)
+        {
+            EXPECT_FALSE(result.hasError);
+        }
+
+        const Compiler::CompactReflectionView view(results[0].reflection.compactDescs);
+        ASSERT_EQ(view.SpecConstantCount(), 2U);
+        const Compiler::CompactSpecConstantDesc* specConstants = view.SpecConstants();
+        EXPECT_STREQ(view.Name(specConstants[0]), "USE_TINT");
+        EXPECT_EQ(specConstants[0].id, 0U);
+        EXPECT_EQ(specConstants[0].dataType, ShaderDataType::Bool);
+        EXPECT_EQ(specConstants[0].defaultValue, 1U);
+        EXPECT_STREQ(view.Name(specConstants[1]), "TINT_SCALE");
+        EXPECT_EQ(specConstants[1].id, 1U);
+        EXPECT_EQ(specConstants[1].dataType, ShaderDataType::Float);
+        const float scale = 2.0f;
+        uint32_t scaleBits;
+        std::memcpy(&scaleBits, &scale, sizeof(scaleBits));
+        EXPECT_EQ(specConstants[1].defaultValue, scaleBits);
+
+        const std::string glsl(reinterpret_cast<const char*>(results[1].target.Data()), results[1].target.Size());
+        EXPECT_NE(glsl.find("SPIRV_CROSS_CONSTANT_ID_1"), std::string::npos);
+        const std::string msl(reinterpret_cast<const char*>(results[2].target.Data()), results[2].target.Size());
+        EXPECT_NE(msl.find("function_constant(1)"), std::string::npos);
+        EXPECT_EQ(Compiler::CompactReflectionView(results[1].reflection.compactDescs).SpecConstantCount(), 2U);
+    }
+
+    TEST(MslTest, ArgumentBuffers)
+    {
+        const std::string fileName = TEST_DATA_DIR "Input/ToneMapping_PS.hlsl";
+        std::vector<uint8_t> input = LoadFile(fileName, true);
+        const std::string source = std::string(reinterpret_cast<char*>(input.data()), input.size());
+
+        const Compiler::SourceDesc sourceDesc = {source.c_str(), fileName.c_str(), "main", ShaderStage::PixelShader};
+        Compiler::Options options;
+        options.mslArgumentBuffers = true;
+        const auto result = Compiler::Compile(sourceDesc, options, {ShadingLanguage::Msl_macOS, "20000"});
+        EXPECT_FALSE(result.hasError);
+
+        const std::string msl(reinterpret_cast<const char*>(result.target.Data()), result.target.Size());
+        EXPECT_NE(msl.find("spvDescriptorSet0"), std::string::npos);
+
+        // Per binding: buffer, texture, sampler
+        const std::tuple<const char*, ShaderResourceType, uint32_t> expected[] = {
+            {"cbPS", ShaderResourceType::ConstantBuffer, 0},  {"colorTex", ShaderResourceType::Texture, 1},
+            {"pointSampler", ShaderResourceType::Sampler, 2}, {"lumTex", ShaderResourceType::Texture, 3},
+            {"linearSampler", ShaderResourceType::Sampler, 4}, {"bloomTex", ShaderResourceType::Texture, 5},
+        };
+        const Compiler::CompactReflectionView view(result.reflection.compactDescs);
+        ASSERT_EQ(view.ArgumentCount(), 6U);
+        for (uint32_t i = 0; i < 6; ++i)
+        {
+            const Compiler::CompactArgumentDesc& argument = view.Arguments()[i];
+            EXPECT_STREQ(view.Name(argument), std::get<0>(expected[i]));
+            EXPECT_EQ(argument.type, std::get<1>(expected[i]));
+            EXPECT_EQ(argument.id, std::get<2>(expected[i]));
+            EXPECT_EQ(argument.argumentBuffer, 0U);
+            EXPECT_EQ(argument.count, 1U);
+        }
+
+        // Argument buffers came with MSL 2.0
+        const auto oldResult = Compiler::Compile(sourceDesc, options, {ShadingLanguage::Msl_macOS, "10200"});
+        EXPECT_TRUE(oldResult.hasError);
+
+        // Each space gets its own argument buffer, at [[buffer]] of the space, with IDs from 0
+        const std::string spacesFileName = TEST_DATA_DIR "Input/ArgumentBuffers.hlsl";
+        input = LoadFile(spacesFileName, true);
+        const std::string spacesSource = std::string(reinterpret_cast<char*>(input.data()), input.size());
+        const auto spacesResult = Compiler::Compile({spacesSource.c_str(), spacesFileName.c_str(), "main", ShaderStage::PixelShader},
+                                                    options, {ShadingLanguage::Msl_macOS, "20000"});
+        EXPECT_FALSE(spacesResult.hasError);
+
+        const std::string spacesMsl(reinterpret_cast<const char*>(spacesResult.target.Data()), spacesResult.target.Size());
+        EXPECT_NE(spacesMsl.find("spvDescriptorSet0 [[buffer(0)]]"), std::string::npos);
+        EXPECT_NE(spacesMsl.find("spvDescriptorSet1 [[buffer(1)]]"), std::string::npos);
+        EXPECT_NE(spacesMsl.find("materialTex [[id(2)]]"), std::string::npos);
+
+        // Sorted by space, binding, then buffer, texture, sampler
+        const std::tuple<const char*, ShaderResourceType, uint32_t, uint32_t> spacesExpected[] = {
+            {"cbFrame", ShaderResourceType::ConstantBuffer, 0, 0},     {"frameTex", ShaderResourceType::Texture, 0, 1},
+            {"frameSampler", ShaderResourceType::Sampler, 0, 2},       {"cbMaterial", ShaderResourceType::ConstantBuffer, 1, 0},
+            {"materialSampler", ShaderResourceType::Sampler, 1, 1},    {"materialTex", ShaderResourceType::Texture, 1, 2},
+        };
+        const Compiler::CompactReflectionView spacesView(spacesResult.reflection.compactDescs);
+        ASSERT_EQ(spacesView.ArgumentCount(), 6U);
+        for (uint32_t i = 0; i < 6; ++i)
+        {
+            const Compiler::CompactArgumentDesc& argument = spacesView.Arguments()[i];
+            EXPECT_STREQ(spacesView.Name(argument), std::get<0>(spacesExpected[i]));
+            EXPECT_EQ(argument.type, std::get<1>(spacesExpected[i]));
+            EXPECT_EQ(argument.argumentBuffer, std::get<2>(spacesExpected[i]));
+            EXPECT_EQ(argument.id, std::get<3>(spacesExpected[i]));
+        }
+    }
+
+    TEST(BindingTest, DenseBindings)
+    {
+        const std::string fileName = TEST_DATA_DIR "Input/DenseBindings.hlsl";
+        std::vector<uint8_t> input = LoadFile(fileName, true);
+        const std::string source = std::string(reinterpret_cast<char*>(input.data()), input.size());
+
+        const Compiler::SourceDesc sourceDesc = {source.c_str(), fileName.c_str(), "main", ShaderStage::PixelShader};
+        Compiler::Options options;
+        options.denseBindings = true;
+        options.inheritCombinedSamplerBindings = true; // So the GLSL combined samplers show the texture bindings
+
+        const Compiler::TargetDesc targets[] = {{ShadingLanguage::Hlsl, "50"},
+                                                {ShadingLanguage::SpirV, nullptr},
+                                                {ShadingLanguage::Glsl, "450"},
+                                                {ShadingLanguage::Msl_macOS, nullptr}};
+        constexpr uint32_t numTargets = sizeof(targets) / sizeof(targets[0]);
+        Compiler::ResultDesc results[numTargets];
+        Compiler::Compile(sourceDesc, options, targets, numTargets, results);
+
+        // HLSL numbers b, t and s on their own, SPIR-V numbers all of them together. GLSL numbers uniform buffers, textures and
+        // samplers on their own, and MSL buffers, textures and samplers. Either way in the order of the registers.
+        const std::tuple<const char*, ShaderResourceType, uint32_t, uint32_t> separateRegisters[4] = {
+            {"cbUsed", ShaderResourceType::ConstantBuffer, 3, 0},
+            {"albedoTex", ShaderResourceType::Texture, 4, 0},
+            {"detailTex", ShaderResourceType::Texture, 7, 1},
+            {"linearSampler", ShaderResourceType::Sampler, 2, 0},
+        };
+        const std::tuple<const char*, ShaderResourceType, uint32_t, uint32_t> sharedRegisters[4] = {
+            {"linearSampler", ShaderResourceType::Sampler, 2, 0},
+            {"cbUsed", ShaderResourceType::ConstantBuffer, 3, 1},
+            {"albedoTex", ShaderResourceType::Texture, 4, 2},
+            {"detailTex", ShaderResourceType::Texture, 7, 3},
+        };
+        const std::tuple<const char*, ShaderResourceType, uint32_t, uint32_t>* expected[numTargets] = {
+            separateRegisters, sharedRegisters, separateRegisters, separateRegisters};
+        for (uint32_t i = 0; i < numTargets; ++i)
+        {
+            ASSERT_FALSE(results[i].hasError);
+
+            const Compiler::CompactReflectionView view(results[i].reflection.compactDescs);
+            ASSERT_EQ(view.BindingCount(), 4U);
+            for (uint32_t j = 0; j < 4; ++j)
+            {
+                const Compiler::CompactBindingDesc& binding = view.Bindings()[j];
+                EXPECT_STREQ(view.Name(binding), std::get<0>(expected[i][j]));
+                EXPECT_EQ(binding.type, std::get<1>(expected[i][j]));
+                EXPECT_EQ(binding.descriptorSet, 0U);
+                EXPECT_EQ(binding.originalBinding, std::get<2>(expected[i][j]));
+                EXPECT_EQ(binding.binding, std::get<3>(expected[i][j]));
+            }
+
+            // The resource descs have the new bindings too
+            for (const auto& desc : view)
+            {
+                EXPECT_EQ(std::string(view.Name(desc)).find("unused"), std::string::npos);
+                for (uint32_t j = 0; j < 4; ++j)
+                {
+                    const auto& binding = expected[i][j];
+                    if ((desc.type == ShaderResourceType::Texture) && (std::string(view.Name(desc)) == std::get<0>(binding)))
+                    {
+                        EXPECT_EQ(desc.bindPoint, std::get<3>(binding));
+                    }
+                }
+            }
+        }
+
+        const std::string hlsl(reinterpret_cast<const char*>(results[0].target.Data()), results[0].target.Size());
+        EXPECT_EQ(hlsl.find("unused"), std::string::npos);
+        EXPECT_NE(hlsl.find("register(b0)"), std::string::npos);
+        EXPECT_NE(hlsl.find("register(t1)"), std::string::npos);
+        EXPECT_NE(hlsl.find("register(s0)"), std::string::npos);
+
+        const std::string glsl(reinterpret_cast<const char*>(results[2].target.Data()), results[2].target.Size());
+        EXPECT_EQ(glsl.find("unused"), std::string::npos);
+        EXPECT_NE(glsl.find("layout(binding = 0, std140) uniform type_cbUsed"), std::string::npos);
+        EXPECT_NE(glsl.find("layout(binding = 1) uniform sampler2D SPIRV_Cross_CombineddetailTexlinearSampler"), std::string::npos);
+
+        const std::string msl(reinterpret_cast<const char*>(results[3].target.Data()), results[3].target.Size());
+        EXPECT_EQ(msl.find("unused"), std::string::npos);
+        EXPECT_NE(msl.find("cbUsed [[buffer(0)]]"), std::string::npos);
+        EXPECT_NE(msl.find("detailTex [[texture(1)]]"), std::string::npos);
+        EXPECT_NE(msl.find("linearSampler [[sampler(0)]]"), std::string::npos);
+    }
+
+    TEST(PipelineTest, LinkVertexPixel)
+    {
+        const std::string fileName = TEST_DATA_DIR "Input/Pipeline.hlsl";
+        std::vector<uint8_t> input = LoadFile(fileName, true);
+        const std::string source = std::string(reinterpret_cast<char*>(input.data()), input.size());
+
+        Compiler::SourceDesc stages[] = {{source.c_str(), fileName.c_str(), "VSMain", ShaderStage::VertexShader},
+                                         {source.c_str(), fileName.c_str(), "PSMain", ShaderStage::PixelShader}};
+
+        const Compiler::TargetDesc targets[] = {{ShadingLanguage::SpirV, nullptr}, {ShadingLanguage::Glsl, "410"}};
+        for (const auto& target : targets)
+        {
+            Compiler::ResultDesc results[2];
+            Compiler::CompilePipeline(stages, 2, Compiler::Options(), target, results);
+            ASSERT_FALSE(results[0].hasError);
+            ASSERT_FALSE(results[1].hasError);
+
+            // The PS doesn't read NORMAL and FOG, the VS outputs left get consecutive locations matching the PS inputs
+            for (uint32_t stage = 0; stage < 2; ++stage)
+            {
+                const Compiler::CompactReflectionView view(results[stage].reflection.compactDescs);
+                const Compiler::CompactParameterDesc* params = (stage == 0) ? view.Outputs() : view.Inputs();
+                const uint32_t numParams = (stage == 0) ? view.OutputCount() : view.InputCount();
+
+                std::map<std::string, uint32_t> locations;
+                for (uint32_t i = 0; i < numParams; ++i)
+                {
+                    if (params[i].location != ~0U)
+                    {
+                        locations[view.Semantic(params[i]) + std::to_string(params[i].semanticIndex)] = params[i].location;
+                    }
+                }
+                EXPECT_EQ(locations, (std::map<std::string, uint32_t>{{"COLOR0", 0}, {"TEXCOORD0", 1}}));
+            }
+
+            if (target.language == ShadingLanguage::Glsl)
+            {
+                const std::string vs(reinterpret_cast<const char*>(results[0].target.Data()), results[0].target.Size());
+                EXPECT_EQ(vs.find("out vec3 out_var_NORMAL"), std::string::npos);
+                EXPECT_EQ(vs.find("out float out_var_FOG"), std::string::npos);
+                EXPECT_NE(vs.find("layout(location = 1) out vec2 out_var_TEXCOORD0"), std::string::npos);
+            }
+        }
+
+        stages[1].entryPoint = "PSMismatch";
+        Compiler::ResultDesc results[2];
+        Compiler::CompilePipeline(stages, 2, Compiler::Options(), {ShadingLanguage::Glsl, "410"}, results);
+        for (const auto& result : results)
+        {
+            EXPECT_TRUE(result.hasError);
+            const std::string errorMsg(reinterpret_cast<const char*>(result.errorWarningMsg.Data()), result.errorWarningMsg.Size());
+            EXPECT_NE(errorMsg.find("TANGENT0"), std::string::npos);
+        }
+    }
+
+    TEST(PipelineTest, DefaultEntryPoint)
+    {
+        const std::string vsName = TEST_DATA_DIR "Input/Transform_VS.hlsl";
+        const std::string psName = TEST_DATA_DIR "Input/Constant_PS.hlsl";
+        std::vector<uint8_t> input = LoadFile(vsName, true);
+        const std::string vsSource = std::string(reinterpret_cast<char*>(input.data()), input.size());
+        input = LoadFile(psName, true);
+        const std::string psSource = std::string(reinterpret_cast<char*>(input.data()), input.size());
+
+        // Like in Compile, a null or empty entry point is main
+        for (const char* entryPoint : {static_cast<const char*>(nullptr), ""})
+        {
+            const Compiler::SourceDesc stages[] = {{vsSource.c_str(), vsName.c_str(), entryPoint, ShaderStage::VertexShader},
+                                                   {psSource.c_str(), psName.c_str(), "PSMain", ShaderStage::PixelShader}};
+            const Compiler::TargetDesc targets[] = {{ShadingLanguage::SpirV, nullptr}, {ShadingLanguage::Glsl, "410"}};
+            for (const auto& target : targets)
+            {
+                Compiler::ResultDesc results[2];
+                Compiler::CompilePipeline(stages, 2, Compiler::Options(), target, results);
+                EXPECT_FALSE(results[0].hasError);
+                EXPECT_FALSE(results[1].hasError);
+                EXPECT_GT(results[0].target.Size(), 0U);
+            }
+        }
+    }
+
+    TEST(PipelineTest, LinkTessellationGeometry)
+    {
+        const std::string fileName = TEST_DATA_DIR "Input/PipelineTessellation.hlsl";
+        std::vector<uint8_t> input = LoadFile(fileName, true);
+        const std::string source = std::string(reinterpret_cast<char*>(input.data()), input.size());
+
+        const Compiler::SourceDesc stages[] = {{source.c_str(), fileName.c_str(), "VSMain", ShaderStage::VertexShader},
+                                               {source.c_str(), fileName.c_str(), "HSMain", ShaderStage::HullShader},
+                                               {source.c_str(), fileName.c_str(), "DSMain", ShaderStage::DomainShader},
+                                               {source.c_str(), fileName.c_str(), "GSMain", ShaderStage::GeometryShader},
+                                               {source.c_str(), fileName.c_str(), "PSMain", ShaderStage::PixelShader}};
+        constexpr uint32_t numStages = sizeof(stages) / sizeof(stages[0]);
+
+        auto locations = [](const Compiler::CompactReflectionView& view, bool outputs) {
+            const Compiler::CompactParameterDesc* params = outputs ? view.Outputs() : view.Inputs();
+            const uint32_t numParams = outputs ? view.OutputCount() : view.InputCount();
+            std::map<std::string, uint32_t> ret;
+            for (uint32_t i = 0; i < numParams; ++i)
+            {
+                if (params[i].location != ~0U)
+                {
+                    ret[view.Semantic(params[i]) + std::to_string(params[i].semanticIndex)] = params[i].location;
+                }
+            }
+            return ret;
+        };
+
+        const Compiler::TargetDesc targets[] = {{ShadingLanguage::SpirV, nullptr}, {ShadingLanguage::Glsl, "450"}};
+        for (const auto& target : targets)
+        {
+            Compiler::ResultDesc results[numStages];
+            Compiler::CompilePipeline(stages, numStages, Compiler::Options(), target, results);
+            for (const auto& result : results)
+            {
+                ASSERT_FALSE(result.hasError);
+            }
+
+            // Per vertex arrays and patch varyings line up across each pair of stages, and only what the next stage reads is left
+            for (uint32_t stage = 0; stage + 1 < numStages; ++stage)
+            {
+                const Compiler::CompactReflectionView producerView(results[stage].reflection.compactDescs);
+                const Compiler::CompactReflectionView consumerView(results[stage + 1].reflection.compactDescs);
+                EXPECT_EQ(locations(producerView, true), locations(consumerView, false)) << "Between stage " << stage << " and the next";
+            }
+
+            const Compiler::CompactReflectionView hsView(results[1].reflection.compactDescs);
+            const auto hsOutputs = locations(hsView, true);
+            EXPECT_EQ(hsOutputs.count("NORMAL0"), 0U);
+            EXPECT_EQ(hsOutputs.count("AREA0"), 0U);
+            EXPECT_EQ(hsOutputs.count("CENTER0"), 1U);
+            EXPECT_EQ(hsOutputs.count("TEXCOORD0"), 1U);
+
+            const Compiler::CompactReflectionView gsView(results[3].reflection.compactDescs);
+            EXPECT_EQ(locations(gsView, true), (std::map<std::string, uint32_t>{{"TEXCOORD0", 0}}));
+
+            if (target.language == ShadingLanguage::Glsl)
+            {
+                // The HS still writes NORMAL and AREA, to private arrays the driver can drop
+                const std::string hs(reinterpret_cast<const char*>(results[1].target.Data()), results[1].target.Size());
+                EXPECT_EQ(hs.find("out vec3 out_var_NORMAL"), std::string::npos);
+                EXPECT_EQ(hs.find("out float out_var_AREA"), std::string::npos);
+                EXPECT_NE(hs.find("out_var_NORMAL"), std::string::npos);
+                EXPECT_NE(hs.find("patch out vec3 out_var_CENTER"), std::string::npos);
+            }
+        }
+    }
+
+    TEST(MinifyTest, Corpus)
+    {
+        const Compiler::TargetDesc targets[] = {
+            {ShadingLanguage::Glsl, "450"}, {ShadingLanguage::Essl, "310"}, {ShadingLanguage::Msl_macOS, nullptr}};
+        Compiler::Options minifyOptions;
+        minifyOptions.minifyOutput = true;
+
+        size_t totalSize = 0;
+        size_t totalMinifiedSize = 0;
+        for (const auto& shader : {std::make_tuple("ToneMapping_PS", "main", ShaderStage::PixelShader),
+                                   std::make_tuple("Transform_VS", "main", ShaderStage::VertexShader),
+                                   std::make_tuple("Constant_PS", "PSMain", ShaderStage::PixelShader),
+                                   std::make_tuple("Constant_VS", "VSMain", ShaderStage::VertexShader),
+                                   std::make_tuple("Fluid_CS", "main", ShaderStage::ComputeShader)})
+        {
+            const std::string fileName = std::string(TEST_DATA_DIR "Input/") + std::get<0>(shader) + ".hlsl";
+            std::vector<uint8_t> input = LoadFile(fileName, true);
+            const std::string source = std::string(reinterpret_cast<char*>(input.data()), input.size());
+            const Compiler::SourceDesc sourceDesc = {source.c_str(), fileName.c_str(), std::get<1>(shader), std::get<2>(shader)};
+
+            for (const auto& target : targets)
+            {
+                const auto result = Compiler::Compile(sourceDesc, {}, target);
+                const auto minified = Compiler::Compile(sourceDesc, minifyOptions, target);
+                ASSERT_FALSE(result.hasError);
+                ASSERT_FALSE(minified.hasError);
+                EXPECT_LT(minified.target.Size(), result.target.Size());
+                totalSize += result.target.Size();
+                totalMinifiedSize += minified.target.Size();
+
+                // The reflection, and the names it reports, don't change
+                ASSERT_EQ(minified.reflection.compactDescs.Size(), result.reflection.compactDescs.Size());
+                EXPECT_EQ(std::memcmp(minified.reflection.compactDescs.Data(), result.reflection.compactDescs.Data(),
+                                      result.reflection.compactDescs.Size()),
+                          0);
+
+                const std::string text(reinterpret_cast<const char*>(minified.target.Data()), minified.target.Size());
+                EXPECT_EQ(text.find("SPIRV_Cross_Combined"), std::string::npos);
+                const Compiler::CompactReflectionView view(minified.reflection.compactDescs);
+                for (const auto& desc : view)
+                {
+                    EXPECT_NE(text.find(view.Name(desc)), std::string::npos) << view.Name(desc);
+                }
+            }
+        }
+
+        // Drivers parse the text at load time, so the size is what they pay for. The sizes go to the test report, and the corpus
+        // has to shrink by at least a tenth.
+        RecordProperty("OriginalBytes", std::to_string(totalSize));
+        RecordProperty("MinifiedBytes", std::to_string(totalMinifiedSize));
+        EXPECT_LT(totalMinifiedSize * 10, totalSize * 9);
+    }
+
+    TEST(MinifyTest, Text)
+    {
+        auto minify = [](const std::string& text) {
+            const Blob minified = Compiler::MinifyText(text.data(), static_cast<uint32_t>(text.size()));
+            return std::string(reinterpret_cast<const char*>(minified.Data()), minified.Size());
+        };
+
+        // Operators that would fuse into another one keep a space
+        EXPECT_EQ(minify("float a = b - -c;"), "float a=b- -c;\n");
+        EXPECT_EQ(minify("float a = b - /* negate */ -c;"), "float a=b- -c;\n");
+        EXPECT_EQ(minify("int a = b + +c;\nint d = e / *f;"), "int a=b+ +c;int d=e/ *f;\n");
+        EXPECT_EQ(minify("uint a = b >> 2u;\nuint c = d << 1u;"), "uint a=b>>2u;uint c=d<<1u;\n");
+
+        // MSL templates, nested ones included
+        EXPECT_EQ(minify("array<texture2d<float>, 2> tex;"), "array<texture2d<float>,2>tex;\n");
+        EXPECT_EQ(minify("vec<vec<float, 2> > a;"), "vec<vec<float,2> >a;\n");
+        EXPECT_EQ(minify("template<typename T>\ninline T spvAbs(T x)\n{\n    return abs(x);\n}\n"),
+                  "template<typename T>inline T spvAbs(T x){return abs(x);}\n");
+
+        // Directives stay on lines of their own, with their continuation lines
+        EXPECT_EQ(minify("#version 450\n#extension GL_EXT_foo : require\nvoid main()\n{\n}\n"),
+                  "#version 450\n#extension GL_EXT_foo : require\nvoid main(){}\n");
+        EXPECT_EQ(minify("#define MAX(a, b) \\\n    ((a) > (b) ? (a) : (b))\nfloat x = MAX(1.0, 2.0); // max\n"),
+                  "#define MAX(a, b) \\\n    ((a) > (b) ? (a) : (b))\nfloat x=MAX(1.0,2.0);\n");
+        EXPECT_EQ(minify("x = 1;\n  #if A\ny = 2;\n#endif"), "x=1;\n#if A\ny=2;\n#endif\n");
+
+        EXPECT_EQ(minify(""), "");
+    }
+
+    TEST(CompressionTest, BlobRoundTrip)
+    {
+        std::vector<uint8_t> input = LoadFile(TEST_DATA_DIR "Expected/ToneMapping_PS.410.glsl", true);
+        const Blob source(input.data(), static_cast<uint32_t>(input.size()));
+
+        for (const auto codec : {CompressionCodec::None, CompressionCodec::Lz4, CompressionCodec::Zstd})
+        {
+            const Blob frame = source.Serialize(codec);
+            if (codec != CompressionCodec::None)
+            {
+                EXPECT_LT(frame.Size(), source.Size());
+            }
+
+            for (const bool decompressOnAccess : {false, true})
+            {
+                const Blob restored = Blob::Deserialize(frame.Data(), frame.Size(), decompressOnAccess);
+                const uint8_t* restored_ptr = reinterpret_cast<const uint8_t*>(restored.Data());
+                EXPECT_EQ(std::vector<uint8_t>(restored_ptr, restored_ptr + restored.Size()), input);
+            }
+        }
+
+        const Blob empty;
+        const Blob emptyFrame = empty.Serialize(CompressionCodec::Zstd);
+        EXPECT_EQ(Blob::Deserialize(emptyFrame.Data(), emptyFrame.Size()).Size(), 0U);
+
+        const Blob frame = source.Serialize(CompressionCodec::Lz4);
+        EXPECT_THROW(Blob::Deserialize(frame.Data(), frame.Size() - 1), std::runtime_error);
+
+        // Clobber the zstd frame magic right after the 16-byte frame header
+        const Blob zstdFrame = source.Serialize(CompressionCodec::Zstd);
+        std::vector<uint8_t> corrupt(reinterpret_cast<const uint8_t*>(zstdFrame.Data()),
+                                     reinterpret_cast<const uint8_t*>(zstdFrame.Data()) + zstdFrame.Size());
+        std::fill(corrupt.begin() + 16, corrupt.begin() + 20, static_cast<uint8_t>(0));
+        EXPECT_THROW(Blob::Deserialize(corrupt.data(), static_cast<uint32_t>(corrupt.size())), std::runtime_error);
+        const Blob lazy = Blob::Deserialize(corrupt.data(), static_cast<uint32_t>(corrupt.size()), true);
+        EXPECT_THROW(lazy.Data(), std::runtime_error);
+        EXPECT_THROW(lazy.Size(), std::runtime_error);
+
+        // A raw size the payload can't expand to is rejected before anything that large is allocated. It's the second uint32_t
+        // of the frame header.
+        for (const auto codec : {CompressionCodec::Lz4, CompressionCodec::Zstd})
+        {
+            const Blob compressedFrame = source.Serialize(codec);
+            std::vector<uint8_t> oversized(reinterpret_cast<const uint8_t*>(compressedFrame.Data()),
+                                           reinterpret_cast<const uint8_t*>(compressedFrame.Data()) + compressedFrame.Size());
+            const uint32_t rawSize = 0xFFFFFFF0U;
+            std::memcpy(oversized.data() + 8, &rawSize, sizeof(rawSize));
+            EXPECT_THROW(Blob::Deserialize(oversized.data(), static_cast<uint32_t>(oversized.size())), std::runtime_error);
+            const Blob lazyOversized = Blob::Deserialize(oversized.data(), static_cast<uint32_t>(oversized.size()), true);
+            EXPECT_THROW(lazyOversized.Data(), std::runtime_error);
+        }
+    }
+
+    TEST(CompressionTest, BlobMoveAssignment)
+    {
+        Blob blob("old", 3);
+        blob = Blob("new!", 4);
+        EXPECT_EQ(blob.Size(), 4U);
+        EXPECT_EQ(std::memcmp(blob.Data(), "new!", 4), 0);
+
+        Blob empty;
+        blob = std::move(empty);
+        EXPECT_EQ(blob.Size(), 0U);
+        EXPECT_EQ(blob.Data(), nullptr);
+    }
+
+    TEST(CompressionTest, ResultRoundTrip)
+    {
+        const std::string fileName = TEST_DATA_DIR "Input/PassThrough_PS.hlsl";
+
+        std::vector<uint8_t> input = LoadFile(fileName, true);
+        const std::string source = std::string(reinterpret_cast<char*>(input.data()), input.size());
+
+        const auto result =
+            Compiler::Compile({source.c_str(), fileName.c_str(), "PSMain", ShaderStage::PixelShader}, {}, {ShadingLanguage::Glsl, "410"});
+        EXPECT_FALSE(result.hasError);
+
+        const Blob archive = Compiler::SerializeResult(result, CompressionCodec::Zstd);
+        const auto restored = Compiler::DeserializeResult(archive.Data(), archive.Size(), true);
+
+        EXPECT_EQ(restored.hasError, result.hasError);
+        EXPECT_EQ(restored.isText, result.isText);
+        EXPECT_EQ(restored.reflection.descCount, result.reflection.descCount);
+        EXPECT_EQ(restored.reflection.instructionCount, result.reflection.instructionCount);
+
+        const uint8_t* target_ptr = reinterpret_cast<const uint8_t*>(restored.target.Data());
+        CompareWithExpected(std::vector<uint8_t>(target_ptr, target_ptr + restored.target.Size()), restored.isText,
+                            "PassThrough_PS.410.glsl");
+    }
+} // namespace
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--update-baselines")
+        {
+            updateBaselines = true;
+        }
+        else if (arg.compare(0, 17, "--cost-threshold=") == 0)
+        {
+            costThreshold = std::atof(arg.c_str() + 17) / 100;
+        }
+    }
 
     int retVal = RUN_ALL_TESTS();
     if (retVal != 0)
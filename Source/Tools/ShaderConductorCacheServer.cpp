@@ -0,0 +1,72 @@
+/*
+ * ShaderConductor
+ *
+ * Copyright (c) Microsoft Corporation. All rights reserved.
+ * Licensed under the MIT License.
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the "Software"), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons
+ * to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED *AS IS*, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <ShaderConductor/ShaderConductor.hpp>
+
+#include <iostream>
+#include <string>
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4819)
+#endif
+#include <cxxopts.hpp>
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+int main(int argc, char** argv)
+{
+    cxxopts::Options options("ShaderConductorCacheServer", "A local stand-in for a shared ShaderConductor cache server.");
+    // clang-format off
+    options.add_options()
+        ("d,dir", "Directory the results are stored in", cxxopts::value<std::string>()->default_value("ShaderConductorCache"))
+        ("a,address", "Address to listen on", cxxopts::value<std::string>()->default_value("127.0.0.1"))
+        ("p,port", "Port to listen on, 0 picks a free one", cxxopts::value<uint16_t>()->default_value("8080"));
+    // clang-format on
+
+    auto opts = options.parse(argc, argv);
+
+    using namespace ShaderConductor;
+
+    const auto dirName = opts["dir"].as<std::string>();
+    const auto address = opts["address"].as<std::string>();
+
+    try
+    {
+        FileSystemCache storage(dirName.c_str());
+        HttpCacheServer server(storage, address.c_str(), opts["port"].as<uint16_t>());
+
+        std::cout << "Serving " << dirName << " on http://" << address << ":" << server.Port() << ". Press Enter to stop." << std::endl;
+        std::cin.get();
+    }
+    catch (std::exception& ex)
+    {
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
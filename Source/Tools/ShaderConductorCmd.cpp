@@ -25,11 +25,28 @@
 
 #include <ShaderConductor/ShaderConductor.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
 #ifdef _MSC_VER
 #pragma warning(push)
 #pragma warning(disable : 4819)
@@ -39,17 +56,307 @@
 #pragma warning(pop)
 #endif
 
+using namespace ShaderConductor;
+
+namespace
+{
+    bool LoadFile(const std::string& name, std::string& content)
+    {
+        std::ifstream file(name, std::ios_base::binary);
+        if (!file)
+        {
+            return false;
+        }
+
+        file.seekg(0, std::ios::end);
+        content.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0, std::ios::beg);
+        file.read(&content[0], content.size());
+        return true;
+    }
+
+    // The parent directory is resolved, the file itself doesn't have to exist. Editors often replace a file on save, so the
+    // watch is on directories and events come as directory + name.
+    std::string CanonicalPath(const std::string& path)
+    {
+        const size_t slash = path.find_last_of("/\\");
+        const std::string dir = (slash == std::string::npos) ? "." : path.substr(0, slash + 1);
+        const std::string name = (slash == std::string::npos) ? path : path.substr(slash + 1);
+
+#ifdef _WIN32
+        char resolved[_MAX_PATH];
+        if (::_fullpath(resolved, dir.c_str(), sizeof(resolved)) == nullptr)
+#else
+        char resolved[PATH_MAX];
+        if (::realpath(dir.c_str(), resolved) == nullptr)
+#endif
+        {
+            return path;
+        }
+        return std::string(resolved) + "/" + name;
+    }
+
+    struct ShaderFile
+    {
+        std::string inputName;
+        std::string outputName;
+        std::set<std::string> dependencies; // Canonical paths of the input and every include DXC asked for
+    };
+
+    struct CompileSettings
+    {
+        Compiler::SourceDesc sourceDesc; // Without source and fileName
+        Compiler::TargetDesc targetDesc;
+        bool spirvInput;
+        CacheBackend* cache;
+    };
+
+    // Returns false if the input can't be read or the output can't be written. Errors from the compiler are only printed.
+    bool CompileShaderFile(ShaderFile& shader, const CompileSettings& settings, std::mutex& consoleMutex)
+    {
+        std::set<std::string> dependencies;
+        dependencies.insert(CanonicalPath(shader.inputName));
+
+        std::string source;
+        if (!LoadFile(shader.inputName, source))
+        {
+            std::lock_guard<std::mutex> lock(consoleMutex);
+            std::cerr << "COULDN'T load the input file: " << shader.inputName << std::endl;
+            shader.dependencies = std::move(dependencies);
+            return false;
+        }
+
+        Compiler::SourceDesc sourceDesc = settings.sourceDesc;
+        sourceDesc.fileName = shader.inputName.c_str();
+        sourceDesc.source = source.c_str();
+        sourceDesc.loadIncludeCallback = [&dependencies](const char* includeName) {
+            // Kept even if it's missing, creating it should trigger a compile
+            dependencies.insert(CanonicalPath(includeName));
+
+            std::string content;
+            if (!LoadFile(includeName, content))
+            {
+                throw std::runtime_error(std::string("COULDN'T load included file ") + includeName + ".");
+            }
+            return Blob(content.data(), static_cast<uint32_t>(content.size()));
+        };
+
+        bool succeeded = true;
+        try
+        {
+            const auto result = [&] {
+                if (settings.spirvInput)
+                {
+                    Compiler::SpirvDesc spirvDesc;
+                    spirvDesc.entryPoint = sourceDesc.entryPoint;
+                    spirvDesc.stage = sourceDesc.stage;
+                    spirvDesc.binary = reinterpret_cast<const uint8_t*>(source.data());
+                    spirvDesc.binarySize = static_cast<uint32_t>(source.size());
+                    return Compiler::CrossCompile(spirvDesc, {}, settings.targetDesc);
+                }
+                else if (settings.cache != nullptr)
+                {
+                    Compiler::ResultDesc cachedResult;
+                    Compiler::Compile(sourceDesc, {}, &settings.targetDesc, 1, &cachedResult, *settings.cache);
+                    return cachedResult;
+                }
+                else
+                {
+                    return Compiler::Compile(sourceDesc, {}, settings.targetDesc);
+                }
+            }();
+
+            std::lock_guard<std::mutex> lock(consoleMutex);
+            if (result.errorWarningMsg.Size() > 0)
+            {
+                const char* msg = reinterpret_cast<const char*>(result.errorWarningMsg.Data());
+                std::cerr << "Error or warning from shader compiler: " << std::endl
+                          << std::string(msg, msg + result.errorWarningMsg.Size()) << std::endl;
+            }
+            if (result.target.Size() > 0)
+            {
+                std::ofstream outputFile(shader.outputName, std::ios_base::binary);
+                if (outputFile)
+                {
+                    outputFile.write(reinterpret_cast<const char*>(result.target.Data()), result.target.Size());
+
+                    std::cout << "The compiled file is saved to " << shader.outputName << std::endl;
+                }
+                else
+                {
+                    std::cerr << "COULDN'T open the output file: " << shader.outputName << std::endl;
+                    succeeded = false;
+                }
+            }
+        }
+        catch (std::exception& ex)
+        {
+            std::lock_guard<std::mutex> lock(consoleMutex);
+            std::cerr << ex.what() << std::endl;
+        }
+
+        shader.dependencies = std::move(dependencies);
+        return succeeded;
+    }
+
+    // One thread per hardware thread at most, each taking the next shader until they run out
+    bool CompileShaderFiles(std::vector<ShaderFile*>& shaders, const CompileSettings& settings, std::mutex& consoleMutex)
+    {
+        std::vector<char> succeeded(shaders.size(), 1);
+        std::atomic<size_t> nextShader{0};
+        auto compileShaders = [&] {
+            for (size_t i = nextShader++; i < shaders.size(); i = nextShader++)
+            {
+                succeeded[i] = CompileShaderFile(*shaders[i], settings, consoleMutex);
+            }
+        };
+
+        const size_t numThreads = std::min<size_t>(shaders.size(), std::max(std::thread::hardware_concurrency(), 1U));
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < numThreads; ++i)
+        {
+            threads.emplace_back(compileShaders);
+        }
+        compileShaders();
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        return std::find(succeeded.begin(), succeeded.end(), 0) == succeeded.end();
+    }
+
+#ifdef __linux__
+    // Recompiles the shaders whose input or includes changed, until the process is stopped
+    int WatchShaderFiles(std::vector<ShaderFile>& shaders, const CompileSettings& settings, std::mutex& consoleMutex)
+    {
+        // Saves usually come as a burst of events. Wait for this long without events before compiling.
+        const int debounceMs = 100;
+
+        const int inotifyFd = ::inotify_init1(IN_CLOEXEC);
+        if (inotifyFd < 0)
+        {
+            std::cerr << "COULDN'T initialize inotify." << std::endl;
+            return 1;
+        }
+
+        std::unordered_map<int, std::string> watchedDirs;
+        std::set<std::string> watchedDirNames;
+        auto watchDependencies = [&] {
+            for (const auto& shader : shaders)
+            {
+                for (const auto& dependency : shader.dependencies)
+                {
+                    const std::string dir = dependency.substr(0, dependency.rfind('/'));
+                    if (watchedDirNames.insert(dir).second)
+                    {
+                        const int wd = ::inotify_add_watch(inotifyFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE);
+                        if (wd >= 0)
+                        {
+                            watchedDirs[wd] = dir;
+                        }
+                    }
+                }
+            }
+        };
+        watchDependencies();
+
+        {
+            std::lock_guard<std::mutex> lock(consoleMutex);
+            std::cout << "Watching " << watchedDirs.size() << " directories for changes. Press Ctrl+C to stop." << std::endl;
+        }
+
+        for (;;)
+        {
+            std::set<std::string> changed;
+            bool overflowed = false;
+            int timeoutMs = -1;
+            for (;;)
+            {
+                pollfd pollFd = {inotifyFd, POLLIN, 0};
+                const int pollRet = ::poll(&pollFd, 1, timeoutMs);
+                if (pollRet == 0)
+                {
+                    break;
+                }
+                if (pollRet < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    ::close(inotifyFd);
+                    return 1;
+                }
+
+                alignas(inotify_event) char buffer[64 * 1024];
+                const ssize_t size = ::read(inotifyFd, buffer, sizeof(buffer));
+                for (ssize_t offset = 0; offset < size;)
+                {
+                    const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+                    if (event->mask & IN_Q_OVERFLOW)
+                    {
+                        // Events were dropped, so there is no telling what changed
+                        overflowed = true;
+                    }
+                    auto iter = watchedDirs.find(event->wd);
+                    if ((iter != watchedDirs.end()) && (event->len > 0))
+                    {
+                        changed.insert(iter->second + "/" + event->name);
+                    }
+                    offset += sizeof(inotify_event) + event->len;
+                }
+
+                timeoutMs = debounceMs;
+            }
+
+            std::vector<ShaderFile*> affected;
+            for (auto& shader : shaders)
+            {
+                if (overflowed)
+                {
+                    affected.push_back(&shader);
+                    continue;
+                }
+                for (const auto& dependency : shader.dependencies)
+                {
+                    if (changed.find(dependency) != changed.end())
+                    {
+                        affected.push_back(&shader);
+                        break;
+                    }
+                }
+            }
+            if (affected.empty())
+            {
+                continue;
+            }
+
+            CompileShaderFiles(affected, settings, consoleMutex);
+
+            // The includes may have changed
+            watchDependencies();
+        }
+    }
+#endif
+} // namespace
+
 int main(int argc, char** argv)
 {
     cxxopts::Options options("ShaderConductorCmd", "A tool for compiling HLSL to many shader languages.");
     // clang-format off
     options.add_options()
         ("E,entry", "Entry point of the shader", cxxopts::value<std::string>()->default_value("main"))
-        ("I,input", "Input file name", cxxopts::value<std::string>())("O,output", "Output file name", cxxopts::value<std::string>())
+        ("I,input", "Input file name, can be given several times", cxxopts::value<std::vector<std::string>>())
+        ("O,output", "Output file name, only with one input", cxxopts::value<std::string>())
+        ("input-format", "Input format: hlsl, spirv", cxxopts::value<std::string>()->default_value("hlsl"))
         ("S,stage", "Shader stage: vs, ps, gs, hs, ds, cs", cxxopts::value<std::string>())
         ("T,target", "Target shading language: dxil, spirv, hlsl, glsl, essl, msl_macos, msl_ios", cxxopts::value<std::string>()->default_value("dxil"))
         ("V,version", "The version of target shading language", cxxopts::value<std::string>()->default_value(""))
-        ("D,define", "Macro define as name=value", cxxopts::value<std::vector<std::string>>());
+        ("D,define", "Macro define as name=value", cxxopts::value<std::vector<std::string>>())
+        ("spec-constant", "Define as name=value that becomes a specialization constant", cxxopts::value<std::vector<std::string>>())
+        ("cache", "Cache results in a directory, or on a cache server given as http://host:port", cxxopts::value<std::string>())
+        ("watch", "Keep running, and recompile the inputs whose file or includes change");
 
     // clang-format on
 
@@ -62,16 +369,13 @@ int main(int argc, char** argv)
         return 1;
     }
 
-    using namespace ShaderConductor;
-
     Compiler::SourceDesc sourceDesc{};
     Compiler::TargetDesc targetDesc{};
 
-    const auto fileName = opts["input"].as<std::string>();
+    const auto fileNames = opts["input"].as<std::vector<std::string>>();
     const auto targetName = opts["target"].as<std::string>();
     const auto targetVersion = opts["version"].as<std::string>();
 
-    sourceDesc.fileName = fileName.c_str();
     targetDesc.version = targetVersion.empty() ? nullptr : targetVersion.c_str();
 
     const auto stageName = opts["stage"].as<std::string>();
@@ -108,6 +412,14 @@ int main(int argc, char** argv)
     const auto entryPoint = opts["entry"].as<std::string>();
     sourceDesc.entryPoint = entryPoint.c_str();
 
+    const auto inputFormat = opts["input-format"].as<std::string>();
+    if ((inputFormat != "hlsl") && (inputFormat != "spirv"))
+    {
+        std::cerr << "Invalid input format: " << inputFormat << std::endl;
+        return 1;
+    }
+    const bool spirvInput = (inputFormat == "spirv");
+
     if (targetName == "dxil")
     {
         targetDesc.language = ShadingLanguage::Dxil;
@@ -141,102 +453,134 @@ int main(int argc, char** argv)
         std::cerr << "Invalid target shading language: " << targetName << std::endl;
         return 1;
     }
-
-    std::string outputName;
-    if (opts.count("output") == 0)
+    if (spirvInput && (targetDesc.language == ShadingLanguage::Dxil))
     {
-        static const std::string extMap[] = {"dxil", "spv", "hlsl", "glsl", "essl", "msl", "msl"};
-        static_assert(sizeof(extMap) / sizeof(extMap[0]) == static_cast<uint32_t>(ShadingLanguage::NumShadingLanguages),
-                      "extMap doesn't match with the number of shading languages.");
-        outputName = fileName + "." + extMap[static_cast<uint32_t>(targetDesc.language)];
+        std::cerr << "SPIR-V input can't be compiled to dxil." << std::endl;
+        return 1;
     }
-    else
+
+    if ((fileNames.size() > 1) && (opts.count("output") > 0))
     {
-        outputName = opts["output"].as<std::string>();
+        std::cerr << "<output> can only be given with one <input>." << std::endl;
+        return 1;
     }
 
-    std::string source;
+    std::vector<ShaderFile> shaders(fileNames.size());
+    for (size_t i = 0; i < fileNames.size(); ++i)
     {
-        std::ifstream inputFile(sourceDesc.fileName, std::ios_base::binary);
-        if (!inputFile)
+        shaders[i].inputName = fileNames[i];
+        if (opts.count("output") == 0)
         {
-            std::cerr << "COULDN'T load the input file: " << sourceDesc.fileName << std::endl;
-            return 1;
+            static const std::string extMap[] = {"dxil", "spv", "hlsl", "glsl", "essl", "msl", "msl"};
+            static_assert(sizeof(extMap) / sizeof(extMap[0]) == static_cast<uint32_t>(ShadingLanguage::NumShadingLanguages),
+                          "extMap doesn't match with the number of shading languages.");
+            shaders[i].outputName = fileNames[i] + "." + extMap[static_cast<uint32_t>(targetDesc.language)];
+        }
+        else
+        {
+            shaders[i].outputName = opts["output"].as<std::string>();
         }
-
-        inputFile.seekg(0, std::ios::end);
-        source.resize(static_cast<size_t>(inputFile.tellg()));
-        inputFile.seekg(0, std::ios::beg);
-        inputFile.read(&source[0], source.size());
     }
-    sourceDesc.source = source.c_str();
 
-    size_t numberOfDefines = opts.count("define");
+    size_t numberOfDefines = opts.count("define") + opts.count("spec-constant");
     std::vector<MacroDefine> macroDefines;
     std::vector<std::string> macroStrings;
     if (numberOfDefines > 0)
     {
         macroDefines.reserve(numberOfDefines);
         macroStrings.reserve(numberOfDefines * 2);
-        auto& defines = opts["define"].as<std::vector<std::string>>();
-        for (const auto& define : defines)
+        for (const bool specConstant : {false, true})
         {
-            MacroDefine macroDefine;
-            macroDefine.name = nullptr;
-            macroDefine.value = nullptr;
-
-            size_t splitPosition = define.find('=');
-            if (splitPosition != std::string::npos)
+            const char* optionName = specConstant ? "spec-constant" : "define";
+            if (opts.count(optionName) == 0)
             {
-                std::string macroName = define.substr(0, splitPosition);
-                std::string macroValue = define.substr(splitPosition + 1, define.size() - splitPosition - 1);
-
-                macroStrings.push_back(macroName);
-                macroDefine.name = macroStrings.back().c_str();
-                macroStrings.push_back(macroValue);
-                macroDefine.value = macroStrings.back().c_str();
+                continue;
             }
-            else
+
+            auto& defines = opts[optionName].as<std::vector<std::string>>();
+            for (const auto& define : defines)
             {
-                macroStrings.push_back(define);
-                macroDefine.name = macroStrings.back().c_str();
-            }
+                MacroDefine macroDefine;
+                macroDefine.name = nullptr;
+                macroDefine.value = nullptr;
+                macroDefine.specConstant = specConstant;
+
+                size_t splitPosition = define.find('=');
+                if (splitPosition != std::string::npos)
+                {
+                    std::string macroName = define.substr(0, splitPosition);
+                    std::string macroValue = define.substr(splitPosition + 1, define.size() - splitPosition - 1);
 
-            macroDefines.push_back(macroDefine);
+                    macroStrings.push_back(macroName);
+                    macroDefine.name = macroStrings.back().c_str();
+                    macroStrings.push_back(macroValue);
+                    macroDefine.value = macroStrings.back().c_str();
+                }
+                else
+                {
+                    macroStrings.push_back(define);
+                    macroDefine.name = macroStrings.back().c_str();
+                }
+
+                macroDefines.push_back(macroDefine);
+            }
         }
 
         sourceDesc.defines = macroDefines.data();
         sourceDesc.numDefines = static_cast<uint32_t>(macroDefines.size());
     }
 
+    std::unique_ptr<CacheBackend> cache;
     try
     {
-        const auto result = Compiler::Compile(sourceDesc, {}, targetDesc);
-
-        if (result.errorWarningMsg.Size() > 0)
-        {
-            const char* msg = reinterpret_cast<const char*>(result.errorWarningMsg.Data());
-            std::cerr << "Error or warning from shader compiler: " << std::endl
-                      << std::string(msg, msg + result.errorWarningMsg.Size()) << std::endl;
-        }
-        if (result.target.Size() > 0)
+        if (opts.count("cache") > 0)
         {
-            std::ofstream outputFile(outputName, std::ios_base::binary);
-            if (!outputFile)
+            const auto cacheName = opts["cache"].as<std::string>();
+            static const std::string httpPrefix = "http://";
+            if (cacheName.compare(0, httpPrefix.size(), httpPrefix) == 0)
             {
-                std::cerr << "COULDN'T open the output file: " << outputName << std::endl;
-                return 1;
+                std::string host = cacheName.substr(httpPrefix.size());
+                uint16_t port = 80;
+                const size_t colon = host.rfind(':');
+                if (colon != std::string::npos)
+                {
+                    port = static_cast<uint16_t>(std::stoi(host.substr(colon + 1)));
+                    host.resize(colon);
+                }
+                cache = std::make_unique<HttpCache>(host.c_str(), port);
+            }
+            else
+            {
+                cache = std::make_unique<FileSystemCache>(cacheName.c_str());
             }
-
-            outputFile.write(reinterpret_cast<const char*>(result.target.Data()), result.target.Size());
-
-            std::cout << "The compiled file is saved to " << outputName << std::endl;
         }
     }
     catch (std::exception& ex)
     {
         std::cerr << ex.what() << std::endl;
+        return 1;
+    }
+
+    const CompileSettings settings = {sourceDesc, targetDesc, spirvInput, cache.get()};
+    std::mutex consoleMutex;
+
+    std::vector<ShaderFile*> allShaders;
+    for (auto& shader : shaders)
+    {
+        allShaders.push_back(&shader);
+    }
+    const bool succeeded = CompileShaderFiles(allShaders, settings, consoleMutex);
+
+    if (opts.count("watch") > 0)
+    {
+#ifdef __linux__
+        // dxcompiler stays loaded and warm for the whole session
+        return WatchShaderFiles(shaders, settings, consoleMutex);
+#else
+        std::cerr << "--watch needs inotify, which is only on Linux." << std::endl;
+        return 1;
+#endif
     }
 
-    return 0;
+    return succeeded ? 0 : 1;
 }